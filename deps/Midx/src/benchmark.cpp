@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <spdlog/spdlog.h>
+
+#include "./library_generator.hpp"
+#include "./midx.hpp"
+#include "./query.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+ * One measured operation, `median_ms` is what's compared against a baseline.
+ */
+struct Result {
+  std::size_t library_size;
+  std::string name;
+  std::size_t runs;
+  double median_ms;
+  double min_ms;
+  double max_ms;
+  /**
+   * Number of items processed per run, used to report a per-item cost.
+   */
+  std::size_t items;
+};
+
+struct Options {
+  std::vector<std::size_t> sizes{10000, 100000, 1000000};
+  std::string work_dir{"./midx-bench"};
+  std::string output{};
+  std::string baseline{};
+  double tolerance   = 0.25;
+  std::size_t repeat = 5;
+};
+
+static std::optional<Options> parse_args(int argc, char **argv);
+static std::vector<Result> run_benchmarks(const Options &options, const std::size_t size);
+static Result measure(
+    const std::size_t library_size, const std::string &name, const std::size_t runs,
+    const std::size_t items, const std::function<void(std::size_t)> &fn
+);
+static std::string to_json(const std::vector<Result> &results);
+static std::vector<Result> read_results(const std::string &path);
+
+int main(int argc, char **argv) {
+  const std::optional<Options> options = parse_args(argc, argv);
+  if (not options.has_value())
+    return 2;
+  // Midx logs every inserted file, which would be measured too
+  spdlog::set_level(spdlog::level::warn);
+
+  std::vector<Result> results{};
+  for (const std::size_t size : options->sizes) {
+    std::vector<Result> r = run_benchmarks(options.value(), size);
+    results.insert(results.end(), r.begin(), r.end());
+  }
+
+  const std::string json = to_json(results);
+  if (options->output.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream file{options->output};
+    file << json;
+  }
+
+  if (options->baseline.empty())
+    return 0;
+  // Fail if anything got slower than the baseline by more than the tolerance
+  int regressions = 0;
+  for (const Result &old : read_results(options->baseline)) {
+    const auto it = std::ranges::find_if(results, [&](const Result &r) {
+      return r.library_size == old.library_size and r.name == old.name;
+    });
+    if (it == results.end() or old.median_ms <= 0.0)
+      continue;
+    const double ratio = it->median_ms / old.median_ms;
+    if (ratio > 1.0 + options->tolerance) {
+      std::cerr << std::format(
+          "REGRESSION {} ({} tracks): {:.3f} ms -> {:.3f} ms (x{:.2f})\n", old.name,
+          old.library_size, old.median_ms, it->median_ms, ratio
+      );
+      ++regressions;
+    }
+  }
+  return regressions == 0 ? 0 : 1;
+}
+
+static std::optional<Options> parse_args(int argc, char **argv) {
+  Options options{};
+  const std::string usage = std::format(
+      "Usage: {} [--sizes 10000,100000,1000000] [--work-dir DIR] [--repeat N]\n"
+      "          [--output results.json] [--baseline old.json] [--tolerance 0.25]\n",
+      argv[0]
+  );
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--sizes") {
+      options.sizes.clear();
+      std::stringstream ss{value};
+      for (std::string size; std::getline(ss, size, ',');)
+        options.sizes.push_back(std::stoul(size));
+    } else if (arg == "--work-dir") {
+      options.work_dir = value;
+    } else if (arg == "--repeat") {
+      options.repeat = std::max<std::size_t>(1, std::stoul(value));
+    } else if (arg == "--output") {
+      options.output = value;
+    } else if (arg == "--baseline") {
+      options.baseline = value;
+    } else if (arg == "--tolerance") {
+      options.tolerance = std::stod(value);
+    } else {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+  }
+  return options;
+}
+
+static std::vector<Result> run_benchmarks(const Options &options, const std::size_t size) {
+  std::vector<Result> results{};
+  const fs::path library_dir = fs::path{options.work_dir} / std::format("library-{}", size);
+  const fs::path marker      = library_dir / ".generated";
+
+  // Generating a large library takes a while, keep it between runs along with the
+  // names used by the search benchmarks
+  Midx::Bench::GeneratedLibrary library{};
+  if (not fs::exists(marker)) {
+    std::cerr << std::format("Generating {} tracks in {}\n", size, library_dir.string());
+    fs::remove_all(library_dir);
+    fs::create_directories(library_dir);
+    Midx::Bench::GeneratorOptions generator_options{};
+    generator_options.track_count = size;
+    library = Midx::Bench::generate_library(library_dir, generator_options);
+    std::ofstream file{marker};
+    for (const std::string &artist : library.sample_artists)
+      file << "artist\t" << artist << '\n';
+    for (const std::string &word : library.sample_words)
+      file << "word\t" << word << '\n';
+  } else {
+    std::ifstream file{marker};
+    for (std::string line; std::getline(file, line);) {
+      const auto tab = line.find('\t');
+      if (tab == std::string::npos)
+        continue;
+      if (line.starts_with("artist"))
+        library.sample_artists.push_back(line.substr(tab + 1));
+      else
+        library.sample_words.push_back(line.substr(tab + 1));
+    }
+  }
+
+  Midx::data_dir = fs::path{options.work_dir} / std::format("data-{}", size);
+  fs::remove_all(Midx::data_dir);
+  fs::create_directories(Midx::data_dir);
+  SQLite::Database db{
+      std::format("{}/db.sqlite", Midx::data_dir), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE
+  };
+  Midx::init_database(db);
+  const std::string library_path = fs::canonical(library_dir);
+  Midx::insert_music_dir(db, library_path);
+
+  std::cerr << std::format("Benchmarking {} tracks\n", size);
+  const std::size_t repeat = options.repeat;
+  results.push_back(measure(size, "cold_scan", 1, size, [&](std::size_t) {
+    Midx::build_music_library(db);
+  }));
+  results.push_back(measure(size, "warm_rescan", repeat, size, [&](std::size_t) {
+    Midx::build_music_library(db);
+  }));
+
+  const std::size_t artist_count = Midx::get_all_artists(db).size();
+  const std::size_t album_count  = Midx::get_all_albums(db).size();
+  const std::size_t track_count  = Midx::get_all_tracks(db).size();
+  results.push_back(measure(size, "get_all_artists", repeat, artist_count, [&](std::size_t) {
+    Midx::get_all_artists(db);
+  }));
+  results.push_back(measure(size, "get_all_albums", repeat, album_count, [&](std::size_t) {
+    Midx::get_all_albums(db);
+  }));
+  results.push_back(measure(size, "get_all_tracks", repeat, track_count, [&](std::size_t) {
+    Midx::get_all_tracks(db);
+  }));
+  results.push_back(measure(size, "get_tracks_first_page", repeat, 100, [&](std::size_t) {
+    Midx::get_tracks_page(db, std::nullopt, 100);
+  }));
+
+  const auto &artists = library.sample_artists;
+  const auto &words   = library.sample_words;
+  results.push_back(measure(size, "search_artist_id", repeat, 1, [&](std::size_t run) {
+    Midx::get_artist_id(db, artists[run % artists.size()]);
+  }));
+  results.push_back(measure(size, "search_artist_tracks", repeat, 1, [&](std::size_t run) {
+    Midx::query_tracks(db, std::format("artist = \"{}\"", artists[run % artists.size()]));
+  }));
+  results.push_back(measure(size, "search_title_contains", repeat, 1, [&](std::size_t run) {
+    Midx::query_tracks(db, std::format("title contains \"{}\"", words[run % words.size()]));
+  }));
+  results.push_back(measure(size, "search_sorted_by_title", repeat, 1, [&](std::size_t) {
+    Midx::query_tracks(db, "duration > 3 min sort by title limit 100");
+  }));
+
+  // Remove 1% of the tracks one by one, then the whole directory
+  std::vector<int> ids{};
+  for (const Midx::Track &track : Midx::get_all_tracks(db))
+    ids.push_back(track.id);
+  std::mt19937 rng{1};
+  std::ranges::shuffle(ids, rng);
+  ids.resize(std::max<std::size_t>(1, ids.size() / 100));
+  results.push_back(measure(size, "remove_tracks", 1, ids.size(), [&](std::size_t) {
+    for (const int id : ids)
+      Midx::remove_track(db, id);
+  }));
+  const std::size_t remaining = track_count - ids.size();
+  results.push_back(measure(size, "remove_music_dir", 1, remaining, [&](std::size_t) {
+    Midx::remove_music_dir(db, library_path);
+  }));
+  return results;
+}
+
+static Result measure(
+    const std::size_t library_size, const std::string &name, const std::size_t runs,
+    const std::size_t items, const std::function<void(std::size_t)> &fn
+) {
+  std::vector<double> times{};
+  for (std::size_t run = 0; run < runs; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    fn(run);
+    const auto end = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  std::ranges::sort(times);
+  const double median = times[times.size() / 2];
+  const Result res{library_size, name, runs, median, times.front(), times.back(), items};
+  std::cerr << std::format("  {:<24} {:>12.3f} ms\n", name, res.median_ms);
+  return res;
+}
+
+/**
+ * One result per line so results can be diffed and read back without a JSON parser.
+ */
+static std::string to_json(const std::vector<Result> &results) {
+  std::string res = "{\n  \"benchmark\": \"midx\",\n  \"results\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    const double per_item_us =
+        r.items > 0 ? r.median_ms * 1000.0 / static_cast<double>(r.items) : 0.0;
+    res += std::format(
+        "    {{\"library_size\": {}, \"name\": \"{}\", \"runs\": {}, \"median_ms\": {:.4f}, "
+        "\"min_ms\": {:.4f}, \"max_ms\": {:.4f}, \"items\": {}, \"per_item_us\": {:.4f}}}{}\n",
+        r.library_size, r.name, r.runs, r.median_ms, r.min_ms, r.max_ms, r.items, per_item_us,
+        i + 1 < results.size() ? "," : ""
+    );
+  }
+  res += "  ]\n}\n";
+  return res;
+}
+
+static std::vector<Result> read_results(const std::string &path) {
+  std::vector<Result> res{};
+  std::ifstream file{path};
+  if (not file) {
+    spdlog::error("Failed to read the baseline {}", path);
+    return res;
+  }
+  static const std::regex line_regex{
+      R"--("library_size": (\d+), "name": "(\w+)", "runs": (\d+), "median_ms": ([\d.]+), )--"
+      R"--("min_ms": ([\d.]+), "max_ms": ([\d.]+), "items": (\d+))--"
+  };
+  std::smatch m;
+  for (std::string line; std::getline(file, line);) {
+    if (not std::regex_search(line, m, line_regex))
+      continue;
+    res.push_back(Result{
+        std::stoul(m[1]), m[2], std::stoul(m[3]), std::stod(m[4]), std::stod(m[5]),
+        std::stod(m[6]), std::stoul(m[7])
+    });
+  }
+  return res;
+}
@@ -0,0 +1,288 @@
+#include "./history.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <format>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace fs = std::filesystem;
+
+namespace Midx {
+
+PlayHistory::PlayHistory(const std::string &db_path, const std::string &log_path)
+    : m_log_path{log_path.empty() ? std::format("{}/play_history.log", data_dir) : log_path},
+      m_db{db_path, SQLite::OPEN_READWRITE} {
+  m_db.setBusyTimeout(5000);
+
+  // Continue numbering after both what's in the database and what's left in the log
+  SQLite::Statement stmt{m_db, "SELECT last_seq FROM t_play_log_checkpoint WHERE id = 0"};
+  if (stmt.executeStep())
+    m_next_seq = stmt.getColumn(0).getInt64() + 1;
+
+  if (fs::exists(m_log_path)) {
+    // Drop a record that was only partially written
+    const auto size = fs::file_size(m_log_path);
+    fs::resize_file(m_log_path, size - size % sizeof(LogRecord));
+
+    std::ifstream log{m_log_path, std::ios::binary};
+    LogRecord r{};
+    while (log.read(reinterpret_cast<char *>(&r), sizeof(r)))
+      m_next_seq = std::max(m_next_seq, r.seq + 1);
+  }
+
+  m_worker = std::thread{&PlayHistory::worker_loop, this};
+}
+
+PlayHistory::~PlayHistory() {
+  {
+    std::lock_guard lock{m_mutex};
+    m_stop = true;
+  }
+  m_cv.notify_one();
+  m_worker.join();
+}
+
+void PlayHistory::record(PlayEvent event) {
+  if (event.timestamp == 0) {
+    event.timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::system_clock::now().time_since_epoch()
+    )
+                          .count();
+  }
+
+  std::size_t buffered = 0;
+  {
+    std::lock_guard lock{m_mutex};
+    const std::int64_t seq = m_next_seq++;
+    m_buffer.push_back(LogRecord{
+        seq, event.timestamp, event.track_id, event.position, static_cast<std::uint8_t>(event.kind),
+        {}
+    });
+
+    PendingStats &stats = m_pending[event.track_id];
+    if (event.kind == PlayEvent::Kind::Played)
+      ++stats.play_count;
+    else if (event.kind == PlayEvent::Kind::Skipped)
+      ++stats.skip_count;
+    stats.last_played     = std::max(stats.last_played.value_or(0), event.timestamp);
+    stats.resume_position = event.kind == PlayEvent::Kind::Stopped ? event.position : 0;
+    stats.last_seq        = seq;
+    buffered              = m_buffer.size();
+  }
+  if (buffered >= batch_size)
+    m_cv.notify_one();
+}
+
+PlayStats PlayHistory::get_stats(SQLite::Database &db, const int track_id) {
+  std::lock_guard stats_lock{m_stats_mutex};
+  const std::optional<PlayStats> stored = get_play_stats(db, track_id);
+
+  std::lock_guard lock{m_mutex};
+  const auto it = m_pending.find(track_id);
+  if (it == m_pending.end())
+    return stored.value_or(PlayStats{track_id});
+
+  const PendingStats &p = it->second;
+  if (not stored.has_value())
+    return PlayStats{track_id, p.play_count, p.skip_count, p.last_played, p.resume_position};
+
+  const PlayStats &s = stored.value();
+  std::optional<std::int64_t> last_played = s.last_played;
+  if (p.last_played.has_value())
+    last_played = std::max(s.last_played.value_or(0), p.last_played.value());
+  return PlayStats{
+      track_id, s.play_count + p.play_count, s.skip_count + p.skip_count, last_played,
+      p.resume_position
+  };
+}
+
+void PlayHistory::sync() {
+  std::unique_lock lock{m_mutex};
+  const std::uint64_t request = ++m_sync_requests;
+  m_cv.notify_one();
+  m_synced_cv.wait(lock, [&] { return m_syncs_done >= request; });
+}
+
+std::vector<int> PlayHistory::take_updated_tracks() {
+  std::lock_guard lock{m_mutex};
+  std::vector<int> res{m_updated_tracks.begin(), m_updated_tracks.end()};
+  m_updated_tracks.clear();
+  return res;
+}
+
+void PlayHistory::worker_loop() {
+  // Fold what the previous run left in the log
+  compact();
+
+  auto last_compaction = std::chrono::steady_clock::now();
+  while (true) {
+    bool stop               = false;
+    std::uint64_t requested = 0;
+    {
+      std::unique_lock lock{m_mutex};
+      m_cv.wait_for(lock, flush_interval, [&] {
+        return m_stop or m_buffer.size() >= batch_size or m_sync_requests > m_syncs_done;
+      });
+      stop      = m_stop;
+      requested = m_sync_requests;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (stop or requested > m_syncs_done or now - last_compaction >= compact_interval) {
+      compact();
+      last_compaction = now;
+    } else {
+      flush();
+    }
+
+    {
+      std::lock_guard lock{m_mutex};
+      m_syncs_done = requested;
+    }
+    m_synced_cv.notify_all();
+    if (stop)
+      return;
+  }
+}
+
+bool PlayHistory::flush(std::unordered_map<int, PendingStats> *pending) {
+  std::vector<LogRecord> batch{};
+  {
+    std::lock_guard lock{m_mutex};
+    std::swap(batch, m_buffer);
+    if (pending != nullptr)
+      *pending = m_pending;
+  }
+  if (batch.empty())
+    return true;
+
+  // Synced before the batch counts as written, a power loss would drop what's only in the
+  // page cache
+  bool written = false;
+  if (const int fd = open(m_log_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+      fd >= 0) {
+    const auto *data = reinterpret_cast<const char *>(batch.data());
+    std::size_t left = batch.size() * sizeof(LogRecord);
+    while (left > 0) {
+      const ssize_t n = write(fd, data, left);
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      data += n;
+      left -= static_cast<std::size_t>(n);
+    }
+    written = left == 0 and fsync(fd) == 0;
+    close(fd);
+  }
+  if (not written) {
+    spdlog::error("Failed to write play history to {}", m_log_path);
+    // Keep the events for the next flush
+    std::lock_guard lock{m_mutex};
+    m_buffer.insert(m_buffer.begin(), batch.begin(), batch.end());
+    return false;
+  }
+  return true;
+}
+
+void PlayHistory::compact() {
+  std::unordered_map<int, PendingStats> flushed{};
+  if (not flush(&flushed))
+    return;
+
+  std::lock_guard stats_lock{m_stats_mutex};
+
+  // Aggregate the log, in order, per track
+  std::unordered_map<int, PendingStats> aggregated{};
+  {
+    std::int64_t checkpoint = 0;
+    SQLite::Statement stmt{m_db, "SELECT last_seq FROM t_play_log_checkpoint WHERE id = 0"};
+    if (stmt.executeStep())
+      checkpoint = stmt.getColumn(0).getInt64();
+
+    std::ifstream log{m_log_path, std::ios::binary};
+    LogRecord r{};
+    while (log.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+      if (r.seq <= checkpoint)
+        continue;
+      PendingStats &stats = aggregated[r.track_id];
+      const auto kind     = static_cast<PlayEvent::Kind>(r.kind);
+      if (kind == PlayEvent::Kind::Played)
+        ++stats.play_count;
+      else if (kind == PlayEvent::Kind::Skipped)
+        ++stats.skip_count;
+      stats.last_played     = std::max(stats.last_played.value_or(0), r.timestamp);
+      stats.resume_position = kind == PlayEvent::Kind::Stopped ? r.position : 0;
+      stats.last_seq        = std::max(stats.last_seq, r.seq);
+    }
+  }
+  if (aggregated.empty()) {
+    // Only events that were already folded (if the last run stopped before truncating)
+    if (fs::exists(m_log_path))
+      fs::resize_file(m_log_path, 0);
+    return;
+  }
+
+  try {
+    SQLite::Transaction transaction{m_db};
+    // Events of tracks removed in the meantime are dropped
+    SQLite::Statement upsert{m_db, R"--(
+      INSERT INTO t_play_stats (track_id, play_count, skip_count, last_played, resume_position)
+      SELECT ?1, ?2, ?3, ?4, ?5 WHERE EXISTS (SELECT 1 FROM t_tracks WHERE id = ?1)
+      ON CONFLICT(track_id) DO UPDATE SET
+        play_count      = play_count + excluded.play_count,
+        skip_count      = skip_count + excluded.skip_count,
+        last_played     = max(coalesce(last_played, 0), excluded.last_played),
+        resume_position = excluded.resume_position
+    )--"};
+    std::int64_t last_seq = 0;
+    for (const auto &[track_id, stats] : aggregated) {
+      upsert.bind(1, track_id);
+      upsert.bind(2, stats.play_count);
+      upsert.bind(3, stats.skip_count);
+      upsert.bind(4, stats.last_played.value_or(0));
+      upsert.bind(5, stats.resume_position);
+      upsert.exec();
+      upsert.reset();
+      last_seq = std::max(last_seq, stats.last_seq);
+    }
+    SQLite::Statement checkpoint{m_db, R"--(
+      INSERT INTO t_play_log_checkpoint (id, last_seq) VALUES (0, ?)
+      ON CONFLICT(id) DO UPDATE SET last_seq = excluded.last_seq
+    )--"};
+    checkpoint.bind(1, last_seq);
+    checkpoint.exec();
+    transaction.commit();
+  } catch (SQLite::Exception &e) {
+    spdlog::error("Error compacting the play history: {}", e.what());
+    return;
+  }
+
+  // Only this thread appends to the log, and everything in it is now in the database
+  fs::resize_file(m_log_path, 0);
+
+  std::lock_guard lock{m_mutex};
+  for (const auto &[track_id, stats] : flushed) {
+    const auto it = m_pending.find(track_id);
+    if (it == m_pending.end())
+      continue;
+    if (it->second.last_seq <= stats.last_seq) {
+      m_pending.erase(it);
+    } else {
+      it->second.play_count -= stats.play_count;
+      it->second.skip_count -= stats.skip_count;
+    }
+  }
+  for (const auto &[track_id, _] : aggregated)
+    m_updated_tracks.insert(track_id);
+}
+
+}  // namespace Midx
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "./midx.hpp"
+
+namespace Midx {
+
+struct PlayEvent {
+  enum class Kind : std::uint8_t {
+    /**
+     * The track was played until the end.
+     */
+    Played,
+    Skipped,
+    /**
+     * Playback stopped (or paused) at `position`, used to resume later.
+     */
+    Stopped
+  };
+
+  int track_id;
+  Kind kind;
+  /**
+   * Position in seconds.
+   */
+  int position = 0;
+  /**
+   * Unix time, filled by `PlayHistory::record()` when 0.
+   */
+  std::int64_t timestamp = 0;
+};
+
+/**
+  Records play events without ever making the caller wait on SQLite.
+
+  Events are kept in memory, appended in batches to a log file (by default
+  `Midx::data_dir/play_history.log`) by a background thread, and periodically
+  folded into the `t_play_stats` table, which is what Midx::get_play_stats() reads.
+  Every event has a sequence number and the last one folded is stored in the same
+  transaction, so a crash between the commit and the log truncation doesn't count
+  events twice.
+*/
+class PlayHistory {
+ public:
+  /**
+   * @param db_path Database initialised with Midx::init_database(), the history opens
+   * its own connection to it.
+   * @param log_path Defaults to `Midx::data_dir/play_history.log`.
+   */
+  explicit PlayHistory(const std::string &db_path, const std::string &log_path = "");
+  PlayHistory(const PlayHistory &) = delete;
+  PlayHistory &operator=(const PlayHistory &) = delete;
+  ~PlayHistory();
+
+  void record(PlayEvent event);
+
+  /**
+   * Stats of a track including the events that haven't been compacted yet.
+   */
+  PlayStats get_stats(SQLite::Database &db, const int track_id);
+
+  /**
+   * Write all recorded events to the log and fold them into the database,
+   * returns once it's done.
+   */
+  void sync();
+
+  /**
+   * Ids of the tracks whose stats changed in the database since the last call, each
+   * once, e.g. to update smart playlists that filter on play counts.
+   */
+  std::vector<int> take_updated_tracks();
+
+ public:
+  /**
+   * Events are written to the log at least this often.
+   */
+  static constexpr std::chrono::milliseconds flush_interval{1000};
+  /**
+   * And folded into the database at least this often.
+   */
+  static constexpr std::chrono::milliseconds compact_interval{60 * 1000};
+  /**
+   * Number of buffered events that triggers a flush before `flush_interval`.
+   */
+  static constexpr std::size_t batch_size = 64;
+
+ private:
+  /**
+   * Events of a track that are not in the database yet.
+   */
+  struct PendingStats {
+    int play_count                          = 0;
+    int skip_count                          = 0;
+    std::optional<std::int64_t> last_played = std::nullopt;
+    int resume_position                     = 0;
+    std::int64_t last_seq                   = 0;
+  };
+
+  struct LogRecord {
+    std::int64_t seq;
+    std::int64_t timestamp;
+    std::int32_t track_id;
+    std::int32_t position;
+    std::uint8_t kind;
+    std::uint8_t padding[7];
+  };
+
+  void worker_loop();
+  /**
+   * Append the buffered events to the log.
+   * If `pending` isn't null, it receives a copy of the pending stats matching what's in the log.
+   */
+  bool flush(std::unordered_map<int, PendingStats> *pending = nullptr);
+  void compact();
+
+ private:
+  const std::string m_log_path;
+  SQLite::Database m_db;
+
+  /**
+   * Held while the database and the pending stats disagree (during compaction).
+   */
+  std::mutex m_stats_mutex;
+  /**
+   * Guards everything below, only ever held for in-memory work.
+   */
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::condition_variable m_synced_cv;
+  std::vector<LogRecord> m_buffer;
+  std::unordered_map<int, PendingStats> m_pending;
+  /**
+   * A set, so that it's bounded by the number of tracks when nothing takes it.
+   */
+  std::unordered_set<int> m_updated_tracks;
+  std::int64_t m_next_seq       = 1;
+  std::uint64_t m_sync_requests = 0;
+  std::uint64_t m_syncs_done    = 0;
+  bool m_stop                   = false;
+  std::thread m_worker;
+};
+
+}  // namespace Midx
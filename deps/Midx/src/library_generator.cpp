@@ -0,0 +1,455 @@
+#include "./library_generator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace Midx::Bench {
+
+using Bytes = std::vector<std::uint8_t>;
+
+static constexpr std::uint32_t flac_sample_rate = 8000;
+static constexpr std::uint32_t flac_block_size  = 16384;
+static constexpr std::size_t mp3_frame_count    = 4;
+static constexpr std::size_t mp3_frame_size     = 144;
+
+static constexpr std::array<std::string_view, 24> syllables{
+    "ka", "lo", "mi", "ra", "ne", "su", "to", "vi", "da", "el", "or", "an",
+    "be", "ri", "sa", "mo", "lu", "ze", "fi", "gor", "tam", "wen", "dru", "pha",
+};
+
+static constexpr std::array<std::string_view, 40> words{
+    "love",  "night",  "river", "fire",  "dream",  "city",   "light", "heart",
+    "blue",  "summer", "rain",  "song",  "home",   "road",   "gold",  "time",
+    "sky",   "stone",  "shadow", "echo", "wild",   "silver", "ocean", "star",
+    "ghost", "north",  "glass", "paper", "electric", "velvet", "morning", "dust",
+    "winter", "garden", "machine", "mirror", "storm", "honey", "tiger", "static",
+};
+
+namespace Utils {
+
+struct Tags {
+  std::optional<std::string> title;
+  std::optional<std::string> artist;
+  std::optional<std::string> album;
+  std::optional<int> track_number;
+  std::optional<int> year;
+};
+
+static void put_be(Bytes &out, const std::uint64_t value, const int byte_count);
+static void put_le32(Bytes &out, const std::uint32_t value);
+static void put_string(Bytes &out, std::string_view s);
+
+static std::uint8_t crc8(const std::uint8_t *data, const std::size_t size);
+static std::uint16_t crc16(const std::uint8_t *data, const std::size_t size);
+static std::uint32_t crc32(const std::uint8_t *data, const std::size_t size);
+
+/**
+ * An uncompressed RGB PNG, a gradient starting from `seed`'s colour.
+ */
+static Bytes make_png(const std::size_t size, const std::uint32_t seed);
+
+/**
+ * FLAC file holding `seconds` of silence (8 kHz, mono, 16 bits) in constant subframes.
+ */
+static Bytes make_flac(const Tags &tags, const Bytes *cover, const int seconds);
+
+/**
+ * ID3v2.4 tag followed by a few silent MPEG-1 layer III frames.
+ */
+static Bytes make_mp3(const Tags &tags, const Bytes *cover);
+
+static std::string make_name(std::mt19937 &rng, const int word_count);
+static std::string make_title(std::mt19937 &rng);
+static std::string sanitize(std::string name);
+static void write_file(const fs::path &path, const Bytes &data);
+
+}  // namespace Utils
+
+GeneratedLibrary generate_library(const std::string &root, const GeneratorOptions &options) {
+  std::mt19937 rng{options.seed};
+  std::uniform_real_distribution<double> chance{0.0, 1.0};
+
+  GeneratedLibrary res{};
+  res.artist_count = std::max<std::size_t>(1, options.track_count / 60);
+
+  // Artist ranks follow a Zipf distribution, the first artists get most albums
+  std::vector<std::string> artists{};
+  std::vector<double> cumulative_weights{};
+  double total_weight = 0.0;
+  for (std::size_t rank = 0; rank < res.artist_count; ++rank) {
+    std::string name = Utils::make_name(rng, 1 + static_cast<int>(rng() % 2));
+    if (chance(rng) < 0.15)
+      name = "The " + name;
+    if (chance(rng) < 0.1) {
+      if (const auto pos = name.find('o'); pos != std::string::npos)
+        name.replace(pos, 1, "ö");
+      else if (const auto e = name.find('e'); e != std::string::npos)
+        name.replace(e, 1, "é");
+    }
+    artists.push_back(std::move(name));
+    total_weight += 1.0 / std::pow(static_cast<double>(rank + 1), 1.1);
+    cumulative_weights.push_back(total_weight);
+  }
+  for (std::size_t i = 0; i < std::min<std::size_t>(artists.size(), 10); ++i)
+    res.sample_artists.push_back(artists[i]);
+  res.sample_words.assign(words.begin(), words.begin() + 8);
+
+  std::uniform_real_distribution<double> pick_weight{0.0, total_weight};
+  std::uniform_int_distribution<int> album_size{6, 16};
+  std::uniform_int_distribution<int> year{1960, 2024};
+  std::uniform_int_distribution<int> seconds{90, 420};
+
+  while (res.track_count < options.track_count) {
+    const auto artist_rank = static_cast<std::size_t>(
+        std::ranges::lower_bound(cumulative_weights, pick_weight(rng)) - cumulative_weights.begin()
+    );
+    const std::string &artist = artists[std::min(artist_rank, artists.size() - 1)];
+    const std::string album   = Utils::make_name(rng, 1 + static_cast<int>(rng() % 3));
+    const int album_year      = year(rng);
+    const auto track_count    = std::min<std::size_t>(
+        static_cast<std::size_t>(album_size(rng)), options.track_count - res.track_count
+    );
+    const bool is_flac   = chance(rng) < options.flac_ratio;
+    const bool has_discs = track_count >= 10 and chance(rng) < 0.08;
+
+    const char initial = std::isalpha(static_cast<unsigned char>(artist[0])) ? artist[0] : '#';
+    fs::path album_dir = fs::path{root} / std::string{initial} / Utils::sanitize(artist) /
+                         Utils::sanitize(std::format("{} - {}", album_year, album));
+    for (int n = 2; fs::exists(album_dir); ++n)
+      album_dir += std::format(" ({})", n);
+    fs::create_directories(album_dir);
+
+    std::optional<Bytes> cover{};
+    if (chance(rng) < options.cover_ratio) {
+      cover = Utils::make_png(options.cover_size, static_cast<std::uint32_t>(rng()));
+      Utils::write_file(album_dir / "cover.png", cover.value());
+      res.byte_count += cover->size();
+    }
+
+    for (std::size_t t = 0; t < track_count; ++t) {
+      Utils::Tags tags{};
+      const double missing    = chance(rng);
+      const std::string title = Utils::make_title(rng);
+      if (missing >= 0.01) {
+        tags.artist = artist;
+        if (chance(rng) < 0.03)
+          tags.artist = std::format("{} feat. {}", artist, artists[rng() % artists.size()]);
+        tags.album        = album;
+        tags.track_number = static_cast<int>(t + 1);
+        tags.year         = album_year;
+        if (missing >= 0.03)
+          tags.title = title;
+      }
+
+      fs::path dir = album_dir;
+      if (has_discs) {
+        dir /= std::format("CD {}", t < track_count / 2 ? 1 : 2);
+        fs::create_directories(dir);
+      }
+      const std::string file_name =
+          std::format("{:02} - {}.{}", t + 1, title, is_flac ? "flac" : "mp3");
+      const Bytes *embedded_cover = cover.has_value() ? &cover.value() : nullptr;
+      const Bytes data            = is_flac ? Utils::make_flac(tags, embedded_cover, seconds(rng))
+                                            : Utils::make_mp3(tags, embedded_cover);
+      Utils::write_file(dir / Utils::sanitize(file_name), data);
+      res.byte_count += data.size();
+      ++res.track_count;
+    }
+    ++res.album_count;
+  }
+  return res;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::put_be(Bytes &out, const std::uint64_t value, const int byte_count) {
+  for (int i = byte_count - 1; i >= 0; --i)
+    out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+}
+
+static void Utils::put_le32(Bytes &out, const std::uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+}
+
+static void Utils::put_string(Bytes &out, std::string_view s) {
+  out.insert(out.end(), s.begin(), s.end());
+}
+
+static std::uint8_t Utils::crc8(const std::uint8_t *data, const std::size_t size) {
+  std::uint8_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b)
+      crc = static_cast<std::uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+  }
+  return crc;
+}
+
+static std::uint16_t Utils::crc16(const std::uint8_t *data, const std::size_t size) {
+  std::uint16_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= static_cast<std::uint16_t>(data[i] << 8);
+    for (int b = 0; b < 8; ++b)
+      crc = static_cast<std::uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+  }
+  return crc;
+}
+
+static std::uint32_t Utils::crc32(const std::uint8_t *data, const std::size_t size) {
+  std::uint32_t crc = 0xFFFFFFFF;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+  }
+  return ~crc;
+}
+
+static Bytes Utils::make_png(const std::size_t size, const std::uint32_t seed) {
+  // Scanlines: a filter byte then RGB pixels
+  Bytes raw{};
+  raw.reserve(size * (1 + size * 3));
+  for (std::size_t y = 0; y < size; ++y) {
+    raw.push_back(0);
+    for (std::size_t x = 0; x < size; ++x) {
+      raw.push_back(static_cast<std::uint8_t>((seed & 0xFF) + x * 4));
+      raw.push_back(static_cast<std::uint8_t>(((seed >> 8) & 0xFF) + y * 4));
+      raw.push_back(static_cast<std::uint8_t>((seed >> 16) & 0xFF));
+    }
+  }
+
+  // zlib stream made of stored (uncompressed) deflate blocks
+  Bytes zlib{0x78, 0x01};
+  for (std::size_t offset = 0; offset < raw.size();) {
+    const std::size_t len = std::min<std::size_t>(raw.size() - offset, 0xFFFF);
+    zlib.push_back(offset + len == raw.size() ? 1 : 0);
+    zlib.push_back(static_cast<std::uint8_t>(len));
+    zlib.push_back(static_cast<std::uint8_t>(len >> 8));
+    zlib.push_back(static_cast<std::uint8_t>(~len));
+    zlib.push_back(static_cast<std::uint8_t>(~len >> 8));
+    zlib.insert(zlib.end(), raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                raw.begin() + static_cast<std::ptrdiff_t>(offset + len));
+    offset += len;
+  }
+  std::uint32_t a = 1, b = 0;
+  for (const std::uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_be(zlib, (b << 16) | a, 4);
+
+  Bytes png{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  const auto put_chunk = [&](std::string_view type, const Bytes &data) {
+    put_be(png, data.size(), 4);
+    const std::size_t start = png.size();
+    put_string(png, type);
+    png.insert(png.end(), data.begin(), data.end());
+    put_be(png, crc32(png.data() + start, png.size() - start), 4);
+  };
+  Bytes header{};
+  put_be(header, size, 4);
+  put_be(header, size, 4);
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+  put_chunk("IHDR", header);
+  put_chunk("IDAT", zlib);
+  put_chunk("IEND", {});
+  return png;
+}
+
+static Bytes Utils::make_flac(const Tags &tags, const Bytes *cover, const int seconds) {
+  const std::uint64_t total_samples =
+      std::uint64_t{flac_sample_rate} * static_cast<std::uint64_t>(seconds);
+
+  Bytes out{};
+  put_string(out, "fLaC");
+  const auto put_block_header = [&](const int type, const bool last, const std::size_t size) {
+    out.push_back(static_cast<std::uint8_t>((last ? 0x80 : 0) | type));
+    put_be(out, size, 3);
+  };
+
+  // STREAMINFO, frame sizes and MD5 left as unknown
+  put_block_header(0, false, 34);
+  put_be(out, flac_block_size, 2);
+  put_be(out, flac_block_size, 2);
+  put_be(out, 0, 3);
+  put_be(out, 0, 3);
+  // Sample rate (20 bits), channels - 1 (3 bits), bits per sample - 1 (5 bits), samples (36 bits)
+  const std::uint64_t format = (std::uint64_t{flac_sample_rate} << 44) | (std::uint64_t{15} << 36);
+  put_be(out, format | total_samples, 8);
+  out.insert(out.end(), 16, 0);
+
+  Bytes comments{};
+  constexpr std::string_view vendor = "Midx benchmark";
+  put_le32(comments, vendor.size());
+  put_string(comments, vendor);
+  std::vector<std::string> fields{};
+  if (tags.title)
+    fields.push_back("TITLE=" + tags.title.value());
+  if (tags.artist)
+    fields.push_back("ARTIST=" + tags.artist.value());
+  if (tags.album)
+    fields.push_back("ALBUM=" + tags.album.value());
+  if (tags.track_number)
+    fields.push_back(std::format("TRACKNUMBER={}", tags.track_number.value()));
+  if (tags.year)
+    fields.push_back(std::format("DATE={}", tags.year.value()));
+  put_le32(comments, static_cast<std::uint32_t>(fields.size()));
+  for (const std::string &field : fields) {
+    put_le32(comments, static_cast<std::uint32_t>(field.size()));
+    put_string(comments, field);
+  }
+  put_block_header(4, cover == nullptr, comments.size());
+  out.insert(out.end(), comments.begin(), comments.end());
+
+  if (cover != nullptr) {
+    constexpr std::string_view mime = "image/png";
+    put_block_header(6, true, 32 + mime.size() + cover->size());
+    put_be(out, 3, 4);  // Front cover
+    put_be(out, mime.size(), 4);
+    put_string(out, mime);
+    put_be(out, 0, 4);  // Description
+    put_be(out, 0, 4);
+    put_be(out, 0, 4);
+    put_be(out, 24, 4);
+    put_be(out, 0, 4);
+    put_be(out, cover->size(), 4);
+    out.insert(out.end(), cover->begin(), cover->end());
+  }
+
+  // Each frame is a header and a constant subframe of zeros
+  std::uint64_t frame_number = 0;
+  for (std::uint64_t written = 0; written < total_samples; written += flac_block_size) {
+    const std::uint64_t block_size =
+        std::min<std::uint64_t>(flac_block_size, total_samples - written);
+    const std::size_t start        = out.size();
+    out.insert(out.end(), {0xFF, 0xF8});
+    out.push_back(0x74);  // Block size stored after the header, 8 kHz
+    out.push_back(0x08);  // Mono, 16 bits per sample
+    if (frame_number < 0x80) {
+      out.push_back(static_cast<std::uint8_t>(frame_number));
+    } else if (frame_number < 0x800) {
+      out.push_back(static_cast<std::uint8_t>(0xC0 | (frame_number >> 6)));
+      out.push_back(static_cast<std::uint8_t>(0x80 | (frame_number & 0x3F)));
+    } else {
+      out.push_back(static_cast<std::uint8_t>(0xE0 | (frame_number >> 12)));
+      out.push_back(static_cast<std::uint8_t>(0x80 | ((frame_number >> 6) & 0x3F)));
+      out.push_back(static_cast<std::uint8_t>(0x80 | (frame_number & 0x3F)));
+    }
+    put_be(out, block_size - 1, 2);
+    out.push_back(crc8(out.data() + start, out.size() - start));
+    out.insert(out.end(), {0x00, 0x00, 0x00});
+    put_be(out, crc16(out.data() + start, out.size() - start), 2);
+    ++frame_number;
+  }
+  return out;
+}
+
+static Bytes Utils::make_mp3(const Tags &tags, const Bytes *cover) {
+  const auto put_syncsafe = [](Bytes &out, const std::size_t value) {
+    for (int i = 3; i >= 0; --i)
+      out.push_back(static_cast<std::uint8_t>((value >> (7 * i)) & 0x7F));
+  };
+
+  Bytes frames{};
+  const auto put_frame = [&](std::string_view id, const Bytes &data) {
+    put_string(frames, id);
+    put_syncsafe(frames, data.size());
+    frames.insert(frames.end(), {0, 0});
+    frames.insert(frames.end(), data.begin(), data.end());
+  };
+  const auto put_text_frame = [&](std::string_view id, std::string_view text) {
+    Bytes data{0x03};  // UTF-8
+    put_string(data, text);
+    put_frame(id, data);
+  };
+  if (tags.title)
+    put_text_frame("TIT2", tags.title.value());
+  if (tags.artist)
+    put_text_frame("TPE1", tags.artist.value());
+  if (tags.album)
+    put_text_frame("TALB", tags.album.value());
+  if (tags.track_number)
+    put_text_frame("TRCK", std::to_string(tags.track_number.value()));
+  if (tags.year)
+    put_text_frame("TDRC", std::to_string(tags.year.value()));
+  if (cover != nullptr) {
+    Bytes data{0x00};
+    put_string(data, "image/png");
+    // End of the mime type, front cover, empty description
+    data.insert(data.end(), {0x00, 0x03, 0x00});
+    data.insert(data.end(), cover->begin(), cover->end());
+    put_frame("APIC", data);
+  }
+
+  Bytes out{};
+  if (not frames.empty()) {
+    put_string(out, "ID3");
+    out.insert(out.end(), {4, 0, 0});
+    put_syncsafe(out, frames.size());
+    out.insert(out.end(), frames.begin(), frames.end());
+  }
+  // MPEG-1 layer III, 32 kbps, 32 kHz, mono, silent
+  for (std::size_t i = 0; i < mp3_frame_count; ++i) {
+    out.insert(out.end(), {0xFF, 0xFB, 0x18, 0xC0});
+    out.insert(out.end(), mp3_frame_size - 4, 0);
+  }
+  return out;
+}
+
+static std::string Utils::make_name(std::mt19937 &rng, const int word_count) {
+  std::string res{};
+  for (int w = 0; w < word_count; ++w) {
+    if (w > 0)
+      res += ' ';
+    const std::size_t start = res.size();
+    const int syllable_count = 1 + static_cast<int>(rng() % 3);
+    for (int s = 0; s < syllable_count; ++s)
+      res += syllables[rng() % syllables.size()];
+    res[start] = static_cast<char>(std::toupper(static_cast<unsigned char>(res[start])));
+  }
+  return res;
+}
+
+static std::string Utils::make_title(std::mt19937 &rng) {
+  std::string res{};
+  const int word_count = 1 + static_cast<int>(rng() % 4);
+  for (int w = 0; w < word_count; ++w) {
+    if (w > 0)
+      res += ' ';
+    const std::size_t start = res.size();
+    res += words[rng() % words.size()];
+    res[start] = static_cast<char>(std::toupper(static_cast<unsigned char>(res[start])));
+  }
+  const auto variant = rng() % 20;
+  if (variant == 0)
+    res += " (Live)";
+  else if (variant == 1)
+    res += " - Remastered";
+  return res;
+}
+
+static std::string Utils::sanitize(std::string name) {
+  std::ranges::replace(name, '/', '-');
+  return name;
+}
+
+static void Utils::write_file(const fs::path &path, const Bytes &data) {
+  std::ofstream file{path, std::ios::binary};
+  const auto size = static_cast<std::streamsize>(data.size());
+  file.write(reinterpret_cast<const char *>(data.data()), size);
+}
+
+}  // namespace Midx::Bench
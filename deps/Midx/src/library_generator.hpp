@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Midx::Bench {
+
+struct GeneratorOptions {
+  std::size_t track_count = 10000;
+  std::uint32_t seed      = 1;
+  /**
+   * Share of albums stored as FLAC, the others are MP3.
+   */
+  double flac_ratio = 0.7;
+  /**
+   * Share of albums with a cover (embedded in every track and saved as `cover.png`).
+   */
+  double cover_ratio = 0.8;
+  /**
+   * Covers are `cover_size` x `cover_size` PNGs.
+   */
+  std::size_t cover_size = 32;
+};
+
+struct GeneratedLibrary {
+  std::size_t track_count   = 0;
+  std::size_t artist_count  = 0;
+  std::size_t album_count   = 0;
+  std::uintmax_t byte_count = 0;
+  /**
+   * A few artist names and title words that exist in the library, for search benchmarks.
+   */
+  std::vector<std::string> sample_artists;
+  std::vector<std::string> sample_words;
+};
+
+/**
+  Create a tree of tiny but valid FLAC and MP3 files under `root`, laid out like a real
+  library: `root/<initial>/<artist>/<year> - <album>/[CD <n>/]<number> - <title>.<ext>`.
+
+  Artists follow a Zipf distribution (a few have most of the albums), albums have 6 to 16
+  tracks, some names start with "The " or have accents, a few tracks are missing their
+  title or all their tags. FLAC files hold an 8 kHz mono stream as long as the track
+  claims to be, MP3 files hold a few silent frames. The same seed gives the same library.
+*/
+GeneratedLibrary generate_library(const std::string &root, const GeneratorOptions &options);
+
+}  // namespace Midx::Bench
@@ -7,7 +7,12 @@
 
 using namespace Midx;
 
-int main() {
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    spdlog::error("Usage: {} <music directory>", argv[0]);
+    return 1;
+  }
+
   Midx::data_dir = "./midx-test";
   std::filesystem::create_directory(Midx::data_dir);
 
@@ -17,7 +22,7 @@ int main() {
 
   Midx::init_database(db);
 
-  auto mdir_id = insert_music_dir(db, "/home/blackpill0w/Music/");
+  auto mdir_id = insert_music_dir(db, argv[1]);
   if (! mdir_id.has_value()) {
     spdlog::error("ERROR: Failed to insert directory.");
   }
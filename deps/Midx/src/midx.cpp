@@ -1,6 +1,7 @@
 #include "./midx.hpp"
 
 #include <array>
+#include <cctype>
 #include <filesystem>
 #include <fstream>
 #include <vector>
@@ -55,6 +56,30 @@ static std::optional<TagLib::ByteVector> get_album_art(const std::string &filena
  */
 static std::optional<int> insert_metadata(SQLite::Database &db, const TrackMetadata &tm);
 
+/**
+ * Add a column to a table created by an older version of Midx.
+ * `CREATE TABLE IF NOT EXISTS` leaves existing tables untouched, so new columns
+ * have to be added by hand.
+ */
+static void add_column_if_missing(
+    SQLite::Database &db, const std::string &table, const std::string &column,
+    const std::string &definition
+);
+
+/**
+ * Compute the sort keys of rows inserted by an older version of Midx.
+ */
+static void fill_missing_sort_keys(
+    SQLite::Database &db, const std::string &table, const std::string &id_column,
+    const std::string &text_column, const std::string &key_column
+);
+
+/**
+ * Build a Track (with its metadata) from a row of
+ * `id, file_path, parent_dir_id, title, track_num, artist_id, album_id, duration`.
+ */
+static Track read_track(SQLite::Statement &stmt);
+
 }  // namespace Utils
 
 void init_database(SQLite::Database &db) {
@@ -71,7 +96,8 @@ void init_database(SQLite::Database &db) {
     db.exec(R"--(
       CREATE TABLE IF NOT EXISTS t_artists (
         id              INTEGER PRIMARY KEY AUTOINCREMENT,
-        name            TEXT NOT NULL UNIQUE
+        name            TEXT NOT NULL UNIQUE,
+        sort_key        BLOB
       );
     )--");
     // Create albums table
@@ -80,6 +106,7 @@ void init_database(SQLite::Database &db) {
         id                         INTEGER PRIMARY KEY AUTOINCREMENT,
         name                       TEXT NOT NULL,
         artist_id                  INTEGER,
+        sort_key                   BLOB,
         FOREIGN KEY(artist_id)     REFERENCES t_artists(id),
         CONSTRAINT unique_artist_album UNIQUE (name, artist_id)
       );
@@ -90,6 +117,7 @@ void init_database(SQLite::Database &db) {
         id                         INTEGER PRIMARY KEY AUTOINCREMENT,
         file_path                  TEXT NOT NULL UNIQUE,
         parent_dir_id              INTEGER NOT NULL,
+        added_at                   INTEGER,
         FOREIGN KEY(parent_dir_id) REFERENCES t_music_dirs(id)
       );
     )--");
@@ -102,11 +130,62 @@ void init_database(SQLite::Database &db) {
         track_num                  INTEGER,
         artist_id                  INTEGER,
         album_id                   INTEGER,
+        duration                   INTEGER,
+        title_sort_key             BLOB,
         FOREIGN KEY(track_id)      REFERENCES t_tracks(id),
         FOREIGN KEY(artist_id)     REFERENCES t_artists(id),
         FOREIGN KEY(album_id)      REFERENCES t_albums(id)
       );
     )--");
+    Utils::add_column_if_missing(db, "t_tracks_metadata", "duration", "INTEGER");
+    Utils::add_column_if_missing(db, "t_tracks", "added_at", "INTEGER");
+    Utils::add_column_if_missing(db, "t_artists", "sort_key", "BLOB");
+    Utils::add_column_if_missing(db, "t_albums", "sort_key", "BLOB");
+    Utils::add_column_if_missing(db, "t_tracks_metadata", "title_sort_key", "BLOB");
+    Utils::fill_missing_sort_keys(db, "t_artists", "id", "name", "sort_key");
+    Utils::fill_missing_sort_keys(db, "t_albums", "id", "name", "sort_key");
+    Utils::fill_missing_sort_keys(db, "t_tracks_metadata", "track_id", "title", "title_sort_key");
+
+    // Create play statistics table, filled by PlayHistory (see history.hpp)
+    db.exec(R"--(
+      CREATE TABLE IF NOT EXISTS t_play_stats (
+        track_id                   INTEGER PRIMARY KEY,
+        play_count                 INTEGER NOT NULL DEFAULT 0,
+        skip_count                 INTEGER NOT NULL DEFAULT 0,
+        last_played                INTEGER,
+        resume_position            INTEGER NOT NULL DEFAULT 0,
+        FOREIGN KEY(track_id)      REFERENCES t_tracks(id)
+      );
+    )--");
+    // Sequence number of the last play event folded into t_play_stats
+    db.exec(R"--(
+      CREATE TABLE IF NOT EXISTS t_play_log_checkpoint (
+        id                         INTEGER PRIMARY KEY CHECK (id = 0),
+        last_seq                   INTEGER NOT NULL
+      );
+    )--");
+
+    // Indexes used by filters (see query.hpp)
+    db.exec(R"--(
+      CREATE INDEX IF NOT EXISTS idx_tracks_metadata_artist
+        ON t_tracks_metadata(artist_id);
+      CREATE INDEX IF NOT EXISTS idx_tracks_metadata_album
+        ON t_tracks_metadata(album_id, track_num);
+      CREATE INDEX IF NOT EXISTS idx_tracks_metadata_duration
+        ON t_tracks_metadata(duration);
+      CREATE INDEX IF NOT EXISTS idx_tracks_added_at
+        ON t_tracks(added_at);
+      CREATE INDEX IF NOT EXISTS idx_play_stats_play_count
+        ON t_play_stats(play_count);
+      CREATE INDEX IF NOT EXISTS idx_play_stats_last_played
+        ON t_play_stats(last_played);
+      CREATE INDEX IF NOT EXISTS idx_artists_sort_key
+        ON t_artists(sort_key, id);
+      CREATE INDEX IF NOT EXISTS idx_albums_sort_key
+        ON t_albums(sort_key, id);
+      CREATE INDEX IF NOT EXISTS idx_tracks_metadata_title_sort_key
+        ON t_tracks_metadata(title_sort_key, track_id);
+    )--");
   } catch (SQLite::Exception &e) {
     spdlog::error("Error initialising the databases: {}", e.what());
     spdlog::error("Code: {}", e.getErrorCode());
@@ -166,26 +245,194 @@ std::vector<Track> get_all_tracks(SQLite::Database &db) {
   std::vector<Track> res{};
 
   SQLite::Statement stmt{db, R"--(
-    SELECT id, file_path, parent_dir_id, title, track_num, artist_id, album_id
+    SELECT id, file_path, parent_dir_id, title, track_num, artist_id, album_id, duration
     FROM t_tracks t
     LEFT JOIN t_tracks_metadata tm ON t.id = tm.track_id
   )--"};
+  while (stmt.executeStep())
+    res.push_back(Utils::read_track(stmt));
+  return res;
+}
+
+Page<Artist> get_artists_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+) {
+  SQLite::Statement stmt{db, after.has_value() ? R"--(
+    SELECT id, name, sort_key FROM t_artists
+    WHERE (sort_key, id) > (?, ?)
+    ORDER BY sort_key, id LIMIT ?
+  )--" : R"--(
+    SELECT id, name, sort_key FROM t_artists
+    ORDER BY sort_key, id LIMIT ?
+  )--"};
+  int index = 1;
+  if (after.has_value()) {
+    stmt.bindNoCopy(index++, after->sort_key.data(), static_cast<int>(after->sort_key.size()));
+    stmt.bind(index++, after->id);
+  }
+  stmt.bind(index, limit);
+
+  Page<Artist> res{};
+  std::optional<PageCursor> last{};
+  while (stmt.executeStep()) {
+    res.items.emplace_back(stmt.getColumn(0).getInt(), stmt.getColumn(1).getString());
+    last.emplace(stmt.getColumn(2).getString(), stmt.getColumn(0).getInt());
+  }
+  if (static_cast<int>(res.items.size()) == limit and last.has_value())
+    res.next.emplace(last->sort_key, last->id);
+  return res;
+}
+
+Page<Album> get_albums_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+) {
+  SQLite::Statement stmt{db, after.has_value() ? R"--(
+    SELECT id, name, artist_id, sort_key FROM t_albums
+    WHERE (sort_key, id) > (?, ?)
+    ORDER BY sort_key, id LIMIT ?
+  )--" : R"--(
+    SELECT id, name, artist_id, sort_key FROM t_albums
+    ORDER BY sort_key, id LIMIT ?
+  )--"};
+  int index = 1;
+  if (after.has_value()) {
+    stmt.bindNoCopy(index++, after->sort_key.data(), static_cast<int>(after->sort_key.size()));
+    stmt.bind(index++, after->id);
+  }
+  stmt.bind(index, limit);
+
+  Page<Album> res{};
+  std::optional<PageCursor> last{};
   while (stmt.executeStep()) {
-    const int id = stmt.getColumn(0);
-    const std::string file_path{stmt.getColumn(1).getString()};
-    const int parent_dir_id = stmt.getColumn(2);
-    res.emplace_back(Track{id, file_path, parent_dir_id});
-    // Get metadata
-    auto title = stmt.getColumn(3).getString();
-    auto track_num =
-        stmt.isColumnNull(4) ? std::nullopt : std::optional<int>(stmt.getColumn(4).getInt());
-    auto artist_id =
-        stmt.isColumnNull(5) ? std::nullopt : std::optional<int>(stmt.getColumn(5).getInt());
-    auto album_id =
-        stmt.isColumnNull(6) ? std::nullopt : std::optional<int>(stmt.getColumn(6).getInt());
-
-    res.back().update_metadata(TrackMetadata{id, std::move(title), track_num, artist_id, album_id});
+    res.items.emplace_back(
+        stmt.getColumn(1).getString(), stmt.getColumn(0).getInt(),
+        stmt.isColumnNull(2) ? std::nullopt : std::optional<int>{stmt.getColumn(2).getInt()}
+    );
+    last.emplace(stmt.getColumn(3).getString(), stmt.getColumn(0).getInt());
+  }
+  if (static_cast<int>(res.items.size()) == limit and last.has_value())
+    res.next.emplace(last->sort_key, last->id);
+  return res;
+}
+
+Page<Track> get_tracks_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+) {
+  SQLite::Statement stmt{db, after.has_value() ? R"--(
+    SELECT id, file_path, parent_dir_id, title, track_num, artist_id, album_id, duration,
+           title_sort_key
+    FROM t_tracks_metadata tm
+    JOIN t_tracks t ON t.id = tm.track_id
+    WHERE (tm.title_sort_key, tm.track_id) > (?, ?)
+    ORDER BY tm.title_sort_key, tm.track_id LIMIT ?
+  )--" : R"--(
+    SELECT id, file_path, parent_dir_id, title, track_num, artist_id, album_id, duration,
+           title_sort_key
+    FROM t_tracks_metadata tm
+    JOIN t_tracks t ON t.id = tm.track_id
+    ORDER BY tm.title_sort_key, tm.track_id LIMIT ?
+  )--"};
+  int index = 1;
+  if (after.has_value()) {
+    stmt.bindNoCopy(index++, after->sort_key.data(), static_cast<int>(after->sort_key.size()));
+    stmt.bind(index++, after->id);
+  }
+  stmt.bind(index, limit);
+
+  Page<Track> res{};
+  std::optional<PageCursor> last{};
+  while (stmt.executeStep()) {
+    res.items.push_back(Utils::read_track(stmt));
+    last.emplace(stmt.getColumn(8).getString(), stmt.getColumn(0).getInt());
+  }
+  if (static_cast<int>(res.items.size()) == limit and last.has_value())
+    res.next.emplace(last->sort_key, last->id);
+  return res;
+}
+
+std::string make_sort_key(const std::string &text) {
+  // Base letters of U+00C0..U+00FF and U+0100..U+017F, '?' marks the special cases below
+  static constexpr std::string_view latin1 =
+      "aaaaaa?ceeeeiiiidnooooo?ouuuuy??aaaaaa?ceeeeiiiidnooooo?ouuuuy?y";
+  static constexpr std::string_view latin_ext_a =
+      "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii??jjkkkllllllllllnnnnnnnnnoooooo??rrrrrr"
+      "ssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+  std::string res{};
+  res.reserve(text.size());
+  bool pending_space = false;
+  std::size_t i      = 0;
+  while (i < text.size()) {
+    const auto c = static_cast<unsigned char>(text[i]);
+    // Decode one UTF-8 sequence, invalid bytes are kept as they are
+    std::size_t len = 1;
+    char32_t cp     = c;
+    if (c >= 0xC0 and c < 0xE0 and i + 1 < text.size()) {
+      len = 2;
+      cp  = static_cast<char32_t>(
+          ((c & 0x1Fu) << 6) | (static_cast<unsigned char>(text[i + 1]) & 0x3Fu)
+      );
+    } else if (c >= 0xE0 and c < 0xF0 and i + 2 < text.size()) {
+      len = 3;
+      cp  = static_cast<char32_t>(
+          ((c & 0x0Fu) << 12) | ((static_cast<unsigned char>(text[i + 1]) & 0x3Fu) << 6) |
+          (static_cast<unsigned char>(text[i + 2]) & 0x3Fu)
+      );
+    } else if (c >= 0xF0 and i + 3 < text.size()) {
+      len = 4;
+      cp  = 0x10000;  // Outside of the ranges folded below
+    }
+
+    std::string_view folded{};
+    char base = 0;
+    if (cp < 0x80) {
+      if (std::isalnum(c)) {
+        base = static_cast<char>(std::tolower(c));
+      } else if (std::isspace(c)) {
+        pending_space = not res.empty();
+        i += len;
+        continue;
+      } else if (res.empty()) {
+        // Leading punctuation, e.g. "...And You Will Know Us by the Trail of Dead"
+        i += len;
+        continue;
+      } else {
+        base = static_cast<char>(c);
+      }
+    } else if (cp >= 0x300 and cp < 0x370) {
+      // Combining diacritical marks
+      i += len;
+      continue;
+    } else if (cp == 0xC6 or cp == 0xE6) {
+      folded = "ae";
+    } else if (cp == 0xDE or cp == 0xFE) {
+      folded = "th";
+    } else if (cp == 0xDF) {
+      folded = "ss";
+    } else if (cp == 0x132 or cp == 0x133) {
+      folded = "ij";
+    } else if (cp == 0x152 or cp == 0x153) {
+      folded = "oe";
+    } else if (cp >= 0xC0 and cp < 0x100 and latin1[cp - 0xC0] != '?') {
+      base = latin1[cp - 0xC0];
+    } else if (cp >= 0x100 and cp < 0x180) {
+      base = latin_ext_a[cp - 0x100];
+    } else {
+      folded = std::string_view{text}.substr(i, len);
+    }
+
+    if (pending_space)
+      res += ' ';
+    pending_space = false;
+    if (base != 0)
+      res += base;
+    else
+      res += folded;
+    i += len;
   }
+
+  if (res.starts_with("the ") and res.size() > 4)
+    res.erase(0, 4);
   return res;
 }
 
@@ -210,10 +457,25 @@ std::optional<Album> get_album(SQLite::Database &db, const int id) {
   };
 }
 
+std::optional<Track> get_track(SQLite::Database &db, const int id) {
+  SQLite::Statement stmt{db, R"--(
+    SELECT id, file_path, parent_dir_id, title, track_num, artist_id, album_id, duration
+    FROM t_tracks t
+    LEFT JOIN t_tracks_metadata tm ON t.id = tm.track_id
+    WHERE t.id = ?
+  )--"};
+  stmt.bind(1, id);
+  if (not stmt.executeStep()) {
+    return std::nullopt;
+  }
+  return Utils::read_track(stmt);
+}
+
 std::optional<TrackMetadata> get_track_metadata(SQLite::Database &db, const int id) {
   SQLite::Statement stmt{
       db,
-      "SELECT track_id, title, track_num, artist_id, album_id FROM t_tracks_metadata WHERE id = ?"
+      "SELECT track_id, title, track_num, artist_id, album_id, duration FROM t_tracks_metadata "
+      "WHERE track_id = ?"
   };
   stmt.bind(1, id);
   if (not stmt.executeStep()) {
@@ -223,7 +485,24 @@ std::optional<TrackMetadata> get_track_metadata(SQLite::Database &db, const int
       stmt.getColumn(0).getInt(), stmt.getColumn(1).getString(),
       stmt.isColumnNull(2) ? std::nullopt : std::optional<int>{stmt.getColumn(2).getInt()},
       stmt.isColumnNull(3) ? std::nullopt : std::optional<int>{stmt.getColumn(3).getInt()},
-      stmt.isColumnNull(4) ? std::nullopt : std::optional<int>{stmt.getColumn(4).getInt()}
+      stmt.isColumnNull(4) ? std::nullopt : std::optional<int>{stmt.getColumn(4).getInt()},
+      stmt.isColumnNull(5) ? std::nullopt : std::optional<int>{stmt.getColumn(5).getInt()}
+  };
+}
+
+std::optional<PlayStats> get_play_stats(SQLite::Database &db, const int track_id) {
+  SQLite::Statement stmt{db, R"--(
+    SELECT play_count, skip_count, last_played, resume_position
+    FROM t_play_stats WHERE track_id = ?
+  )--"};
+  stmt.bind(1, track_id);
+  if (not stmt.executeStep()) {
+    return std::nullopt;
+  }
+  return PlayStats{
+      track_id, stmt.getColumn(0).getInt(), stmt.getColumn(1).getInt(),
+      stmt.isColumnNull(2) ? std::nullopt : std::optional{stmt.getColumn(2).getInt64()},
+      stmt.getColumn(3).getInt()
   };
 }
 
@@ -310,8 +589,12 @@ std::optional<int> insert_artist(SQLite::Database &db, const std::string &name)
   if (id.has_value()) {
     return id;
   }
-  SQLite::Statement stmt{db, "INSERT OR IGNORE INTO t_artists (id, name) VALUES (NULL, ?)"};
+  const std::string sort_key = make_sort_key(name);
+  SQLite::Statement stmt{
+      db, "INSERT OR IGNORE INTO t_artists (id, name, sort_key) VALUES (NULL, ?, ?)"
+  };
   stmt.bindNoCopy(1, name);
+  stmt.bindNoCopy(2, sort_key.data(), static_cast<int>(sort_key.size()));
   stmt.exec();
   return get_artist_id(db, name);
 }
@@ -326,14 +609,16 @@ std::optional<int> insert_album(
   if (id.has_value()) {
     return id;
   }
+  const std::string sort_key = make_sort_key(name);
   SQLite::Statement stmt{
-      db, "INSERT OR IGNORE INTO t_albums (id, name, artist_id) VALUES (NULL, ?, ?)"
+      db, "INSERT OR IGNORE INTO t_albums (id, name, artist_id, sort_key) VALUES (NULL, ?, ?, ?)"
   };
   stmt.bindNoCopy(1, name);
   if (artist_id.has_value())
     stmt.bind(2, artist_id.value());
   else
     stmt.bind(2);
+  stmt.bindNoCopy(3, sort_key.data(), static_cast<int>(sort_key.size()));
   stmt.exec();
 
   return get_album_id(db, name, artist_id);
@@ -354,9 +639,10 @@ std::optional<int> insert_track(
   if (id.has_value()) {
     return id;
   }
-  SQLite::Statement stmt{
-      db, "INSERT OR IGNORE INTO t_tracks (id, file_path, parent_dir_id) VALUES (NULL, ?, ?)"
-  };
+  SQLite::Statement stmt{db, R"--(
+    INSERT OR IGNORE INTO t_tracks (id, file_path, parent_dir_id, added_at)
+    VALUES (NULL, ?, ?, strftime('%s', 'now'))
+  )--"};
   stmt.bindNoCopy(1, abs_path);
   stmt.bind(2, parent_dir_id.value());
   stmt.exec();
@@ -366,19 +652,27 @@ std::optional<int> insert_track(
   if (tm.has_value())
     Utils::insert_metadata(db, tm.value());
 
+  if (on_library_change)
+    on_library_change(trk_id.value(), LibraryChange::TrackInserted);
+
   return trk_id;
 }
 
 bool remove_track(SQLite::Database &db, const int track_id) {
   SQLite::Statement del_metadata_stmt{db, "DELETE FROM t_tracks_metadata WHERE track_id = ?"};
+  SQLite::Statement del_play_stats_stmt{db, "DELETE FROM t_play_stats WHERE track_id = ?"};
   SQLite::Statement stmt{db, "DELETE FROM t_tracks WHERE id = ?"};
 
   del_metadata_stmt.bind(1, track_id);
+  del_play_stats_stmt.bind(1, track_id);
   stmt.bind(1, track_id);
 
   del_metadata_stmt.exec();
+  del_play_stats_stmt.exec();
   stmt.exec();
 
+  if (on_library_change)
+    on_library_change(track_id, LibraryChange::TrackRemoved);
   return true;
 }
 
@@ -408,6 +702,10 @@ bool remove_music_dir(SQLite::Database &db, const std::string &path) {
     return false;
   }
 
+  // Reported once they're gone, so that a query run from the callback doesn't see them
+  const std::vector<int> removed_track_ids =
+      on_library_change ? get_ids_of_tracks_of_music_dir(db, dir_id.value()) : std::vector<int>{};
+
   SQLite::Statement del_tracks_metadata_stmt = {db, R"--(
     DELETE FROM t_tracks_metadata
     WHERE track_id in (
@@ -418,6 +716,14 @@ bool remove_music_dir(SQLite::Database &db, const std::string &path) {
   )--"};
   del_tracks_metadata_stmt.bind(1, dir_id.value());
 
+  SQLite::Statement del_play_stats_stmt = {db, R"--(
+    DELETE FROM t_play_stats
+    WHERE track_id IN (
+      SELECT t_tracks.id FROM t_tracks
+      WHERE t_tracks.parent_dir_id = ?)
+  )--"};
+  del_play_stats_stmt.bind(1, dir_id.value());
+
   SQLite::Statement del_tracks_stmt = {db, R"--(
     DELETE FROM t_tracks
     WHERE t_tracks.id IN (
@@ -431,8 +737,12 @@ bool remove_music_dir(SQLite::Database &db, const std::string &path) {
   stmt.bind(1, dir_id.value());
 
   del_tracks_metadata_stmt.exec();
+  del_play_stats_stmt.exec();
   del_tracks_stmt.exec();
   stmt.exec();
+
+  for (const int track_id : removed_track_ids)
+    on_library_change(track_id, LibraryChange::TrackRemoved);
   return true;
 }
 
@@ -488,6 +798,10 @@ static std::optional<TrackMetadata> Utils::load_metadata(
   if (trk_num.value() == 0)
     trk_num = std::nullopt;
 
+  std::optional<int> duration = std::nullopt;
+  if (fref.audioProperties() != nullptr)
+    duration = fref.audioProperties()->lengthInSeconds();
+
   std::optional<int> artist_id = std::nullopt;
   if (not fref.tag()->artist().isEmpty()) {
     const std::string artist = fref.tag()->artist().to8Bit(true);
@@ -511,7 +825,7 @@ static std::optional<TrackMetadata> Utils::load_metadata(
       }
     }
   }
-  return TrackMetadata(track_id, title, trk_num, artist_id, album_id);
+  return TrackMetadata(track_id, title, trk_num, artist_id, album_id, duration);
 }
 
 static std::optional<TagLib::ByteVector> Utils::get_flac_album_art(const std::string &filename) {
@@ -550,8 +864,9 @@ static std::optional<TagLib::ByteVector> Utils::get_album_art(const std::string
 
 static std::optional<int> Utils::insert_metadata(SQLite::Database &db, const TrackMetadata &tm) {
   SQLite::Statement stmt{db, R"--(
-      INSERT OR REPLACE INTO t_tracks_metadata (track_id, title, track_num, artist_id, album_id)
-      VALUES (?, ?, ?, ?, ?);
+      INSERT OR REPLACE INTO t_tracks_metadata
+        (track_id, title, track_num, artist_id, album_id, duration, title_sort_key)
+      VALUES (?, ?, ?, ?, ?, ?, ?);
   )--"};
   stmt.bind(1, tm.track_id);
   if (tm.title.empty())
@@ -574,9 +889,73 @@ static std::optional<int> Utils::insert_metadata(SQLite::Database &db, const Tra
   else
     stmt.bind(5);
 
+  if (tm.duration.has_value())
+    stmt.bind(6, tm.duration.value());
+  else
+    stmt.bind(6);
+
+  const std::string title_sort_key = make_sort_key(tm.title);
+  stmt.bindNoCopy(7, title_sort_key.data(), static_cast<int>(title_sort_key.size()));
+
   stmt.exec();
 
   return tm.track_id;
 }
 
+static void Utils::add_column_if_missing(
+    SQLite::Database &db, const std::string &table, const std::string &column,
+    const std::string &definition
+) {
+  SQLite::Statement stmt{db, std::format("PRAGMA table_info({})", table)};
+  while (stmt.executeStep()) {
+    if (stmt.getColumn(1).getString() == column)
+      return;
+  }
+  db.exec(std::format("ALTER TABLE {} ADD COLUMN {} {}", table, column, definition));
+}
+
+static void Utils::fill_missing_sort_keys(
+    SQLite::Database &db, const std::string &table, const std::string &id_column,
+    const std::string &text_column, const std::string &key_column
+) {
+  SQLite::Statement select{
+      db, std::format(
+              "SELECT {}, {} FROM {} WHERE {} IS NULL", id_column, text_column, table, key_column
+          )
+  };
+  SQLite::Statement update{
+      db, std::format("UPDATE {} SET {} = ? WHERE {} = ?", table, key_column, id_column)
+  };
+  SQLite::Transaction transaction{db};
+  while (select.executeStep()) {
+    const std::string sort_key = make_sort_key(select.getColumn(1).getString());
+    update.bindNoCopy(1, sort_key.data(), static_cast<int>(sort_key.size()));
+    update.bind(2, select.getColumn(0).getInt());
+    update.exec();
+    update.reset();
+  }
+  transaction.commit();
+}
+
+static Track Utils::read_track(SQLite::Statement &stmt) {
+  const int id = stmt.getColumn(0);
+  const std::string file_path{stmt.getColumn(1).getString()};
+  const int parent_dir_id = stmt.getColumn(2);
+  Track res{id, file_path, parent_dir_id};
+  // Get metadata
+  auto title = stmt.getColumn(3).getString();
+  auto track_num =
+      stmt.isColumnNull(4) ? std::nullopt : std::optional<int>(stmt.getColumn(4).getInt());
+  auto artist_id =
+      stmt.isColumnNull(5) ? std::nullopt : std::optional<int>(stmt.getColumn(5).getInt());
+  auto album_id =
+      stmt.isColumnNull(6) ? std::nullopt : std::optional<int>(stmt.getColumn(6).getInt());
+  auto duration =
+      stmt.isColumnNull(7) ? std::nullopt : std::optional<int>(stmt.getColumn(7).getInt());
+
+  res.update_metadata(TrackMetadata{id, std::move(title), track_num, artist_id, album_id, duration}
+  );
+  return res;
+}
+
 }  // namespace Midx
@@ -3,6 +3,7 @@
 #include <optional>
 #include <vector>
 #include <cstdlib>
+#include <functional>
 
 #include <SQLiteCpp/SQLiteCpp.h>
 
@@ -25,6 +26,20 @@ namespace Midx {
 */
 inline std::string data_dir;
 
+/**
+  Kind of change reported through Midx::on_library_change.
+*/
+enum class LibraryChange { TrackInserted, TrackRemoved };
+
+/**
+  Called whenever a track is added to or removed from the database, so that derived
+  data (e.g. smart playlists) can be updated incrementally instead of being rebuilt.
+  Empty by default.
+
+  @note When a track is removed, the callback runs after its rows are deleted.
+*/
+inline std::function<void(const int track_id, const LibraryChange change)> on_library_change;
+
 /**
  * Initialise database and tables, this function also enables foreign keys check so it is
  * preferred to call it before any operations are done.
@@ -36,6 +51,33 @@ std::vector<Artist> get_all_artists(SQLite::Database &db);
 std::vector<Album> get_all_albums(SQLite::Database &db);
 std::vector<Track> get_all_tracks(SQLite::Database &db);
 
+/**
+  Sorted listings, one page at a time.
+
+  Items are ordered by a binary sort key (see Midx::make_sort_key()) stored in an
+  indexed column, so each page is an index range scan starting after `after`.
+  Pass `std::nullopt` to get the first page and `Page::next` to get the following ones.
+  Tracks without metadata are not listed by get_tracks_page(), which sorts by title.
+*/
+Page<Artist> get_artists_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+);
+Page<Album> get_albums_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+);
+Page<Track> get_tracks_page(
+    SQLite::Database &db, const std::optional<PageCursor> &after, const int limit
+);
+
+/**
+  Binary key used to sort artists, albums and titles for display.
+
+  It is case and accent insensitive for latin scripts (e.g. "Björk" and "bjork" have the same key),
+  ignores leading punctuation and a leading "The " ("The Beatles" sorts as "beatles"),
+  and collapses whitespace. Keys compare with memcmp(), i.e. like BLOBs in SQLite.
+*/
+std::string make_sort_key(const std::string &text);
+
 std::optional<Artist> get_artist(SQLite::Database &db, const int id);
 std::optional<Album> get_album(SQLite::Database &db, const int id);
 std::optional<Track> get_track(SQLite::Database &db, const int id);
@@ -59,6 +101,12 @@ std::optional<int> insert_album(SQLite::Database &db, const std::string &name,
 std::optional<int> insert_track(SQLite::Database &db, const std::string &file_path,
                                 const std::optional<int> parent_dir_id);
 
+/**
+ * Get the play count, skip count... of a track (a primary key lookup).
+ * These are only updated when a PlayHistory is compacted, see history.hpp.
+ */
+std::optional<PlayStats> get_play_stats(SQLite::Database &db, const int track_id);
+
 /**
   Delete a track (and its metadata) from the database.
 */
@@ -4,6 +4,7 @@
 namespace py = pybind11;
 
 #include "./midx.hpp"
+#include "./query.hpp"
 
 PYBIND11_MODULE(midx, handle) {
   handle.doc() =
@@ -50,14 +51,16 @@ PYBIND11_MODULE(midx, handle) {
       handle, "TrackMetadata",
       "Represents a track's metadata, it's supposed to be a read only data structure.")
       .def(py::init<const int, const std::string &, const std::optional<int>,
-                    const std::optional<int>, const std::optional<int>>(),
+                    const std::optional<int>, const std::optional<int>, const std::optional<int>>(),
            py::arg("track_id_"), py::arg("title_"), py::arg("track_number_") = py::none(),
-           py::arg("artist_id_") = py::none(), py::arg("album_id_") = py::none())
+           py::arg("artist_id_") = py::none(), py::arg("album_id_") = py::none(),
+           py::arg("duration_") = py::none())
       .def_readonly("track_id", &Midx::TrackMetadata::track_id)
       .def_readonly("title", &Midx::TrackMetadata::title)
       .def_readonly("track_number", &Midx::TrackMetadata::track_number)
       .def_readonly("artist_id", &Midx::TrackMetadata::artist_id)
       .def_readonly("album_id", &Midx::TrackMetadata::album_id)
+      .def_readonly("duration", &Midx::TrackMetadata::duration)
       .def("__str__", [&](Midx::TrackMetadata &tm) {
         return "TrackMetadata(track_id=" + std::to_string(tm.track_id) +
                ", album_id=" + (tm.album_id ? std::to_string(*tm.album_id) : "None") +
@@ -80,6 +83,25 @@ PYBIND11_MODULE(midx, handle) {
                ", track_metadata?=" + (t.get_metadata() ? "True" : "None") + ")";
       });
 
+  py::class_<Midx::PlayStats>(handle, "PlayStats", "Aggregated playback history of a track.")
+      .def(py::init<const int, const int, const int, const std::optional<std::int64_t>,
+                    const int>(),
+           py::arg("track_id_"), py::arg("play_count_") = 0, py::arg("skip_count_") = 0,
+           py::arg("last_played_") = py::none(), py::arg("resume_position_") = 0)
+      .def_readonly("track_id", &Midx::PlayStats::track_id)
+      .def_readonly("play_count", &Midx::PlayStats::play_count)
+      .def_readonly("skip_count", &Midx::PlayStats::skip_count)
+      .def_readonly("last_played", &Midx::PlayStats::last_played)
+      .def_readonly("resume_position", &Midx::PlayStats::resume_position)
+      .def("skip_rate", &Midx::PlayStats::skip_rate)
+      .def("__str__", [&](Midx::PlayStats &ps) {
+        return "PlayStats(track_id=" + std::to_string(ps.track_id) +
+               ", play_count=" + std::to_string(ps.play_count) +
+               ", skip_count=" + std::to_string(ps.skip_count) + ", last_played=" +
+               (ps.last_played ? std::to_string(*ps.last_played) : "None") +
+               ", resume_position=" + std::to_string(ps.resume_position) + ")";
+      });
+
   handle.def(
       "init_database", &Midx::init_database,
       "Initialise the database and tables, this function also enables foreign keys checks so it is "
@@ -90,10 +112,49 @@ PYBIND11_MODULE(midx, handle) {
   handle.def("get_all_albums", &Midx::get_all_albums);
   handle.def("get_all_tracks", &Midx::get_all_tracks);
 
+  py::class_<Midx::PageCursor>(handle, "PageCursor")
+      .def(py::init<const std::string &, const int>())
+      .def_readonly("sort_key", &Midx::PageCursor::sort_key)
+      .def_readonly("id", &Midx::PageCursor::id);
+
+  handle.def(
+      "get_artists_page",
+      [](SQLite::Database &db, const std::optional<Midx::PageCursor> &after, const int limit) {
+        auto page = Midx::get_artists_page(db, after, limit);
+        return std::make_pair(std::move(page.items), std::move(page.next));
+      },
+      "Get a page of artists sorted by name, returns the artists and the cursor of the next page.",
+      py::arg("db"), py::arg("after") = py::none(), py::arg("limit") = 100
+  );
+  handle.def(
+      "get_albums_page",
+      [](SQLite::Database &db, const std::optional<Midx::PageCursor> &after, const int limit) {
+        auto page = Midx::get_albums_page(db, after, limit);
+        return std::make_pair(std::move(page.items), std::move(page.next));
+      },
+      "Get a page of albums sorted by name, returns the albums and the cursor of the next page.",
+      py::arg("db"), py::arg("after") = py::none(), py::arg("limit") = 100
+  );
+  handle.def(
+      "get_tracks_page",
+      [](SQLite::Database &db, const std::optional<Midx::PageCursor> &after, const int limit) {
+        auto page = Midx::get_tracks_page(db, after, limit);
+        return std::make_pair(std::move(page.items), std::move(page.next));
+      },
+      "Get a page of tracks sorted by title, returns the tracks and the cursor of the next page.",
+      py::arg("db"), py::arg("after") = py::none(), py::arg("limit") = 100
+  );
+  handle.def("make_sort_key", [](const std::string &text) {
+    return py::bytes(Midx::make_sort_key(text));
+  });
+
   handle.def("get_artist", &Midx::get_artist);
   handle.def("get_album", &Midx::get_album);
   handle.def("get_track_metadata", &Midx::get_track_metadata);
 
+  handle.def("get_play_stats", &Midx::get_play_stats,
+             "Get the play count, skip count... of a track.");
+
   handle.def("is_valid_music_dir_id", &Midx::is_valid_music_dir_id);
   handle.def("is_valid_artist_id", &Midx::is_valid_artist_id);
   handle.def("is_valid_album_id", &Midx::is_valid_album_id);
@@ -123,4 +184,8 @@ PYBIND11_MODULE(midx, handle) {
   handle.def(
       "build_music_library", &Midx::build_music_library,
       "Scan all directories present in the database and add all the existing tracks, artists...");
+
+  handle.def("query_tracks", &Midx::query_tracks,
+             "Get the ids of the tracks matching a query (e.g. 'artist = \"Can\" sort by album, "
+             "track'), None if the query is malformed.");
 }
@@ -0,0 +1,980 @@
+#include "./query.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <format>
+#include <functional>
+
+#include <spdlog/spdlog.h>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace Midx {
+
+namespace {
+
+using SortValue = std::variant<std::monostate, std::int64_t, std::string>;
+using Mask      = std::vector<std::uint8_t>;
+
+struct Token {
+  enum class Kind { Word, Number, String, Symbol, End };
+
+  Kind kind;
+  std::string text;
+};
+
+/**
+ * Recursive descent parser for the grammar documented in query.hpp.
+ */
+class Parser {
+ public:
+  explicit Parser(const std::string &text) : m_text{text} {}
+
+  std::optional<Query> parse();
+
+ private:
+  bool tokenize();
+  const Token &peek() const { return m_tokens[m_pos]; }
+  const Token &next() { return m_tokens[m_pos == m_tokens.size() - 1 ? m_pos : m_pos++]; }
+  bool accept_word(const std::string_view word);
+  bool accept_symbol(const std::string_view symbol);
+  std::optional<Expr> parse_or();
+  std::optional<Expr> parse_and();
+  std::optional<Expr> parse_unary();
+  std::optional<Expr> parse_condition();
+  std::optional<Value> parse_value();
+  std::optional<Field> parse_field();
+  bool fail(const std::string &reason);
+
+ private:
+  const std::string &m_text;
+  std::vector<Token> m_tokens;
+  std::size_t m_pos = 0;
+};
+
+}  // namespace
+
+// Static helper functions
+namespace Utils {
+
+static bool is_text_field(const Field field);
+
+static std::string to_lower(std::string_view s);
+
+static std::string value_to_string(const Value &v);
+
+/**
+ * SQL expression of a field in the statements built by compile_query().
+ */
+static std::string_view sql_column(const Field field);
+
+/**
+ * Same as sql_column(), but text fields are sorted by their indexed sort keys.
+ */
+static std::string_view sql_sort_column(const Field field);
+
+static std::string_view sql_operator(const CompareOp op);
+
+static void compile_expr(const Expr &e, std::string &sql, std::vector<Value> &params);
+
+static CompiledQuery compile(const Query &query, const bool single_track);
+
+/**
+ * Order rows like SQLite does: NULLs first, then integers, then text compared bytewise.
+ */
+static bool rows_less(
+    const std::vector<SortKey> &sort, const std::vector<SortValue> &a, const int a_id,
+    const std::vector<SortValue> &b, const int b_id
+);
+
+static Mask eval_expr(const Catalog &catalog, const Expr &e);
+
+static Mask eval_condition(const Catalog &catalog, const Condition &cond);
+
+/**
+ * OR the result of an integer condition over a whole column into `mask`.
+ */
+template <class T>
+static void scan_column(const std::vector<T> &column, const Condition &cond, Mask &mask);
+
+static SortValue catalog_sort_value(const Catalog &catalog, const std::size_t row, const Field f);
+
+}  // namespace Utils
+
+std::optional<Query> parse_query(const std::string &text) {
+  return Parser{text}.parse();
+}
+
+CompiledQuery compile_query(const Query &query) {
+  return Utils::compile(query, false);
+}
+
+bool is_index_assisted(const Query &query) {
+  if (not query.filter.has_value())
+    return false;
+
+  const auto is_indexed = [](const Expr &e) {
+    if (e.kind != Expr::Kind::Condition)
+      return false;
+    const Condition &c = e.condition;
+    switch (c.field) {
+      case Field::Id:
+      case Field::Duration:
+      case Field::LastPlayed:
+      case Field::Added: return c.op != CompareOp::Ne;
+      case Field::Artist:
+      case Field::Album: return c.op == CompareOp::Eq or c.op == CompareOp::In;
+      default: return false;
+    }
+  };
+  // Only conditions that every result has to satisfy can narrow the scan.
+  const Expr &root = query.filter.value();
+  if (root.kind == Expr::Kind::And)
+    return std::ranges::any_of(root.children, is_indexed);
+  return is_indexed(root);
+}
+
+Catalog load_catalog(SQLite::Database &db) {
+  Catalog res{};
+  SQLite::Statement stmt{db, R"--(
+    SELECT id, track_num, artist_id, album_id, duration, title,
+           coalesce(play_count, 0), coalesce(skip_count, 0), last_played, added_at,
+           title_sort_key
+    FROM t_tracks t
+    LEFT JOIN t_tracks_metadata tm ON t.id = tm.track_id
+    LEFT JOIN t_play_stats ps ON t.id = ps.track_id
+  )--"};
+  const auto get_int = [&](const int col) {
+    return stmt.isColumnNull(col) ? Catalog::null_value : stmt.getColumn(col).getInt();
+  };
+  const auto get_time = [&](const int col) {
+    return stmt.isColumnNull(col) ? Catalog::null_time : stmt.getColumn(col).getInt64();
+  };
+  while (stmt.executeStep()) {
+    res.track_ids.push_back(stmt.getColumn(0).getInt());
+    res.track_numbers.push_back(get_int(1));
+    res.artist_ids.push_back(get_int(2));
+    res.album_ids.push_back(get_int(3));
+    res.durations.push_back(get_int(4));
+    res.titles.push_back(
+        stmt.isColumnNull(5) ? std::nullopt : std::optional{stmt.getColumn(5).getString()}
+    );
+    res.play_counts.push_back(get_int(6));
+    res.skip_counts.push_back(get_int(7));
+    res.last_played.push_back(get_time(8));
+    res.added.push_back(get_time(9));
+    res.title_sort_keys.push_back(
+        stmt.isColumnNull(10) ? std::nullopt : std::optional{stmt.getColumn(10).getString()}
+    );
+  }
+
+  SQLite::Statement artists{db, "SELECT id, name, sort_key FROM t_artists"};
+  while (artists.executeStep()) {
+    res.artist_names.emplace(artists.getColumn(0).getInt(), artists.getColumn(1).getString());
+    res.artist_sort_keys.emplace(artists.getColumn(0).getInt(), artists.getColumn(2).getString());
+  }
+  SQLite::Statement albums{db, "SELECT id, name, sort_key FROM t_albums"};
+  while (albums.executeStep()) {
+    res.album_names.emplace(albums.getColumn(0).getInt(), albums.getColumn(1).getString());
+    res.album_sort_keys.emplace(albums.getColumn(0).getInt(), albums.getColumn(2).getString());
+  }
+  return res;
+}
+
+std::vector<int> evaluate_query(const Catalog &catalog, const Query &query) {
+  const std::size_t n = catalog.track_ids.size();
+  const Mask mask =
+      query.filter.has_value() ? Utils::eval_expr(catalog, query.filter.value()) : Mask(n, 1);
+
+  std::vector<std::size_t> rows{};
+  for (std::size_t i = 0; i < n; ++i) {
+    if (mask[i])
+      rows.push_back(i);
+  }
+
+  std::vector<std::vector<SortValue>> keys(n);
+  for (const std::size_t row : rows) {
+    for (const auto &key : query.sort)
+      keys[row].push_back(Utils::catalog_sort_value(catalog, row, key.field));
+  }
+  std::ranges::sort(rows, [&](const std::size_t a, const std::size_t b) {
+    return Utils::rows_less(
+        query.sort, keys[a], catalog.track_ids[a], keys[b], catalog.track_ids[b]
+    );
+  });
+  if (query.limit.has_value() and rows.size() > static_cast<std::size_t>(query.limit.value()))
+    rows.resize(static_cast<std::size_t>(query.limit.value()));
+
+  std::vector<int> res{};
+  res.reserve(rows.size());
+  for (const std::size_t row : rows)
+    res.push_back(catalog.track_ids[row]);
+  return res;
+}
+
+std::vector<int> run_query(SQLite::Database &db, const Query &query, const Catalog *catalog) {
+  if (catalog != nullptr and not is_index_assisted(query))
+    return evaluate_query(*catalog, query);
+
+  const CompiledQuery compiled = compile_query(query);
+  SQLite::Statement stmt{db, compiled.sql};
+  for (std::size_t i = 0; i < compiled.params.size(); ++i) {
+    const int index = static_cast<int>(i) + 1;
+    std::visit([&](const auto &v) { stmt.bind(index, v); }, compiled.params[i]);
+  }
+  std::vector<int> res{};
+  while (stmt.executeStep())
+    res.push_back(stmt.getColumn(0).getInt());
+  return res;
+}
+
+std::optional<std::vector<int>> query_tracks(SQLite::Database &db, const std::string &text) {
+  const std::optional<Query> query = parse_query(text);
+  if (not query.has_value())
+    return std::nullopt;
+  return run_query(db, query.value());
+}
+
+/******************************************************************************/
+/**************************** --| SmartPlaylist |-- ***************************/
+/******************************************************************************/
+
+SmartPlaylist::SmartPlaylist(const Query &query_)
+    : query{query_},
+      m_compiled{Utils::compile(query_, false)},
+      m_compiled_single_track{Utils::compile(query_, true)} {}
+
+void SmartPlaylist::refresh(SQLite::Database &db) {
+  m_rows.clear();
+  m_track_ids.clear();
+  m_keys.clear();
+
+  SQLite::Statement stmt{db, m_compiled.sql};
+  for (std::size_t i = 0; i < m_compiled.params.size(); ++i) {
+    const int index = static_cast<int>(i) + 1;
+    std::visit([&](const auto &v) { stmt.bind(index, v); }, m_compiled.params[i]);
+  }
+  // The statement is already sorted
+  while (stmt.executeStep()) {
+    Row row = read_row(stmt);
+    m_track_ids.push_back(row.track_id);
+    m_keys.emplace(row.track_id, row.keys);
+    m_rows.push_back(std::move(row));
+  }
+}
+
+void SmartPlaylist::apply_change(
+    SQLite::Database &db, const int track_id, const LibraryChange change
+) {
+  const bool was_member = m_keys.contains(track_id);
+  if (change == LibraryChange::TrackRemoved) {
+    if (not was_member)
+      return;
+    // A track from beyond the limit has to take its place, the removed one is already
+    // gone from the database
+    if (query.limit.has_value()) {
+      refresh(db);
+      return;
+    }
+    erase_track(track_id);
+    return;
+  }
+
+  if (was_member)
+    erase_track(track_id);
+
+  SQLite::Statement stmt{db, m_compiled_single_track.sql};
+  for (std::size_t i = 0; i < m_compiled_single_track.params.size(); ++i) {
+    const int index = static_cast<int>(i) + 1;
+    std::visit([&](const auto &v) { stmt.bind(index, v); }, m_compiled_single_track.params[i]);
+  }
+  stmt.bind(static_cast<int>(m_compiled_single_track.params.size()) + 1, track_id);
+  if (stmt.executeStep())
+    insert_row(read_row(stmt));
+}
+
+bool SmartPlaylist::less(const Row &a, const Row &b) const {
+  return Utils::rows_less(query.sort, a.keys, a.track_id, b.keys, b.track_id);
+}
+
+SmartPlaylist::Row SmartPlaylist::read_row(SQLite::Statement &stmt) const {
+  Row row{{}, stmt.getColumn(0).getInt()};
+  for (int col = 1; col <= static_cast<int>(query.sort.size()); ++col) {
+    const SQLite::Column c = stmt.getColumn(col);
+    if (c.isNull())
+      row.keys.emplace_back(std::monostate{});
+    else if (c.isInteger())
+      row.keys.emplace_back(c.getInt64());
+    else
+      row.keys.emplace_back(c.getString());
+  }
+  return row;
+}
+
+void SmartPlaylist::insert_row(Row row) {
+  const auto it    = std::ranges::upper_bound(m_rows, row, [&](const Row &a, const Row &b) {
+    return less(a, b);
+  });
+  const auto index = it - m_rows.begin();
+  if (query.limit.has_value() and index >= query.limit.value())
+    return;
+
+  m_track_ids.insert(m_track_ids.begin() + index, row.track_id);
+  m_keys.emplace(row.track_id, row.keys);
+  m_rows.insert(it, std::move(row));
+
+  if (query.limit.has_value() and m_rows.size() > static_cast<std::size_t>(query.limit.value())) {
+    m_keys.erase(m_rows.back().track_id);
+    m_rows.pop_back();
+    m_track_ids.pop_back();
+  }
+}
+
+void SmartPlaylist::erase_track(const int track_id) {
+  const auto keys = m_keys.find(track_id);
+  if (keys == m_keys.end())
+    return;
+  const Row row{keys->second, track_id};
+  const auto it = std::ranges::lower_bound(m_rows, row, [&](const Row &a, const Row &b) {
+    return less(a, b);
+  });
+  m_track_ids.erase(m_track_ids.begin() + (it - m_rows.begin()));
+  m_rows.erase(it);
+  m_keys.erase(keys);
+}
+
+/******************************************************************************/
+/******************************* --| Parser |-- *******************************/
+/******************************************************************************/
+
+namespace {
+
+std::optional<Query> Parser::parse() {
+  if (not tokenize())
+    return std::nullopt;
+
+  Query query{};
+  if (peek().kind != Token::Kind::End and not (peek().kind == Token::Kind::Word and
+                                               (Utils::to_lower(peek().text) == "sort" or
+                                                Utils::to_lower(peek().text) == "limit"))) {
+    query.filter = parse_or();
+    if (not query.filter.has_value())
+      return std::nullopt;
+  }
+
+  if (accept_word("sort")) {
+    accept_word("by");
+    do {
+      const std::optional<Field> field = parse_field();
+      if (not field.has_value())
+        return std::nullopt;
+      bool descending = false;
+      if (accept_word("desc"))
+        descending = true;
+      else
+        accept_word("asc");
+      query.sort.push_back(SortKey{field.value(), descending});
+    } while (accept_symbol(","));
+  }
+
+  if (accept_word("limit")) {
+    const Token &tok = next();
+    int limit        = 0;
+    if (tok.kind != Token::Kind::Number or
+        std::from_chars(tok.text.data(), tok.text.data() + tok.text.size(), limit).ec !=
+            std::errc{}) {
+      fail("expected a number after 'limit'");
+      return std::nullopt;
+    }
+    query.limit = limit;
+  }
+
+  if (peek().kind != Token::Kind::End) {
+    fail(std::format("unexpected '{}'", peek().text));
+    return std::nullopt;
+  }
+  return query;
+}
+
+bool Parser::tokenize() {
+  std::size_t i = 0;
+  while (i < m_text.size()) {
+    const char c = m_text[i];
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      ++i;
+    } else if (std::isdigit(static_cast<unsigned char>(c))) {
+      const std::size_t begin = i;
+      while (i < m_text.size() and std::isdigit(static_cast<unsigned char>(m_text[i])))
+        ++i;
+      m_tokens.push_back(Token{Token::Kind::Number, m_text.substr(begin, i - begin)});
+    } else if (std::isalpha(static_cast<unsigned char>(c)) or c == '_') {
+      const std::size_t begin = i;
+      while (i < m_text.size() and
+             (std::isalnum(static_cast<unsigned char>(m_text[i])) or m_text[i] == '_'))
+        ++i;
+      m_tokens.push_back(Token{Token::Kind::Word, m_text.substr(begin, i - begin)});
+    } else if (c == '"' or c == '\'') {
+      std::string s{};
+      ++i;
+      while (i < m_text.size() and m_text[i] != c) {
+        if (m_text[i] == '\\' and i + 1 < m_text.size())
+          ++i;
+        s += m_text[i++];
+      }
+      if (i == m_text.size())
+        return fail("unterminated string");
+      ++i;
+      m_tokens.push_back(Token{Token::Kind::String, std::move(s)});
+    } else if ((c == '!' or c == '<' or c == '>' or c == '=') and i + 1 < m_text.size() and
+               m_text[i + 1] == '=') {
+      m_tokens.push_back(Token{Token::Kind::Symbol, m_text.substr(i, 2)});
+      i += 2;
+    } else if (c == '(' or c == ')' or c == ',' or c == '=' or c == '<' or c == '>') {
+      m_tokens.push_back(Token{Token::Kind::Symbol, std::string(1, c)});
+      ++i;
+    } else {
+      return fail(std::format("unexpected character '{}'", c));
+    }
+  }
+  m_tokens.push_back(Token{Token::Kind::End, "end of query"});
+  return true;
+}
+
+bool Parser::accept_word(const std::string_view word) {
+  if (peek().kind != Token::Kind::Word or Utils::to_lower(peek().text) != word)
+    return false;
+  next();
+  return true;
+}
+
+bool Parser::accept_symbol(const std::string_view symbol) {
+  if (peek().kind != Token::Kind::Symbol or peek().text != symbol)
+    return false;
+  next();
+  return true;
+}
+
+std::optional<Expr> Parser::parse_or() {
+  std::optional<Expr> lhs = parse_and();
+  if (not lhs.has_value() or not (peek().kind == Token::Kind::Word and
+                                  Utils::to_lower(peek().text) == "or"))
+    return lhs;
+
+  Expr res{Expr::Kind::Or, {}, {std::move(lhs.value())}};
+  while (accept_word("or")) {
+    std::optional<Expr> rhs = parse_and();
+    if (not rhs.has_value())
+      return std::nullopt;
+    res.children.push_back(std::move(rhs.value()));
+  }
+  return res;
+}
+
+std::optional<Expr> Parser::parse_and() {
+  std::optional<Expr> lhs = parse_unary();
+  if (not lhs.has_value())
+    return std::nullopt;
+
+  Expr res{Expr::Kind::And, {}, {std::move(lhs.value())}};
+  while (accept_word("and") or accept_symbol(",")) {
+    std::optional<Expr> rhs = parse_unary();
+    if (not rhs.has_value())
+      return std::nullopt;
+    res.children.push_back(std::move(rhs.value()));
+  }
+  if (res.children.size() == 1)
+    return std::move(res.children.front());
+  return res;
+}
+
+std::optional<Expr> Parser::parse_unary() {
+  if (accept_word("not")) {
+    std::optional<Expr> operand = parse_unary();
+    if (not operand.has_value())
+      return std::nullopt;
+    return Expr{Expr::Kind::Not, {}, {std::move(operand.value())}};
+  }
+  if (accept_symbol("(")) {
+    std::optional<Expr> inner = parse_or();
+    if (not inner.has_value())
+      return std::nullopt;
+    if (not accept_symbol(")")) {
+      fail("expected ')'");
+      return std::nullopt;
+    }
+    return inner;
+  }
+  return parse_condition();
+}
+
+std::optional<Expr> Parser::parse_condition() {
+  const std::optional<Field> field = parse_field();
+  if (not field.has_value())
+    return std::nullopt;
+
+  Condition cond{field.value(), CompareOp::Eq, {}};
+  const Token &tok = next();
+  if (tok.kind == Token::Kind::Word and Utils::to_lower(tok.text) == "in") {
+    cond.op = CompareOp::In;
+    if (not accept_symbol("(")) {
+      fail("expected '(' after 'in'");
+      return std::nullopt;
+    }
+    do {
+      std::optional<Value> v = parse_value();
+      if (not v.has_value())
+        return std::nullopt;
+      cond.values.push_back(std::move(v.value()));
+    } while (accept_symbol(","));
+    if (not accept_symbol(")")) {
+      fail("expected ')'");
+      return std::nullopt;
+    }
+  } else if (tok.kind == Token::Kind::Word and Utils::to_lower(tok.text) == "contains") {
+    cond.op = CompareOp::Contains;
+    if (not Utils::is_text_field(cond.field) or peek().kind != Token::Kind::String) {
+      fail("'contains' expects a text field and a string");
+      return std::nullopt;
+    }
+    cond.values.push_back(next().text);
+  } else if (tok.kind == Token::Kind::Symbol) {
+    if (tok.text == "=" or tok.text == "==")
+      cond.op = CompareOp::Eq;
+    else if (tok.text == "!=")
+      cond.op = CompareOp::Ne;
+    else if (tok.text == "<")
+      cond.op = CompareOp::Lt;
+    else if (tok.text == "<=")
+      cond.op = CompareOp::Le;
+    else if (tok.text == ">")
+      cond.op = CompareOp::Gt;
+    else if (tok.text == ">=")
+      cond.op = CompareOp::Ge;
+    else {
+      fail(std::format("expected an operator, got '{}'", tok.text));
+      return std::nullopt;
+    }
+    std::optional<Value> v = parse_value();
+    if (not v.has_value())
+      return std::nullopt;
+    cond.values.push_back(std::move(v.value()));
+  } else {
+    fail(std::format("expected an operator, got '{}'", tok.text));
+    return std::nullopt;
+  }
+
+  for (Value &v : cond.values) {
+    if (Utils::is_text_field(cond.field)) {
+      v = Utils::value_to_string(v);
+    } else if (std::holds_alternative<std::string>(v)) {
+      fail(std::format("expected a number, got \"{}\"", std::get<std::string>(v)));
+      return std::nullopt;
+    }
+  }
+  return Expr{Expr::Kind::Condition, std::move(cond), {}};
+}
+
+std::optional<Value> Parser::parse_value() {
+  const Token &tok = next();
+  if (tok.kind == Token::Kind::String)
+    return tok.text;
+  if (tok.kind != Token::Kind::Number) {
+    fail(std::format("expected a value, got '{}'", tok.text));
+    return std::nullopt;
+  }
+  std::int64_t v = 0;
+  if (std::from_chars(tok.text.data(), tok.text.data() + tok.text.size(), v).ec != std::errc{}) {
+    fail(std::format("number out of range: {}", tok.text));
+    return std::nullopt;
+  }
+  if (peek().kind != Token::Kind::Word)
+    return v;
+
+  const std::string unit = Utils::to_lower(peek().text);
+  if (unit == "s" or unit == "sec") {
+    next();
+  } else if (unit == "m" or unit == "min") {
+    next();
+    v *= 60;
+  } else if (unit == "h") {
+    next();
+    v *= 60 * 60;
+  } else if (unit == "d" or unit == "days") {
+    next();
+    v *= 24 * 60 * 60;
+  } else {
+    return v;
+  }
+  if (accept_word("ago")) {
+    const std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                                 std::chrono::system_clock::now().time_since_epoch()
+    )
+                                 .count();
+    v = now - v;
+  }
+  return v;
+}
+
+std::optional<Field> Parser::parse_field() {
+  const Token &tok = next();
+  const std::string name = Utils::to_lower(tok.text);
+  if (tok.kind == Token::Kind::Word) {
+    if (name == "id")
+      return Field::Id;
+    if (name == "title")
+      return Field::Title;
+    if (name == "artist")
+      return Field::Artist;
+    if (name == "album")
+      return Field::Album;
+    if (name == "track")
+      return Field::TrackNumber;
+    if (name == "duration")
+      return Field::Duration;
+    if (name == "plays")
+      return Field::PlayCount;
+    if (name == "skips")
+      return Field::SkipCount;
+    if (name == "last_played")
+      return Field::LastPlayed;
+    if (name == "added")
+      return Field::Added;
+  }
+  fail(std::format("unknown field '{}'", tok.text));
+  return std::nullopt;
+}
+
+bool Parser::fail(const std::string &reason) {
+  spdlog::error("Invalid query '{}': {}", m_text, reason);
+  return false;
+}
+
+}  // namespace
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static bool Utils::is_text_field(const Field field) {
+  return field == Field::Title or field == Field::Artist or field == Field::Album;
+}
+
+static std::string Utils::to_lower(std::string_view s) {
+  std::string res{s};
+  std::ranges::transform(res, res.begin(), [](const unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return res;
+}
+
+static std::string Utils::value_to_string(const Value &v) {
+  if (std::holds_alternative<std::string>(v))
+    return std::get<std::string>(v);
+  return std::to_string(std::get<std::int64_t>(v));
+}
+
+static std::string_view Utils::sql_column(const Field field) {
+  switch (field) {
+    case Field::Id: return "t.id";
+    case Field::Title: return "tm.title";
+    case Field::Artist: return "ar.name";
+    case Field::Album: return "al.name";
+    case Field::TrackNumber: return "tm.track_num";
+    case Field::Duration: return "tm.duration";
+    case Field::PlayCount: return "coalesce(ps.play_count, 0)";
+    case Field::SkipCount: return "coalesce(ps.skip_count, 0)";
+    case Field::LastPlayed: return "ps.last_played";
+    case Field::Added: return "t.added_at";
+  }
+  return "t.id";
+}
+
+static std::string_view Utils::sql_sort_column(const Field field) {
+  switch (field) {
+    case Field::Title: return "tm.title_sort_key";
+    case Field::Artist: return "ar.sort_key";
+    case Field::Album: return "al.sort_key";
+    default: return sql_column(field);
+  }
+}
+
+static std::string_view Utils::sql_operator(const CompareOp op) {
+  switch (op) {
+    case CompareOp::Eq: return "=";
+    case CompareOp::Ne: return "!=";
+    case CompareOp::Lt: return "<";
+    case CompareOp::Le: return "<=";
+    case CompareOp::Gt: return ">";
+    case CompareOp::Ge: return ">=";
+    case CompareOp::In: return "IN";
+    case CompareOp::Contains: return "";
+  }
+  return "=";
+}
+
+static void Utils::compile_expr(const Expr &e, std::string &sql, std::vector<Value> &params) {
+  switch (e.kind) {
+    case Expr::Kind::And:
+    case Expr::Kind::Or: {
+      sql += '(';
+      for (std::size_t i = 0; i < e.children.size(); ++i) {
+        if (i != 0)
+          sql += e.kind == Expr::Kind::And ? " AND " : " OR ";
+        compile_expr(e.children[i], sql, params);
+      }
+      sql += ')';
+      return;
+    }
+    case Expr::Kind::Not: {
+      sql += "NOT ";
+      compile_expr(e.children.front(), sql, params);
+      return;
+    }
+    case Expr::Kind::Condition: break;
+  }
+
+  const Condition &c = e.condition;
+  // Artists and albums are matched by name through their unique indexes, then the
+  // metadata is filtered on the (indexed) id.
+  std::string_view column = sql_column(c.field);
+  std::string_view id_column{};
+  std::string_view table{};
+  if (c.field == Field::Artist) {
+    column    = "name";
+    id_column = "tm.artist_id";
+    table     = "t_artists";
+  } else if (c.field == Field::Album) {
+    column    = "name";
+    id_column = "tm.album_id";
+    table     = "t_albums";
+  }
+
+  std::string predicate{};
+  if (c.op == CompareOp::Contains) {
+    predicate = std::format("instr({}, ?) > 0", column);
+  } else if (c.op == CompareOp::In) {
+    predicate = std::format("{} IN (?", column);
+    for (std::size_t i = 1; i < c.values.size(); ++i)
+      predicate += ", ?";
+    predicate += ')';
+  } else {
+    predicate = std::format("{} {} ?", column, sql_operator(c.op));
+  }
+  params.insert(params.end(), c.values.begin(), c.values.end());
+
+  // A NULL fails the comparison rather than making it NULL, so that a NOT around it
+  // matches the rows without a value, as it does in evaluate_query().
+  if (table.empty())
+    sql += std::format("({} IS NOT NULL AND {})", column, predicate);
+  else
+    sql += std::format(
+        "({0} IS NOT NULL AND {0} IN (SELECT id FROM {1} WHERE {2}))", id_column, table, predicate
+    );
+}
+
+static CompiledQuery Utils::compile(const Query &query, const bool single_track) {
+  CompiledQuery res{};
+  res.sql = "SELECT t.id";
+  for (const auto &key : query.sort)
+    res.sql += std::format(", {}", sql_sort_column(key.field));
+  res.sql += R"--(
+    FROM t_tracks t
+    LEFT JOIN t_tracks_metadata tm ON t.id = tm.track_id
+    LEFT JOIN t_artists ar ON ar.id = tm.artist_id
+    LEFT JOIN t_albums al ON al.id = tm.album_id
+    LEFT JOIN t_play_stats ps ON ps.track_id = t.id
+  )--";
+
+  if (query.filter.has_value() or single_track) {
+    res.sql += "WHERE ";
+    if (query.filter.has_value())
+      compile_expr(query.filter.value(), res.sql, res.params);
+    if (query.filter.has_value() and single_track)
+      res.sql += " AND ";
+    // Bound by SmartPlaylist after the other parameters
+    if (single_track)
+      res.sql += "t.id = ?";
+  }
+
+  res.sql += " ORDER BY ";
+  for (const auto &key : query.sort)
+    res.sql +=
+        std::format("{} {}, ", sql_sort_column(key.field), key.descending ? "DESC" : "ASC");
+  res.sql += "t.id";
+
+  if (query.limit.has_value() and not single_track)
+    res.sql += std::format(" LIMIT {}", query.limit.value());
+  return res;
+}
+
+static bool Utils::rows_less(
+    const std::vector<SortKey> &sort, const std::vector<SortValue> &a, const int a_id,
+    const std::vector<SortValue> &b, const int b_id
+) {
+  // std::variant orders by alternative first: monostate (NULL) < integer < text,
+  // and std::string compares bytes as unsigned char, same as SQLite's BINARY collation.
+  for (std::size_t i = 0; i < sort.size(); ++i) {
+    if (a[i] == b[i])
+      continue;
+    return sort[i].descending ? b[i] < a[i] : a[i] < b[i];
+  }
+  return a_id < b_id;
+}
+
+static Mask Utils::eval_expr(const Catalog &catalog, const Expr &e) {
+  const std::size_t n = catalog.track_ids.size();
+  switch (e.kind) {
+    case Expr::Kind::Condition: return eval_condition(catalog, e.condition);
+    case Expr::Kind::Not: {
+      Mask res = eval_expr(catalog, e.children.front());
+      for (std::size_t i = 0; i < n; ++i)
+        res[i] ^= 1;
+      return res;
+    }
+    case Expr::Kind::And:
+    case Expr::Kind::Or: {
+      Mask res = eval_expr(catalog, e.children.front());
+      for (std::size_t c = 1; c < e.children.size(); ++c) {
+        const Mask other = eval_expr(catalog, e.children[c]);
+        if (e.kind == Expr::Kind::And) {
+          for (std::size_t i = 0; i < n; ++i)
+            res[i] &= other[i];
+        } else {
+          for (std::size_t i = 0; i < n; ++i)
+            res[i] |= other[i];
+        }
+      }
+      return res;
+    }
+  }
+  return Mask(n, 0);
+}
+
+static Mask Utils::eval_condition(const Catalog &catalog, const Condition &cond) {
+  const std::size_t n = catalog.track_ids.size();
+  Mask res(n, 0);
+
+  const auto text_matches = [&](const std::string &s) {
+    return std::ranges::any_of(cond.values, [&](const Value &v) {
+      const std::string &x = std::get<std::string>(v);
+      switch (cond.op) {
+        case CompareOp::Eq:
+        case CompareOp::In: return s == x;
+        case CompareOp::Ne: return s != x;
+        case CompareOp::Lt: return s < x;
+        case CompareOp::Le: return s <= x;
+        case CompareOp::Gt: return s > x;
+        case CompareOp::Ge: return s >= x;
+        case CompareOp::Contains: return s.find(x) != std::string::npos;
+      }
+      return false;
+    });
+  };
+
+  if (cond.field == Field::Title) {
+    for (std::size_t i = 0; i < n; ++i)
+      res[i] = catalog.titles[i].has_value() and text_matches(catalog.titles[i].value());
+    return res;
+  }
+
+  if (cond.field == Field::Artist or cond.field == Field::Album) {
+    // Match the (few) names once, then gather the result through the id column.
+    const auto &names = cond.field == Field::Artist ? catalog.artist_names : catalog.album_names;
+    const auto &ids   = cond.field == Field::Artist ? catalog.artist_ids : catalog.album_ids;
+    std::int32_t max_id = 0;
+    for (const auto &[id, _] : names)
+      max_id = std::max(max_id, id);
+    Mask matching(static_cast<std::size_t>(max_id) + 1, 0);
+    for (const auto &[id, name] : names)
+      matching[static_cast<std::size_t>(id)] = text_matches(name);
+    for (std::size_t i = 0; i < n; ++i) {
+      res[i] = ids[i] >= 0 and ids[i] <= max_id and matching[static_cast<std::size_t>(ids[i])];
+    }
+    return res;
+  }
+
+  switch (cond.field) {
+    case Field::TrackNumber: scan_column(catalog.track_numbers, cond, res); break;
+    case Field::Duration: scan_column(catalog.durations, cond, res); break;
+    case Field::PlayCount: scan_column(catalog.play_counts, cond, res); break;
+    case Field::SkipCount: scan_column(catalog.skip_counts, cond, res); break;
+    case Field::LastPlayed: scan_column(catalog.last_played, cond, res); break;
+    case Field::Added: scan_column(catalog.added, cond, res); break;
+    default: {
+      const std::vector<std::int32_t> ids(catalog.track_ids.begin(), catalog.track_ids.end());
+      scan_column(ids, cond, res);
+      break;
+    }
+  }
+  return res;
+}
+
+template <class T>
+static void Utils::scan_column(const std::vector<T> &column, const Condition &cond, Mask &mask) {
+  constexpr T null = std::numeric_limits<T>::min();
+  const std::size_t n = column.size();
+  const T *data       = column.data();
+  std::uint8_t *out   = mask.data();
+  for (const Value &v : cond.values) {
+    const auto x = static_cast<T>(std::clamp<std::int64_t>(
+        std::get<std::int64_t>(v), std::int64_t{null} + 1, std::numeric_limits<T>::max()
+    ));
+    // Branchless loops over contiguous ints, these get vectorised by the compiler.
+    const auto scan = [&](auto cmp) {
+      for (std::size_t i = 0; i < n; ++i)
+        out[i] |= static_cast<std::uint8_t>((data[i] != null) & cmp(data[i], x));
+    };
+    switch (cond.op) {
+      case CompareOp::Eq:
+      case CompareOp::In: scan(std::equal_to<>{}); break;
+      case CompareOp::Ne: scan(std::not_equal_to<>{}); break;
+      case CompareOp::Lt: scan(std::less<>{}); break;
+      case CompareOp::Le: scan(std::less_equal<>{}); break;
+      case CompareOp::Gt: scan(std::greater<>{}); break;
+      case CompareOp::Ge: scan(std::greater_equal<>{}); break;
+      case CompareOp::Contains: break;
+    }
+  }
+}
+
+static SortValue Utils::catalog_sort_value(
+    const Catalog &catalog, const std::size_t row, const Field f
+) {
+  const auto from_int = [](const std::int32_t v) -> SortValue {
+    if (v == Catalog::null_value)
+      return std::monostate{};
+    return std::int64_t{v};
+  };
+  const auto from_time = [](const std::int64_t v) -> SortValue {
+    if (v == Catalog::null_time)
+      return std::monostate{};
+    return v;
+  };
+  const auto from_key = [](const std::unordered_map<int, std::string> &keys,
+                           const std::int32_t id) -> SortValue {
+    const auto it = keys.find(id);
+    if (id == Catalog::null_value or it == keys.end())
+      return std::monostate{};
+    return it->second;
+  };
+  switch (f) {
+    case Field::Id: return std::int64_t{catalog.track_ids[row]};
+    case Field::Title:
+      if (catalog.title_sort_keys[row].has_value())
+        return catalog.title_sort_keys[row].value();
+      return std::monostate{};
+    case Field::Artist: return from_key(catalog.artist_sort_keys, catalog.artist_ids[row]);
+    case Field::Album: return from_key(catalog.album_sort_keys, catalog.album_ids[row]);
+    case Field::TrackNumber: return from_int(catalog.track_numbers[row]);
+    case Field::Duration: return from_int(catalog.durations[row]);
+    case Field::PlayCount: return from_int(catalog.play_counts[row]);
+    case Field::SkipCount: return from_int(catalog.skip_counts[row]);
+    case Field::LastPlayed: return from_time(catalog.last_played[row]);
+    case Field::Added: return from_time(catalog.added[row]);
+  }
+  return std::monostate{};
+}
+
+}  // namespace Midx
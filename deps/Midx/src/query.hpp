@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "./midx.hpp"
+
+namespace Midx {
+
+/**
+  Fields that can be used in filters and sort keys.
+
+  Filters and sort keys are written in a small language:
+  @code
+  query     := [filter] ["sort" ["by"] sort_key ("," sort_key)*] ["limit" integer]
+  filter    := and_expr ("or" and_expr)*
+  and_expr  := unary (("and" | ",") unary)*
+  unary     := "not" unary | "(" filter ")" | condition
+  condition := field ("=" | "!=" | "<" | "<=" | ">" | ">=") value
+             | field "in" "(" value ("," value)* ")"
+             | field "contains" string
+  value     := string | integer [unit ["ago"]]
+  unit      := "s" | "sec" | "m" | "min" | "h" | "d" | "days"
+  sort_key  := field ["asc" | "desc"]
+  field     := "id" | "title" | "artist" | "album" | "track" | "duration"
+             | "plays" | "skips" | "last_played" | "added"
+  @endcode
+  e.g. `artist in ("Can", "Neu!"), duration > 5 min sort by album, track`
+  or `not last_played > 30 days ago sort by plays desc`.
+
+  Strings are double (or single) quoted, units convert the integer to seconds, "ago"
+  converts it to a unix time relative to when the query is parsed and keywords are
+  case-insensitive. Text comparisons are bytewise and case-sensitive, but sorting by a
+  text field uses Midx::make_sort_key() ("The Beatles" sorts as "beatles").
+  `last_played` and `added` are unix times, `plays` and `skips` come from
+  Midx::get_play_stats() and are 0 for tracks that were never played.
+*/
+enum class Field {
+  Id,
+  Title,
+  Artist,
+  Album,
+  TrackNumber,
+  Duration,
+  PlayCount,
+  SkipCount,
+  LastPlayed,
+  Added
+};
+
+enum class CompareOp { Eq, Ne, Lt, Le, Gt, Ge, In, Contains };
+
+using Value = std::variant<std::int64_t, std::string>;
+
+struct Condition {
+  Field field;
+  CompareOp op;
+  std::vector<Value> values;
+};
+
+struct Expr {
+  enum class Kind { Condition, And, Or, Not };
+
+  Kind kind;
+  /**
+   * Only meaningful when `kind == Kind::Condition`.
+   */
+  Condition condition;
+  std::vector<Expr> children;
+};
+
+struct SortKey {
+  Field field;
+  bool descending = false;
+};
+
+struct Query {
+  std::optional<Expr> filter;
+  std::vector<SortKey> sort;
+  std::optional<int> limit;
+};
+
+/**
+ * A query translated to SQL, the statement selects the track id followed by
+ * one column per sort key.
+ */
+struct CompiledQuery {
+  std::string sql;
+  std::vector<Value> params;
+};
+
+/**
+  Column-oriented copy of the tracks' metadata.
+
+  It is used to evaluate filters that no index can help with (e.g. `title contains "live"`)
+  as tight loops over plain arrays instead of row by row in SQLite.
+  Missing integers are stored as `Catalog::null_value`.
+*/
+class Catalog {
+ public:
+  static constexpr std::int32_t null_value = std::numeric_limits<std::int32_t>::min();
+  static constexpr std::int64_t null_time  = std::numeric_limits<std::int64_t>::min();
+
+ public:
+  std::vector<int> track_ids;
+  std::vector<std::int32_t> track_numbers;
+  std::vector<std::int32_t> artist_ids;
+  std::vector<std::int32_t> album_ids;
+  std::vector<std::int32_t> durations;
+  std::vector<std::int32_t> play_counts;
+  std::vector<std::int32_t> skip_counts;
+  /**
+   * Missing times are stored as `Catalog::null_time`.
+   */
+  std::vector<std::int64_t> last_played;
+  std::vector<std::int64_t> added;
+  std::vector<std::optional<std::string>> titles;
+  std::vector<std::optional<std::string>> title_sort_keys;
+  std::unordered_map<int, std::string> artist_names;
+  std::unordered_map<int, std::string> artist_sort_keys;
+  std::unordered_map<int, std::string> album_names;
+  std::unordered_map<int, std::string> album_sort_keys;
+};
+
+/**
+ * Parse a query, returns std::nullopt (and logs the reason) if it's malformed.
+ */
+std::optional<Query> parse_query(const std::string &text);
+
+CompiledQuery compile_query(const Query &query);
+
+/**
+ * Whether one of the conditions that every result must satisfy can be answered
+ * from an index (artist, album, id, duration...).
+ */
+bool is_index_assisted(const Query &query);
+
+Catalog load_catalog(SQLite::Database &db);
+
+/**
+ * Evaluate a query over a catalog, the results are ordered exactly like `run_query()`'s.
+ */
+std::vector<int> evaluate_query(const Catalog &catalog, const Query &query);
+
+/**
+ * Get the ids of the tracks matching a query.
+ * The query runs in SQLite, unless a catalog is given and no index can help.
+ */
+std::vector<int> run_query(
+    SQLite::Database &db, const Query &query, const Catalog *catalog = nullptr
+);
+
+/**
+ * Parse and run a query.
+ */
+std::optional<std::vector<int>> query_tracks(SQLite::Database &db, const std::string &text);
+
+/**
+  The result of a query, kept up to date one track at a time.
+
+  Call `SmartPlaylist::apply_change()` from Midx::on_library_change so that
+  only the changed tracks are evaluated.
+*/
+class SmartPlaylist {
+ public:
+  explicit SmartPlaylist(const Query &query_);
+
+  /**
+   * Evaluate the whole query again.
+   */
+  void refresh(SQLite::Database &db);
+
+  void apply_change(SQLite::Database &db, const int track_id, const LibraryChange change);
+
+  const std::vector<int> &get_track_ids() const { return m_track_ids; }
+
+ public:
+  const Query query;
+
+ private:
+  using SortValue = std::variant<std::monostate, std::int64_t, std::string>;
+
+  struct Row {
+    std::vector<SortValue> keys;
+    int track_id;
+  };
+
+  bool less(const Row &a, const Row &b) const;
+  Row read_row(SQLite::Statement &stmt) const;
+  void insert_row(Row row);
+  void erase_track(const int track_id);
+
+ private:
+  const CompiledQuery m_compiled;
+  const CompiledQuery m_compiled_single_track;
+  std::vector<Row> m_rows;
+  std::vector<int> m_track_ids;
+  std::unordered_map<int, std::vector<SortValue>> m_keys;
+};
+
+}  // namespace Midx
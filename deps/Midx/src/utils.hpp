@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
 #include <string>
+#include <vector>
 #include <SQLiteCpp/SQLiteCpp.h>
 
 namespace Midx {
@@ -44,12 +46,14 @@ class TrackMetadata {
   explicit TrackMetadata(const int track_id_, const std::string &title_,
                          const std::optional<int> track_number_ = std::nullopt,
                          const std::optional<int> artist_id_    = std::nullopt,
-                         const std::optional<int> album_id_     = std::nullopt)
+                         const std::optional<int> album_id_     = std::nullopt,
+                         const std::optional<int> duration_     = std::nullopt)
       : track_id{track_id_},
         title{title_},
         track_number{track_number_},
         artist_id{artist_id_},
-        album_id{album_id_} {}
+        album_id{album_id_},
+        duration{duration_} {}
 
  public:
   /**
@@ -72,6 +76,10 @@ class TrackMetadata {
    * Track's album's id.
    */
   const std::optional<int> album_id;
+  /**
+   * Track's duration in seconds.
+   */
+  const std::optional<int> duration;
 };
 
 class Track {
@@ -96,4 +104,73 @@ class Track {
   std::optional<TrackMetadata> m_metadata = std::nullopt;
 };
 
+/**
+ * Position in a sorted listing, the next page starts right after the item
+ * with this sort key and id.
+ */
+class PageCursor {
+ public:
+  PageCursor(const std::string &sort_key_, const int id_) : sort_key{sort_key_}, id{id_} {}
+
+ public:
+  /**
+   * Binary sort key, see Midx::make_sort_key().
+   */
+  const std::string sort_key;
+  const int id;
+};
+
+/**
+ * A page of a sorted listing.
+ */
+template <class T>
+class Page {
+ public:
+  std::vector<T> items;
+  /**
+   * Cursor to get the following page, std::nullopt if this is the last one.
+   */
+  std::optional<PageCursor> next;
+};
+
+/**
+ * Aggregated playback history of a track.
+ */
+class PlayStats {
+ public:
+  PlayStats(
+      const int track_id_, const int play_count_ = 0, const int skip_count_ = 0,
+      const std::optional<std::int64_t> last_played_ = std::nullopt, const int resume_position_ = 0
+  )
+      : track_id{track_id_},
+        play_count{play_count_},
+        skip_count{skip_count_},
+        last_played{last_played_},
+        resume_position{resume_position_} {}
+
+  /**
+   * Fraction of the times the track was started that it got skipped.
+   */
+  double skip_rate() const {
+    const int total = play_count + skip_count;
+    return total == 0 ? 0.0 : static_cast<double>(skip_count) / total;
+  }
+
+ public:
+  const int track_id;
+  /**
+   * Number of times the track was played until the end.
+   */
+  const int play_count;
+  const int skip_count;
+  /**
+   * Unix time of the last time the track was played or skipped.
+   */
+  const std::optional<std::int64_t> last_played;
+  /**
+   * Position (in seconds) playback should resume from, 0 if it ended normally.
+   */
+  const int resume_position;
+};
+
 }  // namespace Midx
@@ -0,0 +1,232 @@
+#include "./decoder_pool.hpp"
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Have the calling thread only run when no other thread wants its core.
+ */
+static void lower_thread_priority();
+
+}  // namespace Utils
+
+void DecoderPool::Handle::cancel() {
+  if (m_state != nullptr)
+    m_state->stop.request_stop();
+}
+
+bool DecoderPool::Handle::is_done() const {
+  return m_state == nullptr or m_state->done.load(std::memory_order_acquire);
+}
+
+bool DecoderPool::Handle::is_cancelled() const {
+  return m_state != nullptr and m_state->stop.stop_requested();
+}
+
+void DecoderPool::Handle::wait() const {
+  if (m_state != nullptr)
+    m_state->done.wait(false, std::memory_order_acquire);
+}
+
+DecoderPool::DecoderPool(const DecoderPoolConfig &config_) : config{config_} {
+  const unsigned cores   = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned workers = config.workers != 0 ? config.workers : std::max(1u, cores - 1);
+  for (unsigned i = 0; i < workers; ++i)
+    m_group.workers.push_back(std::make_unique<Worker>());
+  for (unsigned i = 0; i < std::max(1u, config.background_workers); ++i)
+    m_background.workers.push_back(std::make_unique<Worker>());
+
+  // Only once all are made, they steal from each other
+  for (Group *group : {&m_group, &m_background})
+    for (const std::unique_ptr<Worker> &worker : group->workers)
+      worker->thread = std::jthread{[this, group, &self = *worker](std::stop_token stop) {
+        worker_loop(*group, self, stop);
+      }};
+}
+
+DecoderPool::~DecoderPool() {
+  for (Group *group : {&m_group, &m_background}) {
+    for (const std::unique_ptr<Worker> &worker : group->workers) {
+      worker->thread.request_stop();
+      std::lock_guard lock{worker->mutex};
+      if (worker->running != nullptr)
+        worker->running->stop.request_stop();
+      for (std::deque<Task> &queue : worker->queues) {
+        for (Task &task : queue) {
+          task.state->stop.request_stop();
+          finish(*task.state);
+        }
+        queue.clear();
+      }
+    }
+  }
+  for (Group *group : {&m_group, &m_background})
+    for (const std::unique_ptr<Worker> &worker : group->workers)
+      worker->thread.join();
+}
+
+DecoderPool::Handle DecoderPool::submit(const JobPriority priority, Job job) {
+  Handle handle{};
+  handle.m_state = std::make_shared<Handle::State>();
+  Group &group   = get_group(priority);
+  Worker &worker =
+      *group.workers[group.next.fetch_add(1, std::memory_order_relaxed) % group.workers.size()];
+  {
+    // Counted along with the push, so that a preemption never drops a job not counted yet
+    std::lock_guard group_lock{group.mutex};
+    std::lock_guard lock{worker.mutex};
+    worker.queues[static_cast<std::size_t>(priority)].push_back(
+        Task{priority, std::move(job), handle.m_state}
+    );
+    ++group.queued;
+  }
+  group.cv.notify_one();
+  return handle;
+}
+
+void DecoderPool::preempt_background(const std::chrono::milliseconds hold) {
+  const std::int64_t until = (std::chrono::steady_clock::now() + hold).time_since_epoch().count();
+  std::int64_t current     = m_hold_until.load(std::memory_order_relaxed);
+  while (current < until and
+         not m_hold_until.compare_exchange_weak(current, until, std::memory_order_relaxed)) {
+  }
+  m_preemptions.fetch_add(1, std::memory_order_relaxed);
+
+  std::lock_guard group_lock{m_background.mutex};
+  std::size_t dropped = 0;
+  for (const std::unique_ptr<Worker> &worker : m_background.workers) {
+    std::lock_guard lock{worker->mutex};
+    if (worker->running != nullptr)
+      worker->running->stop.request_stop();
+    for (std::deque<Task> &queue : worker->queues) {
+      for (Task &task : queue) {
+        task.state->stop.request_stop();
+        finish(*task.state);
+      }
+      dropped += queue.size();
+      queue.clear();
+    }
+  }
+  m_cancelled.fetch_add(dropped, std::memory_order_relaxed);
+  m_background.queued -= dropped;
+}
+
+DecoderPoolStats DecoderPool::get_stats() const {
+  DecoderPoolStats stats{};
+  for (std::size_t i = 0; i < stats.completed.size(); ++i)
+    stats.completed[i] = m_completed[i].load(std::memory_order_relaxed);
+  stats.cancelled   = m_cancelled.load(std::memory_order_relaxed);
+  stats.stolen      = m_stolen.load(std::memory_order_relaxed);
+  stats.preemptions = m_preemptions.load(std::memory_order_relaxed);
+  return stats;
+}
+
+DecoderPool::Group &DecoderPool::get_group(const JobPriority priority) {
+  return priority == JobPriority::Background ? m_background : m_group;
+}
+
+void DecoderPool::worker_loop(Group &group, Worker &self, std::stop_token stop) {
+  const bool background = &group == &m_background;
+  if (background)
+    Utils::lower_thread_priority();
+
+  while (true) {
+    {
+      std::unique_lock lock{group.mutex};
+      if (not group.cv.wait(lock, stop, [&] { return group.queued > 0; }))
+        return;
+      // Playback ran low not long ago
+      if (background) {
+        const std::chrono::steady_clock::time_point until{
+            std::chrono::steady_clock::duration{m_hold_until.load(std::memory_order_relaxed)}
+        };
+        group.cv.wait_until(lock, stop, until, [] { return false; });
+        if (stop.stop_requested())
+          return;
+      }
+    }
+
+    Task task{};
+    if (not take(group, self, task))
+      continue;
+    {
+      std::lock_guard lock{self.mutex};
+      self.running = task.state;
+    }
+    const std::stop_token token = task.state->stop.get_token();
+    if (not token.stop_requested())
+      task.job(token);
+    if (token.stop_requested())
+      m_cancelled.fetch_add(1, std::memory_order_relaxed);
+    else
+      m_completed[static_cast<std::size_t>(task.priority)].fetch_add(1, std::memory_order_relaxed);
+    {
+      std::lock_guard lock{self.mutex};
+      self.running = nullptr;
+    }
+    finish(*task.state);
+  }
+}
+
+bool DecoderPool::take(Group &group, Worker &self, Task &task) {
+  const auto pop = [&](Worker &worker, const std::size_t priority, const bool front) {
+    std::lock_guard lock{worker.mutex};
+    std::deque<Task> &queue = worker.queues[priority];
+    if (queue.empty())
+      return false;
+    if (front) {
+      task = std::move(queue.front());
+      queue.pop_front();
+    } else {
+      task = std::move(queue.back());
+      queue.pop_back();
+    }
+    return true;
+  };
+
+  for (std::size_t priority = 0; priority < self.queues.size(); ++priority) {
+    bool taken = pop(self, priority, true);
+    for (std::size_t i = 0; not taken and i < group.workers.size(); ++i) {
+      Worker &other = *group.workers[i];
+      if (&other != &self and pop(other, priority, false)) {
+        taken = true;
+        m_stolen.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (taken) {
+      std::lock_guard lock{group.mutex};
+      --group.queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DecoderPool::finish(Handle::State &state) {
+  state.done.store(true, std::memory_order_release);
+  state.done.notify_all();
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::lower_thread_priority() {
+#ifdef SCHED_IDLE
+  const sched_param param{};
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+    return;
+#endif
+  // On Linux, the nice value of the calling thread only
+  setpriority(PRIO_PROCESS, 0, 19);
+}
+
+}  // namespace Tmupp
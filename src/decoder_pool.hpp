@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace Tmupp {
+
+enum class JobPriority {
+  /**
+   * Decoding that playback is waiting on, e.g. what a seek needs.
+   */
+  Realtime,
+  /**
+   * Decoding for what's played soon, e.g. the next track.
+   */
+  Prefetch,
+  /**
+   * Analysis of the library (waveforms, loudness...), which may wait and be cancelled.
+   */
+  Background,
+};
+
+struct DecoderPoolConfig {
+  /**
+   * Workers for realtime and prefetch jobs, 0 for one less than the cores (at least 1).
+   */
+  unsigned workers = 0;
+  /**
+   * Workers for background jobs, which run at the lowest scheduling priority.
+   */
+  unsigned background_workers = 1;
+};
+
+struct DecoderPoolStats {
+  /**
+   * Jobs run until they returned, by priority.
+   */
+  std::array<std::uint64_t, 3> completed{};
+  /**
+   * Jobs cancelled before or while they ran.
+   */
+  std::uint64_t cancelled = 0;
+  /**
+   * Jobs a worker took from another's queue.
+   */
+  std::uint64_t stolen = 0;
+  /**
+   * Times playback needed the CPU back from background jobs.
+   */
+  std::uint64_t preemptions = 0;
+};
+
+/**
+  Worker threads running the jobs of the players and analyses that open their own
+  `ma_decoder`.
+
+  Each worker has a queue per priority, jobs are spread across them and taken from the
+  front of its own queues, highest priority first, and a worker whose queues are empty
+  steals from the back of the others'. Background jobs have workers of their own, running
+  at the OS's idle priority, so that they only ever get the CPU playback leaves: on a
+  2 cores machine, the audio callback and the player's decoder preempt them. Playback
+  running low besides calls `preempt_background()`, which cancels them.
+
+  A job is given a `std::stop_token` it should check between chunks of work, cancelling
+  it requests a stop if it's running and drops it otherwise.
+*/
+class DecoderPool {
+ public:
+  using Job = std::function<void(std::stop_token stop)>;
+
+  /**
+   * A submitted job.
+   */
+  class Handle {
+   public:
+    Handle() = default;
+
+    void cancel();
+    /**
+     * Whether it returned or was dropped, true for an empty handle.
+     */
+    bool is_done() const;
+    /**
+     * Whether it was cancelled, if it was running it may have finished its work anyway.
+     */
+    bool is_cancelled() const;
+    /**
+     * Block until it returned or was dropped.
+     */
+    void wait() const;
+
+   private:
+    friend class DecoderPool;
+    struct State {
+      std::stop_source stop;
+      std::atomic<bool> done{false};
+    };
+
+    std::shared_ptr<State> m_state;
+  };
+
+ public:
+  explicit DecoderPool(const DecoderPoolConfig &config_ = {});
+  DecoderPool(const DecoderPool &)            = delete;
+  DecoderPool &operator=(const DecoderPool &) = delete;
+  /**
+   * Cancel every job and join the workers.
+   */
+  ~DecoderPool();
+
+  Handle submit(const JobPriority priority, Job job);
+  /**
+   * Playback needs the CPU: cancel the background jobs, queued or running, and start none
+   * for `hold`.
+   */
+  void preempt_background(const std::chrono::milliseconds hold);
+  DecoderPoolStats get_stats() const;
+
+ public:
+  const DecoderPoolConfig config;
+
+ private:
+  struct Task {
+    JobPriority priority;
+    Job job;
+    std::shared_ptr<Handle::State> state;
+  };
+
+  struct Worker {
+    /**
+     * Guards the queues and `running`.
+     */
+    std::mutex mutex;
+    std::array<std::deque<Task>, 3> queues;
+    /**
+     * Job being run, to cancel it.
+     */
+    std::shared_ptr<Handle::State> running;
+    std::jthread thread;
+  };
+
+  /**
+   * Workers of either kind, sharing a way to wait for jobs.
+   */
+  struct Group {
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    /**
+     * Jobs in the queues of the group, guarded by `mutex` for waking the workers. It's
+     * held along with the worker's mutex, taken first, whenever jobs are queued or dropped.
+     */
+    std::size_t queued = 0;
+    /**
+     * Worker the next job is queued to.
+     */
+    std::atomic<std::size_t> next{0};
+  };
+
+  Group &get_group(const JobPriority priority);
+  void worker_loop(Group &group, Worker &self, std::stop_token stop);
+  /**
+   * Take the next job of `self`, or steal one, in order of priority.
+   */
+  bool take(Group &group, Worker &self, Task &task);
+  static void finish(Handle::State &state);
+
+ private:
+  Group m_group;
+  Group m_background;
+  /**
+   * No background job starts before, in steady clock ticks.
+   */
+  std::atomic<std::int64_t> m_hold_until{0};
+
+  std::array<std::atomic<std::uint64_t>, 3> m_completed{};
+  std::atomic<std::uint64_t> m_cancelled{0};
+  std::atomic<std::uint64_t> m_stolen{0};
+  std::atomic<std::uint64_t> m_preemptions{0};
+};
+
+}  // namespace Tmupp
@@ -0,0 +1,451 @@
+#include "./dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Tmupp {
+
+/**
+ * Filter states smaller than this are flushed to 0, denormals being very slow to compute.
+ */
+static constexpr float denormal_threshold = 1e-15f;
+
+// The few vector operations the EQ needs, on 4 lanes
+namespace Simd {
+
+#if defined(__SSE2__)
+using Vec = __m128;
+
+static inline Vec load(const float *p) { return _mm_load_ps(p); }
+static inline void store(float *p, const Vec v) { _mm_store_ps(p, v); }
+static inline Vec set1(const float x) { return _mm_set1_ps(x); }
+static inline Vec add(const Vec a, const Vec b) { return _mm_add_ps(a, b); }
+static inline Vec sub(const Vec a, const Vec b) { return _mm_sub_ps(a, b); }
+static inline Vec mul(const Vec a, const Vec b) { return _mm_mul_ps(a, b); }
+/**
+ * `a` in the first two lanes, `b` in the last two.
+ */
+static inline Vec set2(const float a, const float b) { return _mm_set_ps(b, b, a, a); }
+/**
+ * The first two lanes of `a`, then the first two lanes of `b`.
+ */
+static inline Vec low_halves(const Vec a, const Vec b) { return _mm_movelh_ps(a, b); }
+/**
+ * The last two lanes of `v`, then zeros.
+ */
+static inline Vec high_half(const Vec v) { return _mm_movehl_ps(_mm_setzero_ps(), v); }
+static inline Vec flush_denormals(const Vec v) {
+  const Vec magnitude = _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+  return _mm_and_ps(v, _mm_cmpge_ps(magnitude, _mm_set1_ps(denormal_threshold)));
+}
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+using Vec = float32x4_t;
+
+static inline Vec load(const float *p) { return vld1q_f32(p); }
+static inline void store(float *p, const Vec v) { vst1q_f32(p, v); }
+static inline Vec set1(const float x) { return vdupq_n_f32(x); }
+static inline Vec add(const Vec a, const Vec b) { return vaddq_f32(a, b); }
+static inline Vec sub(const Vec a, const Vec b) { return vsubq_f32(a, b); }
+static inline Vec mul(const Vec a, const Vec b) { return vmulq_f32(a, b); }
+static inline Vec set2(const float a, const float b) {
+  return vcombine_f32(vdup_n_f32(a), vdup_n_f32(b));
+}
+static inline Vec low_halves(const Vec a, const Vec b) {
+  return vcombine_f32(vget_low_f32(a), vget_low_f32(b));
+}
+static inline Vec high_half(const Vec v) {
+  return vcombine_f32(vget_high_f32(v), vdup_n_f32(0.0f));
+}
+static inline Vec flush_denormals(const Vec v) {
+  const uint32x4_t mask = vcageq_f32(v, vdupq_n_f32(denormal_threshold));
+  return vreinterpretq_f32_u32(vandq_u32(mask, vreinterpretq_u32_f32(v)));
+}
+#else
+struct Vec {
+  float v[DspChain::lanes];
+};
+
+static inline Vec load(const float *p) { return Vec{p[0], p[1], p[2], p[3]}; }
+static inline void store(float *p, const Vec v) { std::copy(v.v, v.v + DspChain::lanes, p); }
+static inline Vec set1(const float x) { return Vec{x, x, x, x}; }
+static inline Vec add(const Vec a, const Vec b) {
+  return Vec{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]};
+}
+static inline Vec sub(const Vec a, const Vec b) {
+  return Vec{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]};
+}
+static inline Vec mul(const Vec a, const Vec b) {
+  return Vec{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]};
+}
+static inline Vec set2(const float a, const float b) { return Vec{a, a, b, b}; }
+static inline Vec low_halves(const Vec a, const Vec b) {
+  return Vec{a.v[0], a.v[1], b.v[0], b.v[1]};
+}
+static inline Vec high_half(const Vec v) { return Vec{v.v[2], v.v[3], 0.0f, 0.0f}; }
+static inline Vec flush_denormals(Vec v) {
+  for (float &x : v.v)
+    x = std::abs(x) < denormal_threshold ? 0.0f : x;
+  return v;
+}
+#endif
+
+}  // namespace Simd
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Move `current` by `amount` of the way to `target`, landing on it once within `epsilon`.
+ */
+static float approach(
+    const float current, const float target, const float amount, const float epsilon
+);
+
+/**
+ * Keep a band's settings where its filter is stable and meaningful.
+ */
+static EqBand clamp_band(EqBand band, const std::uint32_t sample_rate);
+
+static float db_to_gain(const float db);
+
+}  // namespace Utils
+
+std::array<EqBand, eq_band_count> get_default_eq_bands() {
+  std::array<EqBand, eq_band_count> bands{};
+  for (std::size_t i = 0; i < bands.size(); ++i)
+    bands[i] = EqBand{EqBandType::Peak, 31.25f * static_cast<float>(1 << i), 0.0f, 1.41f};
+  bands.front().type = EqBandType::LowShelf;
+  bands.front().q    = 0.71f;
+  bands.back().type  = EqBandType::HighShelf;
+  bands.back().q     = 0.71f;
+  return bands;
+}
+
+DspChain::DspChain(
+    const std::uint32_t sample_rate_, const std::uint32_t channels_, const DspConfig &config
+)
+    : sample_rate{sample_rate_},
+      channels{channels_},
+      m_smoothing{static_cast<float>(
+          1.0 - std::exp(-static_cast<double>(block_frames) * 1000.0 /
+                         (std::max(config.smoothing_milliseconds, 1.0f) * sample_rate))
+      )},
+      m_release{static_cast<float>(std::exp(
+          -1000.0 / (std::max(config.limiter_release_milliseconds, 1.0f) * sample_rate)
+      ))} {
+  for (std::size_t i = 0; i < eq_band_count; ++i) {
+    set_eq_band(i, config.eq[i]);
+    BandState &band = m_bands[i];
+    band.current    = Utils::clamp_band(config.eq[i], sample_rate);
+    band.biquad     = compute_biquad(band.current);
+    band.flat       = band.current.gain_db == 0.0f;
+  }
+  set_volume(config.volume);
+  set_limiter(config.limiter, config.limiter_threshold_db);
+  m_volume = m_volume_target.load(std::memory_order_relaxed);
+
+  const std::size_t groups = (channels + lanes - 1) / lanes;
+  m_blocks.resize(groups);
+  m_states.resize(groups);
+}
+
+void DspChain::set_volume(const float volume) {
+  m_volume_target.store(std::clamp(volume, 0.0f, 1.0f), std::memory_order_relaxed);
+}
+
+float DspChain::get_volume() const { return m_volume_target.load(std::memory_order_relaxed); }
+
+void DspChain::set_eq_band(const std::size_t band, const EqBand &settings) {
+  if (band >= eq_band_count)
+    return;
+  // A band read while it's being set moves towards a mix of both settings for a block
+  BandTarget &target = m_targets[band];
+  target.type.store(settings.type, std::memory_order_relaxed);
+  target.frequency.store(settings.frequency, std::memory_order_relaxed);
+  target.gain_db.store(settings.gain_db, std::memory_order_relaxed);
+  target.q.store(settings.q, std::memory_order_relaxed);
+}
+
+EqBand DspChain::get_eq_band(const std::size_t band) const {
+  if (band >= eq_band_count)
+    return EqBand{};
+  const BandTarget &target = m_targets[band];
+  return EqBand{
+      target.type.load(std::memory_order_relaxed), target.frequency.load(std::memory_order_relaxed),
+      target.gain_db.load(std::memory_order_relaxed), target.q.load(std::memory_order_relaxed)
+  };
+}
+
+void DspChain::set_limiter(const bool enabled, const float threshold_db) {
+  m_limiter_enabled.store(enabled, std::memory_order_relaxed);
+  m_limiter_threshold.store(
+      Utils::db_to_gain(std::min(threshold_db, 0.0f)), std::memory_order_relaxed
+  );
+}
+
+float DspChain::get_gain_reduction_db() const {
+  return m_gain_reduction_db.load(std::memory_order_relaxed);
+}
+
+void DspChain::process(float *frames, const std::size_t frame_count) {
+  const bool limiter = m_limiter_enabled.load(std::memory_order_relaxed);
+  for (std::size_t done = 0; done < frame_count; done += block_frames) {
+    const std::size_t count = std::min(block_frames, frame_count - done);
+    float *block            = frames + done * channels;
+    const float volume_from = m_volume;
+    update_parameters();
+
+    if (not std::ranges::all_of(m_bands, &BandState::flat)) {
+      for (std::size_t group = 0; group < m_blocks.size(); ++group) {
+        const std::size_t first = group * lanes;
+        const std::size_t last  = std::min<std::size_t>(channels, first + lanes);
+        Lanes *planar           = m_blocks[group].data();
+        for (std::size_t f = 0; f < count; ++f)
+          for (std::size_t c = first; c < last; ++c)
+            planar[f].v[c - first] = block[f * channels + c];
+        run_eq(group, count);
+        for (std::size_t f = 0; f < count; ++f)
+          for (std::size_t c = first; c < last; ++c)
+            block[f * channels + c] = planar[f].v[c - first];
+      }
+    }
+
+    if (limiter)
+      run_limiter(block, count);
+    else
+      m_limiter_gain = 1.0f;
+
+    // Ramp over the block to the smoothed volume
+    if (volume_from != 1.0f or m_volume != 1.0f) {
+      const float step = (m_volume - volume_from) / static_cast<float>(count);
+      for (std::size_t f = 0; f < count; ++f) {
+        const float gain = volume_from + step * static_cast<float>(f + 1);
+        for (std::size_t c = 0; c < channels; ++c)
+          block[f * channels + c] *= gain;
+      }
+    }
+  }
+  m_gain_reduction_db.store(20.0f * std::log10(m_limiter_gain), std::memory_order_relaxed);
+}
+
+void DspChain::update_parameters() {
+  m_volume = Utils::approach(
+      m_volume, m_volume_target.load(std::memory_order_relaxed), m_smoothing, 1e-5f
+  );
+
+  for (std::size_t i = 0; i < eq_band_count; ++i) {
+    const BandTarget &target_ = m_targets[i];
+    const EqBand target       = Utils::clamp_band(
+        EqBand{
+            target_.type.load(std::memory_order_relaxed),
+            target_.frequency.load(std::memory_order_relaxed),
+            target_.gain_db.load(std::memory_order_relaxed),
+            target_.q.load(std::memory_order_relaxed)
+        },
+        sample_rate
+    );
+    BandState &band = m_bands[i];
+    EqBand &current = band.current;
+    if (current.type == target.type and current.frequency == target.frequency and
+        current.gain_db == target.gain_db and current.q == target.q)
+      continue;
+
+    current.type = target.type;
+    // Frequencies move by octaves, so that low and high bands sweep alike
+    current.frequency = std::exp2(Utils::approach(
+        std::log2(current.frequency), std::log2(target.frequency), m_smoothing, 1e-3f
+    ));
+    current.gain_db = Utils::approach(current.gain_db, target.gain_db, m_smoothing, 1e-3f);
+    current.q       = Utils::approach(current.q, target.q, m_smoothing, 1e-4f);
+    band.biquad     = compute_biquad(current);
+
+    // A flat band is skipped, and starts from silence once it's not flat anymore
+    band.flat = current.gain_db == 0.0f;
+    if (band.flat)
+      for (auto &states : m_states)
+        states[i] = {};
+  }
+}
+
+DspChain::Biquad DspChain::compute_biquad(const EqBand &band) const {
+  if (band.gain_db == 0.0f)
+    return Biquad{};
+  const double a      = std::pow(10.0, band.gain_db / 40.0);
+  const double w0     = 2.0 * std::numbers::pi * band.frequency / sample_rate;
+  const double cos_w0 = std::cos(w0);
+  const double alpha  = std::sin(w0) / (2.0 * band.q);
+  const double shelf  = 2.0 * std::sqrt(a) * alpha;
+
+  double b0, b1, b2, a0, a1, a2;
+  switch (band.type) {
+    case EqBandType::Peak:
+      b0 = 1.0 + alpha * a;
+      b1 = -2.0 * cos_w0;
+      b2 = 1.0 - alpha * a;
+      a0 = 1.0 + alpha / a;
+      a1 = -2.0 * cos_w0;
+      a2 = 1.0 - alpha / a;
+      break;
+    case EqBandType::LowShelf:
+      b0 = a * ((a + 1.0) - (a - 1.0) * cos_w0 + shelf);
+      b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cos_w0);
+      b2 = a * ((a + 1.0) - (a - 1.0) * cos_w0 - shelf);
+      a0 = (a + 1.0) + (a - 1.0) * cos_w0 + shelf;
+      a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cos_w0);
+      a2 = (a + 1.0) + (a - 1.0) * cos_w0 - shelf;
+      break;
+    case EqBandType::HighShelf:
+    default:
+      b0 = a * ((a + 1.0) + (a - 1.0) * cos_w0 + shelf);
+      b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cos_w0);
+      b2 = a * ((a + 1.0) + (a - 1.0) * cos_w0 - shelf);
+      a0 = (a + 1.0) - (a - 1.0) * cos_w0 + shelf;
+      a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cos_w0);
+      a2 = (a + 1.0) - (a - 1.0) * cos_w0 - shelf;
+      break;
+  }
+  return Biquad{
+      static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+      static_cast<float>(a1 / a0), static_cast<float>(a2 / a0)
+  };
+}
+
+void DspChain::run_eq(const std::size_t group, const std::size_t frame_count) {
+  std::array<std::size_t, eq_band_count> bands{};
+  std::size_t band_count = 0;
+  for (std::size_t i = 0; i < eq_band_count; ++i)
+    if (not m_bands[i].flat)
+      bands[band_count++] = i;
+
+  Lanes *planar = m_blocks[group].data();
+  // Band after band over the whole block, which stays in L1
+  std::size_t i = 0;
+  if (channels - group * lanes <= lanes / 2)
+    for (; i + 1 < band_count; i += 2)
+      run_band_pair(planar, frame_count, group, bands[i], bands[i + 1]);
+  for (; i < band_count; ++i)
+    run_band(planar, frame_count, group, bands[i]);
+}
+
+void DspChain::run_band(
+    Lanes *planar, const std::size_t frame_count, const std::size_t group, const std::size_t band
+) {
+  using namespace Simd;
+  const Biquad &biquad = m_bands[band].biquad;
+  const Vec b0         = set1(biquad.b0);
+  const Vec b1         = set1(biquad.b1);
+  const Vec b2         = set1(biquad.b2);
+  const Vec a1         = set1(biquad.a1);
+  const Vec a2         = set1(biquad.a2);
+  auto &state          = m_states[group][band];
+  Vec z1               = load(state[0].v);
+  Vec z2               = load(state[1].v);
+  for (std::size_t f = 0; f < frame_count; ++f) {
+    const Vec x = load(planar[f].v);
+    const Vec y = add(mul(b0, x), z1);
+    // The feedback is subtracted last, the rest doesn't wait for `y`
+    z1 = sub(add(mul(b1, x), z2), mul(a1, y));
+    z2 = sub(mul(b2, x), mul(a2, y));
+    store(planar[f].v, y);
+  }
+  store(state[0].v, flush_denormals(z1));
+  store(state[1].v, flush_denormals(z2));
+}
+
+void DspChain::run_band_pair(
+    Lanes *planar, const std::size_t frame_count, const std::size_t group, const std::size_t band_a,
+    const std::size_t band_b
+) {
+  using namespace Simd;
+  const Biquad &a = m_bands[band_a].biquad;
+  const Biquad &b = m_bands[band_b].biquad;
+  const Vec b0    = set2(a.b0, b.b0);
+  const Vec b1    = set2(a.b1, b.b1);
+  const Vec b2    = set2(a.b2, b.b2);
+  const Vec a1    = set2(a.a1, b.a1);
+  const Vec a2    = set2(a.a2, b.a2);
+  auto &state_a   = m_states[group][band_a];
+  auto &state_b   = m_states[group][band_b];
+  Vec z1          = low_halves(load(state_a[0].v), load(state_b[0].v));
+  Vec z2          = low_halves(load(state_a[1].v), load(state_b[1].v));
+
+  // The low half of the vector runs band a on a frame, the high half runs band b on the
+  // frame before, which band a output in the previous step
+  const auto step = [&](const Vec x) {
+    const Vec y = add(mul(b0, x), z1);
+    z1          = sub(add(mul(b1, x), z2), mul(a1, y));
+    z2          = sub(mul(b2, x), mul(a2, y));
+    return y;
+  };
+  const Vec zero = set1(0.0f);
+  const Vec z1_b = z1;
+  const Vec z2_b = z2;
+  Vec y          = step(low_halves(load(planar[0].v), zero));
+  // Band b has no frame to run yet
+  z1 = low_halves(z1, high_half(z1_b));
+  z2 = low_halves(z2, high_half(z2_b));
+  for (std::size_t f = 1; f < frame_count; ++f) {
+    y = step(low_halves(load(planar[f].v), y));
+    store(planar[f - 1].v, high_half(y));
+  }
+  const Vec z1_a = z1;
+  const Vec z2_a = z2;
+  y              = step(low_halves(zero, y));
+  store(planar[frame_count - 1].v, high_half(y));
+  // Band a had no frame left to run
+  z1 = low_halves(z1_a, high_half(z1));
+  z2 = low_halves(z2_a, high_half(z2));
+
+  z1 = flush_denormals(z1);
+  z2 = flush_denormals(z2);
+  store(state_a[0].v, z1);
+  store(state_a[1].v, z2);
+  store(state_b[0].v, high_half(z1));
+  store(state_b[1].v, high_half(z2));
+}
+
+void DspChain::run_limiter(float *frames, const std::size_t frame_count) {
+  const float threshold = m_limiter_threshold.load(std::memory_order_relaxed);
+  for (std::size_t f = 0; f < frame_count; ++f) {
+    float *frame = frames + f * channels;
+    float peak   = 0.0f;
+    for (std::size_t c = 0; c < channels; ++c)
+      peak = std::max(peak, std::abs(frame[c]));
+    // Instant attack so that no peak gets through, exponential release
+    const float released = 1.0f + (m_limiter_gain - 1.0f) * m_release;
+    const float needed   = peak > threshold ? threshold / peak : 1.0f;
+    m_limiter_gain       = std::min(released, needed);
+    if (m_limiter_gain < 1.0f)
+      for (std::size_t c = 0; c < channels; ++c)
+        frame[c] *= m_limiter_gain;
+  }
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static float Utils::approach(
+    const float current, const float target, const float amount, const float epsilon
+) {
+  const float next = current + (target - current) * amount;
+  return std::abs(target - next) <= epsilon ? target : next;
+}
+
+static EqBand Utils::clamp_band(EqBand band, const std::uint32_t sample_rate) {
+  band.frequency = std::clamp(band.frequency, 10.0f, 0.45f * static_cast<float>(sample_rate));
+  band.gain_db   = std::clamp(band.gain_db, -24.0f, 24.0f);
+  band.q         = std::clamp(band.q, 0.1f, 20.0f);
+  return band;
+}
+
+static float Utils::db_to_gain(const float db) { return std::pow(10.0f, db / 20.0f); }
+
+}  // namespace Tmupp
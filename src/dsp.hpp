@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Tmupp {
+
+enum class EqBandType { Peak, LowShelf, HighShelf };
+
+struct EqBand {
+  EqBandType type = EqBandType::Peak;
+  /**
+   * Center frequency of a peak, corner frequency of a shelf, in Hz.
+   */
+  float frequency = 1000.0f;
+  float gain_db   = 0.0f;
+  float q         = 1.41f;
+};
+
+inline constexpr std::size_t eq_band_count = 10;
+
+/**
+ * Octave bands from 31 Hz to 16 kHz, shelves at both ends, all flat.
+ */
+std::array<EqBand, eq_band_count> get_default_eq_bands();
+
+struct DspConfig {
+  /**
+   * From 0 to 1, applied after the limiter.
+   */
+  float volume = 1.0f;
+  std::array<EqBand, eq_band_count> eq = get_default_eq_bands();
+  bool limiter = true;
+  /**
+   * Level the limiter keeps the peaks under.
+   */
+  float limiter_threshold_db = -0.5f;
+  /**
+   * Time the limiter takes to give back most of its gain reduction.
+   */
+  float limiter_release_milliseconds = 80.0f;
+  /**
+   * Time a change of the volume or of a band takes to mostly apply.
+   */
+  float smoothing_milliseconds = 30.0f;
+};
+
+/**
+  Processing applied to the mixed output before it reaches the device: a parametric EQ,
+  a peak limiter and the volume.
+
+  The EQ is a cascade of biquads (RBJ cookbook), vectorised across channels: each block
+  of frames is copied to a planar layout holding up to 4 channels per vector, which the
+  SSE2 or NEON loops filter band after band. Parameter changes are smoothed per block of
+  `block_frames`, the coefficients of a band being recomputed only while it moves.
+
+  The setters can be called from any thread, `process()` only from the audio callback.
+*/
+class DspChain {
+ public:
+  DspChain(
+      const std::uint32_t sample_rate_, const std::uint32_t channels_, const DspConfig &config
+  );
+  DspChain(const DspChain &)            = delete;
+  DspChain &operator=(const DspChain &) = delete;
+
+  void set_volume(const float volume);
+  float get_volume() const;
+  void set_eq_band(const std::size_t band, const EqBand &settings);
+  EqBand get_eq_band(const std::size_t band) const;
+  void set_limiter(const bool enabled, const float threshold_db);
+  /**
+   * Gain reduction of the limiter at the end of the last period, for meters.
+   */
+  float get_gain_reduction_db() const;
+
+  /**
+   * Process `frame_count` interleaved frames in place.
+   */
+  void process(float *frames, const std::size_t frame_count);
+
+ public:
+  /**
+   * Frames processed between two parameter updates.
+   */
+  static constexpr std::size_t block_frames = 32;
+  /**
+   * Channels per vector.
+   */
+  static constexpr std::size_t lanes = 4;
+
+  const std::uint32_t sample_rate;
+  const std::uint32_t channels;
+
+ private:
+  struct alignas(16) Lanes {
+    float v[lanes];
+  };
+
+  /**
+   * Normalised biquad coefficients, `a0` being 1.
+   */
+  struct Biquad {
+    float b0 = 1.0f;
+    float b1 = 0.0f;
+    float b2 = 0.0f;
+    float a1 = 0.0f;
+    float a2 = 0.0f;
+  };
+
+  /**
+   * Settings of a band as set by the user, read by the callback.
+   */
+  struct BandTarget {
+    std::atomic<EqBandType> type{EqBandType::Peak};
+    std::atomic<float> frequency{1000.0f};
+    std::atomic<float> gain_db{0.0f};
+    std::atomic<float> q{1.0f};
+  };
+
+  /**
+   * Settings of a band as applied, moving towards the target.
+   */
+  struct BandState {
+    EqBand current;
+    Biquad biquad;
+    bool flat = true;
+  };
+
+  /**
+   * Move the applied settings one block towards the targets.
+   */
+  void update_parameters();
+  Biquad compute_biquad(const EqBand &band) const;
+  void run_eq(const std::size_t group, const std::size_t frame_count);
+  /**
+   * Run a band over the block of a group, one channel per lane.
+   */
+  void run_band(
+      Lanes *planar, const std::size_t frame_count, const std::size_t group,
+      const std::size_t band
+  );
+  /**
+   * Run two bands over the block of a group of at most `lanes / 2` channels, at once in
+   * the two halves of the vectors.
+   */
+  void run_band_pair(
+      Lanes *planar, const std::size_t frame_count, const std::size_t group,
+      const std::size_t band_a, const std::size_t band_b
+  );
+  void run_limiter(float *frames, const std::size_t frame_count);
+
+ private:
+  /**
+   * Fraction of the distance to a target covered per block.
+   */
+  const float m_smoothing;
+  /**
+   * Per frame decay of the limiter's gain reduction.
+   */
+  const float m_release;
+
+  std::array<BandTarget, eq_band_count> m_targets;
+  std::atomic<float> m_volume_target{1.0f};
+  std::atomic<bool> m_limiter_enabled{true};
+  std::atomic<float> m_limiter_threshold{1.0f};
+  std::atomic<float> m_gain_reduction_db{0.0f};
+
+  // Callback only
+  std::array<BandState, eq_band_count> m_bands;
+  float m_volume = 1.0f;
+  /**
+   * Limiter gain, 1 when it doesn't limit.
+   */
+  float m_limiter_gain = 1.0f;
+  /**
+   * One block per group of `lanes` channels.
+   */
+  std::vector<std::array<Lanes, block_frames>> m_blocks;
+  /**
+   * Filter state of each band and group, `z1` and `z2` of the transposed direct form II.
+   */
+  std::vector<std::array<std::array<Lanes, 2>, eq_band_count>> m_states;
+};
+
+}  // namespace Tmupp
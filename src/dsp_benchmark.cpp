@@ -0,0 +1,153 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "./dsp.hpp"
+
+struct Options {
+  double seconds         = 60.0;
+  std::uint32_t rate     = 96000;
+  std::uint32_t channels = 2;
+  std::size_t period     = 480;
+  /**
+   * Exit with 1 if a scenario takes more than this share of a core.
+   */
+  double max_cpu_percent = 1.0;
+};
+
+struct Scenario {
+  std::string name;
+  /**
+   * Called before each period with its index, to change settings.
+   */
+  void (*update)(Tmupp::DspChain &dsp, const std::size_t period);
+};
+
+static std::optional<Options> parse_args(int argc, char **argv);
+/**
+ * Seconds spent processing `options.seconds` of white noise.
+ */
+static double run(const Options &options, const Scenario &scenario);
+
+int main(int argc, char **argv) {
+  const std::optional<Options> options = parse_args(argc, argv);
+  if (not options.has_value())
+    return 2;
+
+  const std::vector<Scenario> scenarios{
+      {"limiter only",
+       [](Tmupp::DspChain &dsp, const std::size_t period) {
+         if (period == 0)
+           dsp.set_volume(0.8f);
+       }},
+      {"10 bands",
+       [](Tmupp::DspChain &dsp, const std::size_t period) {
+         if (period != 0)
+           return;
+         for (std::size_t i = 0; i < Tmupp::eq_band_count; ++i) {
+           Tmupp::EqBand band = dsp.get_eq_band(i);
+           band.gain_db       = i % 2 == 0 ? 6.0f : -6.0f;
+           dsp.set_eq_band(i, band);
+         }
+       }},
+      // Coefficients are recomputed for every block while the bands move
+      {"10 bands, sweeping",
+       [](Tmupp::DspChain &dsp, const std::size_t period) {
+         if (period % 10 != 0)
+           return;
+         for (std::size_t i = 0; i < Tmupp::eq_band_count; ++i) {
+           Tmupp::EqBand band = dsp.get_eq_band(i);
+           band.gain_db       = (period / 10 + i) % 2 == 0 ? 6.0f : -6.0f;
+           dsp.set_eq_band(i, band);
+         }
+       }},
+  };
+
+  int failures = 0;
+  std::cout << std::format(
+      "{:.0f} s of {} Hz, {} channels, {} frames per period\n", options->seconds, options->rate,
+      options->channels, options->period
+  );
+  for (const Scenario &scenario : scenarios) {
+    const double elapsed = run(*options, scenario);
+    const double frames  = options->seconds * options->rate;
+    const double cpu     = elapsed / options->seconds * 100.0;
+    std::cout << std::format(
+        "{:<20} {:8.3f} ms {:8.2f} ns/frame {:7.3f}% of a core\n", scenario.name,
+        elapsed * 1000.0, elapsed * 1e9 / frames, cpu
+    );
+    if (cpu > options->max_cpu_percent)
+      ++failures;
+  }
+  return failures == 0 ? 0 : 1;
+}
+
+static std::optional<Options> parse_args(int argc, char **argv) {
+  Options options{};
+  const std::string usage = std::format(
+      "Usage: {} [--seconds 60] [--rate 96000] [--channels 2] [--period 480]\n"
+      "          [--max-cpu-percent 1.0]\n",
+      argv[0]
+  );
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--seconds") {
+      options.seconds = std::stod(value);
+    } else if (arg == "--rate") {
+      options.rate = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--channels") {
+      options.channels = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--period") {
+      options.period = std::stoul(value);
+    } else if (arg == "--max-cpu-percent") {
+      options.max_cpu_percent = std::stod(value);
+    } else {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+  }
+  if (options.seconds <= 0.0 or options.rate == 0 or options.channels == 0 or
+      options.period == 0) {
+    std::cerr << usage;
+    return std::nullopt;
+  }
+  return options;
+}
+
+static double run(const Options &options, const Scenario &scenario) {
+  Tmupp::DspChain dsp{options.rate, options.channels, Tmupp::DspConfig{}};
+
+  // A second of noise at -12 dBFS, looped
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> noise{-0.25f, 0.25f};
+  std::vector<float> source(std::size_t{options.rate} * options.channels);
+  for (float &sample : source)
+    sample = noise(rng);
+  std::vector<float> buffer(options.period * options.channels);
+
+  const auto total   = static_cast<std::size_t>(options.seconds * options.rate);
+  std::size_t offset = 0;
+  std::chrono::steady_clock::duration elapsed{};
+  for (std::size_t done = 0, period = 0; done < total; done += options.period, ++period) {
+    for (float &sample : buffer) {
+      sample = source[offset];
+      offset = offset + 1 == source.size() ? 0 : offset + 1;
+    }
+    scenario.update(dsp, period);
+    const auto start = std::chrono::steady_clock::now();
+    dsp.process(buffer.data(), options.period);
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  return std::chrono::duration<double>(elapsed).count();
+}
@@ -0,0 +1,214 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "midx.hpp"
+#include "query.hpp"
+
+#include "./decoder_pool.hpp"
+#include "./resampler.hpp"
+#include "./transcode.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+  Transcodes tracks to WAV or FLAC files in a directory, as many at once as there are
+  jobs, tagged from the Midx database when one is given. The tracks are given as paths,
+  or selected from the database by a query.
+*/
+
+struct Options {
+  std::vector<std::string> tracks;
+  std::string out;
+  Tmupp::TranscodeConfig config{};
+  /**
+   * Files transcoded at once, 0 for one per core.
+   */
+  unsigned jobs = 0;
+  /**
+   * Midx database to tag the files from, if not empty.
+   */
+  std::string database;
+  /**
+   * Exports the tracks of the database it matches, if not empty.
+   */
+  std::string query;
+};
+
+static std::optional<Options> parse_args(int argc, char **argv);
+static std::optional<Tmupp::ResamplerQuality> parse_resampler_quality(const std::string &name);
+/**
+ * `directory/stem.extension`, numbered after the stem if `used` has it already.
+ */
+static std::string get_destination(
+    const std::string &directory, const std::string &source, const std::string &extension,
+    std::unordered_set<std::string> &used
+);
+
+int main(int argc, char **argv) {
+  const std::optional<Options> options = parse_args(argc, argv);
+  if (not options.has_value())
+    return 2;
+
+  std::unique_ptr<SQLite::Database> db{};
+  std::vector<std::string> tracks = options->tracks;
+  std::vector<Tmupp::TranscodeTags> tags(tracks.size());
+  try {
+    if (not options->database.empty())
+      db = std::make_unique<SQLite::Database>(options->database, SQLite::OPEN_READONLY);
+    if (not options->query.empty()) {
+      const std::optional<Midx::Query> query = Midx::parse_query(options->query);
+      if (not query.has_value())
+        return 2;
+      for (const int track_id : Midx::run_query(*db, *query)) {
+        if (const std::optional<Midx::Track> track = Midx::get_track(*db, track_id)) {
+          tracks.push_back(track->file_path);
+          tags.push_back(Tmupp::read_transcode_tags(*db, track_id));
+        }
+      }
+    }
+    // Tracks given as paths are looked up by their canonical path, as Midx indexes them
+    if (db != nullptr)
+      for (std::size_t i = 0; i < options->tracks.size(); ++i) {
+        std::error_code ec;
+        const fs::path path = fs::canonical(options->tracks[i], ec);
+        if (ec)
+          continue;
+        if (const std::optional<int> track_id = Midx::get_track_id(*db, path))
+          tags[i] = Tmupp::read_transcode_tags(*db, *track_id);
+      }
+  } catch (const SQLite::Exception &e) {
+    std::cerr << std::format("Failed to read {}: {}\n", options->database, e.what());
+    return 2;
+  }
+  if (tracks.empty()) {
+    std::cerr << "No track to export\n";
+    return 0;
+  }
+
+  std::error_code ec;
+  fs::create_directories(options->out, ec);
+  if (ec) {
+    std::cerr << std::format("Failed to create {}: {}\n", options->out, ec.message());
+    return 2;
+  }
+
+  const unsigned jobs =
+      options->jobs > 0 ? options->jobs : std::max(1u, std::thread::hardware_concurrency());
+  Tmupp::DecoderPoolConfig pool_config{};
+  pool_config.workers = jobs;
+  Tmupp::DecoderPool pool{pool_config};
+  // Keeps the decoders and chunks in memory to a couple per worker
+  Tmupp::TranscodeConfig config = options->config;
+  config.max_pending_jobs       = 2 * std::size_t{jobs};
+  Tmupp::Transcoder transcoder{pool, config};
+  const std::string extension = config.format == Tmupp::TranscodeFormat::Flac ? "flac" : "wav";
+  std::unordered_set<std::string> used{};
+
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < tracks.size(); ++i) {
+    Tmupp::TranscodeJob job{};
+    job.source      = tracks[i];
+    job.destination = get_destination(options->out, tracks[i], extension, used);
+    job.tags        = std::move(tags[i]);
+    transcoder.submit(std::move(job));
+  }
+  const std::uint64_t failures                = transcoder.wait();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  const Tmupp::TranscodeStats stats = transcoder.get_stats();
+  std::cout << std::format(
+      "{} files exported, {} failed, {:.1f} s of audio in {:.3f} s ({:.1f}x realtime, {} "
+      "jobs)\n",
+      stats.files, failures, stats.seconds, elapsed.count(), stats.seconds / elapsed.count(), jobs
+  );
+  return failures > 0 ? 1 : 0;
+}
+
+static std::optional<Options> parse_args(int argc, char **argv) {
+  Options options{};
+  const std::string usage = std::format(
+      "Usage: {} --out directory [--format flac|wav] [--rate 0] [--channels 0] [--bits 16]\n"
+      "          [--resampler linear|low|medium|high] [--jobs 0] [--database db.sqlite]\n"
+      "          [--query \"...\"] [track...]\n",
+      argv[0]
+  );
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (not arg.starts_with("--")) {
+      options.tracks.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--out") {
+      options.out = value;
+    } else if (arg == "--format" and (value == "flac" or value == "wav")) {
+      options.config.format =
+          value == "flac" ? Tmupp::TranscodeFormat::Flac : Tmupp::TranscodeFormat::Wav;
+    } else if (arg == "--rate") {
+      options.config.sample_rate = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--channels") {
+      options.config.channels = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--bits") {
+      options.config.bits_per_sample = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--resampler") {
+      const auto quality = parse_resampler_quality(value);
+      if (not quality.has_value()) {
+        std::cerr << usage;
+        return std::nullopt;
+      }
+      options.config.resampler_quality = *quality;
+    } else if (arg == "--jobs") {
+      options.jobs = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--database") {
+      options.database = value;
+    } else if (arg == "--query") {
+      options.query = value;
+    } else {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+  }
+  if (options.out.empty() or (options.tracks.empty() and options.query.empty()) or
+      (not options.query.empty() and options.database.empty()) or
+      (options.config.bits_per_sample != 16 and options.config.bits_per_sample != 24)) {
+    std::cerr << usage;
+    return std::nullopt;
+  }
+  return options;
+}
+
+static std::optional<Tmupp::ResamplerQuality> parse_resampler_quality(const std::string &name) {
+  for (const Tmupp::ResamplerQuality quality :
+       {Tmupp::ResamplerQuality::Linear, Tmupp::ResamplerQuality::Low,
+        Tmupp::ResamplerQuality::Medium, Tmupp::ResamplerQuality::High})
+    if (name == Tmupp::get_resampler_quality_name(quality))
+      return quality;
+  return std::nullopt;
+}
+
+static std::string get_destination(
+    const std::string &directory, const std::string &source, const std::string &extension,
+    std::unordered_set<std::string> &used
+) {
+  const std::string stem = fs::path{source}.stem().string();
+  std::string name       = std::format("{}.{}", stem, extension);
+  for (unsigned n = 2; used.contains(name); ++n)
+    name = std::format("{} ({}).{}", stem, n, extension);
+  used.insert(name);
+  return (fs::path{directory} / name).string();
+}
@@ -0,0 +1,302 @@
+#include "./features.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <numbers>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "miniaudio.h"
+
+#include "./fft.hpp"
+
+namespace Tmupp {
+
+static constexpr ma_uint32 sample_rate       = 22050;
+static constexpr std::size_t frame_size      = 1024;
+static constexpr std::size_t hop_size        = 512;
+static constexpr std::size_t bin_count       = frame_size / 2 + 1;
+static constexpr std::size_t mel_band_count  = 26;
+static constexpr std::size_t min_frame_count = 3 * sample_rate / hop_size;
+
+// Static helper functions
+namespace Utils {
+
+struct MelBand {
+  std::size_t first_bin;
+  std::vector<float> weights;
+};
+
+/**
+ * Everything that only depends on the frame size, shared by all analyses.
+ */
+struct AnalysisTables {
+  AnalysisTables();
+
+  Fft fft;
+  std::vector<float> window;
+  std::vector<float> bin_frequencies;
+  std::vector<MelBand> mel_bands;
+  /**
+   * DCT-II matrix, `mfcc_count` rows of `mel_band_count` values.
+   */
+  std::vector<float> dct;
+};
+
+static const AnalysisTables &get_analysis_tables();
+
+/**
+ * Decode the analysed part of a file as mono samples at `sample_rate`.
+ */
+static std::vector<float> decode_mono(const std::string &path);
+
+/**
+ * Tempo in BPM from the per-frame onset strengths, 0 if there are too few frames.
+ */
+static float estimate_tempo(std::span<const float> onsets);
+
+static float dot(std::span<const float> a, std::span<const float> b);
+
+}  // namespace Utils
+
+std::optional<FeatureVector> extract_features(const std::string &path) {
+  const std::vector<float> samples = Utils::decode_mono(path);
+  if (samples.size() < frame_size)
+    return std::nullopt;
+  const std::size_t frame_count = (samples.size() - frame_size) / hop_size + 1;
+  if (frame_count < min_frame_count) {
+    spdlog::error("Not enough audio to analyse in {}", path);
+    return std::nullopt;
+  }
+
+  const Utils::AnalysisTables &tables = Utils::get_analysis_tables();
+
+  std::vector<float> windowed(frame_size);
+  std::vector<std::complex<float>> scratch(frame_size);
+  std::vector<float> power(bin_count);
+  std::vector<float> log_mel(mel_band_count);
+  std::vector<float> prev_log_mel(mel_band_count);
+  std::vector<float> onsets{};
+  onsets.reserve(frame_count);
+
+  // Running sums (and sums of squares) of every per-frame value
+  std::array<double, mfcc_count> mfcc_sum{}, mfcc_sq_sum{};
+  double centroid_sum = 0.0, centroid_sq_sum = 0.0, loudness_sum = 0.0, loudness_sq_sum = 0.0;
+  std::size_t voiced_frames = 0;
+
+  for (std::size_t f = 0; f < frame_count; ++f) {
+    const float *frame = samples.data() + f * hop_size;
+
+    float energy = 0.0f;
+    for (std::size_t i = 0; i < frame_size; ++i) {
+      windowed[i] = frame[i] * tables.window[i];
+      energy += frame[i] * frame[i];
+    }
+    const double loudness = 10.0 * std::log10(energy / frame_size + 1e-10f);
+    loudness_sum += loudness;
+    loudness_sq_sum += loudness * loudness;
+
+    tables.fft.power_spectrum(windowed, power, scratch);
+
+    float total = 0.0f, weighted = 0.0f;
+    for (std::size_t i = 0; i < bin_count; ++i) {
+      total += power[i];
+      weighted += power[i] * tables.bin_frequencies[i];
+    }
+    if (total > 1e-8f) {
+      const double centroid = weighted / total;
+      centroid_sum += centroid;
+      centroid_sq_sum += centroid * centroid;
+      ++voiced_frames;
+    }
+
+    for (std::size_t b = 0; b < mel_band_count; ++b) {
+      const Utils::MelBand &band = tables.mel_bands[b];
+      const float energy_in_band =
+          Utils::dot(band.weights, std::span{power}.subspan(band.first_bin));
+      log_mel[b] = std::log(energy_in_band + 1e-10f);
+    }
+
+    for (std::size_t c = 0; c < mfcc_count; ++c) {
+      const double mfcc =
+          Utils::dot(std::span{tables.dct}.subspan(c * mel_band_count, mel_band_count), log_mel);
+      mfcc_sum[c] += mfcc;
+      mfcc_sq_sum[c] += mfcc * mfcc;
+    }
+
+    // Spectral flux, how much louder each band got since the previous frame
+    float flux = 0.0f;
+    if (f > 0) {
+      for (std::size_t b = 0; b < mel_band_count; ++b)
+        flux += std::max(0.0f, log_mel[b] - prev_log_mel[b]);
+    }
+    onsets.push_back(flux / mel_band_count);
+    std::swap(log_mel, prev_log_mel);
+  }
+
+  const auto mean_and_deviation = [](double sum, double sq_sum, std::size_t n) {
+    const double count = static_cast<double>(std::max<std::size_t>(n, 1));
+    const double mean  = sum / count;
+    const double variance = std::max(0.0, sq_sum / count - mean * mean);
+    return std::pair{static_cast<float>(mean), static_cast<float>(std::sqrt(variance))};
+  };
+
+  FeatureVector features{};
+  features[0] = Utils::estimate_tempo(onsets);
+  std::tie(features[1], features[2]) =
+      mean_and_deviation(centroid_sum, centroid_sq_sum, voiced_frames);
+  for (std::size_t c = 0; c < mfcc_count; ++c) {
+    std::tie(features[3 + c], features[3 + mfcc_count + c]) =
+        mean_and_deviation(mfcc_sum[c], mfcc_sq_sum[c], frame_count);
+  }
+  std::tie(features[29], features[30]) =
+      mean_and_deviation(loudness_sum, loudness_sq_sum, frame_count);
+  double onset_sum = 0.0;
+  for (const float o : onsets)
+    onset_sum += o;
+  features[31] = static_cast<float>(onset_sum / static_cast<double>(onsets.size()));
+  return features;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+Utils::AnalysisTables::AnalysisTables()
+    : fft{frame_size},
+      window(frame_size),
+      bin_frequencies(bin_count),
+      dct(mfcc_count * mel_band_count) {
+  hann_window(window);
+
+  for (std::size_t i = 0; i < bin_count; ++i)
+    bin_frequencies[i] = static_cast<float>(i) * sample_rate / frame_size;
+
+  // Triangular filters evenly spaced on the mel scale, between 0 and the Nyquist frequency
+  const auto hz_to_mel = [](double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); };
+  const auto mel_to_hz = [](double mel) { return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0); };
+  const double max_mel = hz_to_mel(sample_rate / 2.0);
+  std::vector<double> edges(mel_band_count + 2);
+  for (std::size_t i = 0; i < edges.size(); ++i)
+    edges[i] = mel_to_hz(max_mel * static_cast<double>(i) / (mel_band_count + 1));
+
+  for (std::size_t b = 0; b < mel_band_count; ++b) {
+    const double low = edges[b], centre = edges[b + 1], high = edges[b + 2];
+    MelBand band{bin_count, {}};
+    for (std::size_t i = 0; i < bin_count; ++i) {
+      const double hz = bin_frequencies[i];
+      if (hz <= low or hz >= high)
+        continue;
+      if (band.first_bin == bin_count)
+        band.first_bin = i;
+      band.weights.resize(i - band.first_bin + 1, 0.0f);
+      const double rising  = (hz - low) / (centre - low);
+      const double falling = (high - hz) / (high - centre);
+      band.weights.back()  = static_cast<float>(hz < centre ? rising : falling);
+    }
+    // Low bands can fall between two bins, give them the nearest one
+    if (band.weights.empty()) {
+      const auto nearest = static_cast<std::size_t>(std::lround(centre * frame_size / sample_rate));
+      band.first_bin     = std::min(bin_count - 1, nearest);
+      band.weights       = {1.0f};
+    }
+    mel_bands.push_back(std::move(band));
+  }
+
+  for (std::size_t c = 0; c < mfcc_count; ++c) {
+    for (std::size_t b = 0; b < mel_band_count; ++b) {
+      const double angle = std::numbers::pi * static_cast<double>(c) *
+                           (static_cast<double>(b) + 0.5) / mel_band_count;
+      dct[c * mel_band_count + b] = static_cast<float>(std::cos(angle));
+    }
+  }
+}
+
+static const Utils::AnalysisTables &Utils::get_analysis_tables() {
+  static const AnalysisTables tables{};
+  return tables;
+}
+
+static std::vector<float> Utils::decode_mono(const std::string &path) {
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, sample_rate);
+  ma_decoder decoder;
+  if (ma_decoder_init_file(path.c_str(), &config, &decoder) != MA_SUCCESS) {
+    spdlog::error("Failed to decode {}", path);
+    return {};
+  }
+
+  constexpr ma_uint64 max_frames = ma_uint64{max_analysed_seconds} * sample_rate;
+  ma_uint64 length               = 0;
+  if (ma_decoder_get_length_in_pcm_frames(&decoder, &length) == MA_SUCCESS and length > max_frames)
+    ma_decoder_seek_to_pcm_frame(&decoder, (length - max_frames) / 2);
+
+  std::vector<float> samples(static_cast<std::size_t>(max_frames));
+  ma_uint64 read = 0;
+  ma_decoder_read_pcm_frames(&decoder, samples.data(), max_frames, &read);
+  ma_decoder_uninit(&decoder);
+  samples.resize(static_cast<std::size_t>(read));
+  return samples;
+}
+
+static float Utils::estimate_tempo(std::span<const float> onsets) {
+  constexpr double frame_rate = static_cast<double>(sample_rate) / hop_size;
+  constexpr double min_bpm = 60.0, max_bpm = 200.0;
+  const auto min_lag = static_cast<std::size_t>(frame_rate * 60.0 / max_bpm);
+  const auto max_lag = static_cast<std::size_t>(frame_rate * 60.0 / min_bpm);
+  if (onsets.size() <= max_lag * 2)
+    return 0.0f;
+
+  double mean = 0.0;
+  for (const float o : onsets)
+    mean += o;
+  mean /= static_cast<double>(onsets.size());
+  // Smoothed so that beats falling between two lags still correlate
+  std::vector<float> centred(onsets.size());
+  for (std::size_t i = 0; i < onsets.size(); ++i) {
+    const float prev = onsets[i > 0 ? i - 1 : i];
+    const float next = onsets[i + 1 < onsets.size() ? i + 1 : i];
+    centred[i]       = static_cast<float>((prev + 2.0f * onsets[i] + next) / 4.0f - mean);
+  }
+
+  // Autocorrelation of the onset envelope, weighted towards 120 BPM to avoid
+  // picking half or double the tempo
+  double best_score    = -1.0;
+  std::size_t best_lag = 0;
+  for (std::size_t lag = min_lag; lag <= max_lag; ++lag) {
+    const std::size_t n = centred.size() - lag;
+    const std::span<const float> head{centred.data(), n};
+    const std::span<const float> tail{centred.data() + lag, n};
+    const double correlation = dot(head, tail) / static_cast<double>(n);
+    const double octaves     = std::log2(frame_rate * 60.0 / static_cast<double>(lag) / 120.0);
+    const double score       = correlation * std::exp(-0.5 * octaves * octaves);
+    if (score > best_score) {
+      best_score = score;
+      best_lag   = lag;
+    }
+  }
+  return static_cast<float>(frame_rate * 60.0 / static_cast<double>(best_lag));
+}
+
+static float Utils::dot(std::span<const float> a, std::span<const float> b) {
+  // Independent partial sums so the loop vectorizes without -ffast-math
+  constexpr std::size_t lanes = 8;
+  const std::size_t n         = std::min(a.size(), b.size());
+  std::array<float, lanes> partial{};
+  std::size_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    for (std::size_t l = 0; l < lanes; ++l)
+      partial[l] += a[i + l] * b[i + l];
+  }
+  float res = 0.0f;
+  for (; i < n; ++i)
+    res += a[i] * b[i];
+  for (const float p : partial)
+    res += p;
+  return res;
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+
+namespace Tmupp {
+
+inline constexpr std::size_t mfcc_count = 13;
+
+/**
+  Number of values describing a track, a multiple of 8 so vectors can be compared
+  with full SIMD registers.
+*/
+inline constexpr std::size_t feature_count = 32;
+
+/**
+  Audio features of a track, laid out as:
+  - [0] tempo in BPM,
+  - [1, 2] mean and standard deviation of the spectral centroid in Hz,
+  - [3, 16) means of the MFCCs,
+  - [16, 29) standard deviations of the MFCCs,
+  - [29, 31) mean and standard deviation of the loudness in dB,
+  - [31] mean onset strength.
+*/
+using FeatureVector = std::array<float, feature_count>;
+
+/**
+  Decode (up to `max_analysed_seconds` from the middle of) a file and compute its features.
+  Returns std::nullopt if it can't be decoded or is too short.
+*/
+std::optional<FeatureVector> extract_features(const std::string &path);
+
+/**
+ * Longer tracks are only analysed around their middle.
+ */
+inline constexpr unsigned max_analysed_seconds = 90;
+
+}  // namespace Tmupp
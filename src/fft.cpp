@@ -0,0 +1,166 @@
+#include "./fft.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <numbers>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Radix-2 butterflies of `count` pairs, `a[k] + w[k] * b[k]` into `a[k]` and
+ * `a[k] - w[k] * b[k]` into `b[k]`, on interleaved real and imaginary parts.
+ */
+static void butterflies(float *a, float *b, const float *w, const std::size_t count);
+
+}  // namespace Utils
+
+Fft::Fft(const std::size_t size_) : size{size_}, m_twiddles(size_ - 1), m_bit_reversed(size_) {
+  assert(size > 1 and (size & (size - 1)) == 0);
+
+  for (std::size_t half = 1; half < size; half *= 2) {
+    for (std::size_t k = 0; k < half; ++k) {
+      const double angle =
+          -std::numbers::pi * static_cast<double>(k) / static_cast<double>(half);
+      m_twiddles[half - 1 + k] = {
+          static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle))
+      };
+    }
+  }
+
+  std::size_t bits = 0;
+  while ((std::size_t{1} << bits) < size)
+    ++bits;
+  for (std::size_t i = 0; i < size; ++i) {
+    std::size_t r = 0;
+    for (std::size_t b = 0; b < bits; ++b)
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    m_bit_reversed[i] = r;
+  }
+}
+
+void Fft::forward(std::span<const float> in, std::span<std::complex<float>> out) const {
+  assert(in.size() >= size and out.size() >= size);
+
+  for (std::size_t i = 0; i < size; ++i)
+    out[m_bit_reversed[i]] = {in[i], 0.0f};
+  transform(out.data(), size);
+}
+
+void Fft::forward_real(std::span<const float> in, std::span<std::complex<float>> out) const {
+  assert(in.size() >= size and out.size() >= size / 2 + 1);
+
+  // The bit reversal of an index below `half` over one bit less is half of it over all bits
+  const std::size_t half = size / 2;
+  for (std::size_t i = 0; i < half; ++i)
+    out[m_bit_reversed[i] / 2] = {in[2 * i], in[2 * i + 1]};
+  transform(out.data(), half);
+
+  // Split the transform of the packed signal into those of the even and odd samples,
+  // then merge them. Bins `k` and `half - k` are computed together, in place.
+  const std::complex<float> first = out[0];
+  out[0]    = {first.real() + first.imag(), 0.0f};
+  out[half] = {first.real() - first.imag(), 0.0f};
+  for (std::size_t k = 1; k <= half / 2; ++k) {
+    const std::complex<float> a = out[k];
+    const std::complex<float> b = std::conj(out[half - k]);
+    const std::complex<float> w = m_twiddles[half - 1 + k];
+    const float even_re         = 0.5f * (a.real() + b.real());
+    const float even_im         = 0.5f * (a.imag() + b.imag());
+    // (a - b) / 2i
+    const float odd_re = 0.5f * (a.imag() - b.imag());
+    const float odd_im = -0.5f * (a.real() - b.real());
+    const float t_re   = w.real() * odd_re - w.imag() * odd_im;
+    const float t_im   = w.real() * odd_im + w.imag() * odd_re;
+    out[k]             = {even_re + t_re, even_im + t_im};
+    out[half - k]      = {even_re - t_re, t_im - even_im};
+  }
+}
+
+void Fft::power_spectrum(
+    std::span<const float> in, std::span<float> out, std::span<std::complex<float>> scratch
+) const {
+  forward_real(in, scratch);
+  for (std::size_t i = 0; i <= size / 2; ++i)
+    out[i] = std::norm(scratch[i]);
+}
+
+void Fft::transform(std::complex<float> *data, const std::size_t count) const {
+  // The first stage's twiddle is 1
+  for (std::size_t start = 0; start + 1 < count; start += 2) {
+    const std::complex<float> t = data[start + 1];
+    data[start + 1]             = data[start] - t;
+    data[start] += t;
+  }
+
+  // std::complex<float> is laid out as float[2]
+  float *values = reinterpret_cast<float *>(data);
+  for (std::size_t half = 2; half < count; half *= 2) {
+    const float *twiddles = reinterpret_cast<const float *>(m_twiddles.data() + half - 1);
+    for (std::size_t start = 0; start < count; start += half * 2)
+      Utils::butterflies(values + 2 * start, values + 2 * (start + half), twiddles, half);
+  }
+}
+
+void hann_window(std::span<float> window) {
+  const double n = static_cast<double>(window.size());
+  for (std::size_t i = 0; i < window.size(); ++i) {
+    const double angle = 2.0 * std::numbers::pi * static_cast<double>(i) / n;
+    window[i]          = static_cast<float>(0.5 - 0.5 * std::cos(angle));
+  }
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::butterflies(float *a, float *b, const float *w, const std::size_t count) {
+#if defined(__SSE2__)
+  // Two complex values per vector, `count` is even past the first stage
+  const __m128 sign = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+  for (std::size_t k = 0; k < 2 * count; k += 4) {
+    const __m128 x       = _mm_loadu_ps(a + k);
+    const __m128 y       = _mm_loadu_ps(b + k);
+    const __m128 t       = _mm_loadu_ps(w + k);
+    const __m128 t_re    = _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m128 t_im    = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 1, 1));
+    const __m128 swapped = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+    const __m128 product =
+        _mm_add_ps(_mm_mul_ps(y, t_re), _mm_xor_ps(_mm_mul_ps(swapped, t_im), sign));
+    _mm_storeu_ps(a + k, _mm_add_ps(x, product));
+    _mm_storeu_ps(b + k, _mm_sub_ps(x, product));
+  }
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  const float32x4_t sign{-1.0f, 1.0f, -1.0f, 1.0f};
+  for (std::size_t k = 0; k < 2 * count; k += 4) {
+    const float32x4_t x       = vld1q_f32(a + k);
+    const float32x4_t y       = vld1q_f32(b + k);
+    const float32x4_t t       = vld1q_f32(w + k);
+    const float32x4_t t_re    = vtrn1q_f32(t, t);
+    const float32x4_t t_im    = vtrn2q_f32(t, t);
+    const float32x4_t swapped = vrev64q_f32(y);
+    const float32x4_t product = vmlaq_f32(vmulq_f32(y, t_re), vmulq_f32(swapped, t_im), sign);
+    vst1q_f32(a + k, vaddq_f32(x, product));
+    vst1q_f32(b + k, vsubq_f32(x, product));
+  }
+#else
+  for (std::size_t k = 0; k < 2 * count; k += 2) {
+    const float re = b[k] * w[k] - b[k + 1] * w[k + 1];
+    const float im = b[k] * w[k + 1] + b[k + 1] * w[k];
+    b[k]           = a[k] - re;
+    b[k + 1]       = a[k + 1] - im;
+    a[k] += re;
+    a[k + 1] += im;
+  }
+#endif
+}
+
+}  // namespace Tmupp
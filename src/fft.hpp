@@ -0,0 +1,66 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace Tmupp {
+
+/**
+  Radix-2 FFT of a fixed size, twiddles and the bit reversal permutation are
+  computed once so transforming doesn't allocate.
+
+  Butterflies run two at a time with SSE2 or NEON. Real signals are transformed as a
+  complex signal of half the size, the even samples being the real parts and the odd
+  ones the imaginary parts.
+*/
+class Fft {
+ public:
+  /**
+   * @param size_ A power of two.
+   */
+  explicit Fft(const std::size_t size_);
+
+  /**
+   * Transform `size` real samples, `out` must hold `size` values.
+   */
+  void forward(std::span<const float> in, std::span<std::complex<float>> out) const;
+
+  /**
+   * First `size / 2 + 1` bins of `size` real samples, `out` must hold as many values.
+   */
+  void forward_real(std::span<const float> in, std::span<std::complex<float>> out) const;
+
+  /**
+   * Squared magnitudes of the first `size / 2 + 1` bins of a real signal.
+   * @param scratch At least `size / 2 + 1` values.
+   */
+  void power_spectrum(
+      std::span<const float> in, std::span<float> out, std::span<std::complex<float>> scratch
+  ) const;
+
+ public:
+  const std::size_t size;
+
+ private:
+  /**
+   * In-place transform of `count` values (at most `size`) in bit reversed order.
+   */
+  void transform(std::complex<float> *data, const std::size_t count) const;
+
+ private:
+  /**
+   * Twiddles of each stage, those of the stage merging transforms of `half` values
+   * starting at `half - 1`.
+   */
+  std::vector<std::complex<float>> m_twiddles;
+  std::vector<std::size_t> m_bit_reversed;
+};
+
+/**
+ * Fill `window` with a periodic Hann window.
+ */
+void hann_window(std::span<float> window);
+
+}  // namespace Tmupp
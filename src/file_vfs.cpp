@@ -0,0 +1,366 @@
+#include "./file_vfs.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#endif
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * A file opened by a decoder, only used from the thread that opened it.
+ */
+class OpenFile {
+ public:
+  explicit OpenFile(const std::uint64_t size_) : size{size_} {}
+  virtual ~OpenFile() = default;
+
+  /**
+   * Returns the number of bytes read, 0 at the end of the file or once it failed.
+   */
+  virtual std::size_t read(std::uint8_t *dst, const std::size_t count) = 0;
+  virtual bool has_failed() const { return false; }
+
+  std::uint64_t get_position() const { return m_position; }
+  void seek(const std::uint64_t position) { m_position = position; }
+
+ public:
+  const std::uint64_t size;
+
+ protected:
+  std::uint64_t m_position = 0;
+};
+
+/**
+ * A local file, memory mapped.
+ */
+class MappedFile final : public OpenFile {
+ public:
+  MappedFile(void *data, const std::uint64_t size_)
+      : OpenFile{size_}, m_data{static_cast<const std::uint8_t *>(data)} {}
+  ~MappedFile() override {
+    if (m_data != nullptr)
+      munmap(const_cast<std::uint8_t *>(m_data), size);
+  }
+
+  std::size_t read(std::uint8_t *dst, const std::size_t count) override {
+    if (m_position >= size)
+      return 0;
+    const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(count, size - m_position));
+    std::memcpy(dst, m_data + m_position, n);
+    m_position += n;
+    return n;
+  }
+
+ private:
+  const std::uint8_t *m_data;
+};
+
+/**
+ * A file read in large blocks by a background thread, ahead of the decoder.
+ */
+class ReadAheadFile final : public OpenFile {
+ public:
+  ReadAheadFile(
+      const int fd, const std::uint64_t size_, const FileVfsConfig &config,
+      LatencyHistogram &fetches, std::atomic<std::uint64_t> &fetched_bytes
+  )
+      : OpenFile{size_},
+        m_fd{fd},
+        m_block_size{std::max<std::size_t>(config.block_size, 4096)},
+        m_blocks_ahead{std::max<std::size_t>(config.blocks_ahead, 1)},
+        m_fetches{fetches},
+        m_fetched_bytes{fetched_bytes} {
+    m_worker = std::jthread{[this](std::stop_token stop) { fetch_loop(stop); }};
+  }
+
+  ~ReadAheadFile() override {
+    m_worker.request_stop();
+    m_worker.join();
+    close(m_fd);
+  }
+
+  std::size_t read(std::uint8_t *dst, const std::size_t count) override {
+    std::unique_lock lock{m_mutex};
+    std::size_t done = 0;
+    while (done < count and m_position < size and not m_failed) {
+      const std::uint64_t index = m_position / m_block_size;
+      if (index != m_window) {
+        move_window(index);
+        m_worker_cv.notify_one();
+      }
+      const auto it = m_blocks.find(index);
+      if (it == m_blocks.end()) {
+        m_reader_cv.wait(lock);
+        continue;
+      }
+
+      const std::vector<std::uint8_t> &block = it->second;
+      const std::uint64_t offset             = m_position - index * m_block_size;
+      // The file got shorter since it was opened
+      if (offset >= block.size()) {
+        m_failed = true;
+        break;
+      }
+      const std::size_t n = std::min<std::size_t>(count - done, block.size() - offset);
+      std::memcpy(dst + done, block.data() + offset, n);
+      done += n;
+      m_position += n;
+    }
+    return done;
+  }
+
+  bool has_failed() const override {
+    std::lock_guard lock{m_mutex};
+    return m_failed;
+  }
+
+ private:
+  /**
+   * First block of the window missing, if any.
+   */
+  std::optional<std::uint64_t> get_missing_block() const {
+    for (std::uint64_t i = m_window; i < m_window + m_blocks_ahead and i * m_block_size < size;
+         ++i)
+      if (not m_blocks.contains(i))
+        return i;
+    return std::nullopt;
+  }
+
+  /**
+   * Make the window start at `index`, recycling the blocks that fell out of it.
+   */
+  void move_window(const std::uint64_t index) {
+    m_window = index;
+    for (auto it = m_blocks.begin(); it != m_blocks.end();) {
+      if (it->first >= m_window and it->first < m_window + m_blocks_ahead) {
+        ++it;
+        continue;
+      }
+      if (m_spare.size() < m_blocks_ahead)
+        m_spare.push_back(std::move(it->second));
+      it = m_blocks.erase(it);
+    }
+  }
+
+  void fetch_loop(std::stop_token stop) {
+    std::unique_lock lock{m_mutex};
+    while (not stop.stop_requested() and not m_failed) {
+      const std::optional<std::uint64_t> index = get_missing_block();
+      if (not index.has_value()) {
+        m_worker_cv.wait(lock, stop, [&] { return get_missing_block().has_value(); });
+        continue;
+      }
+
+      std::vector<std::uint8_t> block{};
+      if (not m_spare.empty()) {
+        block = std::move(m_spare.back());
+        m_spare.pop_back();
+      }
+      lock.unlock();
+      const bool ok = fetch(*index, block);
+      lock.lock();
+
+      if (not ok)
+        m_failed = true;
+      else if (*index >= m_window and *index < m_window + m_blocks_ahead)
+        m_blocks.emplace(*index, std::move(block));
+      m_reader_cv.notify_all();
+    }
+  }
+
+  /**
+   * Read the block `index` from the file, retrying short reads.
+   */
+  bool fetch(const std::uint64_t index, std::vector<std::uint8_t> &block) {
+    const std::uint64_t offset = index * m_block_size;
+    const auto wanted =
+        static_cast<std::size_t>(std::min<std::uint64_t>(m_block_size, size - offset));
+    block.resize(wanted);
+
+    ScopedLatency latency{m_fetches};
+    std::size_t done = 0;
+    while (done < wanted) {
+      const ssize_t n = pread(
+          m_fd, block.data() + done, wanted - done, static_cast<off_t>(offset + done)
+      );
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += static_cast<std::size_t>(n);
+    }
+    block.resize(done);
+    m_fetched_bytes.fetch_add(done, std::memory_order_relaxed);
+    return done > 0;
+  }
+
+ private:
+  const int m_fd;
+  const std::size_t m_block_size;
+  const std::size_t m_blocks_ahead;
+  LatencyHistogram &m_fetches;
+  std::atomic<std::uint64_t> &m_fetched_bytes;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_reader_cv;
+  std::condition_variable_any m_worker_cv;
+  /**
+   * First block the decoder needs, the worker reads the following ones.
+   */
+  std::uint64_t m_window = 0;
+  std::map<std::uint64_t, std::vector<std::uint8_t>> m_blocks;
+  std::vector<std::vector<std::uint8_t>> m_spare;
+  bool m_failed = false;
+
+  std::jthread m_worker;
+};
+
+/**
+ * Whether `fd` is on a filesystem where reads go over the network.
+ */
+static bool is_network_filesystem(const int fd);
+
+}  // namespace Utils
+
+FileVfs::FileVfs(const FileVfsConfig &config_) : config{config_} {
+  m_handle.callbacks = ma_vfs_callbacks{on_open, nullptr, on_close, on_read,
+                                        nullptr, on_seek, on_tell,  on_info};
+  m_handle.vfs       = this;
+}
+
+IoStats FileVfs::get_stats() const {
+  return IoStats{
+      m_reads.snapshot(), m_fetches.snapshot(), m_mapped_files.load(std::memory_order_relaxed),
+      m_streamed_files.load(std::memory_order_relaxed),
+      m_fetched_bytes.load(std::memory_order_relaxed)
+  };
+}
+
+ma_result FileVfs::on_open(ma_vfs *vfs, const char *path, ma_uint32 mode, ma_vfs_file *file) {
+  FileVfs &self = *static_cast<Handle *>(vfs)->vfs;
+  if ((mode & MA_OPEN_MODE_WRITE) != 0)
+    return MA_NOT_IMPLEMENTED;
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno == ENOENT ? MA_DOES_NOT_EXIST : (errno == EACCES ? MA_ACCESS_DENIED : MA_ERROR);
+  struct stat info{};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return MA_ERROR;
+  }
+  const auto size = static_cast<std::uint64_t>(info.st_size);
+  // Both the mapping and the read ahead go through the file in order
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  if (not Utils::is_network_filesystem(fd)) {
+    void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    if (data != MAP_FAILED) {
+      close(fd);
+      if (data != nullptr) {
+        madvise(data, size, MADV_SEQUENTIAL);
+        madvise(data, std::min<std::uint64_t>(size, self.config.block_size), MADV_WILLNEED);
+      }
+      *file = new Utils::MappedFile{data, size};
+      self.m_mapped_files.fetch_add(1, std::memory_order_relaxed);
+      return MA_SUCCESS;
+    }
+  }
+
+  *file = new Utils::ReadAheadFile{fd, size, self.config, self.m_fetches, self.m_fetched_bytes};
+  self.m_streamed_files.fetch_add(1, std::memory_order_relaxed);
+  return MA_SUCCESS;
+}
+
+ma_result FileVfs::on_close(ma_vfs * /*vfs*/, ma_vfs_file file) {
+  delete static_cast<Utils::OpenFile *>(file);
+  return MA_SUCCESS;
+}
+
+ma_result FileVfs::on_read(
+    ma_vfs *vfs, ma_vfs_file file, void *dst, size_t size, size_t *bytes_read
+) {
+  FileVfs &self = *static_cast<Handle *>(vfs)->vfs;
+  auto &f       = *static_cast<Utils::OpenFile *>(file);
+
+  ScopedLatency latency{self.m_reads};
+  const std::size_t n = f.read(static_cast<std::uint8_t *>(dst), size);
+  if (bytes_read != nullptr)
+    *bytes_read = n;
+  if (n == 0 and size > 0)
+    return f.has_failed() ? MA_IO_ERROR : MA_AT_END;
+  return MA_SUCCESS;
+}
+
+ma_result FileVfs::on_seek(
+    ma_vfs * /*vfs*/, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin
+) {
+  auto &f       = *static_cast<Utils::OpenFile *>(file);
+  ma_int64 base = 0;
+  if (origin == ma_seek_origin_current)
+    base = static_cast<ma_int64>(f.get_position());
+  else if (origin == ma_seek_origin_end)
+    base = static_cast<ma_int64>(f.size);
+  if (base + offset < 0)
+    return MA_INVALID_ARGS;
+  f.seek(static_cast<std::uint64_t>(base + offset));
+  return MA_SUCCESS;
+}
+
+ma_result FileVfs::on_tell(ma_vfs * /*vfs*/, ma_vfs_file file, ma_int64 *cursor) {
+  *cursor = static_cast<ma_int64>(static_cast<Utils::OpenFile *>(file)->get_position());
+  return MA_SUCCESS;
+}
+
+ma_result FileVfs::on_info(ma_vfs * /*vfs*/, ma_vfs_file file, ma_file_info *info) {
+  info->sizeInBytes = static_cast<Utils::OpenFile *>(file)->size;
+  return MA_SUCCESS;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static bool Utils::is_network_filesystem(const int fd) {
+#if defined(__linux__)
+  struct statfs info{};
+  if (fstatfs(fd, &info) != 0)
+    return false;
+  switch (static_cast<std::uint32_t>(info.f_type)) {
+    case 0x6969:      // NFS
+    case 0x517B:      // SMB
+    case 0xFF534D42:  // CIFS
+    case 0xFE534D42:  // SMB2
+    case 0x65735546:  // FUSE (sshfs, rclone...)
+    case 0x01021997:  // 9P
+    case 0x00C36400:  // Ceph
+    case 0x5346414F:  // AFS
+      return true;
+    default: return false;
+  }
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+}  // namespace Tmupp
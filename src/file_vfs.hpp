@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "miniaudio.h"
+
+#include "./histogram.hpp"
+
+namespace Tmupp {
+
+struct FileVfsConfig {
+  /**
+   * Bytes read at once from files on network filesystems.
+   */
+  std::size_t block_size = 1024 * 1024;
+  /**
+   * Blocks kept read ahead of the decoder on network filesystems.
+   */
+  std::size_t blocks_ahead = 4;
+};
+
+struct IoStats {
+  /**
+   * Every read made by a decoder, including waiting for a block.
+   */
+  LatencyHistogram::Snapshot reads;
+  /**
+   * Every block read from a network filesystem.
+   */
+  LatencyHistogram::Snapshot fetches;
+  std::uint64_t mapped_files   = 0;
+  std::uint64_t streamed_files = 0;
+  std::uint64_t fetched_bytes  = 0;
+};
+
+/**
+  `ma_vfs` for the decoders, pass `FileVfs::get()` to `ma_decoder_init_vfs()`.
+
+  Local files are memory mapped with sequential access hints, so the decoder's many
+  small reads are copies from the page cache. Files on network filesystems (NFS, SMB,
+  FUSE...) are read in `FileVfsConfig::block_size` blocks by a thread per file that
+  stays `FileVfsConfig::blocks_ahead` blocks ahead of the decoder, so that the decoder
+  only waits on the network after a seek.
+*/
+class FileVfs {
+ public:
+  explicit FileVfs(const FileVfsConfig &config_ = {});
+  FileVfs(const FileVfs &)            = delete;
+  FileVfs &operator=(const FileVfs &) = delete;
+
+  ma_vfs *get() { return &m_handle; }
+  IoStats get_stats() const;
+
+ public:
+  const FileVfsConfig config;
+
+ private:
+  /**
+   * What miniaudio gets as a `ma_vfs`, leading to us in its callbacks.
+   */
+  struct Handle {
+    ma_vfs_callbacks callbacks;
+    FileVfs *vfs;
+  };
+
+  static ma_result on_open(ma_vfs *vfs, const char *path, ma_uint32 mode, ma_vfs_file *file);
+  static ma_result on_close(ma_vfs *vfs, ma_vfs_file file);
+  static ma_result on_read(
+      ma_vfs *vfs, ma_vfs_file file, void *dst, size_t size, size_t *bytes_read
+  );
+  static ma_result on_seek(
+      ma_vfs *vfs, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin
+  );
+  static ma_result on_tell(ma_vfs *vfs, ma_vfs_file file, ma_int64 *cursor);
+  static ma_result on_info(ma_vfs *vfs, ma_vfs_file file, ma_file_info *info);
+
+ private:
+  Handle m_handle;
+  LatencyHistogram m_reads;
+  LatencyHistogram m_fetches;
+  std::atomic<std::uint64_t> m_mapped_files{0};
+  std::atomic<std::uint64_t> m_streamed_files{0};
+  std::atomic<std::uint64_t> m_fetched_bytes{0};
+};
+
+}  // namespace Tmupp
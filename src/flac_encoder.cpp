@@ -0,0 +1,473 @@
+#include "./flac_encoder.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+namespace Tmupp {
+
+static constexpr char flac_vendor[] = "tmupp";
+
+// Static helper functions
+namespace Utils {
+
+static std::uint8_t crc8(const std::uint8_t *data, const std::size_t size);
+static std::uint16_t crc16(const std::uint8_t *data, const std::size_t size);
+
+/**
+ * Signed residuals are Rice coded as 0, -1, 1, -2, 2...
+ */
+static std::uint32_t zigzag(const std::int32_t value);
+
+/**
+ * Smallest Rice parameter for `count` values summing to `sum` once zigzagged, and the bits
+ * it takes them, estimated from the sum.
+ */
+static std::pair<unsigned, std::uint64_t> get_rice_parameter(
+    const std::uint64_t sum, const std::uint64_t count
+);
+
+}  // namespace Utils
+
+bool FlacEncoder::open(
+    const std::string &path, const std::uint32_t sample_rate, const std::uint32_t channels,
+    const std::uint32_t bits_per_sample, const std::vector<std::string> &comments
+) {
+  if (sample_rate == 0 or sample_rate >= (1 << 20) or channels == 0 or
+      channels > max_channels or bits_per_sample < 8 or bits_per_sample > 24) {
+    spdlog::error(
+        "FLAC can't hold {} channels of {} bits at {} Hz", channels, bits_per_sample, sample_rate
+    );
+    return false;
+  }
+  m_file.open(path, std::ios::binary | std::ios::trunc);
+  if (not m_file) {
+    spdlog::error("Failed to create {}", path);
+    return false;
+  }
+  m_sample_rate     = sample_rate;
+  m_channels        = channels;
+  m_bits            = bits_per_sample;
+  m_block_used      = 0;
+  m_total_frames    = 0;
+  m_frame_number    = 0;
+  m_min_frame_bytes = std::numeric_limits<std::uint32_t>::max();
+  m_max_frame_bytes = 0;
+  m_block.resize(block_frames * channels);
+  // Mid and side besides left and right
+  m_planar.assign(channels == 2 ? 4 : channels, std::vector<std::int32_t>(block_frames));
+  m_residual.resize(block_frames);
+
+  m_file.write("fLaC", 4);
+  write_stream_info(0);
+
+  // Little endian lengths, unlike the rest of the format
+  std::vector<std::uint8_t> block{};
+  const auto append_string = [&block](const std::string_view text) {
+    const auto size = static_cast<std::uint32_t>(text.size());
+    for (unsigned i = 0; i < 4; ++i)
+      block.push_back(static_cast<std::uint8_t>(size >> (8 * i)));
+    block.insert(block.end(), text.begin(), text.end());
+  };
+  append_string(flac_vendor);
+  const auto count = static_cast<std::uint32_t>(comments.size());
+  for (unsigned i = 0; i < 4; ++i)
+    block.push_back(static_cast<std::uint8_t>(count >> (8 * i)));
+  for (const std::string &comment : comments)
+    append_string(comment);
+
+  // Last metadata block, of type VORBIS_COMMENT
+  const auto size              = static_cast<std::uint32_t>(block.size());
+  const std::uint8_t header[4] = {
+      0x80 | 4, static_cast<std::uint8_t>(size >> 16), static_cast<std::uint8_t>(size >> 8),
+      static_cast<std::uint8_t>(size)
+  };
+  m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+  m_file.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(size));
+  return static_cast<bool>(m_file);
+}
+
+bool FlacEncoder::write(const std::int32_t *samples, const std::size_t frame_count) {
+  std::size_t done = 0;
+  while (done < frame_count) {
+    const std::size_t count = std::min(frame_count - done, block_frames - m_block_used);
+    std::copy_n(
+        samples + done * m_channels, count * m_channels,
+        m_block.data() + m_block_used * m_channels
+    );
+    m_block_used += count;
+    done += count;
+    if (m_block_used == block_frames and not encode_block())
+      return false;
+  }
+  return true;
+}
+
+bool FlacEncoder::close() {
+  if (not m_file.is_open())
+    return false;
+  if (m_block_used > 0)
+    encode_block();
+  m_file.seekp(4);
+  write_stream_info(m_total_frames);
+  const bool written = static_cast<bool>(m_file);
+  m_file.close();
+  return written and not m_file.fail();
+}
+
+bool FlacEncoder::encode_block() {
+  const std::size_t frames = m_block_used;
+  for (std::size_t i = 0; i < frames; ++i)
+    for (std::uint32_t c = 0; c < m_channels; ++c)
+      m_planar[c][i] = m_block[i * m_channels + c];
+
+  // Channel assignment and which planes its subframes are, with their bits
+  unsigned assignment = m_channels - 1;
+  std::array<std::size_t, max_channels> planes{};
+  std::array<unsigned, max_channels> bits{};
+  std::array<Subframe, max_channels> subframes{};
+  for (std::uint32_t c = 0; c < m_channels; ++c) {
+    planes[c]    = c;
+    bits[c]      = m_bits;
+    subframes[c] = plan_subframe(m_planar[c].data(), frames, m_bits);
+  }
+  if (m_channels == 2) {
+    std::int32_t *mid  = m_planar[2].data();
+    std::int32_t *side = m_planar[3].data();
+    for (std::size_t i = 0; i < frames; ++i) {
+      // The low bit of the mid is the one of the side
+      mid[i]  = (m_planar[0][i] + m_planar[1][i]) >> 1;
+      side[i] = m_planar[0][i] - m_planar[1][i];
+    }
+    const Subframe mid_subframe  = plan_subframe(mid, frames, m_bits);
+    const Subframe side_subframe = plan_subframe(side, frames, m_bits + 1);
+    const std::uint64_t left     = subframes[0].bits;
+    const std::uint64_t right    = subframes[1].bits;
+    const std::uint64_t best     = std::min(
+        {left + right, left + side_subframe.bits, right + side_subframe.bits,
+         mid_subframe.bits + side_subframe.bits}
+    );
+    if (best == left + side_subframe.bits) {
+      assignment   = 8;
+      planes       = {0, 3};
+      bits         = {m_bits, m_bits + 1};
+      subframes[1] = side_subframe;
+    } else if (best == right + side_subframe.bits) {
+      assignment   = 9;
+      planes       = {3, 1};
+      bits         = {m_bits + 1, m_bits};
+      subframes[0] = side_subframe;
+    } else if (best == mid_subframe.bits + side_subframe.bits) {
+      assignment   = 10;
+      planes       = {2, 3};
+      bits         = {m_bits, m_bits + 1};
+      subframes[0] = mid_subframe;
+      subframes[1] = side_subframe;
+    }
+  }
+
+  BitWriter &writer = m_writer;
+  writer.bytes.clear();
+  writer.pending_bits = 0;
+  // Sync code, fixed block size, then a 16 bits block size at the end of the header, and
+  // the rate and sample size of the stream info
+  writer.write(0xfff8, 16);
+  writer.write(0b0111, 4);
+  writer.write(0b0000, 4);
+  writer.write(assignment, 4);
+  writer.write(0b000, 3);
+  writer.write(0, 1);
+  // Frame number coded as in UTF-8, extended to 36 bits
+  if (m_frame_number < 0x80) {
+    writer.write(m_frame_number, 8);
+  } else {
+    unsigned continuation = 1;
+    while (m_frame_number >> (6 * continuation + 6 - continuation) != 0)
+      ++continuation;
+    const auto lead = static_cast<std::uint8_t>(0xff00 >> (continuation + 1));
+    writer.write(lead | (m_frame_number >> (6 * continuation)), 8);
+    for (unsigned i = continuation; i-- > 0;)
+      writer.write(0x80 | ((m_frame_number >> (6 * i)) & 0x3f), 8);
+  }
+  writer.write(frames - 1, 16);
+  writer.write(Utils::crc8(writer.bytes.data(), writer.bytes.size()), 8);
+
+  for (std::uint32_t c = 0; c < m_channels; ++c)
+    write_subframe(m_planar[planes[c]].data(), frames, bits[c], subframes[c]);
+  writer.align();
+  const std::uint16_t crc = Utils::crc16(writer.bytes.data(), writer.bytes.size());
+  writer.write(crc, 16);
+
+  const auto size = static_cast<std::uint32_t>(writer.bytes.size());
+  m_min_frame_bytes = std::min(m_min_frame_bytes, size);
+  m_max_frame_bytes = std::max(m_max_frame_bytes, size);
+  m_file.write(reinterpret_cast<const char *>(writer.bytes.data()), size);
+  m_total_frames += frames;
+  ++m_frame_number;
+  m_block_used = 0;
+  return static_cast<bool>(m_file);
+}
+
+FlacEncoder::Subframe FlacEncoder::plan_subframe(
+    const std::int32_t *samples, const std::size_t frame_count, const unsigned bits
+) {
+  // Header (type and wasted bits flag)
+  constexpr std::uint64_t header_bits = 8;
+  Subframe subframe{};
+  subframe.bits = header_bits + std::uint64_t{bits} * frame_count;
+  if (std::all_of(samples, samples + frame_count, [&](const std::int32_t sample) {
+        return sample == samples[0];
+      })) {
+    subframe.kind = Subframe::Kind::Constant;
+    subframe.bits = header_bits + bits;
+    return subframe;
+  }
+
+  // The order whose residual is the smallest, measured on the samples all orders predict
+  const unsigned max_order = static_cast<unsigned>(std::min<std::size_t>(4, frame_count - 1));
+  std::array<std::uint64_t, 5> sums{};
+  for (std::size_t i = max_order; i < frame_count; ++i) {
+    const std::int64_t e0 = samples[i];
+    const std::int64_t e1 = e0 - samples[i - 1];
+    const std::int64_t e2 = max_order >= 2 ? e1 - (samples[i - 1] - samples[i - 2]) : 0;
+    const std::int64_t e3 =
+        max_order >= 3 ? e2 - (samples[i - 1] - 2 * std::int64_t{samples[i - 2]} + samples[i - 3])
+                       : 0;
+    const std::int64_t e4 =
+        max_order >= 4 ? e3 - (samples[i - 1] - 3 * std::int64_t{samples[i - 2]} +
+                               3 * std::int64_t{samples[i - 3]} - samples[i - 4])
+                       : 0;
+    sums[0] += static_cast<std::uint64_t>(std::llabs(e0));
+    sums[1] += static_cast<std::uint64_t>(std::llabs(e1));
+    sums[2] += static_cast<std::uint64_t>(std::llabs(e2));
+    sums[3] += static_cast<std::uint64_t>(std::llabs(e3));
+    sums[4] += static_cast<std::uint64_t>(std::llabs(e4));
+  }
+  const auto order = static_cast<unsigned>(
+      std::min_element(sums.begin(), sums.begin() + max_order + 1) - sums.begin()
+  );
+  compute_residual(samples, frame_count, order);
+
+  // Sums of the finest partitions, merged by two for each coarser partitioning
+  unsigned max_partition = 0;
+  while (max_partition < max_partition_order and frame_count % (2u << max_partition) == 0 and
+         (frame_count >> (max_partition + 1)) > order)
+    ++max_partition;
+  std::array<std::uint64_t, 1 << max_partition_order> partition_sums{};
+  const std::size_t partition_size = frame_count >> max_partition;
+  for (std::size_t i = order; i < frame_count; ++i)
+    partition_sums[i / partition_size] += Utils::zigzag(m_residual[i]);
+
+  std::uint64_t best_bits = std::numeric_limits<std::uint64_t>::max();
+  for (unsigned partition_order = max_partition;; --partition_order) {
+    const std::size_t partitions = std::size_t{1} << partition_order;
+    std::array<std::uint8_t, 1 << max_partition_order> parameters{};
+    std::uint64_t residual_bits = 0;
+    bool wide                   = false;
+    for (std::size_t p = 0; p < partitions; ++p) {
+      const std::size_t size = (frame_count >> partition_order) - (p == 0 ? order : 0);
+      const auto [parameter, bits_] = Utils::get_rice_parameter(partition_sums[p], size);
+      parameters[p] = static_cast<std::uint8_t>(parameter);
+      wide          = wide or parameter > 14;
+      residual_bits += bits_;
+    }
+    residual_bits += partitions * (wide ? 5 : 4);
+    if (residual_bits < best_bits) {
+      best_bits                = residual_bits;
+      subframe.partition_order = partition_order;
+      subframe.parameters      = parameters;
+      subframe.wide_parameters = wide;
+    }
+    if (partition_order == 0)
+      break;
+    for (std::size_t p = 0; p < partitions / 2; ++p)
+      partition_sums[p] = partition_sums[2 * p] + partition_sums[2 * p + 1];
+  }
+
+  // Warm up samples, then the coding method and partition order
+  const std::uint64_t fixed_bits = header_bits + std::uint64_t{order} * bits + 6 + best_bits;
+  if (fixed_bits < subframe.bits) {
+    subframe.kind  = Subframe::Kind::Fixed;
+    subframe.order = order;
+    subframe.bits  = fixed_bits;
+  }
+  return subframe;
+}
+
+void FlacEncoder::write_subframe(
+    const std::int32_t *samples, const std::size_t frame_count, const unsigned bits,
+    const Subframe &subframe
+) {
+  BitWriter &writer = m_writer;
+  const auto write_sample = [&](const std::int32_t sample) {
+    writer.write(static_cast<std::uint32_t>(sample), bits);
+  };
+  switch (subframe.kind) {
+    case Subframe::Kind::Constant:
+      writer.write(0b0'000000'0, 8);
+      write_sample(samples[0]);
+      return;
+    case Subframe::Kind::Verbatim:
+      writer.write(0b0'000001'0, 8);
+      for (std::size_t i = 0; i < frame_count; ++i)
+        write_sample(samples[i]);
+      return;
+    case Subframe::Kind::Fixed: break;
+  }
+
+  writer.write((0b001000 | subframe.order) << 1, 8);
+  for (std::size_t i = 0; i < subframe.order; ++i)
+    write_sample(samples[i]);
+  compute_residual(samples, frame_count, subframe.order);
+  writer.write(subframe.wide_parameters ? 0b01 : 0b00, 2);
+  writer.write(subframe.partition_order, 4);
+  const std::size_t partition_size = frame_count >> subframe.partition_order;
+  const unsigned parameter_bits    = subframe.wide_parameters ? 5 : 4;
+  std::size_t i                    = subframe.order;
+  for (std::size_t p = 0; p < (std::size_t{1} << subframe.partition_order); ++p) {
+    const unsigned parameter = subframe.parameters[p];
+    writer.write(parameter, parameter_bits);
+    for (const std::size_t end = (p + 1) * partition_size; i < end; ++i)
+      writer.write_rice(Utils::zigzag(m_residual[i]), parameter);
+  }
+}
+
+void FlacEncoder::compute_residual(
+    const std::int32_t *samples, const std::size_t frame_count, const unsigned order
+) {
+  std::int32_t *residual = m_residual.data();
+  // Differences of `order` consecutive samples, which fit in 32 bits for samples of up
+  // to 25 bits
+  for (std::size_t i = order; i < frame_count; ++i) {
+    const std::int64_t s0 = samples[i];
+    switch (order) {
+      case 0: residual[i] = static_cast<std::int32_t>(s0); break;
+      case 1: residual[i] = static_cast<std::int32_t>(s0 - samples[i - 1]); break;
+      case 2:
+        residual[i] = static_cast<std::int32_t>(
+            s0 - 2 * std::int64_t{samples[i - 1]} + samples[i - 2]
+        );
+        break;
+      case 3:
+        residual[i] = static_cast<std::int32_t>(
+            s0 - 3 * std::int64_t{samples[i - 1]} + 3 * std::int64_t{samples[i - 2]} -
+            samples[i - 3]
+        );
+        break;
+      default:
+        residual[i] = static_cast<std::int32_t>(
+            s0 - 4 * std::int64_t{samples[i - 1]} + 6 * std::int64_t{samples[i - 2]} -
+            4 * std::int64_t{samples[i - 3]} + samples[i - 4]
+        );
+        break;
+    }
+  }
+}
+
+void FlacEncoder::write_stream_info(const std::uint64_t total_frames) {
+  BitWriter writer{};
+  // Last block or not, type STREAMINFO, 34 bytes
+  writer.write(0x00, 8);
+  writer.write(34, 24);
+  writer.write(block_frames, 16);
+  writer.write(block_frames, 16);
+  writer.write(m_max_frame_bytes > 0 ? m_min_frame_bytes : 0, 24);
+  writer.write(m_max_frame_bytes, 24);
+  writer.write(m_sample_rate, 20);
+  writer.write(m_channels - 1, 3);
+  writer.write(m_bits - 1, 5);
+  writer.write(total_frames >> 32, 4);
+  writer.write(total_frames & 0xffffffff, 32);
+  // No MD5 of the audio
+  for (unsigned i = 0; i < 4; ++i)
+    writer.write(0, 32);
+
+  m_file.write(
+      reinterpret_cast<const char *>(writer.bytes.data()),
+      static_cast<std::streamsize>(writer.bytes.size())
+  );
+}
+
+void FlacEncoder::BitWriter::write(const std::uint64_t value, const unsigned bits) {
+  pending = (pending << bits) | (value & ((std::uint64_t{1} << bits) - 1));
+  pending_bits += bits;
+  while (pending_bits >= 8) {
+    pending_bits -= 8;
+    bytes.push_back(static_cast<std::uint8_t>(pending >> pending_bits));
+  }
+}
+
+void FlacEncoder::BitWriter::write_rice(const std::uint32_t value, const unsigned parameter) {
+  // The quotient in unary, as zeros ended by a one
+  std::uint32_t quotient = value >> parameter;
+  for (; quotient >= 32; quotient -= 32)
+    write(0, 32);
+  write(1, quotient + 1);
+  if (parameter > 0)
+    write(value, parameter);
+}
+
+void FlacEncoder::BitWriter::align() {
+  if (pending_bits > 0)
+    write(0, 8 - pending_bits);
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::uint8_t Utils::crc8(const std::uint8_t *data, const std::size_t size) {
+  // Polynomial x^8 + x^2 + x + 1
+  std::uint8_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (unsigned bit = 0; bit < 8; ++bit)
+      crc = static_cast<std::uint8_t>((crc & 0x80) != 0 ? (crc << 1) ^ 0x07 : crc << 1);
+  }
+  return crc;
+}
+
+static std::uint16_t Utils::crc16(const std::uint8_t *data, const std::size_t size) {
+  // Polynomial x^16 + x^15 + x^2 + 1, a byte at a time from a table
+  static const std::array<std::uint16_t, 256> table = [] {
+    std::array<std::uint16_t, 256> entries{};
+    for (unsigned i = 0; i < 256; ++i) {
+      auto crc = static_cast<std::uint16_t>(i << 8);
+      for (unsigned bit = 0; bit < 8; ++bit)
+        crc = static_cast<std::uint16_t>((crc & 0x8000) != 0 ? (crc << 1) ^ 0x8005 : crc << 1);
+      entries[i] = crc;
+    }
+    return entries;
+  }();
+  std::uint16_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i)
+    crc = static_cast<std::uint16_t>((crc << 8) ^ table[(crc >> 8) ^ data[i]]);
+  return crc;
+}
+
+static std::uint32_t Utils::zigzag(const std::int32_t value) {
+  return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+static std::pair<unsigned, std::uint64_t> Utils::get_rice_parameter(
+    const std::uint64_t sum, const std::uint64_t count
+) {
+  // Each value takes `parameter + 1` bits plus its quotient
+  unsigned parameter = 0;
+  std::uint64_t bits = count + sum;
+  while (parameter < 30) {
+    const std::uint64_t next = count * (parameter + 2) + (sum >> (parameter + 1));
+    if (next >= bits)
+      break;
+    ++parameter;
+    bits = next;
+  }
+  return {parameter, bits};
+}
+
+}  // namespace Tmupp
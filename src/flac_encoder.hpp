@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Tmupp {
+
+/**
+  Writes FLAC files, for exports (miniaudio only encodes WAV).
+
+  A small encoder rather than a full one: blocks of `block_frames` frames, each channel
+  predicted by the fixed polynomial predictor (order 0 to 4) with the smallest residual
+  and the residual Rice coded over the partitioning that takes the fewest bits, stereo
+  coded as left/side, right/side or mid/side when that's smaller. The stream info has no
+  MD5 of the audio, which the format allows.
+*/
+class FlacEncoder {
+ public:
+  FlacEncoder() = default;
+  FlacEncoder(const FlacEncoder &)            = delete;
+  FlacEncoder &operator=(const FlacEncoder &) = delete;
+
+  /**
+   * Create `path` for audio of `bits_per_sample` bits (8 to 24), tagged with `comments`
+   * ("KEY=value" Vorbis comments).
+   */
+  bool open(
+      const std::string &path, const std::uint32_t sample_rate, const std::uint32_t channels,
+      const std::uint32_t bits_per_sample, const std::vector<std::string> &comments
+  );
+  /**
+   * Encode `frame_count` interleaved frames of samples in the range of `bits_per_sample`.
+   */
+  bool write(const std::int32_t *samples, const std::size_t frame_count);
+  /**
+   * Encode the last block and complete the stream info, false if anything failed to be
+   * written since `open()`.
+   */
+  bool close();
+
+ public:
+  static constexpr std::size_t block_frames    = 4096;
+  static constexpr std::uint32_t max_channels   = 8;
+  static constexpr unsigned max_partition_order = 8;
+
+ private:
+  /**
+   * Bits of a frame or metadata block being encoded, most significant first.
+   */
+  struct BitWriter {
+    std::vector<std::uint8_t> bytes;
+    std::uint64_t pending = 0;
+    unsigned pending_bits = 0;
+
+    /**
+     * The low `bits` (at most 32) bits of `value`.
+     */
+    void write(const std::uint64_t value, const unsigned bits);
+    void write_rice(const std::uint32_t value, const unsigned parameter);
+    /**
+     * Pad with zeros to a whole byte.
+     */
+    void align();
+  };
+
+  /**
+   * How a channel of a block is encoded.
+   */
+  struct Subframe {
+    enum class Kind { Constant, Verbatim, Fixed };
+
+    Kind kind                = Kind::Verbatim;
+    unsigned order           = 0;
+    unsigned partition_order = 0;
+    /**
+     * Rice parameter of each partition, 5 bits wide if one of them is over 14.
+     */
+    std::array<std::uint8_t, 1 << max_partition_order> parameters{};
+    bool wide_parameters = false;
+    std::uint64_t bits   = 0;
+  };
+
+  bool encode_block();
+  /**
+   * Find the smallest encoding of `frame_count` samples of `bits` bits.
+   */
+  Subframe plan_subframe(
+      const std::int32_t *samples, const std::size_t frame_count, const unsigned bits
+  );
+  void write_subframe(
+      const std::int32_t *samples, const std::size_t frame_count, const unsigned bits,
+      const Subframe &subframe
+  );
+  /**
+   * Fill `m_residual` with the residual of the fixed predictor of `order`, from sample
+   * `order` on.
+   */
+  void compute_residual(
+      const std::int32_t *samples, const std::size_t frame_count, const unsigned order
+  );
+  void write_stream_info(const std::uint64_t total_frames);
+
+ private:
+  std::ofstream m_file;
+  std::uint32_t m_sample_rate = 0;
+  std::uint32_t m_channels    = 0;
+  std::uint32_t m_bits        = 0;
+  /**
+   * Interleaved frames waiting for a block to be complete.
+   */
+  std::vector<std::int32_t> m_block;
+  std::size_t m_block_used        = 0;
+  std::uint64_t m_total_frames    = 0;
+  std::uint64_t m_frame_number    = 0;
+  std::uint32_t m_min_frame_bytes = 0;
+  std::uint32_t m_max_frame_bytes = 0;
+
+  /**
+   * Channels of the block, followed by mid and side for stereo.
+   */
+  std::vector<std::vector<std::int32_t>> m_planar;
+  std::vector<std::int32_t> m_residual;
+  BitWriter m_writer;
+};
+
+}  // namespace Tmupp
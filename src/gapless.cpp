@@ -0,0 +1,238 @@
+#include "./gapless.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <span>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+namespace Tmupp {
+
+/**
+ * Delay of the MP3 synthesis filterbank, added by every decoder.
+ */
+static constexpr std::uint64_t decoder_delay = 529;
+/**
+ * Bytes read after the ID3v2 tag to find the first frame.
+ */
+static constexpr std::size_t frame_search_size = 8192;
+/**
+ * Larger tags are ignored rather than read in memory.
+ */
+static constexpr std::size_t max_tag_size = 16 * 1024 * 1024;
+
+// Static helper functions
+namespace Utils {
+
+struct FrameHeader {
+  std::size_t samples_per_frame;
+  /**
+   * Offset of the Xing/Info header from the start of the frame.
+   */
+  std::size_t xing_offset;
+};
+
+/**
+ * Size of the ID3v2 tag starting `data`, 0 if there's none.
+ */
+static std::size_t id3v2_size(std::span<const std::uint8_t> data);
+
+/**
+ * Read a 4 bytes integer, syncsafe ones only keep 7 bits per byte.
+ */
+static std::uint32_t read_u32(std::span<const std::uint8_t> data, const bool syncsafe);
+
+/**
+ * Parse the iTunSMPB comment of an ID3v2 tag, the info frame isn't counted in the delay.
+ */
+static std::optional<GaplessInfo> parse_itunsmpb(std::span<const std::uint8_t> tag);
+
+/**
+ * Parse the header of a MPEG layer III frame.
+ */
+static std::optional<FrameHeader> parse_frame_header(std::span<const std::uint8_t> data);
+
+/**
+ * Parse the Xing/Info header and LAME tag of the frame starting `data`.
+ * @param has_info_frame Set when the frame is a Xing/Info frame, even without a LAME tag.
+ */
+static std::optional<GaplessInfo> parse_lame_tag(
+    std::span<const std::uint8_t> data, const FrameHeader &header, bool &has_info_frame
+);
+
+}  // namespace Utils
+
+std::optional<GaplessInfo> read_gapless_info(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (not file)
+    return std::nullopt;
+
+  std::vector<std::uint8_t> tag(10);
+  file.read(reinterpret_cast<char *>(tag.data()), static_cast<std::streamsize>(tag.size()));
+  if (file.gcount() != 10)
+    return std::nullopt;
+  const std::size_t tag_size = Utils::id3v2_size(tag);
+  if (tag_size > max_tag_size)
+    return std::nullopt;
+
+  std::optional<GaplessInfo> itunsmpb{};
+  if (tag_size > 0) {
+    tag.resize(tag_size);
+    file.read(
+        reinterpret_cast<char *>(tag.data()) + 10, static_cast<std::streamsize>(tag_size - 10)
+    );
+    itunsmpb = Utils::parse_itunsmpb(tag);
+  } else {
+    file.seekg(0);
+  }
+
+  std::vector<std::uint8_t> data(frame_search_size);
+  file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()));
+  data.resize(static_cast<std::size_t>(file.gcount()));
+
+  // Skip whatever junk is between the tag and the first frame
+  for (std::size_t i = 0; i + 4 <= data.size(); ++i) {
+    const std::span<const std::uint8_t> frame = std::span{data}.subspan(i);
+    const std::optional<Utils::FrameHeader> header = Utils::parse_frame_header(frame);
+    if (not header.has_value())
+      continue;
+
+    bool has_info_frame                   = false;
+    const std::optional<GaplessInfo> lame = Utils::parse_lame_tag(frame, *header, has_info_frame);
+    if (lame.has_value())
+      return lame;
+    if (not itunsmpb.has_value() and not has_info_frame)
+      return std::nullopt;
+
+    GaplessInfo res = itunsmpb.value_or(GaplessInfo{});
+    if (has_info_frame)
+      res.delay += header->samples_per_frame;
+    return res;
+  }
+  return itunsmpb;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::size_t Utils::id3v2_size(std::span<const std::uint8_t> data) {
+  if (data.size() < 10 or data[0] != 'I' or data[1] != 'D' or data[2] != '3')
+    return 0;
+  // The footer flag adds another 10 bytes
+  const std::size_t footer = (data[5] & 0x10) != 0 ? 10 : 0;
+  return 10 + read_u32(data.subspan(6), true) + footer;
+}
+
+static std::uint32_t Utils::read_u32(std::span<const std::uint8_t> data, const bool syncsafe) {
+  const unsigned shift = syncsafe ? 7 : 8;
+  std::uint32_t res    = 0;
+  for (std::size_t i = 0; i < 4; ++i)
+    res = (res << shift) | (syncsafe ? data[i] & 0x7F : data[i]);
+  return res;
+}
+
+static std::optional<GaplessInfo> Utils::parse_itunsmpb(std::span<const std::uint8_t> tag) {
+  const std::uint8_t version = tag[3];
+  if (version != 3 and version != 4)
+    return std::nullopt;
+
+  std::size_t pos = 10;
+  // Extended header, its size includes itself in v2.4 but not in v2.3
+  if ((tag[5] & 0x40) != 0 and tag.size() >= 14)
+    pos += read_u32(tag.subspan(10), version == 4) + (version == 3 ? 4 : 0);
+
+  while (pos + 10 <= tag.size() and tag[pos] != 0) {
+    const std::string_view id{reinterpret_cast<const char *>(&tag[pos]), 4};
+    const std::size_t size = read_u32(tag.subspan(pos + 4), version == 4);
+    const std::size_t body = pos + 10;
+    if (body + size > tag.size())
+      break;
+    pos = body + size;
+    if (id != "COMM" or size < 5)
+      continue;
+
+    // Encoding, language, description then text, drop the zeros of UTF-16 since
+    // everything we look for is ASCII
+    std::string text{};
+    for (std::size_t i = body + 4; i < body + size; ++i)
+      if (tag[i] != 0 and tag[i] != 0xFF and tag[i] != 0xFE)
+        text += static_cast<char>(tag[i]);
+    if (not text.starts_with("iTunSMPB"))
+      continue;
+
+    std::istringstream ss{text.substr(8)};
+    std::uint64_t zero = 0, delay = 0, padding = 0, length = 0;
+    if (not(ss >> std::hex >> zero >> delay >> padding >> length))
+      return std::nullopt;
+    return GaplessInfo{delay, padding, length};
+  }
+  return std::nullopt;
+}
+
+static std::optional<Utils::FrameHeader> Utils::parse_frame_header(
+    std::span<const std::uint8_t> data
+) {
+  if (data.size() < 4 or data[0] != 0xFF or (data[1] & 0xE0) != 0xE0)
+    return std::nullopt;
+  const unsigned version = (data[1] >> 3) & 0x03;
+  const unsigned layer   = (data[1] >> 1) & 0x03;
+  const unsigned bitrate = data[2] >> 4;
+  const unsigned rate    = (data[2] >> 2) & 0x03;
+  // Reserved version, not layer III, free or bad bitrate, reserved sample rate
+  if (version == 1 or layer != 1 or bitrate == 0 or bitrate == 15 or rate == 3)
+    return std::nullopt;
+
+  // The Xing header follows the 4 bytes header and the side information
+  const bool mpeg1            = version == 3;
+  const bool mono             = (data[3] >> 6) == 3;
+  const std::size_t side_info = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+  return FrameHeader{mpeg1 ? std::size_t{1152} : std::size_t{576}, 4 + side_info};
+}
+
+static std::optional<GaplessInfo> Utils::parse_lame_tag(
+    std::span<const std::uint8_t> data, const FrameHeader &header, bool &has_info_frame
+) {
+  std::size_t pos = header.xing_offset;
+  if (pos + 8 > data.size())
+    return std::nullopt;
+  const std::string_view magic{reinterpret_cast<const char *>(&data[pos]), 4};
+  if (magic != "Xing" and magic != "Info")
+    return std::nullopt;
+  has_info_frame = true;
+
+  const std::uint32_t flags = read_u32(data.subspan(pos + 4), false);
+  pos += 8;
+  std::optional<std::uint32_t> frame_count{};
+  if ((flags & 0x1) != 0) {
+    if (pos + 4 > data.size())
+      return std::nullopt;
+    frame_count = read_u32(data.subspan(pos), false);
+    pos += 4;
+  }
+  pos += (flags & 0x2) != 0 ? 4 : 0;
+  pos += (flags & 0x4) != 0 ? 100 : 0;
+  pos += (flags & 0x8) != 0 ? 4 : 0;
+
+  // Encoder version, then the delay and padding as two 12 bits numbers 21 bytes in
+  if (pos + 24 > data.size())
+    return std::nullopt;
+  const std::string_view encoder{reinterpret_cast<const char *>(&data[pos]), 4};
+  if (encoder != "LAME" and encoder != "Lavf" and encoder != "Lavc")
+    return std::nullopt;
+  const std::uint64_t encoder_delay   = (data[pos + 21] << 4) | (data[pos + 22] >> 4);
+  const std::uint64_t encoder_padding = ((data[pos + 22] & 0x0F) << 8) | data[pos + 23];
+
+  GaplessInfo res{
+      header.samples_per_frame + encoder_delay + decoder_delay,
+      encoder_padding - std::min(encoder_padding, decoder_delay), std::nullopt
+  };
+  const std::uint64_t trimmed = encoder_delay + encoder_padding;
+  if (frame_count.has_value() and *frame_count * header.samples_per_frame > trimmed)
+    res.length = *frame_count * header.samples_per_frame - trimmed;
+  return res;
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace Tmupp {
+
+/**
+ * Frames an MP3 encoder added around the actual audio, counted at the file's sample rate.
+ */
+struct GaplessInfo {
+  /**
+   * Frames decoded before the audio: the Xing/Info frame (decoders output it as silence),
+   * the encoder delay and the decoder delay.
+   */
+  std::uint64_t delay = 0;
+  /**
+   * Frames decoded after the audio.
+   */
+  std::uint64_t padding = 0;
+  /**
+   * Frames of actual audio, when the file tells.
+   */
+  std::optional<std::uint64_t> length;
+};
+
+/**
+  Read the encoder delay and padding of an MP3 from its LAME tag (also written by
+  FFmpeg) or, failing that, from an iTunSMPB comment.
+
+  Returns nothing for files without either, or that aren't MP3s.
+*/
+std::optional<GaplessInfo> read_gapless_info(const std::string &path);
+
+}  // namespace Tmupp
@@ -0,0 +1,91 @@
+#include "./histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+
+namespace Tmupp {
+
+static constexpr std::size_t bar_width = 40;
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Upper bound in µs of a bucket.
+ */
+static double bucket_limit_us(const std::size_t bucket);
+
+}  // namespace Utils
+
+std::uint64_t LatencyHistogram::Snapshot::get_count() const {
+  std::uint64_t res = 0;
+  for (const std::uint64_t count : counts)
+    res += count;
+  return res;
+}
+
+double LatencyHistogram::Snapshot::get_mean_us() const {
+  const std::uint64_t count = get_count();
+  return count == 0 ? 0.0 : static_cast<double>(total_ns) / 1000.0 / static_cast<double>(count);
+}
+
+double LatencyHistogram::Snapshot::get_percentile_us(const double percentile) const {
+  const std::uint64_t count = get_count();
+  if (count == 0)
+    return 0.0;
+  const auto rank =
+      static_cast<std::uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * count));
+  std::uint64_t seen = 0;
+  for (std::size_t b = 0; b < bucket_count; ++b) {
+    seen += counts[b];
+    if (seen >= std::max<std::uint64_t>(rank, 1))
+      return std::min(Utils::bucket_limit_us(b), static_cast<double>(max_ns) / 1000.0);
+  }
+  return static_cast<double>(max_ns) / 1000.0;
+}
+
+std::string LatencyHistogram::Snapshot::to_string() const {
+  const std::uint64_t largest = *std::ranges::max_element(counts);
+  std::string res{};
+  for (std::size_t b = 0; b < bucket_count; ++b) {
+    if (counts[b] == 0)
+      continue;
+    const std::size_t width = std::max<std::size_t>(1, counts[b] * bar_width / largest);
+    res += std::format(
+        "  < {:>9.0f} us {:>10} {}\n", Utils::bucket_limit_us(b), counts[b], std::string(width, '#')
+    );
+  }
+  res += std::format(
+      "  count {} mean {:.1f} us p50 {:.0f} us p99 {:.0f} us max {:.1f} us\n", get_count(),
+      get_mean_us(), get_percentile_us(50.0), get_percentile_us(99.0),
+      static_cast<double>(max_ns) / 1000.0
+  );
+  return res;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot res{};
+  for (std::size_t b = 0; b < bucket_count; ++b)
+    res.counts[b] = m_counts[b].load(std::memory_order_relaxed);
+  res.total_ns = m_total_ns.load(std::memory_order_relaxed);
+  res.max_ns   = m_max_ns.load(std::memory_order_relaxed);
+  return res;
+}
+
+void LatencyHistogram::reset() {
+  for (std::atomic<std::uint64_t> &count : m_counts)
+    count.store(0, std::memory_order_relaxed);
+  m_total_ns.store(0, std::memory_order_relaxed);
+  m_max_ns.store(0, std::memory_order_relaxed);
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static double Utils::bucket_limit_us(const std::size_t bucket) {
+  return std::ldexp(1.0, static_cast<int>(bucket));
+}
+
+}  // namespace Tmupp
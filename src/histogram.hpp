@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Tmupp {
+
+/**
+  Histogram of durations in power of two buckets of microseconds: bucket 0 counts what
+  took less than 1 µs and bucket `i` what took [2^(i-1), 2^i) µs.
+
+  Recording never blocks, allocates or makes system calls so it can be done from the
+  audio callback, while another thread takes snapshots.
+*/
+class LatencyHistogram {
+ public:
+  /**
+   * The last bucket also counts everything above 2^22 µs (about 4 s).
+   */
+  static constexpr std::size_t bucket_count = 24;
+
+  struct Snapshot {
+    std::array<std::uint64_t, bucket_count> counts{};
+    std::uint64_t total_ns = 0;
+    std::uint64_t max_ns   = 0;
+
+    std::uint64_t get_count() const;
+    double get_mean_us() const;
+    /**
+     * Upper bound in µs of the bucket holding the `percentile` (0 to 100) duration.
+     */
+    double get_percentile_us(const double percentile) const;
+    /**
+     * One line per non empty bucket with a bar, then the mean, p50, p99 and max.
+     */
+    std::string to_string() const;
+  };
+
+ public:
+  void record(const std::chrono::nanoseconds duration) {
+    const auto ns       = static_cast<std::uint64_t>(std::max<std::int64_t>(0, duration.count()));
+    const std::size_t b = std::min<std::size_t>(std::bit_width(ns / 1000), bucket_count - 1);
+    m_counts[b].fetch_add(1, std::memory_order_relaxed);
+    m_total_ns.fetch_add(ns, std::memory_order_relaxed);
+    std::uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+    while (ns > max and not m_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+  }
+
+  Snapshot snapshot() const;
+  void reset();
+
+ private:
+  std::array<std::atomic<std::uint64_t>, bucket_count> m_counts{};
+  std::atomic<std::uint64_t> m_total_ns{0};
+  std::atomic<std::uint64_t> m_max_ns{0};
+};
+
+/**
+ * Measures the lifetime of the scope into a histogram.
+ */
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(LatencyHistogram &histogram_)
+      : m_histogram{histogram_}, m_start{std::chrono::steady_clock::now()} {}
+  ScopedLatency(const ScopedLatency &)            = delete;
+  ScopedLatency &operator=(const ScopedLatency &) = delete;
+  ~ScopedLatency() { m_histogram.record(std::chrono::steady_clock::now() - m_start); }
+
+ private:
+  LatencyHistogram &m_histogram;
+  const std::chrono::steady_clock::time_point m_start;
+};
+
+}  // namespace Tmupp
@@ -1,5 +1,10 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <functional>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "ftxui/component/component.hpp"
@@ -8,10 +13,33 @@
 #include "ftxui/component/screen_interactive.hpp"
 #include "ftxui/dom/elements.hpp"
 
-int main() {
+#include "./player.hpp"
+#include "./ui.hpp"
+#include "./visualizer.hpp"
+
+int main(int argc, char **argv) {
   using namespace ftxui;
   auto screen = ScreenInteractive::Fullscreen();
 
+  Tmupp::Player player{};
+  const std::string track = argc > 1 ? argv[1] : "";
+  if (not track.empty())
+    player.play(track);
+
+  // Asks for a redraw only when a bar or a meter visibly moved
+  Tmupp::Visualizer visualizer{player, {}, [&] { screen.PostEvent(Event::Custom); }};
+  Component visualizer_panel = Tmupp::make_visualizer_panel(visualizer);
+
+  // The stats overlay and the seek bar are redrawn a few times per second while they move
+  std::atomic<bool> show_stats{false};
+  std::jthread stats_refresh{[&](std::stop_token stop) {
+    while (not stop.stop_requested()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{250});
+      if (show_stats.load() or player.get_state() == Tmupp::Player::State::Playing)
+        screen.PostEvent(Event::Custom);
+    }
+  }};
+
   std::vector<std::string> left_menu_entries = {
       "0%",  "10%", "20%", "30%", "40%", "50%", "60%", "70%", "80%", "90%", "0%",  "10%", "20%",
       "30%", "40%", "50%", "60%", "70%", "80%", "90%", "0%",  "10%", "20%", "30%", "40%", "50%",
@@ -47,6 +75,23 @@ int main() {
       if (e.character() == "a") {
         left_menu_entries[0] = "Ayy!";
         return true;
+      } else if (e.character() == " ") {
+        player.toggle_pause();
+        return true;
+      } else if (e.character() == "v") {
+        visualizer.set_active(not visualizer.is_active());
+        return true;
+      } else if (e.character() == "[" or e.character() == "]") {
+        const float step = e.character() == "]" ? 0.25f : -0.25f;
+        player.set_speed(player.get_speed() + step);
+        return true;
+      } else if (e.character() == "o") {
+        show_stats = not show_stats;
+        return true;
+      } else if (e.character() == "D") {
+        // Appended, to compare period sizes across runs
+        std::ofstream{"tmupp_stats.txt", std::ios::app} << player.get_stats().to_string() << '\n';
+        return true;
       } else if (e.character() == "q") {
         screen.Exit();
         return true;
@@ -57,6 +102,16 @@ int main() {
 
   auto music_view_renderer = Renderer(container, [&] {
     int sum = left_menu_selected * 10 + right_menu_selected;
+    Element seek_bar = emptyElement();
+    if (not track.empty()) {
+      const std::optional<double> duration = player.get_duration();
+      const double progress =
+          duration.has_value() and *duration > 0.0 ? player.get_position() / *duration : 0.0;
+      seek_bar = vbox({
+          separator(),
+          Tmupp::render_seek_bar(player.get_waveforms().get(track), static_cast<float>(progress)),
+      });
+    }
     return vbox({
                // -------- Top panel --------------
                hbox({
@@ -74,10 +129,17 @@ int main() {
                        right_menu_->Render() | frame | flex,
                    }) | xflex_grow,
                }),
+               seek_bar,
                separator(),
+               visualizer.is_active() ? visualizer_panel->Render() : emptyElement(),
            }) |
            border;
   });
+  music_view_renderer |= Renderer([&](Element view) {
+    if (not show_stats)
+      return view;
+    return dbox({view, hbox({filler(), Tmupp::render_player_stats(player.get_stats())})});
+  });
 
   auto music_view_button = Button("Music", [&] { screen.Loop(music_view_renderer); });
   auto quit_button       = Button("Quit", screen.ExitLoopClosure());
@@ -1,2 +1,77 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "./seek_index.hpp"
+
+namespace Tmupp {
+
+static_assert(
+    sizeof(Mp3SeekPoint) == sizeof(ma_dr_mp3_seek_point) and
+    offsetof(Mp3SeekPoint, pcm_frame) == offsetof(ma_dr_mp3_seek_point, pcmFrameIndex) and
+    offsetof(Mp3SeekPoint, pcm_frames_to_discard) ==
+        offsetof(ma_dr_mp3_seek_point, pcmFramesToDiscard)
+);
+static_assert(
+    sizeof(FlacSeekPoint) == sizeof(ma_dr_flac_seekpoint) and
+    offsetof(FlacSeekPoint, byte_offset) == offsetof(ma_dr_flac_seekpoint, flacFrameOffset) and
+    offsetof(FlacSeekPoint, pcm_frame_count) == offsetof(ma_dr_flac_seekpoint, pcmFrameCount)
+);
+
+std::optional<SeekIndex> build_mp3_seek_index(const std::string &path) {
+  ma_dr_mp3 mp3{};
+  if (not ma_dr_mp3_init_file(&mp3, path.c_str(), nullptr))
+    return std::nullopt;
+
+  SeekIndex index{};
+  index.format         = ma_encoding_format_mp3;
+  ma_uint64 mp3_frames = 0;
+  ma_uint64 pcm_frames = 0;
+  bool ok = ma_dr_mp3_get_mp3_and_pcm_frame_count(&mp3, &mp3_frames, &pcm_frames) and
+            mp3_frames > 0;
+  index.length        = pcm_frames;
+  const auto interval = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(mp3.sampleRate * seek_point_interval_seconds)
+  );
+  auto point_count = static_cast<ma_uint32>(std::max<std::uint64_t>(1, index.length / interval));
+  index.mp3_points.resize(point_count);
+  ok = ok and ma_dr_mp3_calculate_seek_points(
+                  &mp3, &point_count,
+                  reinterpret_cast<ma_dr_mp3_seek_point *>(index.mp3_points.data())
+              );
+  ma_dr_mp3_uninit(&mp3);
+  if (not ok)
+    return std::nullopt;
+  index.mp3_points.resize(point_count);
+  return index;
+}
+
+bool bind_seek_index(ma_decoder &decoder, SeekIndex &index) {
+  if (decoder.pBackend == nullptr)
+    return false;
+  if (index.format == ma_encoding_format_mp3 and not index.mp3_points.empty()) {
+    auto *mp3 = static_cast<ma_mp3 *>(decoder.pBackend);
+    return ma_dr_mp3_bind_seek_table(
+        &mp3->dr, static_cast<ma_uint32>(index.mp3_points.size()),
+        reinterpret_cast<ma_dr_mp3_seek_point *>(index.mp3_points.data())
+    );
+  }
+  if (index.format == ma_encoding_format_flac and not index.flac_points.empty()) {
+    // dr_flac only knows the file's SEEKTABLE, point it to ours instead
+    ma_dr_flac *flac = static_cast<ma_flac *>(decoder.pBackend)->dr;
+    if (flac == nullptr or flac->container != ma_dr_flac_container_native)
+      return false;
+    flac->pSeekpoints      = reinterpret_cast<ma_dr_flac_seekpoint *>(index.flac_points.data());
+    flac->seekpointCount   = static_cast<ma_uint32>(index.flac_points.size());
+    flac->_noSeekTableSeek = MA_FALSE;
+    // Streamed encodes don't tell their length, and dr_flac doesn't seek past it
+    if (flac->totalPCMFrameCount == 0)
+      flac->totalPCMFrameCount = index.length;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,82 @@
+#include "./mix.hpp"
+
+#if defined(__AVX__) or defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Tmupp {
+
+#if defined(__AVX__)
+static constexpr std::size_t lanes = 8;
+#else
+static constexpr std::size_t lanes = 4;
+#endif
+
+void mix_ramped(
+    float *out, const float *a, const GainRamp ramp_a, const float *b, const GainRamp ramp_b,
+    const std::size_t frames, const std::size_t channels
+) {
+  const std::size_t count = frames * channels;
+  std::size_t i           = 0;
+
+  // Vectors hold whole frames when the channel count divides the lane count, each lane
+  // starts with the gain of its frame and moves by the frames a vector holds
+#if defined(__AVX__) or defined(__SSE2__) or (defined(__ARM_NEON) and defined(__aarch64__))
+  if (lanes % channels == 0) {
+    alignas(32) float gains_a[lanes];
+    alignas(32) float gains_b[lanes];
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      const auto frame = static_cast<float>(lane / channels);
+      gains_a[lane]    = ramp_a.gain + frame * ramp_a.step;
+      gains_b[lane]    = ramp_b.gain + frame * ramp_b.step;
+    }
+    const auto frames_per_vector = static_cast<float>(lanes / channels);
+#if defined(__AVX__)
+    __m256 ga       = _mm256_load_ps(gains_a);
+    __m256 gb       = _mm256_load_ps(gains_b);
+    const __m256 da = _mm256_set1_ps(frames_per_vector * ramp_a.step);
+    const __m256 db = _mm256_set1_ps(frames_per_vector * ramp_b.step);
+    for (; i + lanes <= count; i += lanes) {
+      const __m256 va = _mm256_mul_ps(_mm256_loadu_ps(a + i), ga);
+      const __m256 vb = _mm256_mul_ps(_mm256_loadu_ps(b + i), gb);
+      _mm256_storeu_ps(out + i, _mm256_add_ps(va, vb));
+      ga = _mm256_add_ps(ga, da);
+      gb = _mm256_add_ps(gb, db);
+    }
+#elif defined(__SSE2__)
+    __m128 ga       = _mm_load_ps(gains_a);
+    __m128 gb       = _mm_load_ps(gains_b);
+    const __m128 da = _mm_set1_ps(frames_per_vector * ramp_a.step);
+    const __m128 db = _mm_set1_ps(frames_per_vector * ramp_b.step);
+    for (; i + lanes <= count; i += lanes) {
+      const __m128 va = _mm_mul_ps(_mm_loadu_ps(a + i), ga);
+      const __m128 vb = _mm_mul_ps(_mm_loadu_ps(b + i), gb);
+      _mm_storeu_ps(out + i, _mm_add_ps(va, vb));
+      ga = _mm_add_ps(ga, da);
+      gb = _mm_add_ps(gb, db);
+    }
+#else
+    float32x4_t ga       = vld1q_f32(gains_a);
+    float32x4_t gb       = vld1q_f32(gains_b);
+    const float32x4_t da = vdupq_n_f32(frames_per_vector * ramp_a.step);
+    const float32x4_t db = vdupq_n_f32(frames_per_vector * ramp_b.step);
+    for (; i + lanes <= count; i += lanes) {
+      const float32x4_t va = vmulq_f32(vld1q_f32(a + i), ga);
+      vst1q_f32(out + i, vfmaq_f32(va, vld1q_f32(b + i), gb));
+      ga = vaddq_f32(ga, da);
+      gb = vaddq_f32(gb, db);
+    }
+#endif
+  }
+#endif
+
+  for (; i < count; ++i) {
+    const auto frame = static_cast<float>(i / channels);
+    out[i] =
+        a[i] * (ramp_a.gain + frame * ramp_a.step) + b[i] * (ramp_b.gain + frame * ramp_b.step);
+  }
+}
+
+}  // namespace Tmupp
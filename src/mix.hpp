@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Tmupp {
+
+/**
+ * A gain changing linearly, `step` being added every frame.
+ */
+struct GainRamp {
+  float gain = 0.0f;
+  float step = 0.0f;
+};
+
+/**
+ * Write `a * ramp_a + b * ramp_b` over `frames` interleaved frames of `channels` to `out`.
+ */
+void mix_ramped(
+    float *out, const float *a, const GainRamp ramp_a, const float *b, const GainRamp ramp_b,
+    const std::size_t frames, const std::size_t channels
+);
+
+}  // namespace Tmupp
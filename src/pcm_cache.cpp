@@ -0,0 +1,226 @@
+#include "./pcm_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+namespace Tmupp {
+
+static constexpr std::size_t min_chunk_bytes = 4096;
+
+// Static helper functions
+namespace Utils {
+
+static void to_s16(const float *in, std::int16_t *out, const std::size_t count);
+
+static void from_s16(const std::int16_t *in, float *out, const std::size_t count);
+
+/**
+ * Integers widened to the 32 bits of a float to 16 bits and back, see `Key::native`.
+ */
+static void narrow_to_s16(const float *in, std::int16_t *out, const std::size_t count);
+
+static void widen_from_s16(const std::int16_t *in, float *out, const std::size_t count);
+
+}  // namespace Utils
+
+PcmCache::PcmCache(const PcmCacheConfig &config_)
+    : config{config_},
+      m_chunk_bytes{std::max(config.chunk_bytes, min_chunk_bytes)},
+      m_max_chunks{config.capacity_bytes / m_chunk_bytes} {}
+
+PcmCache::Entry *PcmCache::acquire(const Key &key) {
+  if (const auto it = m_index.find(key); it != m_index.end()) {
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    ++it->second->pins;
+    return &*it->second;
+  }
+  const auto frames_per_chunk = static_cast<std::uint32_t>(
+      std::max<std::size_t>(1, m_chunk_bytes / (std::max(key.channels, 1u) * get_sample_size()))
+  );
+  m_entries.push_front(Entry{key, frames_per_chunk, {}, std::nullopt, 1});
+  m_index.emplace(key, m_entries.begin());
+  m_entry_count.fetch_add(1, std::memory_order_relaxed);
+  return &m_entries.front();
+}
+
+void PcmCache::release(Entry *entry) {
+  if (entry == nullptr or --entry->pins > 0)
+    return;
+  // Nothing worth remembering
+  const auto has_data = [](const Entry::Chunk &chunk) { return chunk.data != nullptr; };
+  if (std::ranges::none_of(entry->chunks, has_data)) {
+    const auto it = m_index.find(entry->key);
+    m_entries.erase(it->second);
+    m_index.erase(it);
+    m_entry_count.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+std::uint64_t PcmCache::read(
+    Entry &entry, const std::uint64_t frame, float *out, const std::uint64_t count
+) {
+  const std::size_t channels = entry.key.channels;
+  std::uint64_t done         = 0;
+  while (done < count) {
+    const std::uint64_t position = frame + done;
+    const std::uint64_t index    = position / entry.frames_per_chunk;
+    if (index >= entry.chunks.size())
+      break;
+    const Entry::Chunk &chunk  = entry.chunks[index];
+    const std::uint64_t offset = position - index * entry.frames_per_chunk;
+    if (chunk.data == nullptr or offset >= chunk.frames)
+      break;
+
+    const std::uint64_t n     = std::min(count - done, chunk.frames - offset);
+    const std::size_t samples = n * channels;
+    const std::byte *src      = chunk.data + offset * channels * get_sample_size();
+    if (config.format == PcmCacheFormat::S16 and entry.key.native)
+      Utils::widen_from_s16(
+          reinterpret_cast<const std::int16_t *>(src), out + done * channels, samples
+      );
+    else if (config.format == PcmCacheFormat::S16)
+      Utils::from_s16(reinterpret_cast<const std::int16_t *>(src), out + done * channels, samples);
+    else
+      std::memcpy(out + done * channels, src, samples * sizeof(float));
+    done += n;
+  }
+  m_hit_frames.fetch_add(done, std::memory_order_relaxed);
+  return done;
+}
+
+bool PcmCache::contains(const Entry &entry, const std::uint64_t frame) const {
+  const std::uint64_t index = frame / entry.frames_per_chunk;
+  return index < entry.chunks.size() and entry.chunks[index].data != nullptr and
+         frame - index * entry.frames_per_chunk < entry.chunks[index].frames;
+}
+
+void PcmCache::write(
+    Entry &entry, const std::uint64_t frame, const float *in, const std::uint64_t count
+) {
+  m_miss_frames.fetch_add(count, std::memory_order_relaxed);
+  const std::size_t channels = entry.key.channels;
+  std::uint64_t done         = 0;
+  while (done < count) {
+    const std::uint64_t position = frame + done;
+    const std::uint64_t index    = position / entry.frames_per_chunk;
+    const std::uint64_t offset   = position - index * entry.frames_per_chunk;
+    const std::uint64_t n        = std::min(count - done, entry.frames_per_chunk - offset);
+    if (index >= entry.chunks.size())
+      entry.chunks.resize(index + 1);
+    Entry::Chunk &chunk = entry.chunks[index];
+
+    // Only what extends the chunk without leaving a hole
+    if (offset <= chunk.frames and offset + n > chunk.frames) {
+      if (chunk.data == nullptr) {
+        chunk.data = allocate_chunk();
+        if (chunk.data == nullptr)
+          return;
+        m_used_chunks.fetch_add(1, std::memory_order_relaxed);
+      }
+      const std::uint64_t skipped = chunk.frames - offset;
+      const float *src            = in + (done + skipped) * channels;
+      const std::size_t samples   = (n - skipped) * channels;
+      std::byte *dst              = chunk.data + chunk.frames * channels * get_sample_size();
+      if (config.format == PcmCacheFormat::S16 and entry.key.native)
+        Utils::narrow_to_s16(src, reinterpret_cast<std::int16_t *>(dst), samples);
+      else if (config.format == PcmCacheFormat::S16)
+        Utils::to_s16(src, reinterpret_cast<std::int16_t *>(dst), samples);
+      else
+        std::memcpy(dst, src, samples * sizeof(float));
+      chunk.frames = static_cast<std::uint32_t>(offset + n);
+    }
+    done += n;
+  }
+}
+
+PcmCacheStats PcmCache::get_stats() const {
+  return PcmCacheStats{
+      m_hit_frames.load(std::memory_order_relaxed),
+      m_miss_frames.load(std::memory_order_relaxed),
+      m_evicted_entries.load(std::memory_order_relaxed),
+      m_entry_count.load(std::memory_order_relaxed),
+      m_used_chunks.load(std::memory_order_relaxed) * m_chunk_bytes,
+      m_reserved_chunks.load(std::memory_order_relaxed) * m_chunk_bytes
+  };
+}
+
+std::size_t PcmCache::KeyHash::operator()(const Key &key) const {
+  const std::size_t format = (std::size_t{key.sample_rate} << 9) |
+                             (std::size_t{key.channels} << 1) | std::size_t{key.native};
+  return std::hash<std::string>{}(key.path) ^ (format * 0x9E3779B97F4A7C15) ^
+         (key.start_frame * 0xC2B2AE3D27D4EB4F);
+}
+
+std::byte *PcmCache::allocate_chunk() {
+  const std::size_t reserved = m_reserved_chunks.load(std::memory_order_relaxed);
+  if (m_free_chunks.empty() and reserved < m_max_chunks) {
+    const std::size_t count = std::min(chunks_per_block, m_max_chunks - reserved);
+    // Not value initialised, pages are only touched once used
+    m_blocks.emplace_back(new std::byte[count * m_chunk_bytes]);
+    for (std::size_t i = 0; i < count; ++i)
+      m_free_chunks.push_back(m_blocks.back().get() + i * m_chunk_bytes);
+    m_reserved_chunks.store(reserved + count, std::memory_order_relaxed);
+  }
+
+  // Evict the least recently used tracks no one reads
+  for (auto it = m_entries.end(); m_free_chunks.empty() and it != m_entries.begin();) {
+    --it;
+    if (it->pins > 0)
+      continue;
+    free_entry(*it);
+    m_index.erase(it->key);
+    it = m_entries.erase(it);
+    m_entry_count.fetch_sub(1, std::memory_order_relaxed);
+    m_evicted_entries.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (m_free_chunks.empty())
+    return nullptr;
+  std::byte *chunk = m_free_chunks.back();
+  m_free_chunks.pop_back();
+  return chunk;
+}
+
+void PcmCache::free_entry(Entry &entry) {
+  for (Entry::Chunk &chunk : entry.chunks) {
+    if (chunk.data == nullptr)
+      continue;
+    m_free_chunks.push_back(chunk.data);
+    m_used_chunks.fetch_sub(1, std::memory_order_relaxed);
+  }
+  entry.chunks.clear();
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::to_s16(const float *in, std::int16_t *out, const std::size_t count) {
+  // Scaled like miniaudio's s16 to f32 conversion, so that 16 bits audio comes back exact
+  for (std::size_t i = 0; i < count; ++i)
+    out[i] =
+        static_cast<std::int16_t>(std::lrint(std::clamp(in[i] * 32768.0f, -32768.0f, 32767.0f)));
+}
+
+static void Utils::from_s16(const std::int16_t *in, float *out, const std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i)
+    out[i] = static_cast<float>(in[i]) * (1.0f / 32768.0f);
+}
+
+static void Utils::narrow_to_s16(const float *in, std::int16_t *out, const std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    std::int32_t value = 0;
+    std::memcpy(&value, in + i, sizeof(value));
+    out[i] = static_cast<std::int16_t>(value);
+  }
+}
+
+static void Utils::widen_from_s16(const std::int16_t *in, float *out, const std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::int32_t value = in[i];
+    std::memcpy(out + i, &value, sizeof(value));
+  }
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Tmupp {
+
+enum class PcmCacheFormat {
+  /**
+   * Half the memory, and exact for 16 bits tracks played at their own rate. Others are
+   * rounded to 16 bits without dither, and replay below the quality they first played at.
+   */
+  S16,
+  F32,
+};
+
+struct PcmCacheConfig {
+  /**
+   * Memory for the cached audio, 0 to disable the cache.
+   */
+  std::size_t capacity_bytes = 256 * 1024 * 1024;
+  /**
+   * Unit of allocation, tracks are cached by aligned chunks of this size.
+   */
+  std::size_t chunk_bytes = 256 * 1024;
+  PcmCacheFormat format = PcmCacheFormat::F32;
+};
+
+struct PcmCacheStats {
+  /**
+   * Frames served from the cache.
+   */
+  std::uint64_t hit_frames = 0;
+  /**
+   * Frames that had to be decoded.
+   */
+  std::uint64_t miss_frames = 0;
+  std::uint64_t evicted_entries = 0;
+  std::size_t entries           = 0;
+  /**
+   * Bytes of chunks holding audio.
+   */
+  std::size_t used_bytes = 0;
+  /**
+   * Bytes allocated by the arena, never more than `PcmCacheConfig::capacity_bytes`.
+   */
+  std::size_t reserved_bytes = 0;
+};
+
+/**
+  Decoded audio of the recently played and upcoming tracks, so that jumping back to one
+  or seeking in it doesn't decode it again.
+
+  Tracks are keyed by path and output format, and stored interleaved in fixed-size
+  chunks taken from an arena that grows by blocks up to the capacity. When it's full,
+  the least recently used tracks that no one reads are evicted whole.
+
+  Only used by one thread (the player's decoder), except for `get_stats()`.
+*/
+class PcmCache {
+ public:
+  struct Key {
+    std::string path;
+    std::uint32_t sample_rate;
+    std::uint32_t channels;
+    /**
+     * Whether the samples are integers of the track's own format widened to 32 bits rather
+     * than floats (see `PlayerConfig::bit_perfect`), kept as they are in 16 bits, which
+     * only 8 and 16 bits ones fit, by `PcmCacheFormat::S16`.
+     */
+    bool native = false;
+    /**
+     * Frames of the decoded stream the track starts after, which trims change.
+     */
+    std::uint64_t start_frame = 0;
+
+    bool operator==(const Key &) const = default;
+  };
+
+  struct Entry {
+    struct Chunk {
+      std::byte *data = nullptr;
+      /**
+       * Frames stored from the start of the chunk.
+       */
+      std::uint32_t frames = 0;
+    };
+
+    Key key;
+    std::uint32_t frames_per_chunk;
+    std::vector<Chunk> chunks;
+    /**
+     * Set once the end of the track was decoded.
+     */
+    std::optional<std::uint64_t> length;
+    /**
+     * Number of readers, the entry can't be evicted while it has some.
+     */
+    std::size_t pins = 0;
+  };
+
+ public:
+  explicit PcmCache(const PcmCacheConfig &config_ = {});
+  PcmCache(const PcmCache &)            = delete;
+  PcmCache &operator=(const PcmCache &) = delete;
+
+  /**
+   * The entry of `key`, created empty if needed, pinned until `release()`.
+   */
+  Entry *acquire(const Key &key);
+  void release(Entry *entry);
+
+  /**
+   * Copy up to `count` frames starting at `frame`, returns how many were cached
+   * contiguously from there.
+   */
+  std::uint64_t read(
+      Entry &entry, const std::uint64_t frame, float *out, const std::uint64_t count
+  );
+  /**
+   * Whether `frame` is cached.
+   */
+  bool contains(const Entry &entry, const std::uint64_t frame) const;
+  /**
+   * Store `count` decoded frames starting at `frame`. Frames that would leave a hole in a
+   * chunk (after a seek into its middle) are skipped.
+   */
+  void write(Entry &entry, const std::uint64_t frame, const float *in, const std::uint64_t count);
+  void set_length(Entry &entry, const std::uint64_t length) { entry.length = length; }
+
+  PcmCacheStats get_stats() const;
+
+ public:
+  /**
+   * Chunks allocated at once by the arena.
+   */
+  static constexpr std::size_t chunks_per_block = 16;
+
+  const PcmCacheConfig config;
+
+ private:
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const;
+  };
+
+  std::size_t get_sample_size() const { return config.format == PcmCacheFormat::S16 ? 2 : 4; }
+  /**
+   * A free chunk, evicting tracks if needed, nullptr if all the memory is pinned.
+   */
+  std::byte *allocate_chunk();
+  void free_entry(Entry &entry);
+
+ private:
+  const std::size_t m_chunk_bytes;
+  const std::size_t m_max_chunks;
+  std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+  std::vector<std::byte *> m_free_chunks;
+  /**
+   * Most recently used first.
+   */
+  std::list<Entry> m_entries;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+  std::atomic<std::uint64_t> m_hit_frames{0};
+  std::atomic<std::uint64_t> m_miss_frames{0};
+  std::atomic<std::uint64_t> m_evicted_entries{0};
+  std::atomic<std::size_t> m_entry_count{0};
+  std::atomic<std::size_t> m_used_chunks{0};
+  std::atomic<std::size_t> m_reserved_chunks{0};
+};
+
+}  // namespace Tmupp
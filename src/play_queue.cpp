@@ -0,0 +1,429 @@
+#include "./play_queue.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <format>
+
+#include <spdlog/spdlog.h>
+
+#include "midx.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+static constexpr char snapshot_magic[8]      = {'T', 'M', 'U', 'P', 'P', 'Q', 'U', 'E'};
+static constexpr char journal_magic[8]       = {'T', 'M', 'U', 'P', 'P', 'J', 'N', 'L'};
+static constexpr std::uint32_t queue_version = 1;
+
+/**
+ * The journal is folded into a snapshot once it's larger than both this and the queue.
+ */
+static constexpr std::uint64_t min_compaction_bytes = 1 << 20;
+/**
+ * Entries a journal record may insert, more means it's damaged.
+ */
+static constexpr std::uint64_t max_record_entries = 1 << 26;
+/**
+ * Unused entry ids tolerated past twice the entries of the queue.
+ */
+static constexpr std::uint64_t renumber_slack = 1 << 16;
+
+// Static helper functions
+namespace Utils {
+
+struct SnapshotHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t current;
+  std::uint64_t generation;
+  std::uint32_t next_entry_id;
+  std::uint32_t reserved;
+  std::uint64_t count;
+};
+
+struct JournalHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t generation;
+};
+
+/**
+ * Followed by the entries of an insert.
+ */
+struct JournalRecord {
+  std::uint32_t kind;
+  std::uint32_t reserved;
+  std::uint64_t position;
+  std::uint64_t count;
+  std::uint64_t target;
+};
+
+}  // namespace Utils
+
+PlayQueue::PlayQueue(const std::string &directory_)
+    : directory{
+          not directory_.empty() or Midx::data_dir.empty()
+              ? directory_
+              : std::format("{}/queue", Midx::data_dir)
+      } {
+  if (directory.empty())
+    return;
+  std::error_code ec{};
+  fs::create_directories(directory, ec);
+  if (ec) {
+    spdlog::error("Failed to create {}: {}", directory, ec.message());
+    return;
+  }
+  if (not load()) {
+    compact();
+    return;
+  }
+  m_journal.open(get_journal_path(), std::ios::binary | std::ios::app);
+  if (not m_journal)
+    spdlog::error("Failed to open the queue journal {}", get_journal_path());
+}
+
+std::optional<std::size_t> PlayQueue::find(const std::uint32_t entry_id) {
+  const auto lookup = [&]() -> std::optional<std::size_t> {
+    if (entry_id >= m_positions.size())
+      return std::nullopt;
+    const std::size_t position = m_positions[entry_id];
+    if (position >= m_entries.size() or m_entries[position].entry_id != entry_id)
+      return std::nullopt;
+    return position;
+  };
+  if (const std::optional<std::size_t> position = lookup(); position.has_value())
+    return position;
+  // Index what moved since the last lookup
+  m_positions.resize(m_next_entry_id, no_entry);
+  for (; m_indexed < m_entries.size(); ++m_indexed)
+    m_positions[m_entries[m_indexed].entry_id] = static_cast<std::uint32_t>(m_indexed);
+  return lookup();
+}
+
+std::optional<std::size_t> PlayQueue::get_current() {
+  if (m_current == no_entry)
+    return std::nullopt;
+  return find(m_current);
+}
+
+void PlayQueue::insert(const std::size_t position, std::span<const std::int32_t> track_ids) {
+  if (track_ids.empty())
+    return;
+  Operation operation{Operation::Kind::Insert, std::min(position, size()), 0, 0, {}};
+  operation.entries.reserve(track_ids.size());
+  for (const std::int32_t track_id : track_ids)
+    operation.entries.push_back(QueueEntry{track_id, m_next_entry_id++});
+  commit(operation);
+}
+
+void PlayQueue::remove(const std::size_t position, const std::size_t count) {
+  if (position >= size() or count == 0)
+    return;
+  commit(Operation{Operation::Kind::Remove, position, std::min(count, size() - position), 0, {}});
+}
+
+void PlayQueue::move(
+    const std::size_t position, const std::size_t count, const std::size_t target
+) {
+  if (position >= size() or count == 0)
+    return;
+  const std::size_t moved = std::min(count, size() - position);
+  if (const std::size_t to = std::min(target, size() - moved); to != position)
+    commit(Operation{Operation::Kind::Move, position, moved, to, {}});
+}
+
+void PlayQueue::jump(const std::size_t position) {
+  if (position >= size())
+    return;
+  const Operation operation{Operation::Kind::Jump, 0, 0, m_entries[position].entry_id, {}};
+  apply(operation);
+  journal(operation);
+}
+
+std::optional<QueueEntry> PlayQueue::next() {
+  const std::optional<std::size_t> current = get_current();
+  const std::size_t position               = current.has_value() ? *current + 1 : 0;
+  if (position >= size())
+    return std::nullopt;
+  jump(position);
+  return m_entries[position];
+}
+
+bool PlayQueue::undo() {
+  if (m_undo.empty())
+    return false;
+  const UndoStep step = std::move(m_undo.back());
+  m_undo.pop_back();
+  apply(step.inverse);
+  journal(step.inverse);
+  // The entry removed while it was played is back, unless another one was played since
+  if (step.current != step.previous_current and m_current == step.current and
+      find(step.previous_current).has_value()) {
+    const Operation operation{Operation::Kind::Jump, 0, 0, step.previous_current, {}};
+    apply(operation);
+    journal(operation);
+  }
+  return true;
+}
+
+void PlayQueue::commit(const Operation &operation) {
+  const std::uint32_t previous_current = m_current;
+  Operation inverse                    = apply(operation);
+  journal(operation);
+  m_undo.push_back(UndoStep{std::move(inverse), previous_current, m_current});
+  if (m_undo.size() > max_undo_steps)
+    m_undo.pop_front();
+}
+
+void PlayQueue::journal(const Operation &operation) {
+  if (not m_journal.is_open())
+    return;
+  const bool insert = operation.kind == Operation::Kind::Insert;
+  const Utils::JournalRecord record{
+      static_cast<std::uint32_t>(operation.kind), 0, operation.position,
+      insert ? operation.entries.size() : operation.count, operation.target
+  };
+  m_journal.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  if (insert)
+    m_journal.write(
+        reinterpret_cast<const char *>(operation.entries.data()),
+        static_cast<std::streamsize>(operation.entries.size() * sizeof(QueueEntry))
+    );
+  m_journal.flush();
+  if (not m_journal) {
+    spdlog::error("Failed to write the queue journal {}", get_journal_path());
+    m_journal.close();
+    return;
+  }
+  m_journal_bytes += sizeof(record) + (insert ? operation.entries.size() * sizeof(QueueEntry) : 0);
+  if (m_journal_bytes > std::max<std::uint64_t>(
+                            min_compaction_bytes, m_entries.size() * sizeof(QueueEntry)
+                        ))
+    compact();
+}
+
+PlayQueue::Operation PlayQueue::apply(const Operation &operation) {
+  const auto position = static_cast<std::ptrdiff_t>(operation.position);
+  const auto count    = static_cast<std::ptrdiff_t>(operation.count);
+  const auto target   = static_cast<std::ptrdiff_t>(operation.target);
+  Operation inverse{};
+  switch (operation.kind) {
+    case Operation::Kind::Insert:
+      inverse = Operation{
+          Operation::Kind::Remove, operation.position, operation.entries.size(), 0, {}
+      };
+      for (const QueueEntry &entry : operation.entries)
+        m_next_entry_id = std::max(m_next_entry_id, entry.entry_id + 1);
+      m_entries.insert(
+          m_entries.begin() + position, operation.entries.begin(), operation.entries.end()
+      );
+      m_indexed = std::min<std::size_t>(m_indexed, operation.position);
+      break;
+    case Operation::Kind::Remove: {
+      const auto first = m_entries.begin() + position;
+      const auto last  = first + count;
+      inverse = Operation{Operation::Kind::Insert, operation.position, 0, 0, {first, last}};
+      for (auto it = first; it != last; ++it)
+        if (it->entry_id == m_current)
+          m_current = position > 0 ? (first - 1)->entry_id : no_entry;
+      m_entries.erase(first, last);
+      m_indexed = std::min<std::size_t>(m_indexed, operation.position);
+      break;
+    }
+    case Operation::Kind::Move: {
+      inverse = Operation{
+          Operation::Kind::Move, operation.target, operation.count, operation.position, {}
+      };
+      const auto first = m_entries.begin() + position;
+      const auto to    = m_entries.begin() + target;
+      if (target > position)
+        std::rotate(first, first + count, to + count);
+      else
+        std::rotate(to, first, first + count);
+      m_indexed = std::min<std::size_t>(m_indexed, std::min(operation.position, operation.target));
+      break;
+    }
+    case Operation::Kind::Jump:
+      inverse   = Operation{Operation::Kind::Jump, 0, 0, m_current, {}};
+      m_current = static_cast<std::uint32_t>(operation.target);
+      break;
+  }
+  return inverse;
+}
+
+bool PlayQueue::is_valid(const Operation &operation) {
+  switch (operation.kind) {
+    case Operation::Kind::Insert: return operation.position <= size();
+    case Operation::Kind::Remove:
+      return operation.position <= size() and operation.count <= size() - operation.position;
+    case Operation::Kind::Move:
+      return operation.count <= size() and operation.position <= size() - operation.count and
+             operation.target <= size() - operation.count;
+    case Operation::Kind::Jump:
+      return operation.target == no_entry or
+             (operation.target < no_entry and
+              find(static_cast<std::uint32_t>(operation.target)).has_value());
+  }
+  return false;
+}
+
+bool PlayQueue::load() {
+  std::ifstream snapshot{get_snapshot_path(), std::ios::binary};
+  if (not snapshot)
+    return false;
+  Utils::SnapshotHeader header{};
+  if (not snapshot.read(reinterpret_cast<char *>(&header), sizeof(header)) or
+      std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 or
+      header.version != queue_version or header.count > max_record_entries) {
+    spdlog::error("Invalid queue snapshot {}", get_snapshot_path());
+    return false;
+  }
+  m_entries.resize(header.count);
+  if (not snapshot.read(
+          reinterpret_cast<char *>(m_entries.data()),
+          static_cast<std::streamsize>(m_entries.size() * sizeof(QueueEntry))
+      )) {
+    spdlog::error("Truncated queue snapshot {}", get_snapshot_path());
+    m_entries.clear();
+    return false;
+  }
+  m_generation    = header.generation;
+  m_next_entry_id = header.next_entry_id;
+  m_current       = header.current;
+  if (m_current != no_entry and not find(m_current).has_value())
+    m_current = no_entry;
+
+  // Written before the snapshot, what it holds is in there
+  std::ifstream journal{get_journal_path(), std::ios::binary};
+  Utils::JournalHeader journal_header{};
+  if (not journal.read(reinterpret_cast<char *>(&journal_header), sizeof(journal_header)) or
+      std::memcmp(journal_header.magic, journal_magic, sizeof(journal_magic)) != 0 or
+      journal_header.version != queue_version or journal_header.generation != m_generation)
+    return false;
+  m_journal_bytes = sizeof(journal_header);
+
+  std::size_t replayed = 0;
+  while (journal.peek() != std::ifstream::traits_type::eof()) {
+    Utils::JournalRecord record{};
+    if (not journal.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+      spdlog::warn("Truncated queue journal {}, the last change is lost", get_journal_path());
+      return false;
+    }
+    Operation operation{
+        static_cast<Operation::Kind>(record.kind), record.position, record.count, record.target, {}
+    };
+    const bool insert = operation.kind == Operation::Kind::Insert;
+    if (record.kind > static_cast<std::uint32_t>(Operation::Kind::Jump) or
+        (insert and record.count > max_record_entries)) {
+      spdlog::error("Damaged queue journal {}, ignoring the rest", get_journal_path());
+      return false;
+    }
+    if (insert) {
+      operation.entries.resize(record.count);
+      if (not journal.read(
+              reinterpret_cast<char *>(operation.entries.data()),
+              static_cast<std::streamsize>(operation.entries.size() * sizeof(QueueEntry))
+          )) {
+        spdlog::warn("Truncated queue journal {}, the last change is lost", get_journal_path());
+        return false;
+      }
+    }
+    if (not is_valid(operation)) {
+      spdlog::error("Damaged queue journal {}, ignoring the rest", get_journal_path());
+      return false;
+    }
+    apply(operation);
+    m_journal_bytes += sizeof(record) + operation.entries.size() * sizeof(QueueEntry);
+    ++replayed;
+  }
+  spdlog::info("Loaded a queue of {} tracks, {} changes replayed", m_entries.size(), replayed);
+
+  // Ids aren't reused while the queue is edited, they're handed out again from 0 here
+  if (m_next_entry_id > 2 * m_entries.size() + renumber_slack) {
+    std::uint32_t current = no_entry;
+    for (std::size_t i = 0; i < m_entries.size(); ++i) {
+      if (m_entries[i].entry_id == m_current)
+        current = static_cast<std::uint32_t>(i);
+      m_entries[i].entry_id = static_cast<std::uint32_t>(i);
+    }
+    m_current       = current;
+    m_next_entry_id = static_cast<std::uint32_t>(m_entries.size());
+    m_positions.clear();
+    m_indexed = 0;
+    return false;
+  }
+  return true;
+}
+
+void PlayQueue::compact() {
+  m_journal.close();
+  ++m_generation;
+
+  // Each written aside then renamed, the snapshot first: until the journal is replaced,
+  // the old one is older than the snapshot and ignored
+  Utils::SnapshotHeader header{};
+  std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+  header.version       = queue_version;
+  header.current       = m_current;
+  header.generation    = m_generation;
+  header.next_entry_id = m_next_entry_id;
+  header.count         = m_entries.size();
+  const std::string snapshot_path = get_snapshot_path();
+  const std::string snapshot_tmp  = std::format("{}.tmp", snapshot_path);
+  {
+    std::ofstream file{snapshot_tmp, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(
+        reinterpret_cast<const char *>(m_entries.data()),
+        static_cast<std::streamsize>(m_entries.size() * sizeof(QueueEntry))
+    );
+    if (not file) {
+      spdlog::error("Failed to write the queue snapshot {}", snapshot_tmp);
+      return;
+    }
+  }
+  std::error_code ec{};
+  fs::rename(snapshot_tmp, snapshot_path, ec);
+  if (ec) {
+    spdlog::error("Failed to replace the queue snapshot {}: {}", snapshot_path, ec.message());
+    return;
+  }
+
+  Utils::JournalHeader journal_header{};
+  std::memcpy(journal_header.magic, journal_magic, sizeof(journal_magic));
+  journal_header.version          = queue_version;
+  journal_header.generation       = m_generation;
+  const std::string journal_path  = get_journal_path();
+  const std::string journal_tmp   = std::format("{}.tmp", journal_path);
+  {
+    std::ofstream file{journal_tmp, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(&journal_header), sizeof(journal_header));
+    if (not file) {
+      spdlog::error("Failed to write the queue journal {}", journal_tmp);
+      return;
+    }
+  }
+  fs::rename(journal_tmp, journal_path, ec);
+  if (ec) {
+    spdlog::error("Failed to replace the queue journal {}: {}", journal_path, ec.message());
+    return;
+  }
+  m_journal.open(journal_path, std::ios::binary | std::ios::app);
+  if (not m_journal)
+    spdlog::error("Failed to open the queue journal {}", journal_path);
+  m_journal_bytes = sizeof(journal_header);
+}
+
+std::string PlayQueue::get_snapshot_path() const {
+  return std::format("{}/snapshot", directory);
+}
+
+std::string PlayQueue::get_journal_path() const {
+  return std::format("{}/journal", directory);
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,1363 @@
+#include "./player.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <numbers>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "./gapless.hpp"
+
+namespace Tmupp {
+
+/**
+ * Frames decoded at once.
+ */
+static constexpr ma_uint64 chunk_frames = 1024;
+/**
+ * How often the decoder thread tops up the ring when it has no command to run.
+ */
+static constexpr std::chrono::milliseconds poll_interval{10};
+/**
+ * Crossfade gains are computed exactly at least this often and linearly in between.
+ */
+static constexpr ma_uint32 gain_interval = 64;
+/**
+ * Output kept in the tap for its consumer.
+ */
+static constexpr std::size_t tap_milliseconds = 100;
+/**
+ * Periods of the low latency buffer mode.
+ */
+static constexpr ma_uint32 low_latency_period_milliseconds = 3;
+static constexpr ma_uint32 low_latency_periods             = 2;
+/**
+ * Range of the periods of the adaptive buffer mode, and their number unless configured.
+ */
+static constexpr ma_uint32 adaptive_min_period_milliseconds = 5;
+static constexpr ma_uint32 adaptive_max_period_milliseconds = 100;
+static constexpr ma_uint32 adaptive_periods                 = 3;
+/**
+ * How often the adaptive buffer mode looks for glitches, and how long it first waits
+ * without any before halving the periods. A glitch within that time after halving them
+ * doubles it, so that the periods don't keep going back and forth.
+ */
+static constexpr std::chrono::seconds adaptive_check_interval{1};
+static constexpr std::chrono::seconds adaptive_shrink_delay{60};
+static constexpr std::chrono::seconds adaptive_max_shrink_delay{3600};
+/**
+ * Rate the rings are sized for in bit-perfect mode, they hold less time of faster tracks.
+ */
+static constexpr ma_uint32 bit_perfect_ring_rate = 192000;
+/**
+ * Background jobs are held off that long after playback ran low.
+ */
+static constexpr std::chrono::milliseconds background_hold{2000};
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Gain of the track fading in (or of the one fading out with `1 - progress`).
+ */
+static float crossfade_gain(const CrossfadeCurve curve, const float progress);
+
+static const char *get_buffer_mode_name(const BufferMode mode);
+
+/**
+ * `ramp` over `frames` frames, multiplied by a gain going linearly from `from` to `to`.
+ */
+static GainRamp scale_ramp(
+    const GainRamp ramp, const ma_uint32 frames, const float from, const float to
+);
+
+/**
+ * Widen in place the first `count` samples of `format` of `samples` to 32 bits each, the
+ * size of the rings' floats: integers sign-extended (zero-extended for u8), 32-bit formats
+ * as they are.
+ */
+static void widen_samples(void *samples, const ma_format format, const std::size_t count);
+/**
+ * Undo `widen_samples()`, from `slots` to `count` samples of `format` at `out`.
+ */
+static void narrow_samples(
+    void *out, const float *slots, const ma_format format, const std::size_t count
+);
+
+}  // namespace Utils
+
+std::string PlayerStats::to_string() const {
+  const auto to_ms = [&](const std::size_t frames) {
+    return static_cast<double>(frames) * 1000.0 / sample_rate;
+  };
+  std::string res = std::format("  {} Hz", sample_rate);
+  if (period_frames > 0)
+    res += std::format(
+        ", {} periods of {} frames ({:.1f} ms)", periods, period_frames, to_ms(period_frames)
+    );
+  res += std::format(
+      "\n  {} callbacks, {} late, load mean {:.1f}% max {:.1f}%\n", callbacks, late_callbacks,
+      mean_load * 100.0, max_load * 100.0
+  );
+  res += std::format(
+      "  {} underruns ({} frames), buffered {:.0f} ms, fewest {:.0f} ms\n", underruns,
+      underrun_frames, to_ms(buffered_frames), to_ms(min_buffered_frames)
+  );
+  return res + callback_times.to_string();
+}
+
+Player::Player(const PlayerConfig &config_)
+    : config{config_},
+      m_vfs{config.io},
+      m_resampler{config.resampler_quality},
+      m_decoder_pool{config.decoder_pool},
+      m_seek_indexes{m_decoder_pool, config.seek_index_dir},
+      m_waveforms{m_decoder_pool, config.waveform_dir},
+      m_pcm_cache{config.cache},
+      m_replay_gain{config.replay_gain} {
+  m_bit_perfect = config.bit_perfect and not config.headless;
+  if (not config.headless) {
+    bool ready = false;
+    switch (config.buffer_mode) {
+      case BufferMode::Fixed:
+        ready = init_device(config.period_size_in_frames, 0, config.periods);
+        break;
+      case BufferMode::Adaptive:
+        ready = init_device(
+            0, adaptive_min_period_milliseconds,
+            config.periods != 0 ? config.periods : adaptive_periods
+        );
+        break;
+      case BufferMode::LowLatency:
+        ready = init_device(0, low_latency_period_milliseconds, low_latency_periods);
+        break;
+    }
+    m_device_ready.store(ready, std::memory_order_release);
+    if (not ready)
+      spdlog::error("Failed to initialise the audio device");
+  }
+  if (m_sample_rate == 0)
+    m_sample_rate = config.sample_rate != 0 ? config.sample_rate : 48000;
+  m_output = get_mixed_output();
+  m_output_rate.store(m_sample_rate, std::memory_order_relaxed);
+
+  const ma_uint32 ring_rate =
+      m_bit_perfect ? std::max(m_sample_rate, bit_perfect_ring_rate) : m_sample_rate;
+  const std::size_t ring_frames = std::size_t{ring_rate} * config.ring_milliseconds / 1000;
+  for (Source &source : m_sources) {
+    source.ring = std::make_unique<RingBuffer<float>>(ring_frames * config.channels);
+    source.sample_rate.store(m_sample_rate, std::memory_order_relaxed);
+  }
+  m_scratch.resize(chunk_frames * config.channels);
+  if (m_bit_perfect)
+    m_native_scratch.resize(chunk_frames * config.channels);
+  m_dsp     = std::make_unique<DspChain>(m_sample_rate, config.channels, config.dsp);
+  m_stretch = std::make_unique<TimeStretch>(m_sample_rate, config.channels);
+  m_stretch->set_speed(config.speed);
+  m_stretch_scratch.resize(chunk_frames * config.channels);
+  m_tap = std::make_unique<RingBuffer<float>>(
+      std::size_t{m_sample_rate} * config.channels * tap_milliseconds / 1000
+  );
+  set_crossfade(config.crossfade_milliseconds, config.crossfade_curve);
+
+  m_graph_ready = init_graph();
+  if (not m_graph_ready)
+    spdlog::error("Failed to initialise the mixing graph");
+
+  if (not config.headless)
+    m_decoder_thread = std::thread{&Player::decoder_loop, this};
+
+  if (m_device_ready and ma_device_start(&m_device) != MA_SUCCESS)
+    spdlog::error("Failed to start the audio device");
+}
+
+Player::~Player() {
+  // Stop the callback first, it uses the rings
+  {
+    std::lock_guard lock{m_device_mutex};
+    if (m_device_ready.exchange(false, std::memory_order_acq_rel))
+      ma_device_uninit(&m_device);
+  }
+  if (m_decoder_thread.joinable()) {
+    post(Command{Command::Kind::Quit});
+    m_decoder_thread.join();
+  } else {
+    decode_step(std::deque<Command>{Command{Command::Kind::Quit}});
+  }
+  if (m_graph_ready) {
+    for (DeckNode &deck : m_decks)
+      ma_node_uninit(&deck.base, nullptr);
+    ma_node_uninit(&m_mixer.base, nullptr);
+    ma_node_graph_uninit(&m_graph, nullptr);
+  }
+}
+
+void Player::play(const std::string &path) { post(Command{Command::Kind::Play, path}); }
+
+void Player::pause() { m_paused.store(true, std::memory_order_release); }
+
+void Player::resume() { m_paused.store(false, std::memory_order_release); }
+
+void Player::toggle_pause() {
+  m_paused.store(not m_paused.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void Player::stop() { post(Command{Command::Kind::Stop}); }
+
+void Player::seek(const double seconds) { post(Command{Command::Kind::Seek, "", seconds}); }
+
+void Player::set_crossfade(const ma_uint32 milliseconds, const CrossfadeCurve curve) {
+  m_crossfade_milliseconds.store(
+      std::min(milliseconds, max_crossfade_milliseconds), std::memory_order_relaxed
+  );
+  m_crossfade_curve.store(curve, std::memory_order_relaxed);
+}
+
+ma_uint32 Player::get_crossfade_milliseconds() const {
+  return m_crossfade_milliseconds.load(std::memory_order_relaxed);
+}
+
+CrossfadeCurve Player::get_crossfade_curve() const {
+  return m_crossfade_curve.load(std::memory_order_relaxed);
+}
+
+void Player::set_replay_gain(const ReplayGainConfig &settings) {
+  {
+    std::lock_guard lock{m_mutex};
+    m_replay_gain = settings;
+  }
+  post(Command{Command::Kind::ReplayGain});
+}
+
+ReplayGainConfig Player::get_replay_gain() const {
+  std::lock_guard lock{m_mutex};
+  return m_replay_gain;
+}
+
+Player::State Player::get_state() const {
+  if (not m_has_track.load(std::memory_order_acquire))
+    return State::Stopped;
+  return m_paused.load(std::memory_order_acquire) ? State::Paused : State::Playing;
+}
+
+double Player::get_position() const {
+  const Source &source = m_sources[m_playing.load(std::memory_order_relaxed)];
+  return static_cast<double>(m_position_frames.load(std::memory_order_relaxed)) /
+         source.sample_rate.load(std::memory_order_relaxed);
+}
+
+std::optional<double> Player::get_duration() const {
+  const Source &source       = m_sources[m_playing.load(std::memory_order_relaxed)];
+  const std::uint64_t length = source.length_frames.load(std::memory_order_relaxed);
+  if (length == 0)
+    return std::nullopt;
+  return static_cast<double>(length) / source.sample_rate.load(std::memory_order_relaxed);
+}
+
+PlayerStats Player::get_stats() const {
+  const Source &source = m_sources[m_playing.load(std::memory_order_relaxed)];
+  PlayerStats stats{};
+  stats.callbacks       = m_callbacks.load(std::memory_order_relaxed);
+  stats.underruns       = m_underruns.load(std::memory_order_relaxed);
+  stats.underrun_frames = m_underrun_frames.load(std::memory_order_relaxed);
+  stats.buffered_frames = source.ring->size() / config.channels;
+
+  const std::size_t min_buffered = m_min_buffered_frames.load(std::memory_order_relaxed);
+  stats.min_buffered_frames      = min_buffered == SIZE_MAX ? stats.buffered_frames : min_buffered;
+
+  stats.callback_times          = m_callback_times.snapshot();
+  const std::uint64_t budget_ns = m_budget_ns.load(std::memory_order_relaxed);
+  if (budget_ns > 0)
+    stats.mean_load =
+        static_cast<double>(stats.callback_times.total_ns) / static_cast<double>(budget_ns);
+  stats.max_load       = m_max_load.load(std::memory_order_relaxed);
+  stats.late_callbacks = m_late_callbacks.load(std::memory_order_relaxed);
+  stats.sample_rate    = m_output_rate.load(std::memory_order_relaxed);
+  stats.period_frames  = m_period_frames;
+  stats.periods        = m_periods;
+  return stats;
+}
+
+void Player::reset_callback_stats() {
+  m_callback_times.reset();
+  m_budget_ns.store(0, std::memory_order_relaxed);
+  m_max_load.store(0.0, std::memory_order_relaxed);
+  m_late_callbacks.store(0, std::memory_order_relaxed);
+  m_min_buffered_frames.store(SIZE_MAX, std::memory_order_relaxed);
+}
+
+void Player::process(float *out, const ma_uint32 frame_count) {
+  const auto start = std::chrono::steady_clock::now();
+  m_callbacks.fetch_add(1, std::memory_order_relaxed);
+  m_output_frames.fetch_add(frame_count, std::memory_order_release);
+  // What was stretched before a seek or a stop mustn't be heard after it
+  if (m_flush_request.load(std::memory_order_acquire) != m_flush_seen)
+    m_stretch->reset();
+
+  const std::size_t samples = std::size_t{frame_count} * config.channels;
+  ma_uint64 read            = 0;
+  // While paused, what's stretched waits to be played on resume
+  if (m_stretch->is_bypassed() or not m_active.load(std::memory_order_acquire) or
+      m_paused.load(std::memory_order_acquire)) {
+    start_period(frame_count);
+    if (m_graph_ready)
+      ma_node_graph_read_pcm_frames(&m_graph, out, frame_count, &read);
+  } else {
+    read = process_stretched(out, frame_count);
+  }
+  m_dsp->process(out, static_cast<std::size_t>(read));
+  std::fill(out + read * config.channels, out + samples, 0.0f);
+  // Whole periods only, so that the consumer stays aligned on frames
+  if (m_tap_enabled.load(std::memory_order_relaxed) and m_tap->space() >= samples)
+    m_tap->write(out, samples);
+  record_callback(frame_count, std::chrono::steady_clock::now() - start);
+}
+
+void Player::pump_decoder() {
+  assert(config.headless);
+  std::deque<Command> commands{};
+  {
+    std::lock_guard lock{m_mutex};
+    std::swap(commands, m_commands);
+  }
+  decode_step(commands);
+}
+
+ma_uint32 Player::process_stretched(float *out, const ma_uint32 frame_count) {
+  ma_uint32 done = 0;
+  while (true) {
+    done += static_cast<ma_uint32>(
+        m_stretch->read(out + std::size_t{done} * config.channels, frame_count - done)
+    );
+    if (done == frame_count or not m_graph_ready)
+      break;
+    // No more than the output still missing, so that nothing is left over once the speed
+    // is back to 1
+    const auto frames = static_cast<ma_uint32>(std::min<std::size_t>(
+        {m_stretch->get_input_space(), chunk_frames, std::size_t{frame_count - done}}
+    ));
+    start_period(frames);
+    ma_uint64 read = 0;
+    ma_node_graph_read_pcm_frames(&m_graph, m_stretch_scratch.data(), frames, &read);
+    if (read == 0)
+      break;
+    m_stretch->write(m_stretch_scratch.data(), static_cast<std::size_t>(read));
+  }
+  return done;
+}
+
+void Player::start_period(const ma_uint32 frame_count) {
+  std::size_t playing = m_playing.load(std::memory_order_relaxed);
+
+  const std::uint32_t flush_request = m_flush_request.load(std::memory_order_acquire);
+  if (flush_request != m_flush_seen) {
+    for (std::size_t i = 0; i < m_sources.size(); ++i)
+      m_sources[i].ring->skip_to(m_flush_write_counts[i].load(std::memory_order_relaxed));
+    playing = m_flush_source.load(std::memory_order_relaxed);
+    m_position_frames.store(
+        m_flush_position.load(std::memory_order_relaxed), std::memory_order_relaxed
+    );
+    m_flush_seen     = flush_request;
+    m_switches_since = 0;
+    m_fading         = false;
+    m_playing.store(playing, std::memory_order_relaxed);
+    m_callback_state.store(std::uint64_t{m_flush_seen} << 32, std::memory_order_release);
+  }
+
+  for (DeckNode &deck : m_decks) {
+    deck.segment_count = 0;
+    deck.planned       = 0;
+    deck.cursor        = 0;
+  }
+  m_mixer.cursor = 0;
+  if (m_active.load(std::memory_order_acquire) and not m_paused.load(std::memory_order_acquire)) {
+    // Only the callback lowers it
+    const std::size_t buffered = m_sources[playing].ring->size() / config.channels;
+    if (buffered < m_min_buffered_frames.load(std::memory_order_relaxed))
+      m_min_buffered_frames.store(buffered, std::memory_order_relaxed);
+    m_playing.store(plan_period(playing, frame_count), std::memory_order_relaxed);
+  }
+}
+
+void Player::record_callback(
+    const ma_uint32 frame_count, const std::chrono::nanoseconds duration
+) {
+  m_callback_times.record(duration);
+  const std::uint64_t budget_ns =
+      std::uint64_t{frame_count} * 1'000'000'000 / m_output_rate.load(std::memory_order_relaxed);
+  if (budget_ns == 0)
+    return;
+  m_budget_ns.fetch_add(budget_ns, std::memory_order_relaxed);
+  const double load = static_cast<double>(duration.count()) / static_cast<double>(budget_ns);
+  // Only the callback raises it
+  if (load > m_max_load.load(std::memory_order_relaxed))
+    m_max_load.store(load, std::memory_order_relaxed);
+  if (load > 1.0)
+    m_late_callbacks.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Player::init_device(
+    const ma_uint32 period_frames, const ma_uint32 period_milliseconds, const ma_uint32 periods
+) {
+  ma_device_config device_config  = ma_device_config_init(ma_device_type_playback);
+  device_config.playback.format   = m_output.format;
+  device_config.playback.channels = config.channels;
+  // The rings hold audio at the first device's rate, or at the rate of a bit-perfect track
+  device_config.sampleRate = m_output.sample_rate != 0 ? m_output.sample_rate : config.sample_rate;
+  device_config.periodSizeInFrames       = period_frames;
+  device_config.periodSizeInMilliseconds = period_milliseconds;
+  device_config.periods                  = periods;
+  device_config.dataCallback             = data_callback;
+  device_config.pUserData                = this;
+  // Every sample is written by `process()`
+  device_config.noPreSilencedOutputBuffer = MA_TRUE;
+
+  // Have the system mix nothing else in, nor convert what's played bit-perfect, if it lets us
+  const bool native = m_output != get_mixed_output();
+  if (native)
+    device_config.playback.shareMode = ma_share_mode_exclusive;
+
+  if (ma_device_init(nullptr, &device_config, &m_device) != MA_SUCCESS) {
+    if (not native)
+      return false;
+    device_config.playback.shareMode = ma_share_mode_shared;
+    if (ma_device_init(nullptr, &device_config, &m_device) != MA_SUCCESS)
+      return false;
+  }
+  if (m_sample_rate == 0)
+    m_sample_rate = m_device.sampleRate;
+  m_output_rate.store(m_device.sampleRate, std::memory_order_relaxed);
+  const ma_uint32 frames = m_device.playback.internalPeriodSizeInFrames;
+  m_period_frames.store(frames, std::memory_order_relaxed);
+  m_periods.store(m_device.playback.internalPeriods, std::memory_order_relaxed);
+  spdlog::info(
+      "Audio device \"{}\": {} {} Hz, {} channels, {} periods of {} frames ({:.1f} ms), {} "
+      "buffer{}",
+      m_device.playback.name, ma_get_format_name(m_device.playback.format), m_device.sampleRate,
+      config.channels, m_device.playback.internalPeriods, frames,
+      frames * 1000.0 / m_device.playback.internalSampleRate,
+      Utils::get_buffer_mode_name(config.buffer_mode),
+      m_device.playback.shareMode == ma_share_mode_exclusive ? ", exclusive" : ""
+  );
+  return true;
+}
+
+void Player::resize_device(const ma_uint32 period_frames) {
+  std::lock_guard lock{m_device_mutex};
+  if (not m_device_ready.load(std::memory_order_relaxed))
+    return;
+  ma_device_uninit(&m_device);
+  if (not init_device(period_frames, 0, m_periods.load(std::memory_order_relaxed))) {
+    m_device_ready.store(false, std::memory_order_release);
+    spdlog::error("Failed to reinitialise the audio device");
+    return;
+  }
+  if (ma_device_start(&m_device) != MA_SUCCESS)
+    spdlog::error("Failed to start the audio device");
+  // The timings were of the former periods
+  reset_callback_stats();
+}
+
+Player::OutputFormat Player::get_track_output(const std::string &path) {
+  const OutputFormat mixed = get_mixed_output();
+  if (not m_bit_perfect or not is_ready())
+    return mixed;
+
+  // Decoded without any conversion, the backend tells the file's own format
+  ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_unknown, 0, 0);
+  decoder_config.encodingFormat    = guess_encoding_format(path);
+  ma_decoder decoder{};
+  if (ma_decoder_init_vfs(m_vfs.get(), path.c_str(), &decoder_config, &decoder) != MA_SUCCESS)
+    return mixed;
+  ma_format format   = ma_format_unknown;
+  ma_uint32 channels = 0;
+  ma_uint32 rate     = 0;
+  const ma_result result =
+      ma_data_source_get_data_format(decoder.pBackend, &format, &channels, &rate, nullptr, 0);
+  ma_decoder_uninit(&decoder);
+
+  const OutputFormat output{format, rate};
+  // Changing the number of channels would be a conversion too
+  if (result != MA_SUCCESS or format == ma_format_unknown or rate == 0 or
+      channels != config.channels or
+      std::ranges::find(m_refused_outputs, output) != m_refused_outputs.end())
+    return mixed;
+  return output;
+}
+
+void Player::set_output(const OutputFormat &output) {
+  if (output == m_output)
+    return;
+  // Periods as long as before at the new rate
+  const auto scale_period = [&] {
+    return static_cast<ma_uint32>(
+        std::uint64_t{m_period_frames.load(std::memory_order_relaxed)} * m_output.sample_rate /
+        m_output_rate.load(std::memory_order_relaxed)
+    );
+  };
+  const OutputFormat mixed = get_mixed_output();
+  // The device calls back with nothing in between, the callback sees the flag that goes
+  // with its format
+  m_output = output;
+  m_native_output.store(output != mixed, std::memory_order_release);
+  resize_device(scale_period());
+
+  if (output == mixed)
+    return;
+  // Anything converting behind our back (e.g. a shared mode mixer) isn't bit-perfect
+  const bool taken = is_ready() and m_device.playback.internalFormat == output.format and
+                     m_device.playback.internalSampleRate == output.sample_rate and
+                     m_device.playback.internalChannels == config.channels;
+  if (taken)
+    return;
+  spdlog::warn(
+      "The audio device doesn't take {} at {} Hz as it is, converting it instead",
+      ma_get_format_name(output.format), output.sample_rate
+  );
+  m_refused_outputs.push_back(output);
+  m_output = mixed;
+  m_native_output.store(false, std::memory_order_release);
+  resize_device(scale_period());
+}
+
+void Player::adapt_buffer() {
+  const auto now = std::chrono::steady_clock::now();
+  if (m_adapt_checked == std::chrono::steady_clock::time_point{}) {
+    m_adapt_calm_since   = now;
+    m_adapt_shrink_delay = adaptive_shrink_delay;
+  } else if (now - m_adapt_checked < adaptive_check_interval) {
+    return;
+  }
+  m_adapt_checked = now;
+
+  const auto count_glitches = [&] {
+    return m_late_callbacks.load(std::memory_order_relaxed) +
+           m_underruns.load(std::memory_order_relaxed);
+  };
+  const std::uint64_t glitches = count_glitches();
+  // Lower after the callback stats are reset
+  const bool glitched = glitches > m_adapt_glitches;
+  m_adapt_glitches    = glitches;
+
+  const ma_uint32 period     = m_period_frames.load(std::memory_order_relaxed);
+  const ma_uint32 min_period = m_output.sample_rate * adaptive_min_period_milliseconds / 1000;
+  const ma_uint32 max_period = m_output.sample_rate * adaptive_max_period_milliseconds / 1000;
+  if (glitched) {
+    if (m_adapt_shrunk and now - m_adapt_calm_since < m_adapt_shrink_delay)
+      m_adapt_shrink_delay = std::min(m_adapt_shrink_delay * 2, adaptive_max_shrink_delay);
+    m_adapt_shrunk     = false;
+    m_adapt_calm_since = now;
+    if (period >= max_period)
+      return;
+    spdlog::info("Glitches with periods of {} frames, doubling them", period);
+    resize_device(std::min(period * 2, max_period));
+  } else if (now - m_adapt_calm_since >= m_adapt_shrink_delay and period > min_period) {
+    spdlog::info("No glitch for {} s, halving the periods", m_adapt_shrink_delay.count());
+    m_adapt_shrunk     = true;
+    m_adapt_calm_since = now;
+    resize_device(std::max(period / 2, min_period));
+  } else {
+    return;
+  }
+  m_adapt_glitches = count_glitches();
+}
+
+void Player::post(Command command) {
+  {
+    std::lock_guard lock{m_mutex};
+    m_commands.push_back(std::move(command));
+  }
+  m_cv.notify_one();
+}
+
+void Player::decoder_loop() {
+  while (true) {
+    std::deque<Command> commands{};
+    {
+      std::unique_lock lock{m_mutex};
+      m_cv.wait_for(lock, poll_interval, [&] { return not m_commands.empty(); });
+      std::swap(commands, m_commands);
+    }
+    if (not decode_step(commands))
+      return;
+    if (config.buffer_mode == BufferMode::Adaptive)
+      adapt_buffer();
+  }
+}
+
+bool Player::decode_step(const std::deque<Command> &commands) {
+  for (const Command &command : commands) {
+    switch (command.kind) {
+      case Command::Kind::Play: open_track(command.path); break;
+      case Command::Kind::Seek: seek_track(command.seconds); break;
+      case Command::Kind::Stop: close_track(); break;
+      case Command::Kind::ReplayGain: update_replay_gain(); break;
+      case Command::Kind::Quit: close_track(); return false;
+    }
+  }
+
+  if (follow_callback() and on_track_end)
+    on_track_end();
+
+  Source &source = m_sources[m_current];
+  if (not source.open)
+    return true;
+  const std::uint64_t prefill_samples =
+      std::uint64_t{source.sample_rate.load(std::memory_order_relaxed)} *
+      config.prefill_milliseconds / 1000 * config.channels;
+  if (not source.end_of_track) {
+    // The callback nearly caught up with the decoder, take the CPU back from the analyses
+    if (m_active.load(std::memory_order_relaxed) and source.ring->size() < prefill_samples)
+      m_decoder_pool.preempt_background(background_hold);
+    source.end_of_track = fill_ring(source);
+  }
+  // Until the callback handles a flush the ring still holds what it'll drop, only count
+  // what was written since
+  const std::uint64_t buffered = source.ring->get_write_count() -
+                                 m_flush_write_counts[m_current].load(std::memory_order_relaxed);
+  if (not m_active.load(std::memory_order_relaxed) and
+      (source.end_of_track or buffered >= prefill_samples))
+    m_active.store(true, std::memory_order_release);
+
+  prepare_next();
+
+  // The callback played everything and there's nothing to move to
+  if (source.end_of_track and source.ring->size() == 0 and not m_sources[1 - m_current].open) {
+    if (m_deferred_track.has_value()) {
+      // Let the device play what it holds before it's reconfigured, without holding up
+      // the decoder thread
+      const std::uint64_t output_frames = m_output_frames.load(std::memory_order_acquire);
+      if (not m_deferred_at.has_value())
+        m_deferred_at = output_frames +
+                        std::uint64_t{m_period_frames.load(std::memory_order_relaxed)} *
+                            m_periods.load(std::memory_order_relaxed);
+      if (output_frames < *m_deferred_at)
+        return true;
+      open_track(*std::exchange(m_deferred_track, std::nullopt));
+    } else {
+      close_track();
+    }
+    if (on_track_end)
+      on_track_end();
+  }
+  return true;
+}
+
+void Player::open_track(const std::string &path) {
+  close_track();
+  set_output(get_track_output(path));
+  if (not open_source(m_sources[m_current], path, m_output))
+    return;
+  m_paused.store(false, std::memory_order_release);
+  m_has_track.store(true, std::memory_order_release);
+}
+
+void Player::close_track() {
+  m_active.store(false, std::memory_order_release);
+  for (Source &source : m_sources)
+    close_source(source);
+  m_deferred_track = std::nullopt;
+  m_deferred_at    = std::nullopt;
+  flush(0);
+  m_has_track.store(false, std::memory_order_release);
+}
+
+void Player::seek_track(const double seconds) {
+  // During a crossfade the callback already plays the next track, seek in that one
+  if (const std::size_t playing = m_playing.load(std::memory_order_relaxed);
+      playing != m_current and m_sources[playing].open) {
+    close_source(m_sources[m_current]);
+    m_current = playing;
+  }
+  Source &source = m_sources[m_current];
+  if (not source.open)
+    return;
+  auto target = static_cast<ma_uint64>(
+      std::max(0.0, seconds) * source.sample_rate.load(std::memory_order_relaxed)
+  );
+  if (const std::uint64_t length = source.length_frames.load(std::memory_order_relaxed); length > 0)
+    target = std::min<ma_uint64>(target, length);
+
+  m_active.store(false, std::memory_order_release);
+  // A cached target is played without the decoder, which only seeks if it's needed again
+  if (source.cache_entry == nullptr or not m_pcm_cache.contains(*source.cache_entry, target)) {
+    use_seek_index(source, JobPriority::Realtime);
+    if (ma_decoder_seek_to_pcm_frame(&source.decoder, source.start_frame + target) !=
+        MA_SUCCESS) {
+      spdlog::error("Failed to seek to {}s", seconds);
+      m_active.store(true, std::memory_order_release);
+      return;
+    }
+    source.decoder_frames = target;
+  }
+  // The next track was possibly being played already
+  close_source(m_sources[1 - m_current]);
+  flush(target);
+  source.decoded_frames = target;
+  source.end_of_track   = false;
+  source.decoded_all.store(false, std::memory_order_release);
+}
+
+bool Player::open_source(Source &source, const std::string &path, const OutputFormat &output) {
+  ma_decoder_config decoder_config =
+      ma_decoder_config_init(output.format, config.channels, output.sample_rate);
+  m_resampler.apply(decoder_config.resampling);
+  // Naming the backend lets a seek index be bound to it
+  decoder_config.encodingFormat = guess_encoding_format(path);
+  ma_result result =
+      ma_decoder_init_vfs(m_vfs.get(), path.c_str(), &decoder_config, &source.decoder);
+  if (result != MA_SUCCESS and decoder_config.encodingFormat != ma_encoding_format_unknown) {
+    // Misnamed file
+    decoder_config.encodingFormat = ma_encoding_format_unknown;
+    result = ma_decoder_init_vfs(m_vfs.get(), path.c_str(), &decoder_config, &source.decoder);
+  }
+  if (result != MA_SUCCESS) {
+    spdlog::error("Failed to open {}", path);
+    return false;
+  }
+  source.open           = true;
+  source.end_of_track   = false;
+  source.start_frame    = 0;
+  source.decoded_frames = 0;
+  source.decoder_frames = 0;
+  source.path           = path;
+  source.output         = output;
+  source.format         = decoder_config.encodingFormat;
+  source.seek_index     = nullptr;
+  source.replay_gain    = read_replay_gain(path);
+  source.gain.store(
+      get_replay_gain_factor(source.replay_gain, get_replay_gain()), std::memory_order_relaxed
+  );
+  source.start_write_count.store(source.ring->get_write_count(), std::memory_order_relaxed);
+  source.sample_rate.store(output.sample_rate, std::memory_order_relaxed);
+  use_seek_index(source);
+
+  ma_uint32 file_rate = 0;
+  if (ma_data_source_get_data_format(
+          source.decoder.pBackend, nullptr, nullptr, &file_rate, nullptr, 0
+      ) != MA_SUCCESS)
+    file_rate = 0;
+  // From the file's rate to the one we decode at
+  const double ratio = file_rate > 0 ? static_cast<double>(output.sample_rate) / file_rate : 1.0;
+  const auto scale   = [&](const std::uint64_t frames) {
+    return static_cast<std::uint64_t>(std::llround(static_cast<double>(frames) * ratio));
+  };
+
+  // Without a Xing header, miniaudio gets the length of an MP3 by reading the whole file
+  ma_uint64 length = 0;
+  if (source.seek_index != nullptr and file_rate > 0)
+    length = scale(source.seek_index->length);
+  else if (ma_decoder_get_length_in_pcm_frames(&source.decoder, &length) != MA_SUCCESS)
+    length = 0;
+
+  // Trim what the encoder added
+  if (const std::optional<GaplessInfo> gapless = read_gapless_info(path);
+      gapless.has_value() and file_rate > 0) {
+    source.start_frame = scale(gapless->delay);
+    if (gapless->length.has_value())
+      length = scale(*gapless->length);
+    else if (length > 0)
+      length -= std::min<ma_uint64>(length, scale(gapless->delay + gapless->padding));
+  }
+  // And the silence around the music, found once the track was analysed, when it would
+  // delay a crossfade
+  const bool trim_silence = config.trim_silence_milliseconds > 0 and file_rate > 0 and
+                            get_crossfade_milliseconds() > 0;
+  if (const std::shared_ptr<const Waveform> waveform =
+          trim_silence ? m_waveforms.read(path) : nullptr;
+      waveform != nullptr) {
+    const std::uint64_t min_silence =
+        std::uint64_t{file_rate} * config.trim_silence_milliseconds / 1000;
+    // Counted from the start of the file, the encoder delay is silence too
+    std::uint64_t start = source.start_frame;
+    std::uint64_t end   = length > 0 ? source.start_frame + length : scale(waveform->length);
+    if (waveform->leading_silence >= min_silence)
+      start = std::max(start, scale(waveform->leading_silence));
+    if (waveform->trailing_silence >= min_silence)
+      end = std::min(end, scale(waveform->length - waveform->trailing_silence));
+    if (end > start) {
+      source.start_frame = start;
+      length             = end - start;
+    }
+  }
+  if (source.start_frame > 0 and
+      ma_decoder_seek_to_pcm_frame(&source.decoder, source.start_frame) != MA_SUCCESS)
+    source.start_frame = 0;
+
+  // Samples wider than 16 bits can't be cached in 16 bits as they are
+  const bool native   = output.format != ma_format_f32;
+  const bool cachable = not native or m_pcm_cache.config.format == PcmCacheFormat::F32 or
+                        output.format == ma_format_u8 or output.format == ma_format_s16;
+  if (m_pcm_cache.config.capacity_bytes > 0 and cachable) {
+    source.cache_entry =
+        m_pcm_cache.acquire(PcmCache::Key{
+            path, output.sample_rate, config.channels, native, source.start_frame
+        });
+    // Streamed FLACs and the like only tell their length once decoded
+    if (length == 0 and source.cache_entry->length.has_value())
+      length = *source.cache_entry->length;
+  }
+  source.length_frames.store(length, std::memory_order_relaxed);
+  return true;
+}
+
+void Player::close_source(Source &source) {
+  if (source.open)
+    ma_decoder_uninit(&source.decoder);
+  source.open           = false;
+  source.end_of_track   = false;
+  source.decoded_frames = 0;
+  source.decoder_frames = 0;
+  source.format         = ma_encoding_format_unknown;
+  source.seek_index     = nullptr;
+  source.replay_gain    = std::nullopt;
+  m_pcm_cache.release(source.cache_entry);
+  source.cache_entry = nullptr;
+  source.decoded_all.store(false, std::memory_order_release);
+  source.ready.store(false, std::memory_order_release);
+  source.length_frames.store(0, std::memory_order_relaxed);
+}
+
+void Player::update_replay_gain() {
+  const ReplayGainConfig settings = get_replay_gain();
+  for (Source &source : m_sources)
+    if (source.open)
+      source.gain.store(
+          get_replay_gain_factor(source.replay_gain, settings), std::memory_order_relaxed
+      );
+}
+
+void Player::use_seek_index(Source &source, const JobPriority priority) {
+  if (source.seek_index != nullptr or source.format == ma_encoding_format_unknown)
+    return;
+  source.seek_index = m_seek_indexes.get(source.path, source.format, priority);
+  if (source.seek_index != nullptr and not bind_seek_index(source.decoder, *source.seek_index))
+    source.seek_index = nullptr;
+}
+
+void Player::prepare_next() {
+  const Source &source = m_sources[m_current];
+  Source &next         = m_sources[1 - m_current];
+
+  if (not m_next_requested and next_track) {
+    // A crossfade starts that much earlier
+    const ma_uint32 milliseconds = config.gapless_window_milliseconds +
+                                   m_crossfade_milliseconds.load(std::memory_order_relaxed);
+    const std::uint64_t window =
+        std::uint64_t{source.sample_rate.load(std::memory_order_relaxed)} * milliseconds / 1000;
+    const std::uint64_t length   = source.length_frames.load(std::memory_order_relaxed);
+    const std::uint64_t position = m_position_frames.load(std::memory_order_relaxed);
+    // Without a length, wait for the track to be fully decoded
+    const bool near_end = length > 0 ? position + window >= length : source.end_of_track;
+    if (near_end) {
+      m_next_requested = true;
+      if (const std::optional<std::string> path = next_track(); path.has_value()) {
+        // The device can't change formats between two frames
+        if (const OutputFormat output = get_track_output(*path); output == m_output) {
+          open_source(next, *path, output);
+        } else {
+          spdlog::info("{} needs the audio device reconfigured, playing it after a gap", *path);
+          m_deferred_track = *path;
+        }
+      }
+    }
+  }
+
+  if (not next.open or next.end_of_track)
+    return;
+  next.end_of_track = fill_ring(next);
+  if (not next.ready.load(std::memory_order_relaxed)) {
+    const std::uint64_t prefill_samples =
+        std::uint64_t{next.sample_rate.load(std::memory_order_relaxed)} *
+        config.prefill_milliseconds / 1000 * config.channels;
+    if (next.end_of_track or next.ring->size() >= prefill_samples)
+      next.ready.store(true, std::memory_order_release);
+  }
+}
+
+bool Player::follow_callback() {
+  const std::uint64_t state = m_callback_state.load(std::memory_order_acquire);
+  // Moves made before the callback handled the last flush were undone by it
+  if (static_cast<std::uint32_t>(state >> 32) != m_flush_request.load(std::memory_order_relaxed))
+    return false;
+  const auto switches = static_cast<std::uint32_t>(state);
+  if (switches == m_switches)
+    return false;
+
+  // Only one next track is ever ready, so the callback can't have moved twice
+  close_source(m_sources[m_current]);
+  m_current        = 1 - m_current;
+  m_switches       = switches;
+  m_next_requested = false;
+  return true;
+}
+
+void Player::flush(const std::uint64_t position_frames) {
+  for (std::size_t i = 0; i < m_sources.size(); ++i)
+    m_flush_write_counts[i].store(m_sources[i].ring->get_write_count(), std::memory_order_relaxed);
+  m_flush_position.store(position_frames, std::memory_order_relaxed);
+  m_flush_source.store(m_current, std::memory_order_relaxed);
+  m_flush_request.fetch_add(1, std::memory_order_release);
+  m_switches       = 0;
+  m_next_requested = false;
+}
+
+bool Player::fill_ring(Source &source) {
+  const std::uint64_t length = source.length_frames.load(std::memory_order_relaxed);
+  PcmCache::Entry *entry     = source.cache_entry;
+  while (source.ring->space() >= m_scratch.size()) {
+    if (entry != nullptr) {
+      const std::uint64_t cached =
+          m_pcm_cache.read(*entry, source.decoded_frames, m_scratch.data(), chunk_frames);
+      if (cached > 0) {
+        source.ring->write(m_scratch.data(), static_cast<std::size_t>(cached) * config.channels);
+        source.decoded_frames += cached;
+        if (entry->length.has_value() and source.decoded_frames >= *entry->length) {
+          source.decoded_all.store(true, std::memory_order_release);
+          return true;
+        }
+        continue;
+      }
+    }
+
+    // Past what's cached, the decoder has to catch up
+    if (source.decoder_frames != source.decoded_frames) {
+      use_seek_index(source, JobPriority::Realtime);
+      if (ma_decoder_seek_to_pcm_frame(
+              &source.decoder, source.start_frame + source.decoded_frames
+          ) != MA_SUCCESS) {
+        spdlog::error("Failed to seek in {}", source.path);
+        source.decoded_all.store(true, std::memory_order_release);
+        return true;
+      }
+      source.decoder_frames = source.decoded_frames;
+    }
+
+    ma_uint64 read = 0;
+    const ma_result result =
+        ma_decoder_read_pcm_frames(&source.decoder, m_scratch.data(), chunk_frames, &read);
+    bool ended = result != MA_SUCCESS or read < chunk_frames;
+    // The resampler holds back the last frames until told that no more input is coming
+    if (ended and (result == MA_SUCCESS or result == MA_AT_END) and
+        Resampler::drain(source.decoder))
+      ended = false;
+    // Drop the encoder padding
+    if (length > 0 and source.decoded_frames + read >= length) {
+      read  = length - std::min(length, source.decoded_frames);
+      ended = true;
+    }
+    // What the rings hold of a track played bit-perfect
+    Utils::widen_samples(
+        m_scratch.data(), source.output.format, static_cast<std::size_t>(read) * config.channels
+    );
+    source.ring->write(m_scratch.data(), static_cast<std::size_t>(read) * config.channels);
+    if (entry != nullptr)
+      m_pcm_cache.write(*entry, source.decoded_frames, m_scratch.data(), read);
+    source.decoded_frames += read;
+    source.decoder_frames = source.decoded_frames;
+    if (ended) {
+      // Not on a read error, the rest of the track may be fine the next time
+      if (entry != nullptr and (result == MA_SUCCESS or result == MA_AT_END))
+        m_pcm_cache.set_length(*entry, source.decoded_frames);
+      source.decoded_all.store(true, std::memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::size_t Player::plan_period(std::size_t playing, const ma_uint32 frame_count) {
+  // Tracks played bit-perfect are only ever played back to back, those converted to the
+  // mixed output are crossfaded as usual
+  const std::uint64_t crossfade_frames =
+      m_native_output.load(std::memory_order_relaxed)
+          ? 0
+          : std::uint64_t{m_sample_rate} *
+                m_crossfade_milliseconds.load(std::memory_order_relaxed) / 1000;
+
+  ma_uint32 done = 0;
+  while (done < frame_count) {
+    const ma_uint32 left   = frame_count - done;
+    const Source &source   = m_sources[playing];
+    const bool decoded_all = source.decoded_all.load(std::memory_order_acquire);
+
+    if (m_fading) {
+      const auto frames = static_cast<ma_uint32>(
+          std::min<std::uint64_t>(left, m_fade_length - m_fade_position)
+      );
+      const float position = static_cast<float>(m_fade_position) / m_fade_length;
+      const float step     = 1.0f / m_fade_length;
+      plan_segment(m_fading_out, done, frames, Segment::Gain::FadeOut, position, step);
+      const ma_uint32 read =
+          plan_segment(playing, done, frames, Segment::Gain::FadeIn, position, step);
+      m_position_frames.fetch_add(read, std::memory_order_relaxed);
+      if (read < frames and not decoded_all) {
+        m_underruns.fetch_add(1, std::memory_order_relaxed);
+        m_underrun_frames.fetch_add(frames - read, std::memory_order_relaxed);
+      }
+
+      done += frames;
+      m_fade_position += frames;
+      if (m_fade_position == m_fade_length) {
+        // What's left of the previous track is dropped when its source is reused
+        m_fading = false;
+        ++m_switches_since;
+        m_callback_state.store(
+            (std::uint64_t{m_flush_seen} << 32) | m_switches_since, std::memory_order_release
+        );
+      }
+      continue;
+    }
+
+    // Play until the crossfade starts, which needs to know where the track ends
+    ma_uint32 frames             = left;
+    const std::uint64_t length   = source.length_frames.load(std::memory_order_relaxed);
+    const std::uint64_t position = m_position_frames.load(std::memory_order_relaxed);
+    if (crossfade_frames > 0 and length > position) {
+      const std::uint64_t fade_start = length - std::min(length, crossfade_frames);
+      if (position < fade_start) {
+        frames = static_cast<ma_uint32>(std::min<std::uint64_t>(frames, fade_start - position));
+      } else if (const std::size_t previous = playing; start_next(playing)) {
+        const std::uint64_t next_length =
+            m_sources[playing].length_frames.load(std::memory_order_relaxed);
+        m_fading        = true;
+        m_fading_out    = previous;
+        m_fade_position = 0;
+        m_fade_length   = std::min(crossfade_frames, length - position);
+        if (next_length > 0)
+          m_fade_length = std::min(m_fade_length, next_length);
+        m_fade_curve = m_crossfade_curve.load(std::memory_order_relaxed);
+        continue;
+      }
+    }
+
+    const ma_uint32 read = plan_segment(playing, done, frames, Segment::Gain::Unity);
+    m_position_frames.fetch_add(read, std::memory_order_relaxed);
+    done += read;
+    if (read == frames)
+      continue;
+
+    // The track ended in this period, carry on with the next one from the next frame
+    if (decoded_all and start_next(playing)) {
+      ++m_switches_since;
+      m_callback_state.store(
+          (std::uint64_t{m_flush_seen} << 32) | m_switches_since, std::memory_order_release
+      );
+      continue;
+    }
+    if (not decoded_all) {
+      m_underruns.fetch_add(1, std::memory_order_relaxed);
+      m_underrun_frames.fetch_add(frame_count - done, std::memory_order_relaxed);
+    }
+    break;
+  }
+  return playing;
+}
+
+ma_uint32 Player::plan_segment(
+    const std::size_t source, const ma_uint32 offset, const ma_uint32 frames,
+    const Segment::Gain gain, const float fade_position, const float fade_step
+) {
+  DeckNode &deck = m_decks[source];
+  // Frames planned earlier in the period are still in the ring
+  const std::size_t available = m_sources[source].ring->size() / config.channels - deck.planned;
+  const auto planned = static_cast<ma_uint32>(std::min<std::size_t>(frames, available));
+  if (planned == 0 or deck.segment_count == deck.segments.size())
+    return 0;
+  deck.segments[deck.segment_count++] = Segment{offset, planned, gain, fade_position, fade_step};
+  deck.planned += planned;
+  return planned;
+}
+
+bool Player::start_next(std::size_t &playing) {
+  Source &next = m_sources[1 - playing];
+  if (not next.ready.exchange(false, std::memory_order_acq_rel))
+    return false;
+  // Drop what's left of the track that used the source before
+  next.ring->skip_to(next.start_write_count.load(std::memory_order_relaxed));
+  playing = 1 - playing;
+  m_position_frames.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+GainRamp Player::get_gain_ramp(
+    const DeckNode &deck, const ma_uint32 frame, const ma_uint32 frames
+) const {
+  for (std::size_t i = 0; i < deck.segment_count; ++i) {
+    const Segment &segment = deck.segments[i];
+    if (frame < segment.offset or frame >= segment.offset + segment.frames)
+      continue;
+    if (segment.gain == Segment::Gain::Unity)
+      return GainRamp{1.0f, 0.0f};
+
+    const float from  = segment.fade_position + (frame - segment.offset) * segment.fade_step;
+    const float to    = from + frames * segment.fade_step;
+    const bool in     = segment.gain == Segment::Gain::FadeIn;
+    const float start = Utils::crossfade_gain(m_fade_curve, in ? from : 1.0f - from);
+    const float end   = Utils::crossfade_gain(m_fade_curve, in ? to : 1.0f - to);
+    return GainRamp{start, (end - start) / frames};
+  }
+  return GainRamp{};
+}
+
+bool Player::init_graph() {
+  static const ma_node_vtable deck_vtable{deck_process, nullptr, 0, 1, 0};
+  static const ma_node_vtable mixer_vtable{mixer_process, nullptr, 2, 1, 0};
+
+  const ma_node_graph_config graph_config = ma_node_graph_config_init(config.channels);
+  if (ma_node_graph_init(&graph_config, nullptr, &m_graph) != MA_SUCCESS)
+    return false;
+
+  // Both decks feed the mixer, which feeds the endpoint
+  const ma_uint32 channels[2] = {config.channels, config.channels};
+  ma_node_config node_config  = ma_node_config_init();
+  node_config.vtable          = &mixer_vtable;
+  node_config.pInputChannels  = channels;
+  node_config.pOutputChannels = channels;
+  m_mixer.player              = this;
+  if (ma_node_init(&m_graph, &node_config, nullptr, &m_mixer.base) != MA_SUCCESS) {
+    ma_node_graph_uninit(&m_graph, nullptr);
+    return false;
+  }
+  ma_node_attach_output_bus(&m_mixer.base, 0, ma_node_graph_get_endpoint(&m_graph), 0);
+
+  node_config.vtable         = &deck_vtable;
+  node_config.pInputChannels = nullptr;
+  for (std::size_t i = 0; i < m_decks.size(); ++i) {
+    m_decks[i].player = this;
+    m_decks[i].source = i;
+    m_decks[i].gain   = 1.0f;
+    if (ma_node_init(&m_graph, &node_config, nullptr, &m_decks[i].base) != MA_SUCCESS) {
+      for (std::size_t j = 0; j < i; ++j)
+        ma_node_uninit(&m_decks[j].base, nullptr);
+      ma_node_uninit(&m_mixer.base, nullptr);
+      ma_node_graph_uninit(&m_graph, nullptr);
+      return false;
+    }
+    ma_node_attach_output_bus(&m_decks[i].base, 0, &m_mixer.base, static_cast<ma_uint32>(i));
+  }
+  return true;
+}
+
+void Player::process_native(void *out, const ma_uint32 frame_count) {
+  const auto start = std::chrono::steady_clock::now();
+  m_callbacks.fetch_add(1, std::memory_order_relaxed);
+  m_output_frames.fetch_add(frame_count, std::memory_order_release);
+  start_period(frame_count);
+
+  // Only unity segments, without a crossfade
+  const ma_format format      = m_device.playback.format;
+  const ma_uint32 frame_bytes = ma_get_bytes_per_frame(format, config.channels);
+  const std::size_t chunk     = m_native_scratch.size() / config.channels;
+  auto *const bytes           = static_cast<std::uint8_t *>(out);
+  ma_silence_pcm_frames(out, frame_count, format, config.channels);
+  for (const DeckNode &deck : m_decks) {
+    RingBuffer<float> &ring = *m_sources[deck.source].ring;
+    for (std::size_t i = 0; i < deck.segment_count; ++i) {
+      const Segment &segment = deck.segments[i];
+      for (ma_uint32 done = 0; done < segment.frames;) {
+        const auto frames         = static_cast<ma_uint32>(
+            std::min<std::size_t>(segment.frames - done, chunk)
+        );
+        const std::size_t samples = std::size_t{frames} * config.channels;
+        ring.read(m_native_scratch.data(), samples);
+        Utils::narrow_samples(
+            bytes + std::size_t{segment.offset + done} * frame_bytes, m_native_scratch.data(),
+            format, samples
+        );
+        done += frames;
+      }
+    }
+  }
+  record_callback(frame_count, std::chrono::steady_clock::now() - start);
+}
+
+void Player::data_callback(
+    ma_device *device, void *output, const void * /*input*/, ma_uint32 frame_count
+) {
+  Player &player = *static_cast<Player *>(device->pUserData);
+  if (player.m_native_output.load(std::memory_order_acquire))
+    player.process_native(output, frame_count);
+  else
+    player.process(static_cast<float *>(output), frame_count);
+}
+
+void Player::deck_process(
+    ma_node *node, const float ** /*frames_in*/, ma_uint32 * /*frame_count_in*/,
+    float **frames_out, ma_uint32 *frame_count_out
+) {
+  DeckNode &deck           = *static_cast<DeckNode *>(node);
+  const ma_uint32 channels = deck.player->config.channels;
+  RingBuffer<float> &ring  = *deck.player->m_sources[deck.source].ring;
+  float *out               = frames_out[0];
+  const ma_uint32 begin    = deck.cursor;
+  const ma_uint32 end      = begin + *frame_count_out;
+
+  std::fill(out, out + std::size_t{*frame_count_out} * channels, 0.0f);
+  for (std::size_t i = 0; i < deck.segment_count; ++i) {
+    const Segment &segment = deck.segments[i];
+    const ma_uint32 from   = std::max(begin, segment.offset);
+    const ma_uint32 to     = std::min(end, segment.offset + segment.frames);
+    if (from < to)
+      ring.read(out + std::size_t{from - begin} * channels, std::size_t{to - from} * channels);
+  }
+  deck.cursor = end;
+}
+
+void Player::mixer_process(
+    ma_node *node, const float **frames_in, ma_uint32 *frame_count_in, float **frames_out,
+    ma_uint32 *frame_count_out
+) {
+  MixerNode &mixer         = *static_cast<MixerNode *>(node);
+  Player &player           = *mixer.player;
+  const ma_uint32 channels = player.config.channels;
+  const ma_uint32 frames   = std::min(*frame_count_in, *frame_count_out);
+
+  // ReplayGain of each deck, from what was applied last to the source's
+  std::array<float, 2> gains_from{};
+  std::array<float, 2> gains_to{};
+  for (std::size_t i = 0; i < player.m_decks.size(); ++i) {
+    DeckNode &deck = player.m_decks[i];
+    gains_from[i]  = deck.gain;
+    gains_to[i]    = player.m_sources[deck.source].gain.load(std::memory_order_relaxed);
+    deck.gain      = gains_to[i];
+  }
+  const auto gain_at = [&](const std::size_t deck, const ma_uint32 frame) {
+    const float progress = frames > 0 ? static_cast<float>(frame) / frames : 1.0f;
+    return gains_from[deck] + (gains_to[deck] - gains_from[deck]) * progress;
+  };
+
+  // Split where a segment of either deck starts or ends, and every `gain_interval` frames
+  // so that equal power curves stay accurate
+  ma_uint32 done = 0;
+  while (done < frames) {
+    const ma_uint32 frame = mixer.cursor + done;
+    ma_uint32 end         = mixer.cursor + std::min(frames, done + gain_interval);
+    for (const DeckNode &deck : player.m_decks) {
+      for (std::size_t i = 0; i < deck.segment_count; ++i) {
+        const Segment &segment = deck.segments[i];
+        if (segment.offset > frame)
+          end = std::min(end, segment.offset);
+        if (segment.offset + segment.frames > frame)
+          end = std::min(end, segment.offset + segment.frames);
+      }
+    }
+    const ma_uint32 count  = end - frame;
+    const std::size_t skip = std::size_t{done} * channels;
+    const GainRamp ramp_a  = Utils::scale_ramp(
+        player.get_gain_ramp(player.m_decks[0], frame, count), count, gain_at(0, done),
+        gain_at(0, done + count)
+    );
+    const GainRamp ramp_b = Utils::scale_ramp(
+        player.get_gain_ramp(player.m_decks[1], frame, count), count, gain_at(1, done),
+        gain_at(1, done + count)
+    );
+    mix_ramped(
+        frames_out[0] + skip, frames_in[0] + skip, ramp_a, frames_in[1] + skip, ramp_b, count,
+        channels
+    );
+    done += count;
+  }
+  mixer.cursor += frames;
+  *frame_count_in  = frames;
+  *frame_count_out = frames;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static float Utils::crossfade_gain(const CrossfadeCurve curve, const float progress) {
+  const float x = std::clamp(progress, 0.0f, 1.0f);
+  if (curve == CrossfadeCurve::Linear)
+    return x;
+  return std::sin(x * std::numbers::pi_v<float> / 2.0f);
+}
+
+static const char *Utils::get_buffer_mode_name(const BufferMode mode) {
+  switch (mode) {
+    case BufferMode::Fixed: return "fixed";
+    case BufferMode::Adaptive: return "adaptive";
+    case BufferMode::LowLatency: return "low latency";
+  }
+  return "";
+}
+
+static GainRamp Utils::scale_ramp(
+    const GainRamp ramp, const ma_uint32 frames, const float from, const float to
+) {
+  const float start = ramp.gain * from;
+  const float end   = (ramp.gain + ramp.step * static_cast<float>(frames)) * to;
+  return GainRamp{start, (end - start) / static_cast<float>(frames)};
+}
+
+static void Utils::widen_samples(void *samples, const ma_format format, const std::size_t count) {
+  auto *const bytes = static_cast<std::uint8_t *>(samples);
+  const auto store  = [&](const std::size_t i, const std::int32_t value) {
+    std::memcpy(bytes + i * sizeof(float), &value, sizeof(value));
+  };
+  // From the end, the wider samples overwrite those already widened
+  switch (format) {
+    case ma_format_u8:
+      for (std::size_t i = count; i-- > 0;)
+        store(i, bytes[i]);
+      break;
+    case ma_format_s16:
+      for (std::size_t i = count; i-- > 0;) {
+        std::int16_t value = 0;
+        std::memcpy(&value, bytes + i * sizeof(value), sizeof(value));
+        store(i, value);
+      }
+      break;
+    case ma_format_s24:
+      // Packed little endian, shifted back down from the top for the sign
+      for (std::size_t i = count; i-- > 0;) {
+        const std::uint8_t *sample = bytes + i * 3;
+        const std::uint32_t value  = (std::uint32_t{sample[0]} << 8) |
+                                    (std::uint32_t{sample[1]} << 16) |
+                                    (std::uint32_t{sample[2]} << 24);
+        store(i, static_cast<std::int32_t>(value) >> 8);
+      }
+      break;
+    default: break;
+  }
+}
+
+static void Utils::narrow_samples(
+    void *out, const float *slots, const ma_format format, const std::size_t count
+) {
+  auto *const bytes = static_cast<std::uint8_t *>(out);
+  const auto load   = [&](const std::size_t i) {
+    std::int32_t value = 0;
+    std::memcpy(&value, slots + i, sizeof(value));
+    return value;
+  };
+  switch (format) {
+    case ma_format_u8:
+      for (std::size_t i = 0; i < count; ++i)
+        bytes[i] = static_cast<std::uint8_t>(load(i));
+      break;
+    case ma_format_s16:
+      for (std::size_t i = 0; i < count; ++i) {
+        const auto value = static_cast<std::int16_t>(load(i));
+        std::memcpy(bytes + i * sizeof(value), &value, sizeof(value));
+      }
+      break;
+    case ma_format_s24:
+      for (std::size_t i = 0; i < count; ++i) {
+        const auto value = static_cast<std::uint32_t>(load(i));
+        bytes[i * 3]     = static_cast<std::uint8_t>(value);
+        bytes[i * 3 + 1] = static_cast<std::uint8_t>(value >> 8);
+        bytes[i * 3 + 2] = static_cast<std::uint8_t>(value >> 16);
+      }
+      break;
+    default: std::memcpy(out, slots, count * sizeof(float)); break;
+  }
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,753 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "miniaudio.h"
+
+#include "./decoder_pool.hpp"
+#include "./dsp.hpp"
+#include "./file_vfs.hpp"
+#include "./histogram.hpp"
+#include "./mix.hpp"
+#include "./pcm_cache.hpp"
+#include "./replay_gain.hpp"
+#include "./resampler.hpp"
+#include "./ring_buffer.hpp"
+#include "./seek_index.hpp"
+#include "./time_stretch.hpp"
+#include "./waveform.hpp"
+
+namespace Tmupp {
+
+enum class CrossfadeCurve {
+  /**
+   * Keeps the loudness constant between uncorrelated tracks.
+   */
+  EqualPower,
+  Linear,
+};
+
+enum class BufferMode {
+  /**
+   * `PlayerConfig::period_size_in_frames` and `PlayerConfig::periods` as they are.
+   */
+  Fixed,
+  /**
+   * Start with short periods, double them when the callback is late or runs out of
+   * audio, and halve them back after a long enough time without.
+   */
+  Adaptive,
+  /**
+   * The shortest periods, for pause, seek and skip to be heard at once.
+   */
+  LowLatency,
+};
+
+struct PlayerConfig {
+  /**
+   * 0 to use the device's native rate.
+   */
+  ma_uint32 sample_rate = 0;
+  ma_uint32 channels    = 2;
+  /**
+   * 0 to let miniaudio pick, as for the number of periods.
+   */
+  ma_uint32 period_size_in_frames = 0;
+  ma_uint32 periods               = 0;
+  BufferMode buffer_mode          = BufferMode::Fixed;
+  /**
+   * Amount of decoded audio kept ahead of the device.
+   */
+  ma_uint32 ring_milliseconds = 500;
+  /**
+   * Audio decoded before a track (or a seek) starts playing.
+   */
+  ma_uint32 prefill_milliseconds = 50;
+  /**
+   * The next track is opened and decoded once the current one is this close to its end.
+   */
+  ma_uint32 gapless_window_milliseconds = 5000;
+  /**
+   * Initial crossfade settings, see `Player::set_crossfade()`.
+   */
+  ma_uint32 crossfade_milliseconds = 0;
+  CrossfadeCurve crossfade_curve   = CrossfadeCurve::EqualPower;
+  /**
+   * How tracks are converted to the device's rate when theirs differs, see `Resampler`.
+   */
+  ResamplerQuality resampler_quality = ResamplerQuality::Medium;
+  /**
+   * How the decoders read the files.
+   */
+  FileVfsConfig io{};
+  /**
+   * Workers for the decoding and analyses run besides playback, see `DecoderPool`.
+   */
+  DecoderPoolConfig decoder_pool{};
+  /**
+   * Where the seek indexes of MP3s and FLACs are kept, see `SeekIndexStore`.
+   */
+  std::string seek_index_dir{};
+  /**
+   * Where the waveforms, and the silence found along, are kept, see `WaveformStore`.
+   */
+  std::string waveform_dir{};
+  /**
+   * Skip the silence at the start and the end of tracks when it lasts at least that long,
+   * 0 to play it. Only done while crossfading, tracks played back to back keep the pauses
+   * between them. Tracks are analysed in the background the first time they're played,
+   * and trimmed from then on.
+   */
+  ma_uint32 trim_silence_milliseconds = 0;
+  /**
+   * Decoded audio kept for replays and seeks, see `PcmCache`.
+   */
+  PcmCacheConfig cache{};
+  /**
+   * Initial volume, EQ and limiter settings, see `Player::get_dsp()`.
+   */
+  DspConfig dsp{};
+  /**
+   * Initial ReplayGain settings, see `Player::set_replay_gain()`.
+   */
+  ReplayGainConfig replay_gain{};
+  /**
+   * Initial playback speed, see `Player::set_speed()`.
+   */
+  float speed = 1.0f;
+  /**
+   * Play tracks in their own sample format and rate when the device takes them, with no
+   * conversion at all: no resampling, ReplayGain, crossfade, volume or EQ. The device is
+   * reconfigured when a track in another format starts, which takes a short gap between
+   * tracks that would otherwise be gapless. Ignored by headless players.
+   */
+  bool bit_perfect = false;
+  /**
+   * Open no device and start no decoder thread, the audio is pulled with
+   * `Player::pump_decoder()` and `Player::process()` instead, e.g. to render offline.
+   */
+  bool headless = false;
+};
+
+/**
+ * Counters updated by the audio callback.
+ */
+struct PlayerStats {
+  std::uint64_t callbacks = 0;
+  /**
+   * Callbacks that ran out of decoded audio while a track was playing.
+   */
+  std::uint64_t underruns = 0;
+  /**
+   * Frames of silence output because of underruns.
+   */
+  std::uint64_t underrun_frames = 0;
+  /**
+   * Decoded frames waiting in the ring buffer.
+   */
+  std::size_t buffered_frames = 0;
+  /**
+   * Fewest decoded frames waiting when a callback started playing, the margin left
+   * before an underrun.
+   */
+  std::size_t min_buffered_frames = 0;
+  /**
+   * Time spent in the callback.
+   */
+  LatencyHistogram::Snapshot callback_times{};
+  /**
+   * Time spent in the callbacks over the length of the periods they filled, on average
+   * and at most.
+   */
+  double mean_load = 0.0;
+  double max_load  = 0.0;
+  /**
+   * Callbacks that took longer than the period they filled.
+   */
+  std::uint64_t late_callbacks = 0;
+  ma_uint32 sample_rate        = 0;
+  /**
+   * Period size and number of periods of the device, 0 if there's none.
+   */
+  ma_uint32 period_frames = 0;
+  ma_uint32 periods       = 0;
+
+  /**
+   * Device settings, counters, then the histogram of the callback times.
+   */
+  std::string to_string() const;
+};
+
+/**
+  Plays one track at a time.
+
+  A decoder thread pulls PCM from `ma_decoder` into a lock-free ring buffer and the
+  `ma_device` callback only copies from that ring, the callback never locks, allocates
+  or touches the filesystem. Every method only queues a command for the decoder thread
+  and returns immediately.
+
+  Seeking and stopping don't wait for the callback: the decoder records the ring's write
+  count and the callback drops everything written before it the next time it runs.
+
+  Playback is gapless: near the end of a track the next one (see `Player::next_track`) is
+  opened and decoded into a second ring, and the callback moves to that ring on the frame
+  following the last one of the current track. The encoder delay and padding of MP3s
+  are trimmed so that no silence is added in between, as are the long silences a track
+  starts or ends with once it was analysed: the decoder only starts after them and stops
+  before them, like it does for the encoder delay and padding.
+
+  With a crossfade, the two rings are played at once by two nodes of a `ma_node_graph`
+  feeding a mixer node, which ramps their gains frame by frame.
+*/
+class Player {
+ public:
+  enum class State { Stopped, Playing, Paused };
+
+ public:
+  explicit Player(const PlayerConfig &config_ = {});
+  Player(const Player &)            = delete;
+  Player &operator=(const Player &) = delete;
+  ~Player();
+
+  /**
+   * Whether the audio device was initialised, nothing is played otherwise.
+   */
+  bool is_ready() const { return m_device_ready.load(std::memory_order_acquire); }
+
+  void play(const std::string &path);
+  void pause();
+  void resume();
+  void toggle_pause();
+  void stop();
+  void seek(const double seconds);
+  /**
+   * Crossfade the end of each track with the start of the next one over `milliseconds`
+   * (0 to play them back to back, at most `max_crossfade_milliseconds`). Takes effect
+   * from the next transition, one in progress isn't changed.
+   */
+  void set_crossfade(const ma_uint32 milliseconds, const CrossfadeCurve curve);
+  ma_uint32 get_crossfade_milliseconds() const;
+  CrossfadeCurve get_crossfade_curve() const;
+  /**
+   * Gain applied to each track from its tags, changes apply to the tracks already open
+   * within a period.
+   */
+  void set_replay_gain(const ReplayGainConfig &settings);
+  ReplayGainConfig get_replay_gain() const;
+  /**
+   * Volume, EQ and limiter applied to the output, whose setters take effect right away.
+   */
+  DspChain &get_dsp() { return *m_dsp; }
+  /**
+   * Play `speed` times faster, from `TimeStretch::min_speed` to `TimeStretch::max_speed`,
+   * keeping the pitch. Positions, lengths and crossfades stay in the tracks' own time.
+   * Tracks played bit-perfect are always played at their speed.
+   */
+  void set_speed(const float speed) { m_stretch->set_speed(speed); }
+  float get_speed() const { return m_stretch->get_speed(); }
+  /**
+   * Have the callback copy its output to `get_output_tap()`, for meters and visualizers.
+   */
+  void set_output_tap(const bool enabled) {
+    m_tap_enabled.store(enabled, std::memory_order_release);
+  }
+  /**
+   * Output of the callback while the tap is enabled, interleaved, for a single consumer.
+   * What doesn't fit is dropped.
+   */
+  RingBuffer<float> &get_output_tap() { return *m_tap; }
+
+  State get_state() const;
+  /**
+   * Position in seconds of what's being heard.
+   */
+  double get_position() const;
+  /**
+   * Length in seconds of the current track, if known.
+   */
+  std::optional<double> get_duration() const;
+  PlayerStats get_stats() const;
+  /**
+   * Reset the callback times, loads and fewest buffered frames, e.g. after changing the
+   * period size. The other counters count from the start.
+   */
+  void reset_callback_stats();
+  /**
+   * Latency of the decoders' reads and how the files were opened.
+   */
+  IoStats get_io_stats() const { return m_vfs.get_stats(); }
+  PcmCacheStats get_cache_stats() const { return m_pcm_cache.get_stats(); }
+  /**
+   * Pool the seek indexes are built by, for analyses to share. Its background jobs are
+   * cancelled whenever playback runs low.
+   */
+  DecoderPool &get_decoder_pool() { return m_decoder_pool; }
+  /**
+   * Waveforms of the tracks played, for the UI.
+   */
+  WaveformStore &get_waveforms() { return m_waveforms; }
+
+  /**
+   * Rate of the mixed output, the device's once it's initialised. Tracks played
+   * bit-perfect are output at their own rate instead.
+   */
+  ma_uint32 get_sample_rate() const { return m_sample_rate; }
+  ma_uint32 get_channels() const { return config.channels; }
+
+  /**
+   * Fill `frame_count` frames of `out`, this is the body of the audio callback.
+   */
+  void process(float *out, const ma_uint32 frame_count);
+  /**
+   * Headless players only: do the decoder thread's work once. Called before every
+   * `process()`, the rings are always topped up so the output doesn't depend on timing
+   * and is rendered as fast as it's decoded.
+   */
+  void pump_decoder();
+
+ public:
+  static constexpr ma_uint32 max_crossfade_milliseconds = 12000;
+
+  const PlayerConfig config;
+
+  /**
+   * Called from the decoder thread for the track to play after the current one, nothing
+   * to stop at the end of the current one.
+   */
+  std::function<std::optional<std::string>()> next_track;
+  /**
+   * Called from the decoder thread when a track played until its end, the next one (if
+   * any) is already playing.
+   */
+  std::function<void()> on_track_end;
+
+ private:
+  struct Command {
+    enum class Kind { Play, Seek, Stop, ReplayGain, Quit };
+
+    Kind kind;
+    std::string path{};
+    double seconds = 0.0;
+  };
+
+  /**
+   * Format of the device, and of the audio the rings hold in it.
+   */
+  struct OutputFormat {
+    ma_format format;
+    ma_uint32 sample_rate;
+
+    bool operator==(const OutputFormat &) const = default;
+  };
+
+  /**
+   * A track being decoded into its own ring.
+   */
+  struct Source {
+    /**
+     * Floats, or the samples of a track played bit-perfect, each in 32 bits (see
+     * `Utils::widen_samples()`).
+     */
+    std::unique_ptr<RingBuffer<float>> ring;
+
+    // Decoder thread only
+    ma_decoder decoder{};
+    bool open         = false;
+    bool end_of_track = false;
+    std::string path;
+    OutputFormat output{ma_format_f32, 0};
+    /**
+     * Unknown unless the decoder was opened as an MP3 or a FLAC.
+     */
+    ma_encoding_format format = ma_encoding_format_unknown;
+    /**
+     * Bound to the decoder once built.
+     */
+    std::shared_ptr<SeekIndex> seek_index;
+    std::optional<ReplayGain> replay_gain;
+    /**
+     * Frames trimmed from the start of the decoded stream.
+     */
+    std::uint64_t start_frame = 0;
+    /**
+     * Frames written to the ring since `start_frame`.
+     */
+    std::uint64_t decoded_frames = 0;
+    /**
+     * Frame the decoder outputs next, behind `decoded_frames` after reading from the cache
+     * and ahead of it after a seek served by the cache.
+     */
+    std::uint64_t decoder_frames = 0;
+    /**
+     * Audio of the track decoded before, nullptr if the cache is disabled.
+     */
+    PcmCache::Entry *cache_entry = nullptr;
+
+    // Shared with the callback
+    /**
+     * Set once the last frame of the track was written to the ring.
+     */
+    std::atomic<bool> decoded_all{false};
+    /**
+     * Set by the decoder once the next track is buffered, cleared by the callback when
+     * it starts playing it.
+     */
+    std::atomic<bool> ready{false};
+    /**
+     * Length of the track once trimmed, 0 if unknown.
+     */
+    std::atomic<std::uint64_t> length_frames{0};
+    /**
+     * Write count of the ring when the track was opened, anything before is stale.
+     */
+    std::atomic<std::uint64_t> start_write_count{0};
+    /**
+     * ReplayGain of the track, applied by the mixer.
+     */
+    std::atomic<float> gain{1.0f};
+    /**
+     * Rate of the audio in the ring.
+     */
+    std::atomic<ma_uint32> sample_rate{0};
+  };
+
+  /**
+   * Frames of a period a deck plays and how loud.
+   */
+  struct Segment {
+    enum class Gain { Unity, FadeIn, FadeOut };
+
+    ma_uint32 offset;
+    ma_uint32 frames;
+    Gain gain;
+    /**
+     * Progress of the crossfade at `offset`, from 0 to 1, and per frame.
+     */
+    float fade_position;
+    float fade_step;
+  };
+
+  /**
+   * Node playing the ring of one source, at the segments planned for the period.
+   */
+  struct DeckNode {
+    /**
+     * At most a crossfade ending, a track ending and a crossfade starting per period.
+     */
+    static constexpr std::size_t max_segments = 4;
+
+    ma_node_base base;
+    Player *player;
+    std::size_t source;
+    std::array<Segment, max_segments> segments;
+    std::size_t segment_count;
+    /**
+     * Frames planned and frames already output in this period.
+     */
+    ma_uint32 planned;
+    ma_uint32 cursor;
+    /**
+     * ReplayGain the mixer applied last, it ramps to the source's over a call when the
+     * source's changes.
+     */
+    float gain;
+  };
+
+  /**
+   * Node summing the decks with their gains.
+   */
+  struct MixerNode {
+    ma_node_base base;
+    Player *player;
+    ma_uint32 cursor;
+  };
+
+  /**
+   * Initialise the device with periods of `period_frames` frames, or
+   * `period_milliseconds` if 0, at the rate of the rings once they're made.
+   */
+  bool init_device(
+      const ma_uint32 period_frames, const ma_uint32 period_milliseconds, const ma_uint32 periods
+  );
+  /**
+   * Reinitialise the device with periods of `period_frames` frames.
+   */
+  void resize_device(const ma_uint32 period_frames);
+  /**
+   * Mixed output: floats at the player's rate.
+   */
+  OutputFormat get_mixed_output() const { return OutputFormat{ma_format_f32, m_sample_rate}; }
+  /**
+   * Format to output a track in: its own in bit-perfect mode, if the device didn't refuse
+   * it before and it has as many channels as the output, the mixed one otherwise.
+   */
+  OutputFormat get_track_output(const std::string &path);
+  /**
+   * Reconfigure the device for `output` if it isn't already, or for the mixed output if
+   * it doesn't take `output` as it is.
+   */
+  void set_output(const OutputFormat &output);
+  /**
+   * Adaptive buffer mode: grow or shrink the periods depending on the glitches since the
+   * last check.
+   */
+  void adapt_buffer();
+  bool init_graph();
+  void post(Command command);
+  void decoder_loop();
+  /**
+   * Run `commands`, then top up the rings and prepare the next track, returns false
+   * once asked to quit.
+   */
+  bool decode_step(const std::deque<Command> &commands);
+  void open_track(const std::string &path);
+  void close_track();
+  void seek_track(const double seconds);
+  /**
+   * Open the track at `path`, decoded to `output`.
+   */
+  bool open_source(Source &source, const std::string &path, const OutputFormat &output);
+  void close_source(Source &source);
+  /**
+   * Recompute the ReplayGain of the open sources with the current settings.
+   */
+  void update_replay_gain();
+  /**
+   * Bind the seek index of the source if it's ready, have it built otherwise by a job of
+   * `priority`.
+   */
+  void use_seek_index(Source &source, const JobPriority priority = JobPriority::Prefetch);
+  /**
+   * Open and buffer the next track once the current one is close to its end.
+   */
+  void prepare_next();
+  /**
+   * Handle the callback having moved to the next track, returns whether it did.
+   */
+  bool follow_callback();
+  /**
+   * Drop everything buffered, including the next track, and make the position
+   * `position_frames` once the callback has done so.
+   */
+  void flush(const std::uint64_t position_frames);
+  /**
+   * Decode (or read from the cache) until the ring is full or the track ends, returns
+   * whether the track ended.
+   */
+  bool fill_ring(Source &source);
+
+  /**
+   * Handle a flush, then plan what the decks play in the period if playing, which both
+   * kinds of callbacks start with.
+   */
+  void start_period(const ma_uint32 frame_count);
+  /**
+   * Fill `frame_count` frames of `out` through the time stretch, pulling periods from the
+   * graph as it needs them. Returns the frames filled, fewer if the graph couldn't be read.
+   */
+  ma_uint32 process_stretched(float *out, const ma_uint32 frame_count);
+  /**
+   * Plan what the decks play in the period, returns the source playing at its end.
+   */
+  std::size_t plan_period(std::size_t playing, const ma_uint32 frame_count);
+  /**
+   * Plan up to `frames` frames of the ring of `source` at `offset`, as much as it holds.
+   */
+  ma_uint32 plan_segment(
+      const std::size_t source, const ma_uint32 offset, const ma_uint32 frames,
+      const Segment::Gain gain, const float fade_position = 0.0f, const float fade_step = 0.0f
+  );
+  /**
+   * Account for a callback that filled `frame_count` frames in `duration`.
+   */
+  void record_callback(const ma_uint32 frame_count, const std::chrono::nanoseconds duration);
+  /**
+   * Start playing the next track if it's ready, returns whether it was.
+   */
+  bool start_next(std::size_t &playing);
+  /**
+   * Gain of a deck over `frames` frames from `frame`, which mustn't cross a segment.
+   */
+  GainRamp get_gain_ramp(const DeckNode &deck, const ma_uint32 frame, const ma_uint32 frames) const;
+
+  /**
+   * Body of the audio callback while playing bit-perfect: copy the rings to `out`, in the
+   * device's format.
+   */
+  void process_native(void *out, const ma_uint32 frame_count);
+
+  static void data_callback(
+      ma_device *device, void *output, const void *input, ma_uint32 frame_count
+  );
+  static void deck_process(
+      ma_node *node, const float **frames_in, ma_uint32 *frame_count_in, float **frames_out,
+      ma_uint32 *frame_count_out
+  );
+  static void mixer_process(
+      ma_node *node, const float **frames_in, ma_uint32 *frame_count_in, float **frames_out,
+      ma_uint32 *frame_count_out
+  );
+
+ private:
+  ma_device m_device{};
+  FileVfs m_vfs;
+  Resampler m_resampler;
+  DecoderPool m_decoder_pool;
+  SeekIndexStore m_seek_indexes;
+  WaveformStore m_waveforms;
+  PcmCache m_pcm_cache;
+  std::unique_ptr<DspChain> m_dsp;
+  std::unique_ptr<TimeStretch> m_stretch;
+  std::unique_ptr<RingBuffer<float>> m_tap;
+  std::atomic<bool> m_device_ready{false};
+  ma_uint32 m_sample_rate = 0;
+  /**
+   * Rate of the device, which differs from `m_sample_rate` while playing bit-perfect.
+   */
+  std::atomic<ma_uint32> m_output_rate{0};
+  /**
+   * `config.bit_perfect` unless headless: tracks are output in their own format when the
+   * device takes it.
+   */
+  bool m_bit_perfect = false;
+  /**
+   * Whether the device is configured for a track's own format rather than the mixed
+   * output, the callback is then `process_native()`.
+   */
+  std::atomic<bool> m_native_output{false};
+  std::atomic<ma_uint32> m_period_frames{0};
+  std::atomic<ma_uint32> m_periods{0};
+  /**
+   * Held while the device is (re)initialised or uninitialised.
+   */
+  std::mutex m_device_mutex;
+  std::array<Source, 2> m_sources;
+  ma_node_graph m_graph{};
+  bool m_graph_ready = false;
+  std::array<DeckNode, 2> m_decks{};
+  MixerNode m_mixer{};
+
+  // Decoder thread only
+  /**
+   * Source of the current track, the other one is for the next track.
+   */
+  std::size_t m_current    = 0;
+  bool m_next_requested    = false;
+  std::uint32_t m_switches = 0;
+  std::vector<float> m_scratch;
+  /**
+   * Adaptive buffer mode state: last check, late callbacks and underruns counted then,
+   * last glitch or resize, and how long to go without glitches before shrinking.
+   */
+  std::chrono::steady_clock::time_point m_adapt_checked{};
+  std::uint64_t m_adapt_glitches = 0;
+  std::chrono::steady_clock::time_point m_adapt_calm_since{};
+  std::chrono::seconds m_adapt_shrink_delay{0};
+  /**
+   * Whether the last resize was a shrink, which a glitch soon after proves wrong.
+   */
+  bool m_adapt_shrunk = false;
+  /**
+   * Format the device was last configured with, and formats it refused to take as they
+   * are.
+   */
+  OutputFormat m_output{ma_format_f32, 0};
+  std::vector<OutputFormat> m_refused_outputs;
+  /**
+   * Next track, if it needs the device in another format and will only be opened once
+   * the current one ended.
+   */
+  std::optional<std::string> m_deferred_track;
+  /**
+   * Once the current track ended, value of `m_output_frames` by which the device played
+   * what it held of it and can be reconfigured for the deferred track.
+   */
+  std::optional<std::uint64_t> m_deferred_at;
+
+  // Shared with the callback
+  /**
+   * Whether the callback should play what's in the ring, false while (re)buffering.
+   */
+  std::atomic<bool> m_active{false};
+  std::atomic<bool> m_paused{false};
+  std::atomic<bool> m_tap_enabled{false};
+  std::atomic<ma_uint32> m_crossfade_milliseconds{0};
+  std::atomic<CrossfadeCurve> m_crossfade_curve{CrossfadeCurve::EqualPower};
+  std::atomic<std::uint32_t> m_flush_request{0};
+  std::array<std::atomic<std::uint64_t>, 2> m_flush_write_counts{};
+  std::atomic<std::uint64_t> m_flush_position{0};
+  std::atomic<std::size_t> m_flush_source{0};
+  /**
+   * Last flush the callback handled (high 32 bits) and the number of times it moved
+   * to the next track since (low 32 bits), in one word so the decoder can tell
+   * whether a move happened before or after a flush.
+   */
+  std::atomic<std::uint64_t> m_callback_state{0};
+  /**
+   * Source the callback plays.
+   */
+  std::atomic<std::size_t> m_playing{0};
+  std::atomic<std::uint64_t> m_position_frames{0};
+  std::atomic<std::uint64_t> m_callbacks{0};
+  /**
+   * Frames the callback output, past the end of the tracks too.
+   */
+  std::atomic<std::uint64_t> m_output_frames{0};
+  std::atomic<std::uint64_t> m_underruns{0};
+  std::atomic<std::uint64_t> m_underrun_frames{0};
+  LatencyHistogram m_callback_times;
+  /**
+   * Length of the periods the callback filled since the reset, for the mean load.
+   */
+  std::atomic<std::uint64_t> m_budget_ns{0};
+  std::atomic<double> m_max_load{0.0};
+  std::atomic<std::uint64_t> m_late_callbacks{0};
+  std::atomic<std::size_t> m_min_buffered_frames{SIZE_MAX};
+  /**
+   * Whether a track is open, only written by the decoder thread.
+   */
+  std::atomic<bool> m_has_track{false};
+
+  // Callback only
+  /**
+   * Samples read from the rings before they're narrowed to the device's format.
+   */
+  std::vector<float> m_native_scratch;
+  /**
+   * Output of the graph on its way to the time stretch.
+   */
+  std::vector<float> m_stretch_scratch;
+  std::uint32_t m_flush_seen     = 0;
+  std::uint32_t m_switches_since = 0;
+  /**
+   * Crossfade in progress, from `m_fading_out` to the playing source.
+   */
+  bool m_fading                 = false;
+  std::size_t m_fading_out      = 0;
+  std::uint64_t m_fade_position = 0;
+  std::uint64_t m_fade_length   = 0;
+  CrossfadeCurve m_fade_curve   = CrossfadeCurve::EqualPower;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Command> m_commands;
+  /**
+   * Guarded by `m_mutex`.
+   */
+  ReplayGainConfig m_replay_gain{};
+  std::thread m_decoder_thread;
+};
+
+}  // namespace Tmupp
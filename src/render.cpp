@@ -0,0 +1,206 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "miniaudio.h"
+
+#include "./histogram.hpp"
+#include "./player.hpp"
+#include "./resampler.hpp"
+
+/**
+  Plays tracks back to back through a headless player as fast as they decode, without a
+  sound card, and reports a hash of the output, the time spent per callback and the
+  underruns. The output is the same on every run, so the hash can be compared to a known
+  one to catch regressions of the gapless transitions, crossfades, DSP and time stretch.
+*/
+
+struct Options {
+  std::vector<std::string> tracks;
+  std::uint32_t rate                   = 48000;
+  std::uint32_t channels               = 2;
+  std::uint32_t period                 = 480;
+  std::uint32_t crossfade_milliseconds = 0;
+  Tmupp::ResamplerQuality resampler    = Tmupp::ResamplerQuality::Medium;
+  /**
+   * Playback speed, see `Tmupp::TimeStretch`.
+   */
+  float speed = 1.0f;
+  /**
+   * 32 bits float WAV of the output, if not empty.
+   */
+  std::string out;
+  /**
+   * Stop after this much output, 0 to play everything.
+   */
+  double max_seconds = 0.0;
+  /**
+   * Exit with 1 if there are more underruns.
+   */
+  std::uint64_t max_underruns = 0;
+};
+
+static std::optional<Options> parse_args(int argc, char **argv);
+static std::optional<Tmupp::ResamplerQuality> parse_resampler_quality(const std::string &name);
+/**
+ * FNV-1a of the bytes of `samples`, continuing from `hash`.
+ */
+static std::uint64_t hash_samples(std::uint64_t hash, const std::vector<float> &samples);
+
+int main(int argc, char **argv) {
+  const std::optional<Options> options = parse_args(argc, argv);
+  if (not options.has_value())
+    return 2;
+
+  Tmupp::PlayerConfig config{};
+  config.headless               = true;
+  config.sample_rate            = options->rate;
+  config.channels               = options->channels;
+  config.crossfade_milliseconds = options->crossfade_milliseconds;
+  config.resampler_quality      = options->resampler;
+  config.speed                  = options->speed;
+  // Whether the tracks were analysed in the background by then would change the output
+  config.trim_silence_milliseconds = 0;
+  Tmupp::Player player{config};
+  std::size_t next_track = 1;
+  player.next_track      = [&]() -> std::optional<std::string> {
+    if (next_track == options->tracks.size())
+      return std::nullopt;
+    return options->tracks[next_track++];
+  };
+
+  ma_encoder encoder{};
+  bool encoding = false;
+  if (not options->out.empty()) {
+    const ma_encoder_config encoder_config = ma_encoder_config_init(
+        ma_encoding_format_wav, ma_format_f32, options->channels, options->rate
+    );
+    if (ma_encoder_init_file(options->out.c_str(), &encoder_config, &encoder) != MA_SUCCESS) {
+      std::cerr << std::format("Failed to create {}\n", options->out);
+      return 2;
+    }
+    encoding = true;
+  }
+
+  const auto max_frames =
+      static_cast<std::uint64_t>(options->max_seconds * static_cast<double>(options->rate));
+  std::vector<float> buffer(std::size_t{options->period} * options->channels);
+  Tmupp::LatencyHistogram decoder_times{};
+  std::uint64_t hash   = 0xcbf29ce484222325;
+  std::uint64_t frames = 0;
+
+  player.play(options->tracks.front());
+  const auto start = std::chrono::steady_clock::now();
+  do {
+    {
+      Tmupp::ScopedLatency latency{decoder_times};
+      player.pump_decoder();
+    }
+    player.process(buffer.data(), options->period);
+    hash = hash_samples(hash, buffer);
+    if (encoding)
+      ma_encoder_write_pcm_frames(&encoder, buffer.data(), options->period, nullptr);
+    frames += options->period;
+  } while (player.get_state() != Tmupp::Player::State::Stopped and
+           (max_frames == 0 or frames < max_frames));
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  if (encoding)
+    ma_encoder_uninit(&encoder);
+
+  const Tmupp::PlayerStats stats = player.get_stats();
+  const double seconds           = static_cast<double>(frames) / options->rate;
+  std::cout << std::format(
+      "{:.3f} s rendered in {:.3f} s ({:.1f}x realtime)\n", seconds, elapsed.count(),
+      seconds / elapsed.count()
+  );
+  std::cout << std::format("hash {:016x}\n", hash);
+  std::cout << std::format(
+      "\nCallbacks of {} frames ({:.0f} us):\n{}", options->period,
+      options->period * 1e6 / options->rate, stats.to_string()
+  );
+  std::cout << std::format("\nTime per decoder step:\n{}", decoder_times.snapshot().to_string());
+  return stats.underruns > options->max_underruns ? 1 : 0;
+}
+
+static std::optional<Options> parse_args(int argc, char **argv) {
+  Options options{};
+  const std::string usage = std::format(
+      "Usage: {} [--rate 48000] [--channels 2] [--period 480] [--crossfade 0]\n"
+      "          [--resampler linear|low|medium|high] [--speed 1.0] [--out output.wav]\n"
+      "          [--max-seconds 0] [--max-underruns 0] track...\n",
+      argv[0]
+  );
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (not arg.starts_with("--")) {
+      options.tracks.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--rate") {
+      options.rate = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--channels") {
+      options.channels = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--period") {
+      options.period = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--crossfade") {
+      options.crossfade_milliseconds = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--resampler") {
+      const auto quality = parse_resampler_quality(value);
+      if (not quality.has_value()) {
+        std::cerr << usage;
+        return std::nullopt;
+      }
+      options.resampler = *quality;
+    } else if (arg == "--speed") {
+      options.speed = std::stof(value);
+    } else if (arg == "--out") {
+      options.out = value;
+    } else if (arg == "--max-seconds") {
+      options.max_seconds = std::stod(value);
+    } else if (arg == "--max-underruns") {
+      options.max_underruns = std::stoull(value);
+    } else {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+  }
+  if (options.tracks.empty() or options.rate == 0 or options.channels == 0 or
+      options.period == 0 or options.speed < Tmupp::TimeStretch::min_speed or
+      options.speed > Tmupp::TimeStretch::max_speed) {
+    std::cerr << usage;
+    return std::nullopt;
+  }
+  return options;
+}
+
+static std::optional<Tmupp::ResamplerQuality> parse_resampler_quality(const std::string &name) {
+  for (const Tmupp::ResamplerQuality quality :
+       {Tmupp::ResamplerQuality::Linear, Tmupp::ResamplerQuality::Low,
+        Tmupp::ResamplerQuality::Medium, Tmupp::ResamplerQuality::High})
+    if (name == Tmupp::get_resampler_quality_name(quality))
+      return quality;
+  return std::nullopt;
+}
+
+static std::uint64_t hash_samples(std::uint64_t hash, const std::vector<float> &samples) {
+  for (const float sample : samples) {
+    unsigned char bytes[sizeof(float)];
+    std::memcpy(bytes, &sample, sizeof(float));
+    for (const unsigned char byte : bytes) {
+      hash ^= byte;
+      hash *= 0x100000001b3;
+    }
+  }
+  return hash;
+}
@@ -0,0 +1,83 @@
+#include "./replay_gain.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <string_view>
+
+#include <taglib/fileref.h>
+#include <taglib/tpropertymap.h>
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * The number a tag starts with, as in "-6.48 dB" or "+1.20 dB".
+ */
+static std::optional<float> parse_tag_value(
+    const TagLib::PropertyMap &properties, const char *key
+);
+
+}  // namespace Utils
+
+std::optional<ReplayGain> read_replay_gain(const std::string &path) {
+  const TagLib::FileRef fref{path.c_str()};
+  if (fref.isNull() or fref.file() == nullptr)
+    return std::nullopt;
+  const TagLib::PropertyMap properties = fref.file()->properties();
+
+  ReplayGain tags{};
+  tags.track_gain_db = Utils::parse_tag_value(properties, "REPLAYGAIN_TRACK_GAIN");
+  tags.track_peak    = Utils::parse_tag_value(properties, "REPLAYGAIN_TRACK_PEAK");
+  tags.album_gain_db = Utils::parse_tag_value(properties, "REPLAYGAIN_ALBUM_GAIN");
+  tags.album_peak    = Utils::parse_tag_value(properties, "REPLAYGAIN_ALBUM_PEAK");
+  if (not tags.track_gain_db.has_value() and not tags.album_gain_db.has_value())
+    return std::nullopt;
+  return tags;
+}
+
+float get_replay_gain_factor(
+    const std::optional<ReplayGain> &tags, const ReplayGainConfig &config
+) {
+  if (config.mode == ReplayGainMode::Off)
+    return 1.0f;
+  if (not tags.has_value())
+    return std::pow(10.0f, config.untagged_db / 20.0f);
+
+  const bool album = config.mode == ReplayGainMode::Album ? tags->album_gain_db.has_value()
+                                                          : not tags->track_gain_db.has_value();
+  const float gain_db             = album ? *tags->album_gain_db : *tags->track_gain_db;
+  const std::optional<float> peak = album ? tags->album_peak : tags->track_peak;
+
+  float factor = std::pow(10.0f, (gain_db + config.preamp_db) / 20.0f);
+  if (config.prevent_clipping and peak.has_value() and *peak > 0.0f)
+    factor = std::min(factor, 1.0f / *peak);
+  return factor;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::optional<float> Utils::parse_tag_value(
+    const TagLib::PropertyMap &properties, const char *key
+) {
+  const auto it = properties.find(key);
+  if (it == properties.end() or it->second.isEmpty())
+    return std::nullopt;
+  const std::string value = it->second.front().to8Bit(true);
+
+  std::string_view view{value};
+  while (not view.empty() and (view.front() == ' ' or view.front() == '+'))
+    view.remove_prefix(1);
+  float number = 0.0f;
+  const std::from_chars_result result =
+      std::from_chars(view.data(), view.data() + view.size(), number);
+  if (result.ec != std::errc{} or not std::isfinite(number))
+    return std::nullopt;
+  return number;
+}
+
+}  // namespace Tmupp
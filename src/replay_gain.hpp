@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+namespace Tmupp {
+
+enum class ReplayGainMode {
+  Off,
+  Track,
+  /**
+   * Keeps the loudness differences between the tracks of an album.
+   */
+  Album,
+};
+
+struct ReplayGainConfig {
+  ReplayGainMode mode = ReplayGainMode::Track;
+  /**
+   * Added to the gain of every tagged track.
+   */
+  float preamp_db = 0.0f;
+  /**
+   * Gain of the tracks without ReplayGain tags.
+   */
+  float untagged_db = 0.0f;
+  /**
+   * Lower the gain of tracks whose peak would clip otherwise.
+   */
+  bool prevent_clipping = true;
+};
+
+/**
+ * ReplayGain tags of a track, peaks being linear.
+ */
+struct ReplayGain {
+  std::optional<float> track_gain_db;
+  std::optional<float> track_peak;
+  std::optional<float> album_gain_db;
+  std::optional<float> album_peak;
+};
+
+/**
+  Read the REPLAYGAIN_* tags of a file (Vorbis comments of a FLAC, TXXX frames of an
+  MP3's ID3v2 tag).
+
+  Returns nothing for files TagLib can't open or without any of these tags.
+*/
+std::optional<ReplayGain> read_replay_gain(const std::string &path);
+
+/**
+ * Linear gain to apply to a track, falling back to the other mode's gain if the one of
+ * `config.mode` isn't tagged.
+ */
+float get_replay_gain_factor(
+    const std::optional<ReplayGain> &tags, const ReplayGainConfig &config
+);
+
+}  // namespace Tmupp
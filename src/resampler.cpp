@@ -0,0 +1,412 @@
+#include "./resampler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <new>
+#include <numbers>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Tmupp {
+
+/**
+ * Phases the table of a filter holds at most, more are rounded down to the nearest one.
+ */
+static constexpr std::uint64_t max_phases = 1024;
+/**
+ * Taps of a filter at most, when downsampling by a large factor widens it.
+ */
+static constexpr std::size_t max_taps = 1024;
+/**
+ * Frames of input a stream takes at once, past what its filter needs.
+ */
+static constexpr std::size_t chunk_frames = 1024;
+
+struct QualitySettings {
+  std::size_t taps;
+  /**
+   * Of the Kaiser window.
+   */
+  double beta;
+  /**
+   * Cutoff frequency over the Nyquist frequency of the lower rate.
+   */
+  double cutoff;
+};
+
+// Static helper functions
+namespace Utils {
+
+static QualitySettings get_quality_settings(const ResamplerQuality quality);
+
+/**
+ * Zeroth order modified Bessel function of the first kind.
+ */
+static double bessel_i0(const double x);
+
+/**
+ * Sum of `a[i] * b[i]`, `count` being a multiple of 8.
+ */
+static float dot(const float *a, const float *b, const std::size_t count);
+
+}  // namespace Utils
+
+Resampler::Resampler(const ResamplerQuality quality_) : quality{quality_} {}
+
+void Resampler::apply(ma_resampler_config &config) {
+  if (quality == ResamplerQuality::Linear) {
+    config.algorithm = ma_resample_algorithm_linear;
+    return;
+  }
+  config.algorithm        = ma_resample_algorithm_custom;
+  config.pBackendVTable   = get_vtable();
+  config.pBackendUserData = this;
+}
+
+bool Resampler::drain(ma_decoder &decoder) {
+  const ma_resampler &resampler = decoder.converter.resampler;
+  if (not decoder.converter.hasResampler or resampler.pBackendVTable != get_vtable())
+    return false;
+  Stream &stream = *static_cast<Stream *>(resampler.pBackend);
+  if (stream.draining)
+    return false;
+  stream.draining = true;
+  stream.padding  = stream.filter->taps / 2;
+  return true;
+}
+
+ma_resampling_backend_vtable *Resampler::get_vtable() {
+  static ma_resampling_backend_vtable vtable{
+      &Resampler::backend_get_heap_size,
+      &Resampler::backend_init,
+      &Resampler::backend_uninit,
+      &Resampler::backend_process,
+      nullptr,
+      &Resampler::backend_get_input_latency,
+      &Resampler::backend_get_output_latency,
+      &Resampler::backend_get_required_input_frame_count,
+      &Resampler::backend_get_expected_output_frame_count,
+      &Resampler::backend_reset,
+  };
+  return &vtable;
+}
+
+const Resampler::Filter &Resampler::get_filter(const ma_uint32 rate_in, const ma_uint32 rate_out) {
+  std::lock_guard lock{m_mutex};
+  std::unique_ptr<Filter> &filter = m_filters[{rate_in, rate_out}];
+  if (filter != nullptr)
+    return *filter;
+
+  const QualitySettings settings = Utils::get_quality_settings(quality);
+  const std::uint64_t divisor    = std::gcd(rate_in, rate_out);
+  filter                         = std::make_unique<Filter>();
+  filter->step                   = rate_in / divisor;
+  filter->phases                 = rate_out / divisor;
+  filter->table_phases           = std::min(filter->phases, max_phases);
+
+  // Downsampling lowers the cutoff below the input's Nyquist frequency, which takes as
+  // many more taps for the same transition band
+  const double ratio  = std::min(1.0, static_cast<double>(rate_out) / rate_in);
+  const double taps   = std::ceil(static_cast<double>(settings.taps) / ratio / 8.0) * 8.0;
+  filter->taps        = std::min(max_taps, static_cast<std::size_t>(taps));
+  const double cutoff = settings.cutoff * ratio;
+
+  // Tap `j` of phase `p` weighs the input frame `j - taps / 2 + 1 - p / table_phases`
+  // frames away from the output one
+  const double half   = static_cast<double>(filter->taps) / 2.0;
+  const double window = Utils::bessel_i0(settings.beta);
+  filter->coefficients.resize(filter->table_phases * filter->taps);
+  std::vector<double> values(filter->taps);
+  for (std::uint64_t p = 0; p < filter->table_phases; ++p) {
+    float *row          = filter->coefficients.data() + p * filter->taps;
+    const double offset = static_cast<double>(p) / static_cast<double>(filter->table_phases);
+    double sum          = 0.0;
+    for (std::size_t j = 0; j < filter->taps; ++j) {
+      const double distance = static_cast<double>(j) - half + 1.0 - offset;
+      const double x        = std::numbers::pi * cutoff * distance;
+      const double sinc     = x == 0.0 ? 1.0 : std::sin(x) / x;
+      const double edge     = distance / half;
+      const double kaiser =
+          std::abs(edge) >= 1.0
+              ? 0.0
+              : Utils::bessel_i0(settings.beta * std::sqrt(1.0 - edge * edge)) / window;
+      values[j] = cutoff * sinc * kaiser;
+      sum += values[j];
+    }
+    // Unity gain at DC for every phase, or the phases would modulate the level
+    for (std::size_t j = 0; j < filter->taps; ++j)
+      row[j] = static_cast<float>(values[j] / sum);
+  }
+  return *filter;
+}
+
+void Resampler::reset(Stream &stream) {
+  // Taps before the first input frame, which they'll repeat
+  const std::size_t lead = stream.filter->taps / 2 - 1;
+  std::fill(stream.input, stream.input + stream.capacity * stream.channels, 0.0f);
+  stream.end        = lead;
+  stream.first      = 0;
+  stream.phase      = 0;
+  stream.frames_in  = 0;
+  stream.frames_out = 0;
+  stream.draining   = false;
+  stream.padding    = 0;
+}
+
+std::uint64_t Resampler::get_required_input(
+    const Stream &stream, const std::uint64_t frame_count
+) {
+  if (frame_count == 0 or stream.draining)
+    return 0;
+  const Filter &filter = *stream.filter;
+  // Frames up to the last tap of the last output frame
+  const std::uint64_t last =
+      stream.first + (stream.phase + (frame_count - 1) * filter.step) / filter.phases;
+  const std::uint64_t needed = last + filter.taps;
+  if (needed <= stream.end)
+    return 0;
+  // What the next call can take, once the frames no longer needed are dropped
+  const std::size_t kept = stream.end - std::min(stream.first, stream.end);
+  return std::min<std::uint64_t>(needed - stream.end, stream.capacity - kept);
+}
+
+std::uint64_t Resampler::get_expected_output(
+    const Stream &stream, const std::uint64_t frame_count
+) {
+  const Filter &filter    = *stream.filter;
+  const std::uint64_t end = stream.end + frame_count;
+  if (end < stream.first + filter.taps)
+    return 0;
+  // Output frames whose taps end within `end`
+  const std::uint64_t span = (end - stream.first - filter.taps) * filter.phases;
+  return span < stream.phase ? 0 : (span - stream.phase) / filter.step + 1;
+}
+
+std::size_t Resampler::compact(Stream &stream) {
+  const std::size_t dropped = std::min(stream.first, stream.end);
+  if (dropped > 0) {
+    for (std::uint32_t c = 0; c < stream.channels; ++c) {
+      float *input = stream.input + c * stream.capacity;
+      std::copy(input + dropped, input + stream.end, input);
+    }
+    stream.first -= dropped;
+    stream.end -= dropped;
+  }
+  return stream.capacity - stream.end;
+}
+
+ma_result Resampler::backend_get_heap_size(
+    void *user_data, const ma_resampler_config *config, size_t *heap_size
+) {
+  if (config->format != ma_format_f32 or config->channels == 0 or config->sampleRateIn == 0 or
+      config->sampleRateOut == 0)
+    return MA_INVALID_ARGS;
+  const Filter &filter =
+      static_cast<Resampler *>(user_data)->get_filter(config->sampleRateIn, config->sampleRateOut);
+  const std::size_t capacity = filter.taps + chunk_frames;
+  *heap_size                 = sizeof(Stream) + capacity * config->channels * sizeof(float);
+  return MA_SUCCESS;
+}
+
+ma_result Resampler::backend_init(
+    void *user_data, const ma_resampler_config *config, void *heap,
+    ma_resampling_backend **backend
+) {
+  Resampler &resampler = *static_cast<Resampler *>(user_data);
+  Stream *stream       = new (heap) Stream{};
+  stream->filter       = &resampler.get_filter(config->sampleRateIn, config->sampleRateOut);
+  stream->channels     = config->channels;
+  stream->capacity     = stream->filter->taps + chunk_frames;
+  // The input buffers follow the state
+  stream->input = reinterpret_cast<float *>(static_cast<unsigned char *>(heap) + sizeof(Stream));
+  reset(*stream);
+  *backend = stream;
+  return MA_SUCCESS;
+}
+
+void Resampler::backend_uninit(
+    void *user_data, ma_resampling_backend *backend, const ma_allocation_callbacks *callbacks
+) {
+  // The heap belongs to miniaudio
+  (void)user_data;
+  (void)callbacks;
+  static_cast<Stream *>(backend)->~Stream();
+}
+
+ma_result Resampler::backend_process(
+    void *user_data, ma_resampling_backend *backend, const void *frames_in,
+    ma_uint64 *frame_count_in, void *frames_out, ma_uint64 *frame_count_out
+) {
+  (void)user_data;
+  Stream &stream       = *static_cast<Stream *>(backend);
+  const Filter &filter = *stream.filter;
+  const auto in        = static_cast<const float *>(frames_in);
+  const auto out       = static_cast<float *>(frames_out);
+
+  // Take what fits of the input, deinterleaved, then the padding past its end. The edges
+  // are extended with the first and last frames: a track that stops mid-waveform to
+  // continue in the next one rings much less at the join than if they were with silence.
+  const std::size_t space = compact(stream);
+  const auto taken        = static_cast<std::size_t>(std::min<ma_uint64>(*frame_count_in, space));
+  for (std::uint32_t c = 0; c < stream.channels; ++c) {
+    float *input = stream.input + c * stream.capacity;
+    for (std::size_t i = 0; i < taken; ++i)
+      input[stream.end + i] = in != nullptr ? in[i * stream.channels + c] : 0.0f;
+    if (stream.frames_in == 0 and taken > 0)
+      std::fill(input, input + stream.end, input[stream.end]);
+  }
+  stream.end += taken;
+  stream.frames_in += taken;
+  if (stream.draining and stream.padding > 0) {
+    const std::size_t padding = std::min(stream.padding, stream.capacity - stream.end);
+    for (std::uint32_t c = 0; c < stream.channels; ++c) {
+      float *input = stream.input + c * stream.capacity + stream.end;
+      std::fill(input, input + padding, input[-1]);
+    }
+    stream.end += padding;
+    stream.padding -= padding;
+  }
+
+  // Past the end, only the frames the input's length accounts for are output
+  std::uint64_t limit = *frame_count_out;
+  if (stream.draining) {
+    const std::uint64_t total =
+        (stream.frames_in * filter.phases + filter.step - 1) / filter.step;
+    limit = std::min(limit, total - std::min(total, stream.frames_out));
+  }
+
+  std::uint64_t produced = 0;
+  while (produced < limit and stream.first + filter.taps <= stream.end) {
+    if (out != nullptr) {
+      const std::uint64_t row = stream.phase * filter.table_phases / filter.phases;
+      const float *weights    = filter.coefficients.data() + row * filter.taps;
+      float *frame            = out + produced * stream.channels;
+      for (std::uint32_t c = 0; c < stream.channels; ++c) {
+        const float *input = stream.input + c * stream.capacity + stream.first;
+        frame[c]           = Utils::dot(input, weights, filter.taps);
+      }
+    }
+    stream.phase += filter.step;
+    stream.first += stream.phase / filter.phases;
+    stream.phase %= filter.phases;
+    ++produced;
+  }
+  stream.frames_out += produced;
+
+  *frame_count_in  = taken;
+  *frame_count_out = produced;
+  return MA_SUCCESS;
+}
+
+ma_uint64 Resampler::backend_get_input_latency(
+    void *user_data, const ma_resampling_backend *backend
+) {
+  (void)user_data;
+  return static_cast<const Stream *>(backend)->filter->taps / 2;
+}
+
+ma_uint64 Resampler::backend_get_output_latency(
+    void *user_data, const ma_resampling_backend *backend
+) {
+  (void)user_data;
+  const Filter &filter = *static_cast<const Stream *>(backend)->filter;
+  return filter.taps / 2 * filter.phases / filter.step;
+}
+
+ma_result Resampler::backend_get_required_input_frame_count(
+    void *user_data, const ma_resampling_backend *backend, ma_uint64 output_frame_count,
+    ma_uint64 *input_frame_count
+) {
+  (void)user_data;
+  *input_frame_count =
+      get_required_input(*static_cast<const Stream *>(backend), output_frame_count);
+  return MA_SUCCESS;
+}
+
+ma_result Resampler::backend_get_expected_output_frame_count(
+    void *user_data, const ma_resampling_backend *backend, ma_uint64 input_frame_count,
+    ma_uint64 *output_frame_count
+) {
+  (void)user_data;
+  *output_frame_count =
+      get_expected_output(*static_cast<const Stream *>(backend), input_frame_count);
+  return MA_SUCCESS;
+}
+
+ma_result Resampler::backend_reset(void *user_data, ma_resampling_backend *backend) {
+  (void)user_data;
+  reset(*static_cast<Stream *>(backend));
+  return MA_SUCCESS;
+}
+
+const char *get_resampler_quality_name(const ResamplerQuality quality) {
+  switch (quality) {
+    case ResamplerQuality::Linear: return "linear";
+    case ResamplerQuality::Low: return "low";
+    case ResamplerQuality::Medium: return "medium";
+    case ResamplerQuality::High: return "high";
+  }
+  return "unknown";
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static QualitySettings Utils::get_quality_settings(const ResamplerQuality quality) {
+  switch (quality) {
+    case ResamplerQuality::Linear:
+    case ResamplerQuality::Low: return QualitySettings{16, 5.0, 0.80};
+    case ResamplerQuality::Medium: return QualitySettings{48, 7.5, 0.90};
+    case ResamplerQuality::High: return QualitySettings{128, 10.0, 0.95};
+  }
+  return QualitySettings{48, 7.5, 0.90};
+}
+
+static double Utils::bessel_i0(const double x) {
+  // The series converges quickly for the betas of the windows
+  double sum  = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 64 and term > sum * 1e-12; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static float Utils::dot(const float *a, const float *b, const std::size_t count) {
+#if defined(__SSE2__)
+  // Two sums, to not wait on the latency of the additions
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (std::size_t i = 0; i < count; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum        = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum        = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(sum);
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  for (std::size_t i = 0; i < count; i += 8) {
+    sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+    sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  return vaddvq_f32(vaddq_f32(sum0, sum1));
+#else
+  float sum = 0.0f;
+  for (std::size_t i = 0; i < count; ++i)
+    sum += a[i] * b[i];
+  return sum;
+#endif
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "miniaudio.h"
+
+namespace Tmupp {
+
+enum class ResamplerQuality {
+  /**
+   * miniaudio's linear resampler: nearly free, but aliases audibly.
+   */
+  Linear,
+  /**
+   * 16 taps, about 54 dB of stopband attenuation.
+   */
+  Low,
+  /**
+   * 48 taps, about 77 dB.
+   */
+  Medium,
+  /**
+   * 128 taps, about 99 dB, flat to 90% of the lower Nyquist frequency.
+   */
+  High,
+};
+
+/**
+  Polyphase windowed-sinc resampler, used by the decoders as a custom miniaudio
+  resampling backend (see `apply()`).
+
+  For each pair of rates, the Kaiser windowed sinc is sampled once per phase, a phase
+  being one of the fractional positions between input frames an output frame can fall
+  on, into a table shared by all the streams converting between these rates. An output
+  sample is then the dot product of a row of the table with as many input samples, which
+  the SSE2 or NEON loops compute 8 taps at a time. Rates that have too many phases in
+  common use the nearest of `max_phases` ones.
+
+  A stream keeps its input in planar buffers, so that the taps are contiguous, and delays
+  nothing: the first output frame lines up with the first input frame. Since the last
+  output frames need input past the end, it holds them back until `drain()` says that no
+  more input is coming.
+*/
+class Resampler {
+ public:
+  explicit Resampler(const ResamplerQuality quality_);
+  Resampler(const Resampler &)            = delete;
+  Resampler &operator=(const Resampler &) = delete;
+
+  /**
+   * Have `config` (e.g. `ma_decoder_config::resampling`) use this resampler, which must
+   * outlive what is initialised with it. When the rates match, miniaudio doesn't create
+   * a resampler and nothing is resampled.
+   */
+  void apply(ma_resampler_config &config);
+
+  /**
+   * Have the resampler of `decoder`, if it's one of ours, output the end of the stream
+   * once its input runs out. Returns whether it wasn't already draining, reading from
+   * `decoder` again then gives the last frames. A seek cancels it.
+   */
+  static bool drain(ma_decoder &decoder);
+
+ public:
+  const ResamplerQuality quality;
+
+ private:
+  /**
+   * Coefficients for converting from `rate_in` to `rate_out`.
+   */
+  struct Filter {
+    /**
+     * Output frames advance by `step / phases` input frames.
+     */
+    std::uint64_t step;
+    std::uint64_t phases;
+    /**
+     * Rows of `taps` coefficients, `table_phases` (at most `max_phases`) of them.
+     */
+    std::size_t taps;
+    std::uint64_t table_phases;
+    std::vector<float> coefficients;
+  };
+
+  /**
+   * State of a stream, at the start of the heap miniaudio allocates for it and followed
+   * by the planar input buffers.
+   */
+  struct Stream {
+    const Filter *filter;
+    std::uint32_t channels;
+    /**
+     * Frames each input buffer holds.
+     */
+    std::size_t capacity;
+    float *input;
+    /**
+     * Frames buffered, and the first one the next output frame is computed from.
+     */
+    std::size_t end;
+    std::size_t first;
+    /**
+     * Position of the next output frame past `first`, in `1 / filter->phases` frames.
+     */
+    std::uint64_t phase;
+    /**
+     * Frames taken and output since the last reset.
+     */
+    std::uint64_t frames_in;
+    std::uint64_t frames_out;
+    bool draining;
+    /**
+     * Silent frames still to append past the end of the input while draining.
+     */
+    std::size_t padding;
+  };
+
+  static ma_resampling_backend_vtable *get_vtable();
+  const Filter &get_filter(const ma_uint32 rate_in, const ma_uint32 rate_out);
+  static void reset(Stream &stream);
+  /**
+   * Input frames needed for `frame_count` more output frames, as much as fits.
+   */
+  static std::uint64_t get_required_input(const Stream &stream, const std::uint64_t frame_count);
+  /**
+   * Output frames available once `frame_count` more input frames are taken.
+   */
+  static std::uint64_t get_expected_output(const Stream &stream, const std::uint64_t frame_count);
+  /**
+   * Move the frames still needed to the start of the buffers, returns how many frames fit
+   * after them.
+   */
+  static std::size_t compact(Stream &stream);
+
+  // miniaudio callbacks
+  static ma_result backend_get_heap_size(
+      void *user_data, const ma_resampler_config *config, size_t *heap_size
+  );
+  static ma_result backend_init(
+      void *user_data, const ma_resampler_config *config, void *heap,
+      ma_resampling_backend **backend
+  );
+  static void backend_uninit(
+      void *user_data, ma_resampling_backend *backend, const ma_allocation_callbacks *callbacks
+  );
+  static ma_result backend_process(
+      void *user_data, ma_resampling_backend *backend, const void *frames_in,
+      ma_uint64 *frame_count_in, void *frames_out, ma_uint64 *frame_count_out
+  );
+  static ma_uint64 backend_get_input_latency(void *user_data, const ma_resampling_backend *backend);
+  static ma_uint64 backend_get_output_latency(
+      void *user_data, const ma_resampling_backend *backend
+  );
+  static ma_result backend_get_required_input_frame_count(
+      void *user_data, const ma_resampling_backend *backend, ma_uint64 output_frame_count,
+      ma_uint64 *input_frame_count
+  );
+  static ma_result backend_get_expected_output_frame_count(
+      void *user_data, const ma_resampling_backend *backend, ma_uint64 input_frame_count,
+      ma_uint64 *output_frame_count
+  );
+  static ma_result backend_reset(void *user_data, ma_resampling_backend *backend);
+
+ private:
+  /**
+   * Guards `m_filters`, decoders may be opened from several threads.
+   */
+  std::mutex m_mutex;
+  std::map<std::pair<ma_uint32, ma_uint32>, std::unique_ptr<Filter>> m_filters;
+};
+
+/**
+ * "linear", "low", "medium" or "high".
+ */
+const char *get_resampler_quality_name(const ResamplerQuality quality);
+
+}  // namespace Tmupp
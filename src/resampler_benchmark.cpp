@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "miniaudio.h"
+
+#include "./resampler.hpp"
+
+struct Options {
+  double seconds         = 60.0;
+  std::uint32_t channels = 2;
+  /**
+   * Output frames asked for at once, as the decoder does.
+   */
+  std::size_t chunk = 1024;
+};
+
+static std::optional<Options> parse_args(int argc, char **argv);
+/**
+ * Seconds spent converting `options.seconds` of white noise from `rate_in` to `rate_out`,
+ * or nothing if the resampler couldn't be initialised.
+ */
+static std::optional<double> run(
+    const Options &options, const Tmupp::ResamplerQuality quality, const ma_uint32 rate_in,
+    const ma_uint32 rate_out
+);
+
+int main(int argc, char **argv) {
+  const std::optional<Options> options = parse_args(argc, argv);
+  if (not options.has_value())
+    return 2;
+
+  const std::vector<std::pair<ma_uint32, ma_uint32>> rates{
+      {44100, 48000}, {48000, 44100}, {88200, 48000}, {96000, 48000}, {192000, 48000},
+  };
+  const std::vector<Tmupp::ResamplerQuality> qualities{
+      Tmupp::ResamplerQuality::Linear, Tmupp::ResamplerQuality::Low,
+      Tmupp::ResamplerQuality::Medium, Tmupp::ResamplerQuality::High
+  };
+
+  int failures = 0;
+  std::cout << std::format(
+      "{:.0f} s of {} channels, {} frames at once\n", options->seconds, options->channels,
+      options->chunk
+  );
+  for (const auto &[rate_in, rate_out] : rates) {
+    for (const Tmupp::ResamplerQuality quality : qualities) {
+      const std::string name = std::format(
+          "{} to {} Hz, {}", rate_in, rate_out, Tmupp::get_resampler_quality_name(quality)
+      );
+      const std::optional<double> elapsed = run(*options, quality, rate_in, rate_out);
+      if (not elapsed.has_value()) {
+        std::cout << std::format("{:<28} failed\n", name);
+        ++failures;
+        continue;
+      }
+      const double frames = options->seconds * rate_out;
+      std::cout << std::format(
+          "{:<28} {:8.3f} ms {:8.2f} ns/frame {:9.1f}x realtime\n", name, *elapsed * 1000.0,
+          *elapsed * 1e9 / frames, options->seconds / *elapsed
+      );
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
+
+static std::optional<Options> parse_args(int argc, char **argv) {
+  Options options{};
+  const std::string usage =
+      std::format("Usage: {} [--seconds 60] [--channels 2] [--chunk 1024]\n", argv[0]);
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--seconds") {
+      options.seconds = std::stod(value);
+    } else if (arg == "--channels") {
+      options.channels = static_cast<std::uint32_t>(std::stoul(value));
+    } else if (arg == "--chunk") {
+      options.chunk = std::stoul(value);
+    } else {
+      std::cerr << usage;
+      return std::nullopt;
+    }
+  }
+  if (options.seconds <= 0.0 or options.channels == 0 or options.chunk == 0) {
+    std::cerr << usage;
+    return std::nullopt;
+  }
+  return options;
+}
+
+static std::optional<double> run(
+    const Options &options, const Tmupp::ResamplerQuality quality, const ma_uint32 rate_in,
+    const ma_uint32 rate_out
+) {
+  Tmupp::Resampler resampler{quality};
+  ma_resampler_config config = ma_resampler_config_init(
+      ma_format_f32, options.channels, rate_in, rate_out, ma_resample_algorithm_linear
+  );
+  resampler.apply(config);
+  ma_resampler converter{};
+  if (ma_resampler_init(&config, nullptr, &converter) != MA_SUCCESS)
+    return std::nullopt;
+
+  // A second of noise at -12 dBFS, looped
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> noise{-0.25f, 0.25f};
+  std::vector<float> source(std::size_t{rate_in} * options.channels);
+  for (float &sample : source)
+    sample = noise(rng);
+  std::vector<float> output(options.chunk * options.channels);
+
+  const auto total   = static_cast<std::uint64_t>(options.seconds * rate_out);
+  std::size_t offset = 0;
+  std::chrono::steady_clock::duration elapsed{};
+  for (std::uint64_t done = 0; done < total;) {
+    ma_uint64 frames_in = 0;
+    ma_resampler_get_required_input_frame_count(&converter, options.chunk, &frames_in);
+    frames_in = std::min<ma_uint64>(frames_in, rate_in - offset);
+    ma_uint64 frames_out = options.chunk;
+
+    const auto start = std::chrono::steady_clock::now();
+    ma_resampler_process_pcm_frames(
+        &converter, source.data() + offset * options.channels, &frames_in, output.data(),
+        &frames_out
+    );
+    elapsed += std::chrono::steady_clock::now() - start;
+
+    offset = (offset + frames_in) % rate_in;
+    done += frames_out;
+  }
+  ma_resampler_uninit(&converter, nullptr);
+  return std::chrono::duration<double>(elapsed).count();
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Tmupp {
+
+/**
+  Lock-free single-producer/single-consumer ring buffer.
+
+  Reads and writes never block, allocate or make system calls, so the consumer can be
+  the audio callback. Positions are 64 bits counters of the items ever written and read,
+  which lets the producer mark a point (see `RingBuffer::get_write_count()`) that the
+  consumer later skips to with `RingBuffer::skip_to()`, e.g. to drop stale audio after
+  a seek without the two threads waiting on each other.
+*/
+template <class T>
+class RingBuffer {
+ public:
+  /**
+   * @param capacity_ Rounded up to a power of two.
+   */
+  explicit RingBuffer(const std::size_t capacity_)
+      : capacity{std::bit_ceil(std::max<std::size_t>(capacity_, 2))}, m_data(capacity) {}
+
+  RingBuffer(const RingBuffer &)            = delete;
+  RingBuffer &operator=(const RingBuffer &) = delete;
+
+  /**
+   * Producer only, returns the number of items written.
+   */
+  std::size_t write(const T *items, const std::size_t count) {
+    const std::uint64_t w = m_write.load(std::memory_order_relaxed);
+    const std::uint64_t r = m_read.load(std::memory_order_acquire);
+    const std::size_t n   = std::min<std::size_t>(count, capacity - (w - r));
+    copy_in(w, items, n);
+    m_write.store(w + n, std::memory_order_release);
+    return n;
+  }
+
+  /**
+   * Consumer only, returns the number of items read.
+   */
+  std::size_t read(T *items, const std::size_t count) {
+    const std::uint64_t r = m_read.load(std::memory_order_relaxed);
+    const std::uint64_t w = m_write.load(std::memory_order_acquire);
+    const std::size_t n   = std::min<std::size_t>(count, w - r);
+    copy_out(r, items, n);
+    m_read.store(r + n, std::memory_order_release);
+    return n;
+  }
+
+  /**
+   * Consumer only, drop everything written before `write_count`.
+   */
+  void skip_to(const std::uint64_t write_count) {
+    const std::uint64_t r = m_read.load(std::memory_order_relaxed);
+    if (write_count > r)
+      m_read.store(write_count, std::memory_order_release);
+  }
+
+  /**
+   * Consumer only, drop everything that's readable.
+   */
+  void clear() { skip_to(m_write.load(std::memory_order_acquire)); }
+
+  /**
+   * Number of items ever written, see `skip_to()`.
+   */
+  std::uint64_t get_write_count() const { return m_write.load(std::memory_order_acquire); }
+
+  /**
+   * Readable items, a lower bound from the consumer's side and an upper bound from the producer's.
+   */
+  std::size_t size() const {
+    const std::uint64_t r = m_read.load(std::memory_order_acquire);
+    const std::uint64_t w = m_write.load(std::memory_order_acquire);
+    return w - r;
+  }
+
+  /**
+   * Writable items, a lower bound from the producer's side and an upper bound from the consumer's.
+   */
+  std::size_t space() const { return capacity - size(); }
+
+ public:
+  const std::size_t capacity;
+
+ private:
+  void copy_in(const std::uint64_t position, const T *items, const std::size_t count) {
+    const std::size_t start = static_cast<std::size_t>(position) & (capacity - 1);
+    const std::size_t first = std::min(count, capacity - start);
+    std::copy_n(items, first, m_data.begin() + static_cast<std::ptrdiff_t>(start));
+    std::copy_n(items + first, count - first, m_data.begin());
+  }
+
+  void copy_out(const std::uint64_t position, T *items, const std::size_t count) const {
+    const std::size_t start = static_cast<std::size_t>(position) & (capacity - 1);
+    const std::size_t first = std::min(count, capacity - start);
+    std::copy_n(m_data.begin() + static_cast<std::ptrdiff_t>(start), first, items);
+    std::copy_n(m_data.begin(), count - first, items + first);
+  }
+
+ private:
+  std::vector<T> m_data;
+  // On separate cache lines so the two threads don't invalidate each other's
+  alignas(64) std::atomic<std::uint64_t> m_write{0};
+  alignas(64) std::atomic<std::uint64_t> m_read{0};
+};
+
+}  // namespace Tmupp
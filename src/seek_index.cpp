@@ -0,0 +1,403 @@
+#include "./seek_index.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "midx.hpp"
+
+#include "./sidecar.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+static constexpr SidecarFormat index_format{
+    {'T', 'M', 'U', 'P', 'P', 'S', 'E', 'K'}, 2, "seek index"
+};
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Follows the sidecar header.
+ */
+struct IndexHeader {
+  std::uint64_t format;
+  std::uint64_t length;
+  std::uint64_t point_count;
+};
+
+/**
+ * A FLAC frame header.
+ */
+struct FlacFrame {
+  bool variable_block_size;
+  /**
+   * Frame number with a fixed block size, first sample otherwise.
+   */
+  std::uint64_t number;
+  std::uint32_t block_size;
+};
+
+static std::optional<SeekIndex> build_flac_index(const std::string &path);
+
+/**
+ * Parse the header of the frame starting at `data`, std::nullopt if it isn't one.
+ */
+static std::optional<FlacFrame> parse_flac_frame(const std::uint8_t *data, const std::size_t size);
+
+static std::uint8_t crc8(const std::uint8_t *data, const std::size_t size);
+
+/**
+ * Size of the ID3v2 tag at the start of `data`, 0 if there's none.
+ */
+static std::size_t get_id3v2_size(const std::uint8_t *data, const std::size_t size);
+
+}  // namespace Utils
+
+ma_encoding_format guess_encoding_format(const std::string &path) {
+  std::string extension = fs::path{path}.extension().string();
+  std::ranges::transform(extension, extension.begin(), [](const unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  if (extension == ".mp3")
+    return ma_encoding_format_mp3;
+  if (extension == ".flac")
+    return ma_encoding_format_flac;
+  return ma_encoding_format_unknown;
+}
+
+std::optional<SeekIndex> build_seek_index(
+    const std::string &path, const ma_encoding_format format
+) {
+  switch (format) {
+    case ma_encoding_format_mp3: return build_mp3_seek_index(path);
+    case ma_encoding_format_flac: return Utils::build_flac_index(path);
+    default: return std::nullopt;
+  }
+}
+
+bool write_seek_index(
+    const std::string &index_path, const std::string &file_path, const SeekIndex &index
+) {
+  const bool mp3 = index.format == ma_encoding_format_mp3;
+  Utils::IndexHeader header{};
+  header.format      = static_cast<std::uint64_t>(index.format);
+  header.length      = index.length;
+  header.point_count = mp3 ? index.mp3_points.size() : index.flac_points.size();
+
+  return write_sidecar(index_path, file_path, index_format, [&](std::ofstream &file) {
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (mp3)
+      file.write(
+          reinterpret_cast<const char *>(index.mp3_points.data()),
+          static_cast<std::streamsize>(index.mp3_points.size() * sizeof(Mp3SeekPoint))
+      );
+    else
+      file.write(
+          reinterpret_cast<const char *>(index.flac_points.data()),
+          static_cast<std::streamsize>(index.flac_points.size() * sizeof(FlacSeekPoint))
+      );
+  });
+}
+
+std::optional<SeekIndex> read_seek_index(
+    const std::string &index_path, const std::string &file_path
+) {
+  std::optional<std::ifstream> file = open_sidecar(index_path, file_path, index_format);
+  Utils::IndexHeader header{};
+  if (not file.has_value() or not file->read(reinterpret_cast<char *>(&header), sizeof(header)))
+    return std::nullopt;
+
+  SeekIndex index{};
+  index.format = static_cast<ma_encoding_format>(header.format);
+  index.length = header.length;
+  if (index.format == ma_encoding_format_mp3) {
+    index.mp3_points.resize(header.point_count);
+    file->read(
+        reinterpret_cast<char *>(index.mp3_points.data()),
+        static_cast<std::streamsize>(header.point_count * sizeof(Mp3SeekPoint))
+    );
+  } else if (index.format == ma_encoding_format_flac) {
+    index.flac_points.resize(header.point_count);
+    file->read(
+        reinterpret_cast<char *>(index.flac_points.data()),
+        static_cast<std::streamsize>(header.point_count * sizeof(FlacSeekPoint))
+    );
+  } else {
+    return std::nullopt;
+  }
+  if (not *file) {
+    spdlog::error("Truncated seek index {}", index_path);
+    return std::nullopt;
+  }
+  return index;
+}
+
+SeekIndexStore::SeekIndexStore(DecoderPool &pool, const std::string &directory_)
+    : directory{
+          not directory_.empty() or Midx::data_dir.empty()
+              ? directory_
+              : std::format("{}/seek_index", Midx::data_dir)
+      },
+      m_pool{pool} {
+  if (not directory.empty()) {
+    std::error_code ec{};
+    fs::create_directories(directory, ec);
+    if (ec)
+      spdlog::error("Failed to create {}: {}", directory, ec.message());
+  }
+}
+
+SeekIndexStore::~SeekIndexStore() {
+  std::vector<Job> jobs{};
+  {
+    std::lock_guard lock{m_mutex};
+    std::swap(jobs, m_jobs);
+  }
+  for (Job &job : jobs) {
+    job.handle.cancel();
+    job.handle.wait();
+  }
+}
+
+std::shared_ptr<SeekIndex> SeekIndexStore::get(
+    const std::string &path, const ma_encoding_format format, const JobPriority priority
+) {
+  std::lock_guard lock{m_mutex};
+  const auto it = std::ranges::find(m_indexes, path, &decltype(m_indexes)::value_type::first);
+  if (it != m_indexes.end()) {
+    m_indexes.splice(m_indexes.begin(), m_indexes, it);
+    return it->second;
+  }
+  std::erase_if(m_jobs, [](const Job &job) { return job.handle.is_done(); });
+
+  // Playback waits for it, queue it again ahead of the other jobs, whichever runs first
+  // loads it
+  const auto find_job = [&](const bool urgent) {
+    return std::ranges::any_of(m_jobs, [&](const Job &job) {
+      return job.path == path and (not urgent or job.priority == JobPriority::Realtime);
+    });
+  };
+  const bool hurry = priority == JobPriority::Realtime and find_job(false) and not find_job(true);
+  if (m_requested.insert(path).second or hurry) {
+    m_jobs.push_back(Job{
+        path, priority,
+        m_pool.submit(priority, [this, path, format](std::stop_token stop) {
+          load(path, format, stop);
+        })
+    });
+  }
+  return nullptr;
+}
+
+void SeekIndexStore::load(
+    const std::string &path, const ma_encoding_format format, std::stop_token stop
+) {
+  {
+    std::lock_guard lock{m_mutex};
+    if (stop.stop_requested() or
+        std::ranges::find(m_indexes, path, &decltype(m_indexes)::value_type::first) !=
+            m_indexes.end())
+      return;
+  }
+
+  const std::string index_path = get_index_path(path);
+  std::optional<SeekIndex> index{};
+  if (not index_path.empty())
+    index = read_seek_index(index_path, path);
+  if (not index.has_value()) {
+    const auto start = std::chrono::steady_clock::now();
+    index            = build_seek_index(path, format);
+    if (index.has_value()) {
+      spdlog::info(
+          "Indexed {} in {} ms", path,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start
+          )
+              .count()
+      );
+      if (not index_path.empty())
+        write_seek_index(index_path, path, index.value());
+    }
+  }
+
+  std::lock_guard lock{m_mutex};
+  if (not index.has_value())
+    return;
+  m_indexes.emplace_front(path, std::make_shared<SeekIndex>(std::move(index.value())));
+  if (m_indexes.size() > max_cached_indexes) {
+    m_requested.erase(m_indexes.back().first);
+    m_indexes.pop_back();
+  }
+}
+
+std::string SeekIndexStore::get_index_path(const std::string &path) const {
+  return get_sidecar_path(directory, path, "seek");
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::optional<SeekIndex> Utils::build_flac_index(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return std::nullopt;
+  struct stat info{};
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &info) == 0 and info.st_size > 0)
+    mapping = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return std::nullopt;
+  const auto size  = static_cast<std::size_t>(info.st_size);
+  const auto *data = static_cast<const std::uint8_t *>(mapping);
+  madvise(mapping, size, MADV_SEQUENTIAL);
+
+  // Metadata blocks, the first one being the STREAMINFO
+  std::size_t position = get_id3v2_size(data, size);
+  if (position + 4 + 4 + 34 > size or std::memcmp(data + position, "fLaC", 4) != 0 or
+      (data[position + 4] & 0x7F) != 0) {
+    munmap(mapping, size);
+    return std::nullopt;
+  }
+  const std::uint8_t *stream_info = data + position + 8;
+  const std::uint32_t max_block   = (stream_info[2] << 8) | stream_info[3];
+  const std::uint32_t sample_rate =
+      (stream_info[10] << 12) | (stream_info[11] << 4) | (stream_info[12] >> 4);
+  for (position += 4; position + 4 <= size;) {
+    const bool last = (data[position] & 0x80) != 0;
+    position += 4 + static_cast<std::size_t>(
+                        (data[position + 1] << 16) | (data[position + 2] << 8) | data[position + 3]
+                    );
+    if (last)
+      break;
+  }
+  const std::size_t first_frame = position;
+
+  // Any 0xFF could start a frame, only those whose header checks out and that follow the
+  // previous frame exactly are taken
+  SeekIndex index{};
+  index.format = ma_encoding_format_flac;
+  const auto interval = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(sample_rate * seek_point_interval_seconds)
+  );
+  std::uint64_t next_point = 0;
+  while (position < size) {
+    const auto *sync =
+        static_cast<const std::uint8_t *>(std::memchr(data + position, 0xFF, size - position));
+    if (sync == nullptr)
+      break;
+    position = static_cast<std::size_t>(sync - data);
+    const std::optional<FlacFrame> frame = parse_flac_frame(sync, size - position);
+    if (not frame.has_value()) {
+      ++position;
+      continue;
+    }
+    const std::uint64_t first_sample =
+        frame->variable_block_size ? frame->number : frame->number * max_block;
+    if (first_sample != index.length) {
+      ++position;
+      continue;
+    }
+    if (first_sample >= next_point) {
+      index.flac_points.push_back(FlacSeekPoint{
+          first_sample, position - first_frame, static_cast<ma_uint16>(frame->block_size)
+      });
+      next_point = first_sample + interval;
+    }
+    index.length = first_sample + frame->block_size;
+    position += 2;
+  }
+  munmap(mapping, size);
+
+  if (index.flac_points.empty())
+    return std::nullopt;
+  return index;
+}
+
+static std::optional<Utils::FlacFrame> Utils::parse_flac_frame(
+    const std::uint8_t *data, const std::size_t size
+) {
+  if (size < 6 or data[0] != 0xFF or (data[1] & 0xFE) != 0xF8)
+    return std::nullopt;
+  const std::uint8_t block_code = data[2] >> 4;
+  const std::uint8_t rate_code  = data[2] & 0x0F;
+  const std::uint8_t channels   = data[3] >> 4;
+  const std::uint8_t bit_depth  = (data[3] >> 1) & 0x07;
+  if (block_code == 0 or rate_code == 15 or channels > 10 or bit_depth == 3 or (data[3] & 1) != 0)
+    return std::nullopt;
+
+  // UTF-8 like coded number, up to 7 bytes
+  std::size_t i          = 4;
+  std::uint64_t number   = data[i];
+  const int leading_ones = std::countl_one(data[i]);
+  if (leading_ones == 1 or leading_ones > 7)
+    return std::nullopt;
+  if (leading_ones > 1) {
+    number &= 0x7F >> leading_ones;
+    for (int k = 1; k < leading_ones; ++k) {
+      if (i + 1 >= size or (data[i + 1] & 0xC0) != 0x80)
+        return std::nullopt;
+      number = (number << 6) | (data[++i] & 0x3F);
+    }
+  }
+  ++i;
+
+  std::uint32_t block_size = 0;
+  if (block_code == 1)
+    block_size = 192;
+  else if (block_code <= 5)
+    block_size = 576u << (block_code - 2);
+  else if (block_code >= 8)
+    block_size = 256u << (block_code - 8);
+  if (block_code == 6 or block_code == 7) {
+    const std::size_t bytes = block_code == 6 ? 1 : 2;
+    if (i + bytes >= size)
+      return std::nullopt;
+    block_size = (bytes == 1 ? data[i] : (data[i] << 8) | data[i + 1]) + 1u;
+    i += bytes;
+  }
+  if (rate_code >= 12)
+    i += rate_code == 12 ? 1 : 2;
+  if (i >= size or crc8(data, i) != data[i] or block_size > 65535)
+    return std::nullopt;
+  return FlacFrame{(data[1] & 1) != 0, number, block_size};
+}
+
+static std::uint8_t Utils::crc8(const std::uint8_t *data, const std::size_t size) {
+  std::uint8_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc & 0x80) != 0 ? static_cast<std::uint8_t>((crc << 1) ^ 0x07)
+                              : static_cast<std::uint8_t>(crc << 1);
+  }
+  return crc;
+}
+
+static std::size_t Utils::get_id3v2_size(const std::uint8_t *data, const std::size_t size) {
+  if (size < 10 or std::memcmp(data, "ID3", 3) != 0)
+    return 0;
+  const std::size_t tag_size =
+      (data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 | (data[8] & 0x7F) << 7 | (data[9] & 0x7F);
+  // With a footer
+  const std::size_t footer = (data[5] & 0x10) != 0 ? 10 : 0;
+  return std::min(size, 10 + tag_size + footer);
+}
+
+}  // namespace Tmupp
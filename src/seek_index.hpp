@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "miniaudio.h"
+
+#include "./decoder_pool.hpp"
+
+namespace Tmupp {
+
+/**
+ * Laid out as miniaudio's `ma_dr_mp3_seek_point`.
+ */
+struct Mp3SeekPoint {
+  std::uint64_t byte_offset;
+  std::uint64_t pcm_frame;
+  /**
+   * Frames decoded from `byte_offset` to refill the bit reservoir, then dropped.
+   */
+  std::uint16_t mp3_frames_to_discard;
+  std::uint16_t pcm_frames_to_discard;
+};
+
+/**
+ * Laid out as miniaudio's `ma_dr_flac_seekpoint`.
+ */
+struct FlacSeekPoint {
+  std::uint64_t pcm_frame;
+  /**
+   * From the first frame of the stream.
+   */
+  std::uint64_t byte_offset;
+  std::uint16_t pcm_frame_count;
+};
+
+/**
+  Seek points of an MP3 or a FLAC, for miniaudio's decoders.
+
+  Without one, seeking in a VBR MP3 decodes every frame up to the target and seeking in
+  a FLAC without a SEEKTABLE bisects (or scans) the file, which takes seconds on long mixes.
+*/
+struct SeekIndex {
+  /**
+   * What the decoder must be opened as for `bind_seek_index()`.
+   */
+  ma_encoding_format format = ma_encoding_format_unknown;
+  /**
+   * Frames in the stream at the file's sample rate, as the decoder outputs them.
+   */
+  std::uint64_t length = 0;
+  std::vector<Mp3SeekPoint> mp3_points;
+  std::vector<FlacSeekPoint> flac_points;
+};
+
+/**
+ * Distance between two seek points.
+ */
+inline constexpr double seek_point_interval_seconds = 1.0;
+
+/**
+ * MP3 or FLAC from the extension of `path`, unknown for anything else.
+ */
+ma_encoding_format guess_encoding_format(const std::string &path);
+
+/**
+  Read the whole file to index it: MP3 frame headers are parsed without decoding the
+  audio, FLAC frame headers are found by their sync code and CRC-8.
+
+  Returns std::nullopt if the file isn't an MP3 or a native FLAC.
+*/
+std::optional<SeekIndex> build_seek_index(const std::string &path, const ma_encoding_format format);
+
+// miniaudio only declares its decoders' structures along with its implementation, these
+// two are defined next to it in miniaudio.cpp
+
+/**
+ * Index an MP3 with miniaudio's own frame parser, see `build_seek_index()`.
+ */
+std::optional<SeekIndex> build_mp3_seek_index(const std::string &path);
+
+/**
+  Make `decoder` seek with `index`, which must outlive it. `decoder` must have been
+  opened with `ma_decoder_config::encodingFormat` set to `index.format`, so that its
+  backend is known.
+*/
+bool bind_seek_index(ma_decoder &decoder, SeekIndex &index);
+
+/**
+ * Write an index file for `file_path` (remembering its size and modification time).
+ */
+bool write_seek_index(
+    const std::string &index_path, const std::string &file_path, const SeekIndex &index
+);
+
+/**
+ * Read an index file, std::nullopt if it's invalid or `file_path` changed since.
+ */
+std::optional<SeekIndex> read_seek_index(
+    const std::string &index_path, const std::string &file_path
+);
+
+/**
+  Seek indexes of the recently played files, loaded or built by jobs of a `DecoderPool`.
+
+  Each index is written next to the others in a directory, under a hash of the file's
+  path, so that it's built once per file.
+*/
+class SeekIndexStore {
+ public:
+  /**
+   * @param directory Defaults to `Midx::data_dir/seek_index`, without a data dir the
+   * indexes are only kept in memory.
+   */
+  explicit SeekIndexStore(DecoderPool &pool, const std::string &directory = "");
+  SeekIndexStore(const SeekIndexStore &)            = delete;
+  SeekIndexStore &operator=(const SeekIndexStore &) = delete;
+  /**
+   * Cancel the jobs not started yet and wait for the others.
+   */
+  ~SeekIndexStore();
+
+  /**
+   * The index of `path` if it's ready, otherwise nullptr and it's loaded or built by a
+   * job of `priority`. Asking again with `JobPriority::Realtime` moves the job ahead.
+   */
+  std::shared_ptr<SeekIndex> get(
+      const std::string &path, const ma_encoding_format format,
+      const JobPriority priority = JobPriority::Prefetch
+  );
+
+ public:
+  static constexpr std::size_t max_cached_indexes = 32;
+
+  /**
+   * Empty when the indexes aren't persisted.
+   */
+  const std::string directory;
+
+ private:
+  struct Job {
+    std::string path;
+    JobPriority priority;
+    DecoderPool::Handle handle;
+  };
+
+  void load(const std::string &path, const ma_encoding_format format, std::stop_token stop);
+  std::string get_index_path(const std::string &path) const;
+
+ private:
+  DecoderPool &m_pool;
+  std::mutex m_mutex;
+  /**
+   * Including those done, until the next `get()`.
+   */
+  std::vector<Job> m_jobs;
+  /**
+   * Most recently used first.
+   */
+  std::list<std::pair<std::string, std::shared_ptr<SeekIndex>>> m_indexes;
+  /**
+   * Files that were queued or couldn't be indexed, never tried again.
+   */
+  std::unordered_set<std::string> m_requested;
+};
+
+}  // namespace Tmupp
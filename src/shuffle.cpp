@@ -0,0 +1,175 @@
+#include "./shuffle.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * The finalizer of SplitMix64.
+ */
+static std::uint64_t mix(std::uint64_t value);
+
+/**
+ * Tracks are spread by artist, by album for those without one, otherwise on their own.
+ */
+static std::int64_t get_group(const ShuffleTrack &track);
+
+}  // namespace Utils
+
+/**
+ * Rounds of the Feistel network, enough for a play order to look random, not for secrecy.
+ */
+static constexpr unsigned feistel_rounds = 4;
+
+/**
+ * How far, as a fraction of their spacing, the tracks of a group are moved from the evenly
+ * spaced positions, so that the pattern doesn't show.
+ */
+static constexpr double spread_jitter = 0.25;
+
+BalancedShuffle::BalancedShuffle(
+    const std::size_t count, TrackGetter get_track, const std::uint64_t seed
+)
+    : m_count{count}, m_get_track{std::move(get_track)}, m_seed{seed}, m_rng{seed} {
+  // The permutation is over the smallest even number of bits holding every index, indexes
+  // past the count are walked through until they fall back under it, which takes at most
+  // four steps on average
+  const unsigned bits = count > 1 ? std::bit_width(count - 1) : 1;
+  m_half_bits         = std::max(1u, (bits + 1) / 2);
+  m_window.reserve(std::min(window_size, count));
+}
+
+BalancedShuffle::BalancedShuffle(const Midx::Catalog &catalog, const std::uint64_t seed)
+    : BalancedShuffle(
+          catalog.track_ids.size(),
+          [&catalog](const std::size_t index) {
+            return ShuffleTrack{
+                catalog.track_ids[index], catalog.artist_ids[index], catalog.album_ids[index]
+            };
+          },
+          seed
+      ) {}
+
+std::optional<int> BalancedShuffle::next() {
+  if (m_next == m_window.size()) {
+    if (m_drawn == m_count)
+      return std::nullopt;
+    fill_window();
+  }
+
+  const auto is_recent = [this](const ShuffleTrack &track) {
+    return std::ranges::find(m_recent, Utils::get_group(track)) != m_recent.end();
+  };
+
+  // Play first the closest track of an artist that wasn't played recently, the others keep
+  // their order
+  if (is_recent(m_window[m_next])) {
+    const std::size_t end = std::min(m_next + lookahead, m_window.size());
+    for (std::size_t i = m_next + 1; i < end; ++i) {
+      if (is_recent(m_window[i]))
+        continue;
+      const auto begin = m_window.begin();
+      std::rotate(
+          begin + static_cast<std::ptrdiff_t>(m_next), begin + static_cast<std::ptrdiff_t>(i),
+          begin + static_cast<std::ptrdiff_t>(i + 1)
+      );
+      break;
+    }
+  }
+
+  const ShuffleTrack &track = m_window[m_next++];
+  m_recent.push_back(Utils::get_group(track));
+  if (m_recent.size() > artist_gap)
+    m_recent.pop_front();
+  ++m_position;
+  return track.track_id;
+}
+
+void BalancedShuffle::fill_window() {
+  const std::size_t count = std::min(window_size, m_count - m_drawn);
+  m_window.clear();
+  m_next = 0;
+
+  std::vector<std::pair<std::int64_t, ShuffleTrack>> tracks;
+  tracks.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const ShuffleTrack track = m_get_track(permute(m_drawn++));
+    tracks.emplace_back(Utils::get_group(track), track);
+  }
+  std::ranges::sort(tracks, {}, &std::pair<std::int64_t, ShuffleTrack>::first);
+
+  // Each group of k tracks gets one position every count / k from a random offset, its
+  // albums taking turns, then the window is played in the order of the positions
+  std::vector<std::pair<double, ShuffleTrack>> positions;
+  positions.reserve(count);
+  std::vector<std::pair<std::size_t, ShuffleTrack>> ranked;
+  std::uniform_real_distribution<double> unit{0.0, 1.0};
+  for (auto group = tracks.begin(); group != tracks.end();) {
+    const auto group_end = std::find_if(group, tracks.end(), [&group](const auto &track) {
+      return track.first != group->first;
+    });
+    std::shuffle(group, group_end, m_rng);
+
+    ranked.clear();
+    for (auto it = group; it != group_end; ++it) {
+      const auto rank = std::count_if(group, it, [&it](const auto &track) {
+        return track.second.album_id == it->second.album_id;
+      });
+      ranked.emplace_back(static_cast<std::size_t>(rank), it->second);
+    }
+    std::ranges::stable_sort(ranked, {}, &std::pair<std::size_t, ShuffleTrack>::first);
+
+    const double spacing = static_cast<double>(count) / static_cast<double>(ranked.size());
+    const double offset  = unit(m_rng);
+    for (std::size_t i = 0; i < ranked.size(); ++i) {
+      const double jitter   = ranked.size() > 1 ? (unit(m_rng) * 2.0 - 1.0) * spread_jitter : 0.0;
+      const double position = (static_cast<double>(i) + offset + jitter) * spacing;
+      positions.emplace_back(position, ranked[i].second);
+    }
+    group = group_end;
+  }
+
+  std::ranges::sort(positions, {}, &std::pair<double, ShuffleTrack>::first);
+  for (const auto &[position, track] : positions)
+    m_window.push_back(track);
+}
+
+std::uint64_t BalancedShuffle::permute(std::uint64_t index) const {
+  const std::uint64_t mask = (std::uint64_t{1} << m_half_bits) - 1;
+  do {
+    std::uint64_t left  = index >> m_half_bits;
+    std::uint64_t right = index & mask;
+    for (unsigned round = 0; round < feistel_rounds; ++round) {
+      const std::uint64_t mixed = Utils::mix(right ^ Utils::mix(m_seed + round)) & mask;
+      left                      = std::exchange(right, left ^ mixed);
+    }
+    index = (left << m_half_bits) | right;
+  } while (index >= m_count);
+  return index;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::uint64_t Utils::mix(std::uint64_t value) {
+  value += 0x9e3779b97f4a7c15;
+  value  = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+  value  = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+  return value ^ (value >> 31);
+}
+
+static std::int64_t Utils::get_group(const ShuffleTrack &track) {
+  if (track.artist_id != Midx::Catalog::null_value)
+    return track.artist_id;
+  if (track.album_id != Midx::Catalog::null_value)
+    return (std::int64_t{1} << 32) | static_cast<std::uint32_t>(track.album_id);
+  return (std::int64_t{2} << 32) | static_cast<std::uint32_t>(track.track_id);
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "query.hpp"
+
+namespace Tmupp {
+
+struct ShuffleTrack {
+  int track_id;
+  /**
+   * `Midx::Catalog::null_value` when unknown.
+   */
+  std::int32_t artist_id;
+  std::int32_t album_id;
+};
+
+/**
+  Shuffle that spreads the tracks of an artist, and of an album, across the play order
+  instead of letting them cluster as a uniform shuffle does.
+
+  It's computed lazily, a window of `window_size` tracks at a time: the tracks are drawn
+  in the order of a pseudo-random permutation of their indexes (a Feistel network, which
+  maps an index to its shuffled one without storing the order), then the tracks of each
+  artist in the window are spaced evenly from a random offset with some jitter, their
+  albums taking turns. When a track's artist is among the last `artist_gap` played, a
+  later track of the window is played first if one isn't, which also smooths the joints
+  between windows. Starting a shuffle of the whole library is O(1), and it takes
+  O(`window_size`) memory whatever the number of tracks.
+
+  The tracks are read through a function, so nothing is copied: tracks added to the
+  library aren't part of a shuffle started before, start another one.
+*/
+class BalancedShuffle {
+ public:
+  /**
+   * Returns the track at an index from 0 to the count given to the constructor.
+   */
+  using TrackGetter = std::function<ShuffleTrack(const std::size_t index)>;
+
+  BalancedShuffle(
+      const std::size_t count, TrackGetter get_track,
+      const std::uint64_t seed = std::random_device{}()
+  );
+  /**
+   * Shuffle the whole library, `catalog` must outlive the shuffle.
+   */
+  explicit BalancedShuffle(
+      const Midx::Catalog &catalog, const std::uint64_t seed = std::random_device{}()
+  );
+
+  /**
+   * The next track to play, std::nullopt once they all were.
+   */
+  std::optional<int> next();
+
+  std::size_t size() const { return m_count; }
+  /**
+   * Tracks returned by `next()` so far.
+   */
+  std::size_t get_position() const { return m_position; }
+
+ public:
+  static constexpr std::size_t window_size = 512;
+  /**
+   * Tracks played before an artist comes back, when the window allows it.
+   */
+  static constexpr std::size_t artist_gap = 3;
+  /**
+   * Tracks of the window looked at for one whose artist wasn't played recently.
+   */
+  static constexpr std::size_t lookahead = 64;
+
+ private:
+  /**
+   * Draw the next tracks of the permutation and spread them.
+   */
+  void fill_window();
+  /**
+   * Position of `index` in the permutation, a bijection of [0, `m_count`).
+   */
+  std::uint64_t permute(std::uint64_t index) const;
+
+ private:
+  const std::size_t m_count;
+  TrackGetter m_get_track;
+  const std::uint64_t m_seed;
+  /**
+   * Bits of each half of the Feistel network's blocks.
+   */
+  unsigned m_half_bits = 1;
+  /**
+   * Tracks of the permutation drawn into windows.
+   */
+  std::size_t m_drawn    = 0;
+  std::size_t m_position = 0;
+  std::vector<ShuffleTrack> m_window;
+  std::size_t m_next = 0;
+  /**
+   * Artists of the last tracks played, as `Utils::get_group()` keys.
+   */
+  std::deque<std::int64_t> m_recent;
+  std::mt19937_64 m_rng;
+};
+
+}  // namespace Tmupp
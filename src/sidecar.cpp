@@ -0,0 +1,127 @@
+#include "./sidecar.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <system_error>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+struct SidecarHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t path_size;
+  std::uint64_t file_size;
+  std::int64_t file_time;
+};
+
+/**
+ * Size and modification time of `path`.
+ */
+static std::pair<std::uint64_t, std::int64_t> stat_file(
+    const std::string &path, std::error_code &ec
+);
+
+static std::uint64_t fnv1a(const std::string &s);
+
+}  // namespace Utils
+
+std::string get_sidecar_path(
+    const std::string &directory, const std::string &file_path, const std::string &extension
+) {
+  if (directory.empty())
+    return "";
+  return std::format("{}/{:016x}.{}", directory, Utils::fnv1a(file_path), extension);
+}
+
+bool write_sidecar(
+    const std::string &sidecar_path, const std::string &file_path, const SidecarFormat &format,
+    const std::function<void(std::ofstream &)> &write_payload
+) {
+  std::error_code ec{};
+  const auto [file_size, file_time] = Utils::stat_file(file_path, ec);
+  if (ec) {
+    spdlog::error("Failed to stat {}: {}", file_path, ec.message());
+    return false;
+  }
+
+  Utils::SidecarHeader header{};
+  std::memcpy(header.magic, format.magic.data(), sizeof(header.magic));
+  header.version   = format.version;
+  header.path_size = static_cast<std::uint32_t>(file_path.size());
+  header.file_size = file_size;
+  header.file_time = file_time;
+
+  const std::string tmp_path = std::format("{}.tmp", sidecar_path);
+  {
+    std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(file_path.data(), static_cast<std::streamsize>(file_path.size()));
+    write_payload(file);
+    if (not file) {
+      spdlog::error("Failed to write the {} {}", format.name, tmp_path);
+      return false;
+    }
+  }
+  fs::rename(tmp_path, sidecar_path, ec);
+  if (ec) {
+    spdlog::error("Failed to replace the {} {}: {}", format.name, sidecar_path, ec.message());
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::ifstream> open_sidecar(
+    const std::string &sidecar_path, const std::string &file_path, const SidecarFormat &format
+) {
+  std::ifstream file{sidecar_path, std::ios::binary};
+  if (not file)
+    return std::nullopt;
+  Utils::SidecarHeader header{};
+  if (not file.read(reinterpret_cast<char *>(&header), sizeof(header)) or
+      std::memcmp(header.magic, format.magic.data(), sizeof(header.magic)) != 0 or
+      header.version != format.version or header.path_size != file_path.size())
+    return std::nullopt;
+  std::string path(header.path_size, '\0');
+  if (not file.read(path.data(), static_cast<std::streamsize>(path.size())) or path != file_path)
+    return std::nullopt;
+
+  std::error_code ec{};
+  const auto [file_size, file_time] = Utils::stat_file(file_path, ec);
+  if (ec or file_size != header.file_size or file_time != header.file_time)
+    return std::nullopt;
+  return file;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static std::pair<std::uint64_t, std::int64_t> Utils::stat_file(
+    const std::string &path, std::error_code &ec
+) {
+  const std::uint64_t size = fs::file_size(path, ec);
+  if (ec)
+    return {};
+  const fs::file_time_type time = fs::last_write_time(path, ec);
+  return {size, time.time_since_epoch().count()};
+}
+
+static std::uint64_t Utils::fnv1a(const std::string &s) {
+  std::uint64_t hash = 0xCBF29CE484222325;
+  for (const char c : s) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001B3;
+  }
+  return hash;
+}
+
+}  // namespace Tmupp
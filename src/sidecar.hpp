@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+
+namespace Tmupp {
+
+/**
+ * What identifies a kind of sidecar file, the version changing with its layout.
+ */
+struct SidecarFormat {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  /**
+   * What the file holds, for the logs.
+   */
+  const char *name;
+};
+
+/**
+  Files computed from a track and kept in a directory (seek indexes, waveforms), named
+  after a hash of the track's path.
+
+  Each starts with a header telling which track it was computed from, with the size and
+  modification time the track had then, so that it's ignored once the track changed.
+*/
+
+/**
+ * Where the sidecar of `file_path` goes in `directory`, empty without a directory.
+ */
+std::string get_sidecar_path(
+    const std::string &directory, const std::string &file_path, const std::string &extension
+);
+
+/**
+  Write the header identifying `file_path` then what `write_payload` writes. The file is
+  written next to `sidecar_path` then renamed over it, so that a reader never sees half
+  of it.
+*/
+bool write_sidecar(
+    const std::string &sidecar_path, const std::string &file_path, const SidecarFormat &format,
+    const std::function<void(std::ofstream &)> &write_payload
+);
+
+/**
+ * Open a sidecar past its header, std::nullopt if it's of another format or version, or
+ * if `file_path` changed since it was written.
+ */
+std::optional<std::ifstream> open_sidecar(
+    const std::string &sidecar_path, const std::string &file_path, const SidecarFormat &format
+);
+
+}  // namespace Tmupp
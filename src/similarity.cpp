@@ -0,0 +1,576 @@
+#include "./similarity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX__) or defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "midx.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+static_assert(feature_count % 8 == 0);
+
+static constexpr char index_magic[8]                  = {'T', 'M', 'U', 'P', 'P', 'S', 'I', 'M'};
+static constexpr std::uint32_t index_version          = 1;
+static constexpr std::size_t section_alignment        = 64;
+static constexpr std::size_t kmeans_iterations        = 10;
+static constexpr std::size_t training_points_per_list = 64;
+
+// Static helper functions
+namespace Utils {
+
+struct IndexHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t dimension;
+  std::uint64_t track_count;
+  std::uint64_t list_count;
+  float mean[feature_count];
+  float scale[feature_count];
+};
+
+/**
+ * Byte offsets of the sections of an index file.
+ */
+struct IndexLayout {
+  std::size_t centroids;
+  std::size_t list_offsets;
+  std::size_t track_ids;
+  std::size_t vectors;
+  std::size_t size;
+};
+
+/**
+ * The `k` closest neighbours seen so far, as a max-heap on the distance.
+ */
+class NearestSet {
+ public:
+  explicit NearestSet(const std::size_t k) : m_k{k} { m_heap.reserve(k); }
+
+  float worst() const {
+    return m_heap.size() < m_k ? std::numeric_limits<float>::infinity() : m_heap.front().distance;
+  }
+
+  void push(const Neighbour n) {
+    if (m_k == 0)
+      return;
+    if (m_heap.size() == m_k) {
+      std::ranges::pop_heap(m_heap, {}, &Neighbour::distance);
+      m_heap.pop_back();
+    }
+    m_heap.push_back(n);
+    std::ranges::push_heap(m_heap, {}, &Neighbour::distance);
+  }
+
+  std::vector<Neighbour> take_sorted() {
+    std::ranges::sort_heap(m_heap, {}, &Neighbour::distance);
+    return std::move(m_heap);
+  }
+
+ private:
+  const std::size_t m_k;
+  std::vector<Neighbour> m_heap;
+};
+
+static IndexLayout get_layout(const std::size_t track_count, const std::size_t list_count);
+
+static float squared_distance(const float *a, const float *b);
+
+static std::size_t nearest_centroid(
+    const float *v, const std::vector<float> &centroids, const std::size_t list_count
+);
+
+/**
+ * k-means over a sample of the (normalised) vectors.
+ */
+static std::vector<float> train_centroids(
+    const std::vector<float> &vectors, const std::size_t list_count
+);
+
+/**
+ * Call `fn(i)` for every `i` in [0, count) from as many threads as there are cores.
+ */
+static void parallel_for(const std::size_t count, const std::function<void(std::size_t)> &fn);
+
+}  // namespace Utils
+
+std::optional<SimilarityIndex> SimilarityIndex::open(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    spdlog::error("Failed to open the similarity index {}", path);
+    return std::nullopt;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 or static_cast<std::size_t>(st.st_size) < sizeof(Utils::IndexHeader)) {
+    spdlog::error("Invalid similarity index {}", path);
+    ::close(fd);
+    return std::nullopt;
+  }
+  const auto size = static_cast<std::size_t>(st.st_size);
+  void *mapping   = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    spdlog::error("Failed to map the similarity index {}", path);
+    return std::nullopt;
+  }
+
+  SimilarityIndex index{};
+  index.m_mapping      = mapping;
+  index.m_mapping_size = size;
+
+  const auto *bytes  = static_cast<const char *>(mapping);
+  const auto *header = static_cast<const Utils::IndexHeader *>(mapping);
+  if (std::memcmp(header->magic, index_magic, sizeof(index_magic)) != 0 or
+      header->version != index_version or header->dimension != feature_count) {
+    spdlog::error("Invalid similarity index {}", path);
+    return std::nullopt;
+  }
+  const Utils::IndexLayout layout = Utils::get_layout(header->track_count, header->list_count);
+  if (layout.size > size) {
+    spdlog::error("Truncated similarity index {}", path);
+    return std::nullopt;
+  }
+
+  index.m_track_count  = header->track_count;
+  index.m_list_count   = header->list_count;
+  index.m_mean         = header->mean;
+  index.m_scale        = header->scale;
+  index.m_centroids    = reinterpret_cast<const float *>(bytes + layout.centroids);
+  index.m_list_offsets = reinterpret_cast<const std::uint64_t *>(bytes + layout.list_offsets);
+  index.m_track_ids    = reinterpret_cast<const std::int32_t *>(bytes + layout.track_ids);
+  index.m_vectors      = reinterpret_cast<const float *>(bytes + layout.vectors);
+  if (index.m_list_count > 0 and index.m_list_offsets[index.m_list_count] != index.m_track_count) {
+    spdlog::error("Invalid similarity index {}", path);
+    return std::nullopt;
+  }
+
+  index.m_rows.reserve(index.m_track_count);
+  for (std::size_t row = 0; row < index.m_track_count; ++row)
+    index.m_rows.emplace(index.m_track_ids[row], row);
+  return index;
+}
+
+SimilarityIndex::SimilarityIndex(SimilarityIndex &&other) noexcept { *this = std::move(other); }
+
+SimilarityIndex &SimilarityIndex::operator=(SimilarityIndex &&other) noexcept {
+  if (this == &other)
+    return *this;
+  if (m_mapping != nullptr)
+    munmap(m_mapping, m_mapping_size);
+  m_mapping      = std::exchange(other.m_mapping, nullptr);
+  m_mapping_size = std::exchange(other.m_mapping_size, 0);
+  m_track_count  = std::exchange(other.m_track_count, 0);
+  m_list_count   = std::exchange(other.m_list_count, 0);
+  m_mean         = other.m_mean;
+  m_scale        = other.m_scale;
+  m_centroids    = other.m_centroids;
+  m_list_offsets = other.m_list_offsets;
+  m_track_ids    = other.m_track_ids;
+  m_vectors      = other.m_vectors;
+  m_rows         = std::move(other.m_rows);
+  probe_count    = other.probe_count;
+  return *this;
+}
+
+SimilarityIndex::~SimilarityIndex() {
+  if (m_mapping != nullptr)
+    munmap(m_mapping, m_mapping_size);
+}
+
+std::vector<Neighbour> SimilarityIndex::nearest(
+    const int track_id, const std::size_t k, const std::unordered_set<int> &exclude
+) const {
+  const auto it = m_rows.find(track_id);
+  if (it == m_rows.end())
+    return {};
+  return search(m_vectors + it->second * feature_count, k, exclude, track_id);
+}
+
+std::vector<Neighbour> SimilarityIndex::nearest(
+    const FeatureVector &features, const std::size_t k, const std::unordered_set<int> &exclude
+) const {
+  FeatureVector normalised{};
+  for (std::size_t i = 0; i < feature_count; ++i)
+    normalised[i] = (features[i] - m_mean[i]) * m_scale[i];
+  return search(normalised.data(), k, exclude, std::nullopt);
+}
+
+std::optional<FeatureVector> SimilarityIndex::get_features(const int track_id) const {
+  const auto it = m_rows.find(track_id);
+  if (it == m_rows.end())
+    return std::nullopt;
+  const float *v = m_vectors + it->second * feature_count;
+  FeatureVector res{};
+  for (std::size_t i = 0; i < feature_count; ++i)
+    res[i] = v[i] / m_scale[i] + m_mean[i];
+  return res;
+}
+
+std::vector<Neighbour> SimilarityIndex::search(
+    const float *query, const std::size_t k, const std::unordered_set<int> &exclude,
+    const std::optional<int> skipped_track_id
+) const {
+  Utils::NearestSet res{k};
+  const auto scan = [&](const std::size_t begin, const std::size_t end) {
+    for (std::size_t row = begin; row < end; ++row) {
+      const float d = Utils::squared_distance(query, m_vectors + row * feature_count);
+      if (d >= res.worst())
+        continue;
+      const int track_id = m_track_ids[row];
+      if (track_id == skipped_track_id or exclude.contains(track_id))
+        continue;
+      res.push(Neighbour{track_id, d});
+    }
+  };
+
+  if (m_list_count == 0) {
+    scan(0, m_track_count);
+    return res.take_sorted();
+  }
+
+  // Only scan the lists whose centroids are the closest to the query
+  std::vector<std::pair<float, std::size_t>> lists(m_list_count);
+  for (std::size_t l = 0; l < m_list_count; ++l)
+    lists[l] = {Utils::squared_distance(query, m_centroids + l * feature_count), l};
+  const std::size_t probes = std::min(probe_count, m_list_count);
+  const auto probed = lists.begin() + static_cast<std::ptrdiff_t>(probes);
+  std::partial_sort(lists.begin(), probed, lists.end());
+  for (std::size_t p = 0; p < probes; ++p) {
+    const std::size_t l = lists[p].second;
+    scan(m_list_offsets[l], m_list_offsets[l + 1]);
+  }
+  return res.take_sorted();
+}
+
+bool write_similarity_index(
+    const std::string &path, const std::vector<std::pair<int, FeatureVector>> &tracks
+) {
+  const std::size_t track_count = tracks.size();
+  const std::size_t list_count =
+      track_count >= min_partitioned_tracks
+          ? static_cast<std::size_t>(std::lround(std::sqrt(static_cast<double>(track_count))))
+          : 0;
+
+  Utils::IndexHeader header{};
+  std::memcpy(header.magic, index_magic, sizeof(index_magic));
+  header.version     = index_version;
+  header.dimension   = feature_count;
+  header.track_count = track_count;
+  header.list_count  = list_count;
+
+  // Normalise every feature to zero mean and unit variance so they weigh the same
+  for (std::size_t i = 0; i < feature_count; ++i) {
+    double sum = 0.0, sq_sum = 0.0;
+    for (const auto &[_, features] : tracks) {
+      sum += features[i];
+      sq_sum += static_cast<double>(features[i]) * features[i];
+    }
+    const double count     = static_cast<double>(std::max<std::size_t>(track_count, 1));
+    const double mean      = sum / count;
+    const double deviation = std::sqrt(std::max(0.0, sq_sum / count - mean * mean));
+    header.mean[i]         = static_cast<float>(mean);
+    header.scale[i]        = deviation > 1e-6 ? static_cast<float>(1.0 / deviation) : 1.0f;
+  }
+  std::vector<float> vectors(track_count * feature_count);
+  for (std::size_t row = 0; row < track_count; ++row) {
+    for (std::size_t i = 0; i < feature_count; ++i) {
+      vectors[row * feature_count + i] =
+          (tracks[row].second[i] - header.mean[i]) * header.scale[i];
+    }
+  }
+
+  // Group the vectors by list
+  std::vector<float> centroids{};
+  std::vector<std::uint64_t> list_offsets(list_count + 1, 0);
+  std::vector<std::size_t> order(track_count);
+  std::iota(order.begin(), order.end(), 0);
+  if (list_count > 0) {
+    centroids = Utils::train_centroids(vectors, list_count);
+    std::vector<std::size_t> lists(track_count);
+    Utils::parallel_for(track_count, [&](const std::size_t row) {
+      lists[row] = Utils::nearest_centroid(&vectors[row * feature_count], centroids, list_count);
+    });
+    for (const std::size_t l : lists)
+      ++list_offsets[l + 1];
+    std::partial_sum(list_offsets.begin(), list_offsets.end(), list_offsets.begin());
+    std::vector<std::uint64_t> next(list_offsets.begin(), list_offsets.end() - 1);
+    for (std::size_t row = 0; row < track_count; ++row)
+      order[next[lists[row]]++] = row;
+  }
+
+  const Utils::IndexLayout layout = Utils::get_layout(track_count, list_count);
+  std::vector<char> buffer(layout.size, 0);
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  std::memcpy(buffer.data() + layout.centroids, centroids.data(), centroids.size() * sizeof(float));
+  std::memcpy(
+      buffer.data() + layout.list_offsets, list_offsets.data(),
+      list_offsets.size() * sizeof(std::uint64_t)
+  );
+  for (std::size_t i = 0; i < track_count; ++i) {
+    const std::size_t row = order[i];
+    const std::int32_t id = tracks[row].first;
+    std::memcpy(buffer.data() + layout.track_ids + i * sizeof(id), &id, sizeof(id));
+    std::memcpy(
+        buffer.data() + layout.vectors + i * feature_count * sizeof(float),
+        &vectors[row * feature_count], feature_count * sizeof(float)
+    );
+  }
+
+  // Readers may have the old file mapped, write a new one and swap them
+  const std::string tmp_path = std::format("{}.tmp", path);
+  {
+    std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (not file) {
+      spdlog::error("Failed to write the similarity index {}", tmp_path);
+      return false;
+    }
+  }
+  std::error_code ec{};
+  fs::rename(tmp_path, path, ec);
+  if (ec) {
+    spdlog::error("Failed to replace the similarity index {}: {}", path, ec.message());
+    return false;
+  }
+  return true;
+}
+
+bool update_similarity_index(SQLite::Database &db, const std::string &path) {
+  const std::string index_path =
+      path.empty() ? std::format("{}/similarity.idx", Midx::data_dir) : path;
+
+  std::vector<std::pair<int, FeatureVector>> tracks{};
+  std::vector<std::pair<int, std::string>> missing{};
+  {
+    std::optional<SimilarityIndex> existing{};
+    if (fs::exists(index_path))
+      existing = SimilarityIndex::open(index_path);
+    for (const Midx::Track &track : Midx::get_all_tracks(db)) {
+      std::optional<FeatureVector> features{};
+      if (existing.has_value())
+        features = existing->get_features(track.id);
+      if (features.has_value())
+        tracks.emplace_back(track.id, features.value());
+      else
+        missing.emplace_back(track.id, track.file_path);
+    }
+  }
+
+  std::vector<std::optional<FeatureVector>> extracted(missing.size());
+  Utils::parallel_for(missing.size(), [&](const std::size_t i) {
+    extracted[i] = extract_features(missing[i].second);
+  });
+  std::size_t extracted_count = 0;
+  for (std::size_t i = 0; i < missing.size(); ++i) {
+    if (not extracted[i].has_value())
+      continue;
+    tracks.emplace_back(missing[i].first, extracted[i].value());
+    ++extracted_count;
+  }
+  spdlog::info("Extracted the features of {} tracks", extracted_count);
+
+  return write_similarity_index(index_path, tracks);
+}
+
+Radio::Radio(const SimilarityIndex &index, const int seed_track_id)
+    : m_index{index},
+      m_seed{seed_track_id},
+      m_current{seed_track_id},
+      m_rng{std::random_device{}()} {
+  remember(seed_track_id);
+}
+
+std::optional<int> Radio::next() {
+  const std::optional<FeatureVector> seed    = m_index.get_features(m_seed);
+  const std::optional<FeatureVector> current = m_index.get_features(m_current);
+  if (not seed.has_value() or not current.has_value())
+    return std::nullopt;
+
+  FeatureVector target{};
+  for (std::size_t i = 0; i < feature_count; ++i)
+    target[i] = (seed.value()[i] + current.value()[i]) / 2.0f;
+
+  std::vector<Neighbour> candidates = m_index.nearest(target, candidate_count, m_played);
+  if (candidates.empty()) {
+    // Everything was played recently, start over
+    m_history.clear();
+    m_played.clear();
+    remember(m_current);
+    candidates = m_index.nearest(target, candidate_count, m_played);
+    if (candidates.empty())
+      return std::nullopt;
+  }
+
+  std::uniform_int_distribution<std::size_t> pick{0, candidates.size() - 1};
+  m_current = candidates[pick(m_rng)].track_id;
+  remember(m_current);
+  return m_current;
+}
+
+void Radio::remember(const int track_id) {
+  m_history.push_back(track_id);
+  m_played.insert(track_id);
+  if (m_history.size() > history_size) {
+    m_played.erase(m_history.front());
+    m_history.pop_front();
+  }
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static Utils::IndexLayout Utils::get_layout(
+    const std::size_t track_count, const std::size_t list_count
+) {
+  const auto align = [](std::size_t offset) {
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+  };
+  IndexLayout layout{};
+  layout.centroids    = align(sizeof(IndexHeader));
+  layout.list_offsets = align(layout.centroids + list_count * feature_count * sizeof(float));
+  layout.track_ids    = align(layout.list_offsets + (list_count + 1) * sizeof(std::uint64_t));
+  layout.vectors      = align(layout.track_ids + track_count * sizeof(std::int32_t));
+  layout.size         = layout.vectors + track_count * feature_count * sizeof(float);
+  return layout;
+}
+
+static float Utils::squared_distance(const float *a, const float *b) {
+#if defined(__AVX__)
+  __m256 sum = _mm256_setzero_ps();
+  for (std::size_t i = 0; i < feature_count; i += 8) {
+    const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    sum            = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+  }
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+#elif defined(__SSE2__)
+  __m128 s = _mm_setzero_ps();
+  for (std::size_t i = 0; i < feature_count; i += 4) {
+    const __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    s              = _mm_add_ps(s, _mm_mul_ps(d, d));
+  }
+#endif
+#if defined(__AVX__) or defined(__SSE2__)
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  float32x4_t s = vdupq_n_f32(0.0f);
+  for (std::size_t i = 0; i < feature_count; i += 4) {
+    const float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+    s                   = vfmaq_f32(s, d, d);
+  }
+  return vaddvq_f32(s);
+#else
+  float sum = 0.0f;
+  for (std::size_t i = 0; i < feature_count; ++i)
+    sum += (a[i] - b[i]) * (a[i] - b[i]);
+  return sum;
+#endif
+}
+
+static std::size_t Utils::nearest_centroid(
+    const float *v, const std::vector<float> &centroids, const std::size_t list_count
+) {
+  std::size_t best    = 0;
+  float best_distance = std::numeric_limits<float>::infinity();
+  for (std::size_t l = 0; l < list_count; ++l) {
+    const float d = squared_distance(v, &centroids[l * feature_count]);
+    if (d < best_distance) {
+      best_distance = d;
+      best          = l;
+    }
+  }
+  return best;
+}
+
+static std::vector<float> Utils::train_centroids(
+    const std::vector<float> &vectors, const std::size_t list_count
+) {
+  const std::size_t track_count = vectors.size() / feature_count;
+  // Fixed seed, the same library always gives the same index
+  std::mt19937 rng{42};
+
+  std::vector<std::size_t> sample(track_count);
+  std::iota(sample.begin(), sample.end(), 0);
+  std::shuffle(sample.begin(), sample.end(), rng);
+  sample.resize(std::min(track_count, list_count * training_points_per_list));
+
+  std::vector<float> centroids(list_count * feature_count);
+  for (std::size_t l = 0; l < list_count; ++l) {
+    std::copy_n(
+        &vectors[sample[l] * feature_count], feature_count, &centroids[l * feature_count]
+    );
+  }
+
+  std::vector<std::size_t> assignments(sample.size());
+  std::vector<double> sums(list_count * feature_count);
+  std::vector<std::size_t> counts(list_count);
+  std::uniform_int_distribution<std::size_t> pick{0, sample.size() - 1};
+  for (std::size_t iteration = 0; iteration < kmeans_iterations; ++iteration) {
+    parallel_for(sample.size(), [&](const std::size_t i) {
+      assignments[i] = nearest_centroid(&vectors[sample[i] * feature_count], centroids, list_count);
+    });
+
+    std::ranges::fill(sums, 0.0);
+    std::ranges::fill(counts, 0);
+    for (std::size_t i = 0; i < sample.size(); ++i) {
+      const float *v = &vectors[sample[i] * feature_count];
+      for (std::size_t f = 0; f < feature_count; ++f)
+        sums[assignments[i] * feature_count + f] += v[f];
+      ++counts[assignments[i]];
+    }
+    for (std::size_t l = 0; l < list_count; ++l) {
+      float *centroid = &centroids[l * feature_count];
+      if (counts[l] == 0) {
+        // Move empty lists to a random point so no list stays useless
+        std::copy_n(&vectors[sample[pick(rng)] * feature_count], feature_count, centroid);
+        continue;
+      }
+      const double count = static_cast<double>(counts[l]);
+      for (std::size_t f = 0; f < feature_count; ++f)
+        centroid[f] = static_cast<float>(sums[l * feature_count + f] / count);
+    }
+  }
+  return centroids;
+}
+
+static void Utils::parallel_for(
+    const std::size_t count, const std::function<void(std::size_t)> &fn
+) {
+  std::atomic<std::size_t> next{0};
+  const auto work = [&] {
+    for (std::size_t i = next++; i < count; i = next++)
+      fn(i);
+  };
+  const std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::jthread> threads{};
+  for (std::size_t t = 1; t < std::min(thread_count, count); ++t)
+    threads.emplace_back(work);
+  work();
+}
+
+}  // namespace Tmupp
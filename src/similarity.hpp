@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "./features.hpp"
+
+namespace Tmupp {
+
+struct Neighbour {
+  int track_id;
+  /**
+   * Squared euclidean distance between the normalised features.
+   */
+  float distance;
+};
+
+/**
+  Read-only, memory mapped k-NN index over the tracks' features.
+
+  The file is written by `write_similarity_index()`: a header holding the per-feature
+  mean and scale used to normalise the vectors, the IVF centroids and list offsets, the
+  track ids, then one 128 bytes vector per track. Every section is 64 bytes aligned and
+  the vectors are grouped by list, so a query is one sequential scan of the closest lists
+  (or of the whole file when the library is too small to be partitioned).
+*/
+class SimilarityIndex {
+ public:
+  /**
+   * Map an index file, returns std::nullopt (and logs the reason) if it's missing or invalid.
+   */
+  static std::optional<SimilarityIndex> open(const std::string &path);
+
+  SimilarityIndex(SimilarityIndex &&other) noexcept;
+  SimilarityIndex &operator=(SimilarityIndex &&other) noexcept;
+  SimilarityIndex(const SimilarityIndex &)            = delete;
+  SimilarityIndex &operator=(const SimilarityIndex &) = delete;
+  ~SimilarityIndex();
+
+  /**
+   * The `k` tracks closest to a track, excluding itself and `exclude`.
+   * Empty if the track isn't in the index.
+   */
+  std::vector<Neighbour> nearest(
+      const int track_id, const std::size_t k, const std::unordered_set<int> &exclude = {}
+  ) const;
+
+  /**
+   * The `k` tracks closest to (not normalised) features.
+   */
+  std::vector<Neighbour> nearest(
+      const FeatureVector &features, const std::size_t k,
+      const std::unordered_set<int> &exclude = {}
+  ) const;
+
+  /**
+   * Features of a track as they were extracted.
+   */
+  std::optional<FeatureVector> get_features(const int track_id) const;
+
+  std::size_t size() const { return m_track_count; }
+
+  /**
+   * Whether the index is partitioned, queries only scan the closest lists if it is.
+   */
+  bool is_partitioned() const { return m_list_count > 0; }
+
+ public:
+  /**
+   * Number of lists scanned by a query on a partitioned index.
+   */
+  std::size_t probe_count = 8;
+
+ private:
+  SimilarityIndex() = default;
+
+  std::vector<Neighbour> search(
+      const float *query, const std::size_t k, const std::unordered_set<int> &exclude,
+      const std::optional<int> skipped_track_id
+  ) const;
+
+ private:
+  void *m_mapping                     = nullptr;
+  std::size_t m_mapping_size          = 0;
+  std::size_t m_track_count           = 0;
+  std::size_t m_list_count            = 0;
+  const float *m_mean                 = nullptr;
+  const float *m_scale                = nullptr;
+  const float *m_centroids            = nullptr;
+  const std::uint64_t *m_list_offsets = nullptr;
+  const std::int32_t *m_track_ids     = nullptr;
+  const float *m_vectors              = nullptr;
+  std::unordered_map<int, std::size_t> m_rows;
+};
+
+/**
+  Libraries with at least this many tracks get an IVF index (about sqrt(n) lists),
+  smaller ones are scanned entirely.
+*/
+inline constexpr std::size_t min_partitioned_tracks = 20000;
+
+/**
+ * Write an index file, atomically replacing `path`.
+ */
+bool write_similarity_index(
+    const std::string &path, const std::vector<std::pair<int, FeatureVector>> &tracks
+);
+
+/**
+  Extract the features of the tracks that are not in the index yet (in parallel) and
+  rewrite it, tracks that were removed from the database are dropped.
+  @param path Defaults to `Midx::data_dir/similarity.idx`.
+*/
+bool update_similarity_index(SQLite::Database &db, const std::string &path = "");
+
+/**
+  Endless "play similar" queue.
+
+  Each track is picked among the closest ones to both the seed and the previous
+  track, so the radio drifts slowly instead of wandering off, and tracks that were
+  played recently are never picked again.
+*/
+class Radio {
+ public:
+  Radio(const SimilarityIndex &index, const int seed_track_id);
+
+  /**
+   * The next track to play, std::nullopt if the seed isn't in the index.
+   */
+  std::optional<int> next();
+
+ public:
+  /**
+   * The next track is picked at random among this many neighbours.
+   */
+  static constexpr std::size_t candidate_count = 5;
+  /**
+   * Number of tracks remembered to avoid repetitions.
+   */
+  static constexpr std::size_t history_size = 200;
+
+ private:
+  void remember(const int track_id);
+
+ private:
+  const SimilarityIndex &m_index;
+  const int m_seed;
+  int m_current;
+  std::deque<int> m_history;
+  std::unordered_set<int> m_played;
+  std::mt19937 m_rng;
+};
+
+}  // namespace Tmupp
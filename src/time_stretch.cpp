@@ -0,0 +1,291 @@
+#include "./time_stretch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numbers>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+static float dot(const float *a, const float *b, const std::size_t count);
+
+/**
+ * `out[i] += a[i] * b[i]` for `count` samples.
+ */
+static void multiply_add(float *out, const float *a, const float *b, const std::size_t count);
+
+}  // namespace Utils
+
+TimeStretch::TimeStretch(const std::uint32_t sample_rate_, const std::uint32_t channels_)
+    : sample_rate{sample_rate_},
+      channels{channels_},
+      m_window_frames{std::max<std::size_t>(
+          2 * (std::size_t{sample_rate_} * window_milliseconds / 2000), 16
+      )},
+      m_hop_frames{m_window_frames / 2},
+      m_search_frames{std::size_t{sample_rate_} * search_milliseconds / 1000} {
+  // Periodic, so that two frames half a frame apart add up to 1
+  m_window.resize(m_window_frames * channels);
+  for (std::size_t i = 0; i < m_window_frames; ++i) {
+    const double phase = 2.0 * std::numbers::pi * static_cast<double>(i) / m_window_frames;
+    std::fill_n(m_window.data() + i * channels, channels, 0.5f - 0.5f * std::cos(phase));
+  }
+
+  // The most input a frame reaches, plus as much again to write into
+  const std::size_t reach = static_cast<std::size_t>((max_speed - 1.0f) * m_hop_frames) +
+                            2 * m_search_frames + m_window_frames;
+  m_input.resize(2 * reach * channels);
+  m_overlap.resize(m_window_frames * channels);
+  m_output.resize(m_hop_frames * channels);
+  m_search_input.resize((2 * m_search_frames + m_hop_frames) / 2 + 1);
+  m_search_reference.resize(m_hop_frames / 2 + 1);
+}
+
+void TimeStretch::set_speed(const float speed) {
+  m_speed.store(std::clamp(speed, min_speed, max_speed), std::memory_order_relaxed);
+}
+
+float TimeStretch::get_speed() const { return m_speed.load(std::memory_order_relaxed); }
+
+bool TimeStretch::is_bypassed() const {
+  return get_speed() == 1.0f and not m_started and m_input_frames == 0 and
+         m_output_read == m_output_frames;
+}
+
+std::size_t TimeStretch::get_input_space() const {
+  return m_input.size() / channels - m_input_frames;
+}
+
+std::size_t TimeStretch::write(const float *frames, const std::size_t frame_count) {
+  const std::size_t count = std::min(frame_count, get_input_space());
+  std::copy_n(frames, count * channels, m_input.data() + m_input_frames * channels);
+  m_input_frames += count;
+  return count;
+}
+
+std::size_t TimeStretch::read(float *frames, const std::size_t frame_count) {
+  const bool draining = get_speed() == 1.0f;
+  std::size_t done    = 0;
+  while (done < frame_count) {
+    if (m_output_read < m_output_frames) {
+      const std::size_t count = std::min(frame_count - done, m_output_frames - m_output_read);
+      std::copy_n(
+          m_output.data() + m_output_read * channels, count * channels, frames + done * channels
+      );
+      m_output_read += count;
+      done += count;
+      continue;
+    }
+
+    if (draining) {
+      // The audio that followed the last frame completes its fading half as it is, the
+      // rest of the input follows
+      if (m_started) {
+        discard_input(m_previous - m_input_start + m_hop_frames);
+        std::fill(m_overlap.begin(), m_overlap.end(), 0.0f);
+        m_started = false;
+      }
+      const std::size_t count = std::min(frame_count - done, m_input_frames);
+      if (count == 0)
+        break;
+      std::copy_n(m_input.begin(), count * channels, frames + done * channels);
+      discard_input(count);
+      done += count;
+      continue;
+    }
+
+    if (not run_frame())
+      break;
+  }
+  if (is_bypassed())
+    reset();
+  return done;
+}
+
+void TimeStretch::reset() {
+  m_input_frames  = 0;
+  m_input_start   = 0;
+  m_target        = 0.0;
+  m_previous      = 0;
+  m_started       = false;
+  m_output_frames = 0;
+  m_output_read   = 0;
+  std::fill(m_overlap.begin(), m_overlap.end(), 0.0f);
+}
+
+bool TimeStretch::run_frame() {
+  const std::size_t samples = m_window_frames * channels;
+  std::size_t frame         = 0;
+  if (not m_started) {
+    // Nothing to match, the frame starts with the input as it is so that it continues
+    // what was output before
+    if (m_input_frames < m_window_frames)
+      return false;
+    std::copy_n(m_input.begin(), samples / 2, m_overlap.begin());
+    Utils::multiply_add(
+        m_overlap.data() + samples / 2, m_window.data() + samples / 2,
+        m_input.data() + samples / 2, samples - samples / 2
+    );
+    m_target  = static_cast<double>(m_input_start);
+    m_started = true;
+  } else {
+    const auto target = static_cast<std::int64_t>(std::llround(m_target)) -
+                        static_cast<std::int64_t>(m_input_start);
+    const auto reach  = static_cast<std::int64_t>(m_search_frames);
+    const auto from   = static_cast<std::size_t>(std::max<std::int64_t>(target - reach, 0));
+    const auto to     = static_cast<std::size_t>(std::max<std::int64_t>(target + reach, 0));
+    if (m_input_frames < to + m_window_frames)
+      return false;
+    frame = search(from, to, m_previous - m_input_start + m_hop_frames);
+    Utils::multiply_add(
+        m_overlap.data(), m_window.data(), m_input.data() + frame * channels, samples
+    );
+  }
+
+  const std::size_t hop_samples = m_hop_frames * channels;
+  float *overlap                = m_overlap.data();
+  std::copy_n(overlap, hop_samples, m_output.data());
+  std::copy(overlap + hop_samples, overlap + m_overlap.size(), overlap);
+  std::fill(overlap + m_overlap.size() - hop_samples, overlap + m_overlap.size(), 0.0f);
+  m_output_frames = m_hop_frames;
+  m_output_read   = 0;
+
+  m_previous = m_input_start + frame;
+  m_target += get_speed() * static_cast<double>(m_hop_frames);
+  // Keep what the next search and its reference read
+  const double keep = std::min(
+      m_target - static_cast<double>(m_search_frames),
+      static_cast<double>(m_previous + m_hop_frames)
+  );
+  if (keep > static_cast<double>(m_input_start))
+    discard_input(static_cast<std::size_t>(keep) - m_input_start);
+  return true;
+}
+
+std::size_t TimeStretch::search(
+    const std::size_t from, const std::size_t to, const std::size_t reference
+) {
+  // The first half of a frame overlaps the audio that followed the previous one
+  const std::size_t overlap = m_hop_frames / 2;
+  const std::size_t lags    = (to - from) / 2 + 1;
+  downmix(reference, m_hop_frames, m_search_reference.data());
+  downmix(from, to - from + m_hop_frames, m_search_input.data());
+
+  // Normalised by the energy of the candidate only, the reference's is the same for all
+  const auto score = [](const float correlation, const float energy) {
+    return energy > 0.0f ? correlation / std::sqrt(energy) : 0.0f;
+  };
+  float energy = Utils::dot(m_search_input.data(), m_search_input.data(), overlap);
+  std::size_t best_lag = 0;
+  float best_score     = -std::numeric_limits<float>::infinity();
+  for (std::size_t lag = 0; lag < lags; ++lag) {
+    const float *candidate = m_search_input.data() + lag;
+    const float value =
+        score(Utils::dot(m_search_reference.data(), candidate, overlap), std::max(energy, 0.0f));
+    if (value > best_score) {
+      best_score = value;
+      best_lag   = lag;
+    }
+    if (lag + 1 < lags)
+      energy += candidate[overlap] * candidate[overlap] - candidate[0] * candidate[0];
+  }
+
+  // Around the best lag at the full rate, on the interleaved samples
+  const std::size_t samples = m_hop_frames * channels;
+  const float *target       = m_input.data() + reference * channels;
+  const std::size_t center  = from + 2 * best_lag;
+  std::size_t best          = center;
+  best_score                = -std::numeric_limits<float>::infinity();
+  for (std::size_t frame = std::max(center, from + 1) - 1; frame <= std::min(center + 1, to);
+       ++frame) {
+    const float *candidate = m_input.data() + frame * channels;
+    const float value =
+        score(Utils::dot(target, candidate, samples), Utils::dot(candidate, candidate, samples));
+    if (value > best_score) {
+      best_score = value;
+      best       = frame;
+    }
+  }
+  return best;
+}
+
+void TimeStretch::downmix(const std::size_t first, const std::size_t frame_count, float *out)
+    const {
+  const float *in = m_input.data() + first * channels;
+  for (std::size_t i = 0; i + 1 < frame_count; i += 2) {
+    float sum = 0.0f;
+    for (std::size_t c = 0; c < 2 * channels; ++c)
+      sum += in[i * channels + c];
+    out[i / 2] = sum;
+  }
+}
+
+void TimeStretch::discard_input(const std::size_t frame) {
+  const std::size_t count = std::min(frame, m_input_frames);
+  float *input            = m_input.data();
+  std::copy(input + count * channels, input + m_input_frames * channels, input);
+  m_input_frames -= count;
+  m_input_start += count;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static float Utils::dot(const float *a, const float *b, const std::size_t count) {
+  std::size_t i = 0;
+  float sum     = 0.0f;
+#if defined(__SSE2__)
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (; i + 8 <= count; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  __m128 s = _mm_add_ps(sum0, sum1);
+  s        = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s        = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+  sum      = _mm_cvtss_f32(s);
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  for (; i + 8 <= count; i += 8) {
+    sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+    sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  sum = vaddvq_f32(vaddq_f32(sum0, sum1));
+#endif
+  for (; i < count; ++i)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+static void Utils::multiply_add(
+    float *out, const float *a, const float *b, const std::size_t count
+) {
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(
+        out + i,
+        _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)))
+    );
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  for (; i + 4 <= count; i += 4)
+    vst1q_f32(out + i, vfmaq_f32(vld1q_f32(out + i), vld1q_f32(a + i), vld1q_f32(b + i)));
+#endif
+  for (; i < count; ++i)
+    out[i] += a[i] * b[i];
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Tmupp {
+
+/**
+  Changes the speed of audio without changing its pitch, by WSOLA (waveform similarity
+  overlap-add).
+
+  The output is built from overlapping frames of the input, `window_milliseconds` long and
+  Hann windowed, one every half frame. The input is read `speed` times faster, and each
+  frame is taken where, within `search_milliseconds` of that position, it best matches the
+  audio that followed the previous frame, so that the two add up without the phase
+  cancellations a plain overlap-add causes. The match is a cross-correlation of the
+  channels mixed to mono, first at half the rate then refined around the best lag, with
+  SSE2 or NEON dot products; the overlap-add multiplies interleaved samples by a window
+  precomputed per sample, with the same vectors.
+
+  At a speed of 1 nothing is processed: the audio goes through as it is once what was
+  buffered is played, without a glitch since the last frame continues into the input.
+
+  `set_speed()` can be called from any thread, the rest only from the audio callback,
+  which it never allocates in.
+*/
+class TimeStretch {
+ public:
+  TimeStretch(const std::uint32_t sample_rate_, const std::uint32_t channels_);
+  TimeStretch(const TimeStretch &)            = delete;
+  TimeStretch &operator=(const TimeStretch &) = delete;
+
+  /**
+   * From `min_speed` to `max_speed`, applied from the next frame.
+   */
+  void set_speed(const float speed);
+  float get_speed() const;
+
+  /**
+   * Whether the input can skip `write()` and `read()`: the speed is 1 and nothing is
+   * buffered anymore.
+   */
+  bool is_bypassed() const;
+  /**
+   * Input frames `write()` takes at most.
+   */
+  std::size_t get_input_space() const;
+  /**
+   * Buffer `frame_count` interleaved frames of input, returns how many were taken.
+   */
+  std::size_t write(const float *frames, const std::size_t frame_count);
+  /**
+   * Output up to `frame_count` interleaved frames, as many as the input buffered allows.
+   */
+  std::size_t read(float *frames, const std::size_t frame_count);
+  /**
+   * Drop what's buffered, e.g. after a seek.
+   */
+  void reset();
+
+ public:
+  static constexpr float min_speed = 0.5f;
+  static constexpr float max_speed = 3.0f;
+  /**
+   * Long enough to hold a few periods of the lowest voices, short enough for transients
+   * not to be heard twice at low speeds.
+   */
+  static constexpr std::uint32_t window_milliseconds = 30;
+  /**
+   * How far from where it should be a frame may be taken, the lowest period matched.
+   */
+  static constexpr std::uint32_t search_milliseconds = 8;
+
+  const std::uint32_t sample_rate;
+  const std::uint32_t channels;
+
+ private:
+  /**
+   * Overlap-add the next frame, false if there's not enough input for it.
+   */
+  bool run_frame();
+  /**
+   * Frame past `m_input_start` the next frame best starts at, from `from` to `to`.
+   */
+  std::size_t search(const std::size_t from, const std::size_t to, const std::size_t reference);
+  /**
+   * Mix `frame_count` frames of the input from `first` to mono at half the rate, into
+   * `out`.
+   */
+  void downmix(const std::size_t first, const std::size_t frame_count, float *out) const;
+  /**
+   * Drop the input before `frame`, relative to `m_input_start`.
+   */
+  void discard_input(const std::size_t frame);
+
+ private:
+  /**
+   * Frames of a frame, and between two frames of the output.
+   */
+  const std::size_t m_window_frames;
+  const std::size_t m_hop_frames;
+  const std::size_t m_search_frames;
+  /**
+   * Hann window, its value repeated for each channel.
+   */
+  std::vector<float> m_window;
+
+  std::atomic<float> m_speed{1.0f};
+
+  // Callback only
+  /**
+   * Interleaved input, its first frame being `m_input_start` frames into the input
+   * buffered since the last reset.
+   */
+  std::vector<float> m_input;
+  std::size_t m_input_frames  = 0;
+  std::uint64_t m_input_start = 0;
+  /**
+   * Where the next frame should be taken from, then where the last one was, in frames of
+   * the input since the last reset.
+   */
+  double m_target          = 0.0;
+  std::uint64_t m_previous = 0;
+  /**
+   * Whether a frame was taken since the last reset or drain: at a speed of 1, once the
+   * output is played, the input follows as it is from `m_previous + m_hop_frames`.
+   */
+  bool m_started = false;
+  /**
+   * Frames overlapped so far, the first `m_hop_frames` complete.
+   */
+  std::vector<float> m_overlap;
+  std::vector<float> m_output;
+  std::size_t m_output_frames = 0;
+  std::size_t m_output_read   = 0;
+  /**
+   * Mono input and reference of the search, at half the rate.
+   */
+  std::vector<float> m_search_input;
+  std::vector<float> m_search_reference;
+};
+
+}  // namespace Tmupp
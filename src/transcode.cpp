@@ -0,0 +1,370 @@
+#include "./transcode.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "miniaudio.h"
+
+#include "midx.hpp"
+
+#include "./flac_encoder.hpp"
+#include "./gapless.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Round `sample_count` samples to `bits` bits, with triangular dither of one step for
+ * fewer than 24 bits.
+ */
+static void quantize(
+    const float *in, std::int32_t *out, const std::size_t sample_count, const std::uint32_t bits,
+    std::uint32_t &random
+);
+
+/**
+ * Little endian samples of `bits / 8` bytes, as a WAV file holds them.
+ */
+static void pack_samples(
+    const std::int32_t *in, std::uint8_t *out, const std::size_t sample_count,
+    const std::uint32_t bits
+);
+
+static std::vector<std::string> get_vorbis_comments(const TranscodeTags &tags);
+
+/**
+ * Append a LIST INFO chunk with `tags` to the WAV file at `path`, and count it in the
+ * size of the RIFF chunk.
+ */
+static bool write_riff_info(const std::string &path, const TranscodeTags &tags);
+
+}  // namespace Utils
+
+TranscodeTags read_transcode_tags(SQLite::Database &db, const int track_id) {
+  TranscodeTags tags{};
+  const std::optional<Midx::TrackMetadata> metadata = Midx::get_track_metadata(db, track_id);
+  if (not metadata.has_value())
+    return tags;
+  tags.title        = metadata->title;
+  tags.track_number = metadata->track_number;
+  if (metadata->artist_id.has_value())
+    if (const std::optional<Midx::Artist> artist = Midx::get_artist(db, *metadata->artist_id))
+      tags.artist = artist->name;
+  if (metadata->album_id.has_value())
+    if (const std::optional<Midx::Album> album = Midx::get_album(db, *metadata->album_id)) {
+      tags.album = album->name;
+      if (album->artist_id.has_value())
+        if (const std::optional<Midx::Artist> artist = Midx::get_artist(db, *album->artist_id))
+          tags.album_artist = artist->name;
+    }
+  return tags;
+}
+
+Transcoder::Transcoder(DecoderPool &pool, const TranscodeConfig &config_)
+    : config{config_},
+      m_resampler{config_.resampler_quality},
+      m_pool{pool},
+      m_max_pending{
+          config_.max_pending_jobs > 0
+              ? config_.max_pending_jobs
+              : 2 * std::size_t{std::max(1u, std::thread::hardware_concurrency())}
+      } {}
+
+Transcoder::~Transcoder() {
+  // Not waited for with the lock held, the jobs take it as they finish
+  std::vector<DecoderPool::Handle> handles{};
+  {
+    std::lock_guard lock{m_mutex};
+    handles = std::move(m_handles);
+  }
+  for (DecoderPool::Handle &handle : handles)
+    handle.cancel();
+  for (const DecoderPool::Handle &handle : handles)
+    handle.wait();
+}
+
+void Transcoder::submit(TranscodeJob job) {
+  std::unique_lock lock{m_mutex};
+  m_done.wait(lock, [this]() { return m_pending < m_max_pending; });
+  ++m_pending;
+  std::erase_if(m_handles, [](const DecoderPool::Handle &handle) { return handle.is_done(); });
+  // Not as background jobs, which run on a single worker at the lowest priority
+  m_handles.push_back(m_pool.submit(
+      JobPriority::Prefetch,
+      [this, job = std::move(job)](std::stop_token stop) {
+        transcode(job, stop);
+        {
+          std::lock_guard job_lock{m_mutex};
+          --m_pending;
+        }
+        m_done.notify_all();
+      }
+  ));
+}
+
+std::uint64_t Transcoder::wait() {
+  std::unique_lock lock{m_mutex};
+  m_done.wait(lock, [this]() { return m_pending == 0; });
+  return m_failures.load(std::memory_order_relaxed);
+}
+
+TranscodeStats Transcoder::get_stats() const {
+  TranscodeStats stats{};
+  stats.files    = m_files.load(std::memory_order_relaxed);
+  stats.failures = m_failures.load(std::memory_order_relaxed);
+  stats.frames   = m_frames.load(std::memory_order_relaxed);
+  stats.seconds  = static_cast<double>(m_microseconds.load(std::memory_order_relaxed)) / 1e6;
+  return stats;
+}
+
+bool Transcoder::transcode(const TranscodeJob &job, std::stop_token stop) {
+  const auto fail = [this]() {
+    m_failures.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  };
+  const std::uint32_t bits = config.bits_per_sample;
+  if (bits != 16 and bits != 24) {
+    spdlog::error("Can't export {} bits samples", bits);
+    return fail();
+  }
+
+  ma_decoder_config decoder_config =
+      ma_decoder_config_init(ma_format_f32, config.channels, config.sample_rate);
+  m_resampler.apply(decoder_config.resampling);
+  ma_decoder decoder{};
+  if (ma_decoder_init_file(job.source.c_str(), &decoder_config, &decoder) != MA_SUCCESS) {
+    spdlog::error("Failed to open {}", job.source);
+    return fail();
+  }
+  const std::uint32_t rate     = decoder.outputSampleRate;
+  const std::uint32_t channels = decoder.outputChannels;
+
+  // Trim what the encoder added, counted at the file's rate
+  std::uint64_t start_frame = 0;
+  ma_uint64 length          = 0;
+  ma_uint32 file_rate       = 0;
+  if (ma_data_source_get_data_format(
+          decoder.pBackend, nullptr, nullptr, &file_rate, nullptr, 0
+      ) != MA_SUCCESS)
+    file_rate = 0;
+  if (const std::optional<GaplessInfo> gapless = read_gapless_info(job.source);
+      gapless.has_value() and file_rate > 0) {
+    const double ratio = static_cast<double>(rate) / file_rate;
+    const auto scale   = [&](const std::uint64_t frames) {
+      return static_cast<std::uint64_t>(std::llround(static_cast<double>(frames) * ratio));
+    };
+    start_frame = scale(gapless->delay);
+    if (gapless->length.has_value())
+      length = scale(*gapless->length);
+    else if (ma_decoder_get_length_in_pcm_frames(&decoder, &length) == MA_SUCCESS and length > 0)
+      length -= std::min<ma_uint64>(length, scale(gapless->delay + gapless->padding));
+    if (start_frame > 0 and ma_decoder_seek_to_pcm_frame(&decoder, start_frame) != MA_SUCCESS) {
+      spdlog::error("Failed to seek in {}", job.source);
+      ma_decoder_uninit(&decoder);
+      return fail();
+    }
+  }
+
+  // Written aside then renamed, an export that failed leaves nothing behind
+  const std::string part_path = std::format("{}.part", job.destination);
+  FlacEncoder flac{};
+  ma_encoder wav{};
+  bool opened = false;
+  if (config.format == TranscodeFormat::Flac) {
+    opened = flac.open(part_path, rate, channels, bits, Utils::get_vorbis_comments(job.tags));
+  } else {
+    const ma_encoder_config encoder_config = ma_encoder_config_init(
+        ma_encoding_format_wav, bits == 16 ? ma_format_s16 : ma_format_s24, channels, rate
+    );
+    opened = ma_encoder_init_file(part_path.c_str(), &encoder_config, &wav) == MA_SUCCESS;
+  }
+  if (not opened) {
+    spdlog::error("Failed to create {}", part_path);
+    ma_decoder_uninit(&decoder);
+    return fail();
+  }
+
+  const std::size_t chunk_samples = chunk_frames * channels;
+  std::vector<float> chunk(chunk_samples);
+  std::vector<std::int32_t> samples(chunk_samples);
+  std::vector<std::uint8_t> packed(config.format == TranscodeFormat::Wav ? chunk_samples * 4 : 0);
+  // The same output on every run
+  std::uint32_t random = 0x9e3779b9;
+  ma_uint64 frames     = 0;
+  bool written         = true;
+  bool ended           = false;
+  while (not ended) {
+    if (stop.stop_requested()) {
+      written = false;
+      break;
+    }
+    ma_uint64 read = 0;
+    const ma_result result =
+        ma_decoder_read_pcm_frames(&decoder, chunk.data(), chunk_frames, &read);
+    if (result != MA_SUCCESS and result != MA_AT_END) {
+      spdlog::error("Failed to decode {}", job.source);
+      written = false;
+      break;
+    }
+    ended = result != MA_SUCCESS or read < chunk_frames;
+    // The resampler holds back the last frames until told that no more input is coming
+    if (ended and Resampler::drain(decoder))
+      ended = false;
+    // Drop the encoder padding
+    if (length > 0 and frames + read >= length) {
+      read  = length - std::min(length, frames);
+      ended = true;
+    }
+
+    const std::size_t sample_count = static_cast<std::size_t>(read) * channels;
+    Utils::quantize(chunk.data(), samples.data(), sample_count, bits, random);
+    if (config.format == TranscodeFormat::Flac) {
+      written = flac.write(samples.data(), read);
+    } else {
+      Utils::pack_samples(samples.data(), packed.data(), sample_count, bits);
+      written = ma_encoder_write_pcm_frames(&wav, packed.data(), read, nullptr) == MA_SUCCESS;
+    }
+    if (not written) {
+      spdlog::error("Failed to write {}", part_path);
+      break;
+    }
+    frames += read;
+  }
+  ma_decoder_uninit(&decoder);
+
+  if (config.format == TranscodeFormat::Flac) {
+    written = flac.close() and written;
+  } else {
+    ma_encoder_uninit(&wav);
+    written = written and Utils::write_riff_info(part_path, job.tags);
+  }
+  std::error_code ec;
+  if (not written) {
+    fs::remove(part_path, ec);
+    return fail();
+  }
+  fs::rename(part_path, job.destination, ec);
+  if (ec) {
+    spdlog::error("Failed to replace {}: {}", job.destination, ec.message());
+    fs::remove(part_path, ec);
+    return fail();
+  }
+
+  m_files.fetch_add(1, std::memory_order_relaxed);
+  m_frames.fetch_add(frames, std::memory_order_relaxed);
+  m_microseconds.fetch_add(frames * 1'000'000 / rate, std::memory_order_relaxed);
+  return true;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::quantize(
+    const float *in, std::int32_t *out, const std::size_t sample_count, const std::uint32_t bits,
+    std::uint32_t &random
+) {
+  const float scale = static_cast<float>(1 << (bits - 1));
+  const float max   = scale - 1.0f;
+  if (bits >= 24) {
+    // As many bits as a float has, the samples of a 24 bits file come back as they were
+    for (std::size_t i = 0; i < sample_count; ++i)
+      out[i] = static_cast<std::int32_t>(std::lrint(std::clamp(in[i] * scale, -scale, max)));
+    return;
+  }
+  // The difference of two uniform values in [0, 1), with xorshift32
+  const auto uniform = [&random]() {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return static_cast<float>(random >> 8) * (1.0f / 16777216.0f);
+  };
+  for (std::size_t i = 0; i < sample_count; ++i) {
+    const float dither = uniform() - uniform();
+    out[i] =
+        static_cast<std::int32_t>(std::lrint(std::clamp(in[i] * scale + dither, -scale, max)));
+  }
+}
+
+static void Utils::pack_samples(
+    const std::int32_t *in, std::uint8_t *out, const std::size_t sample_count,
+    const std::uint32_t bits
+) {
+  const std::size_t bytes = bits / 8;
+  for (std::size_t i = 0; i < sample_count; ++i)
+    for (std::size_t b = 0; b < bytes; ++b)
+      out[i * bytes + b] = static_cast<std::uint8_t>(static_cast<std::uint32_t>(in[i]) >> (8 * b));
+}
+
+static std::vector<std::string> Utils::get_vorbis_comments(const TranscodeTags &tags) {
+  std::vector<std::string> comments{};
+  const auto add = [&comments](const char *key, const std::string &value) {
+    if (not value.empty())
+      comments.push_back(std::format("{}={}", key, value));
+  };
+  add("TITLE", tags.title);
+  add("ARTIST", tags.artist);
+  add("ALBUM", tags.album);
+  add("ALBUMARTIST", tags.album_artist);
+  if (tags.track_number.has_value())
+    add("TRACKNUMBER", std::to_string(*tags.track_number));
+  return comments;
+}
+
+static bool Utils::write_riff_info(const std::string &path, const TranscodeTags &tags) {
+  std::string chunk = "INFO";
+  const auto add    = [&chunk](const char *id, const std::string &value) {
+    if (value.empty())
+      return;
+    // Null terminated, padded to an even size
+    const auto size = static_cast<std::uint32_t>(value.size() + 1);
+    chunk.append(id, 4);
+    for (unsigned i = 0; i < 4; ++i)
+      chunk.push_back(static_cast<char>(size >> (8 * i)));
+    chunk.append(value);
+    chunk.push_back('\0');
+    if (size % 2 != 0)
+      chunk.push_back('\0');
+  };
+  // There's no id for the album artist
+  add("INAM", tags.title);
+  add("IART", tags.artist);
+  add("IPRD", tags.album);
+  if (tags.track_number.has_value())
+    add("ITRK", std::to_string(*tags.track_number));
+  if (chunk.size() == 4)
+    return true;
+
+  std::fstream file{path, std::ios::binary | std::ios::in | std::ios::out};
+  const auto write_size = [&file](const std::uint64_t size) {
+    char bytes[4];
+    for (unsigned i = 0; i < 4; ++i)
+      bytes[i] = static_cast<char>(size >> (8 * i));
+    file.write(bytes, 4);
+  };
+  file.seekp(0, std::ios::end);
+  const auto end = static_cast<std::uint64_t>(file.tellp());
+  file.write("LIST", 4);
+  write_size(chunk.size());
+  file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+  // Everything past the RIFF chunk's id and size
+  file.seekp(4);
+  write_size(end + chunk.size());
+  if (not file) {
+    spdlog::error("Failed to tag {}", path);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "./decoder_pool.hpp"
+#include "./resampler.hpp"
+
+namespace Tmupp {
+
+enum class TranscodeFormat { Wav, Flac };
+
+/**
+ * Tags written to the exported files, empty ones are left out.
+ */
+struct TranscodeTags {
+  std::string title;
+  std::string artist;
+  std::string album;
+  std::string album_artist;
+  std::optional<int> track_number;
+};
+
+/**
+ * Tags of a track as Midx indexed them.
+ */
+TranscodeTags read_transcode_tags(SQLite::Database &db, const int track_id);
+
+struct TranscodeConfig {
+  TranscodeFormat format = TranscodeFormat::Flac;
+  /**
+   * Output rate and channels, 0 to keep the source's.
+   */
+  std::uint32_t sample_rate = 0;
+  std::uint32_t channels    = 0;
+  /**
+   * 16 (dithered) or 24.
+   */
+  std::uint32_t bits_per_sample      = 16;
+  ResamplerQuality resampler_quality = ResamplerQuality::High;
+  /**
+   * Jobs submitted and not done yet, beyond which `submit()` blocks, 0 for twice the
+   * cores. Each holds a decoder and a few chunks, so this bounds the memory used.
+   */
+  std::size_t max_pending_jobs = 0;
+};
+
+struct TranscodeJob {
+  std::string source;
+  std::string destination;
+  TranscodeTags tags;
+};
+
+struct TranscodeStats {
+  std::uint64_t files    = 0;
+  std::uint64_t failures = 0;
+  /**
+   * Output frames written, at the output rate of each file.
+   */
+  std::uint64_t frames = 0;
+  /**
+   * Output frames divided by their rate.
+   */
+  double seconds = 0.0;
+};
+
+/**
+  Decodes tracks and writes them as WAV or FLAC, as prefetch jobs of a `DecoderPool`, so
+  that as many files are transcoded at once as the pool has workers.
+
+  Each file is decoded through `ma_decoder`, resampled with our resampler when the rate
+  changes, trimmed of the MP3 encoder delay and padding, dithered to 16 bits or rounded to
+  24, and written next to its destination before being renamed over it: an export that
+  was interrupted or failed leaves no truncated file.
+
+  WAV files are written by miniaudio's encoder, then tagged with a RIFF INFO chunk; FLAC
+  files by `FlacEncoder`, tagged with Vorbis comments.
+*/
+class Transcoder {
+ public:
+  Transcoder(DecoderPool &pool, const TranscodeConfig &config_);
+  Transcoder(const Transcoder &)            = delete;
+  Transcoder &operator=(const Transcoder &) = delete;
+  /**
+   * Cancel the jobs and wait for them.
+   */
+  ~Transcoder();
+
+  /**
+   * Queue `job`, waiting first for one of the pending ones to be done if there are too
+   * many.
+   */
+  void submit(TranscodeJob job);
+  /**
+   * Wait for every job submitted, returns how many failed.
+   */
+  std::uint64_t wait();
+  TranscodeStats get_stats() const;
+
+  /**
+   * Transcode a file on the calling thread, false if it failed or `stop` was requested.
+   */
+  bool transcode(const TranscodeJob &job, std::stop_token stop = {});
+
+ public:
+  /**
+   * Frames decoded at once, between checks of the stop token.
+   */
+  static constexpr std::size_t chunk_frames = 8192;
+
+  const TranscodeConfig config;
+
+ private:
+  Resampler m_resampler;
+  DecoderPool &m_pool;
+  std::size_t m_max_pending;
+
+  /**
+   * Guards `m_handles` and `m_pending`.
+   */
+  std::mutex m_mutex;
+  std::condition_variable m_done;
+  std::vector<DecoderPool::Handle> m_handles;
+  std::size_t m_pending = 0;
+
+  std::atomic<std::uint64_t> m_files{0};
+  std::atomic<std::uint64_t> m_failures{0};
+  std::atomic<std::uint64_t> m_frames{0};
+  /**
+   * Sum of the seconds written, in microseconds.
+   */
+  std::atomic<std::uint64_t> m_microseconds{0};
+};
+
+}  // namespace Tmupp
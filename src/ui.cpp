@@ -0,0 +1,118 @@
+#include "./ui.hpp"
+
+#include <format>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ftxui/component/component.hpp"
+#include "ftxui/dom/elements.hpp"
+
+namespace Tmupp {
+
+/**
+ * Rows taken by the spectrum bars.
+ */
+static constexpr int spectrum_height = 12;
+/**
+ * Rows taken by the waveform of the seek bar.
+ */
+static constexpr int seek_bar_height = 3;
+
+// Static helper functions
+namespace Utils {
+
+static ftxui::Color get_level_color(const float level);
+
+/**
+ * A VU meter: RMS as a bar and peak in dBFS.
+ */
+static ftxui::Element render_meter(
+    const std::string &label, const float rms, const float peak, const float floor_db
+);
+
+}  // namespace Utils
+
+ftxui::Component make_visualizer_panel(Visualizer &visualizer) {
+  using namespace ftxui;
+  return Renderer([&visualizer, frame = VisualizerFrame{}]() mutable {
+    visualizer.get_frame(frame);
+
+    Elements bars;
+    for (const float level : frame.bands)
+      bars.push_back(gaugeUp(level) | color(Utils::get_level_color(level)) | flex);
+    const float floor_db = visualizer.config.floor_db;
+    return vbox({
+        hbox(std::move(bars)) | size(HEIGHT, EQUAL, spectrum_height),
+        separator(),
+        Utils::render_meter("L", frame.rms[0], frame.peak[0], floor_db),
+        Utils::render_meter("R", frame.rms[1], frame.peak[1], floor_db),
+    });
+  });
+}
+
+ftxui::Element render_seek_bar(std::shared_ptr<const Waveform> waveform, const float progress) {
+  using namespace ftxui;
+  if (waveform == nullptr)
+    return gauge(progress) | color(Color::GrayDark);
+  // Sized to the box it's given, a peak per dot column
+  return canvas(
+             2, 4 * seek_bar_height,
+             [waveform = std::move(waveform), progress](Canvas &c) {
+               const int middle = c.height() / 2;
+               const int played = static_cast<int>(progress * static_cast<float>(c.width()));
+               const std::vector<WaveformPeak> peaks =
+                   waveform->render(static_cast<std::size_t>(c.width()));
+               for (int x = 0; x < static_cast<int>(peaks.size()); ++x) {
+                 const WaveformPeak &peak = peaks[static_cast<std::size_t>(x)];
+                 const int top            = middle - peak.max * middle / 127;
+                 const int bottom         = middle - peak.min * middle / 127;
+                 const int rms            = peak.rms * middle / 255;
+                 // Dots share a color per cell, the RMS drawn last stands out of the peaks
+                 c.DrawPointLine(x, top, x, bottom, x < played ? Color::Cyan : Color::GrayDark);
+                 c.DrawPointLine(
+                     x, middle - rms, x, middle + rms,
+                     x < played ? Color::CyanLight : Color::GrayLight
+                 );
+               }
+             }
+         ) |
+         xflex | size(HEIGHT, EQUAL, seek_bar_height);
+}
+
+ftxui::Element render_player_stats(const PlayerStats &stats) {
+  using namespace ftxui;
+  Elements lines;
+  std::istringstream stream{stats.to_string()};
+  for (std::string line; std::getline(stream, line);)
+    lines.push_back(text(line));
+  return window(text(" Audio callback "), vbox(std::move(lines))) | clear_under;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static ftxui::Color Utils::get_level_color(const float level) {
+  if (level > 0.9f)
+    return ftxui::Color::Red;
+  if (level > 0.75f)
+    return ftxui::Color::Yellow;
+  return ftxui::Color::Green;
+}
+
+static ftxui::Element Utils::render_meter(
+    const std::string &label, const float rms, const float peak, const float floor_db
+) {
+  using namespace ftxui;
+  const std::string peak_text =
+      peak > 0.0f ? std::format("{:6.1f} dB", floor_db * (1.0f - peak)) : "   -inf dB";
+  return hbox({
+      text(label + " "),
+      gauge(rms) | color(get_level_color(peak)) | flex,
+      text(" " + peak_text),
+  });
+}
+
+}  // namespace Tmupp
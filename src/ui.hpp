@@ -1 +1,30 @@
+#pragma once
 
+#include "ftxui/component/component_base.hpp"
+#include "ftxui/dom/elements.hpp"
+
+#include "./player.hpp"
+
+#include "./visualizer.hpp"
+#include "./waveform.hpp"
+
+namespace Tmupp {
+
+/**
+ * Spectrum bars over the VU meters, drawing the latest frame of `visualizer` each render.
+ */
+ftxui::Component make_visualizer_panel(Visualizer &visualizer);
+
+/**
+ * Box of the audio callback's timings and buffering, drawn over the rest as a debug
+ * overlay.
+ */
+ftxui::Element render_player_stats(const PlayerStats &stats);
+
+/**
+ * Waveform of the track with what's been played, `progress` of its length, highlighted.
+ * A plain gauge until the waveform is ready.
+ */
+ftxui::Element render_seek_bar(std::shared_ptr<const Waveform> waveform, const float progress);
+
+}  // namespace Tmupp
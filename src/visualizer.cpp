@@ -0,0 +1,252 @@
+#include "./visualizer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+namespace Tmupp {
+
+/**
+ * Frames drained from the tap at once.
+ */
+static constexpr std::size_t tap_chunk_frames = 1024;
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Level from 0 to 1 of a power relative to full scale, `floor_db` and below being 0.
+ */
+static float power_to_level(const double power, const float floor_db);
+
+}  // namespace Utils
+
+Visualizer::Visualizer(
+    Player &player_, const VisualizerConfig &config_, std::function<void()> on_frame
+)
+    : config{config_},
+      m_player{player_},
+      m_channels{player_.get_channels()},
+      m_on_frame{std::move(on_frame)},
+      m_fft{config_.fft_size},
+      m_window(config_.fft_size),
+      m_band_ranges(config_.band_count),
+      m_history(config_.fft_size),
+      m_tap_chunk(tap_chunk_frames * m_channels),
+      m_windowed(config_.fft_size),
+      m_spectrum(config_.fft_size / 2 + 1),
+      m_power(config_.fft_size / 2 + 1),
+      m_shown(config_.band_count + 4) {
+  assert(config.band_count > 0 and config.min_frequency > 0.0f and config.fps > 0.0f);
+
+  hann_window(m_window);
+
+  const float sample_rate    = static_cast<float>(m_player.get_sample_rate());
+  const float bin_hz         = sample_rate / static_cast<float>(config.fft_size);
+  const float top            = std::min(config.max_frequency, sample_rate / 2.0f);
+  const float ratio          = top / config.min_frequency;
+  const float bands          = static_cast<float>(config.band_count);
+  const std::size_t last_bin = config.fft_size / 2;
+  for (std::size_t i = 0; i < config.band_count; ++i) {
+    const float low  = config.min_frequency * std::pow(ratio, static_cast<float>(i) / bands);
+    const float high = config.min_frequency * std::pow(ratio, static_cast<float>(i + 1) / bands);
+    // Bands narrower than a bin show the one nearest to them
+    const auto first = std::clamp<std::size_t>(
+        static_cast<std::size_t>(std::lround(low / bin_hz)), 1, last_bin
+    );
+    const auto last = std::clamp<std::size_t>(
+        static_cast<std::size_t>(std::lround(high / bin_hz)), first + 1, last_bin + 1
+    );
+    m_band_ranges[i] = BandRange{first, last - 1};
+  }
+
+  m_levels.bands.resize(config.band_count);
+  for (VisualizerFrame &frame : m_frames)
+    frame.bands.resize(config.band_count);
+
+  m_thread = std::thread{&Visualizer::analysis_loop, this};
+}
+
+Visualizer::~Visualizer() {
+  {
+    std::lock_guard lock{m_mutex};
+    m_quit = true;
+  }
+  m_cv.notify_one();
+  m_thread.join();
+  m_player.set_output_tap(false);
+}
+
+void Visualizer::set_active(const bool active) {
+  {
+    std::lock_guard lock{m_mutex};
+    m_active.store(active, std::memory_order_relaxed);
+  }
+  m_player.set_output_tap(active);
+  m_cv.notify_one();
+}
+
+bool Visualizer::get_frame(VisualizerFrame &frame) {
+  if ((m_middle.load(std::memory_order_relaxed) & fresh_bit) == 0)
+    return false;
+  m_front = m_middle.exchange(static_cast<std::uint32_t>(m_front), std::memory_order_acq_rel) &
+            ~fresh_bit;
+  frame = m_frames[m_front];
+  return true;
+}
+
+void Visualizer::analysis_loop() {
+  using Clock = std::chrono::steady_clock;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<float>{1.0f / config.fps}
+  );
+
+  bool running = false;
+  Clock::time_point next{};
+  Clock::time_point last{};
+  while (true) {
+    {
+      std::unique_lock lock{m_mutex};
+      if (running)
+        m_cv.wait_until(lock, next, [&] { return m_quit; });
+      else
+        m_cv.wait(lock, [&] { return m_quit or m_active.load(std::memory_order_relaxed); });
+      if (m_quit)
+        return;
+    }
+    const bool started = not running;
+    running            = m_active.load(std::memory_order_relaxed);
+    if (not running)
+      continue;
+
+    const Clock::time_point now = Clock::now();
+    if (started) {
+      // What the tap holds is stale
+      m_player.get_output_tap().clear();
+      std::fill(m_history.begin(), m_history.end(), 0.0f);
+      last = now;
+      next = now;
+    }
+    // Late analyses are skipped, not caught up with
+    next += interval;
+    if (next <= now)
+      next = now + interval;
+
+    drain_tap();
+    analyse(std::chrono::duration<float>{now - last}.count());
+    last = now;
+    if (publish() and m_on_frame)
+      m_on_frame();
+  }
+}
+
+void Visualizer::drain_tap() {
+  RingBuffer<float> &tap = m_player.get_output_tap();
+  const std::size_t mask = config.fft_size - 1;
+  while (true) {
+    // The callback writes whole periods, so reads of whole frames stay aligned
+    const std::size_t frames = tap.read(m_tap_chunk.data(), m_tap_chunk.size()) / m_channels;
+    for (std::size_t i = 0; i < frames; ++i) {
+      const float *frame = m_tap_chunk.data() + i * m_channels;
+      float sum          = 0.0f;
+      for (std::size_t c = 0; c < m_channels; ++c)
+        sum += frame[c];
+      m_history[m_history_position] = sum / static_cast<float>(m_channels);
+      m_history_position            = (m_history_position + 1) & mask;
+
+      for (std::size_t side = 0; side < 2; ++side) {
+        const float sample = frame[std::min<std::size_t>(side, m_channels - 1)];
+        m_squares[side] += double{sample} * sample;
+        m_peaks[side] = std::max(m_peaks[side], std::abs(sample));
+      }
+    }
+    m_drained += frames;
+    if (frames * m_channels < m_tap_chunk.size())
+      break;
+  }
+}
+
+void Visualizer::analyse(const float seconds) {
+  const float fall = config.fall_db_per_second * seconds / -config.floor_db;
+  const auto decay = [&](float &level, const float target) {
+    level = std::max(target, level - fall);
+  };
+
+  if (m_drained == 0) {
+    // Nothing was output, let everything fall
+    for (float &level : m_levels.bands)
+      decay(level, 0.0f);
+    for (std::size_t side = 0; side < 2; ++side) {
+      decay(m_levels.rms[side], 0.0f);
+      decay(m_levels.peak[side], 0.0f);
+    }
+    return;
+  }
+
+  const std::size_t mask = config.fft_size - 1;
+  for (std::size_t i = 0; i < config.fft_size; ++i)
+    m_windowed[i] = m_history[(m_history_position + i) & mask] * m_window[i];
+  m_fft.power_spectrum(m_windowed, m_power, m_spectrum);
+
+  // A full scale sine reaches `fft_size / 4` through a Hann window
+  const double full_scale = static_cast<double>(config.fft_size) / 4.0;
+  const double reference  = full_scale * full_scale;
+  for (std::size_t i = 0; i < config.band_count; ++i) {
+    const BandRange range = m_band_ranges[i];
+    const float loudest   = *std::max_element(
+        m_power.begin() + static_cast<std::ptrdiff_t>(range.first),
+        m_power.begin() + static_cast<std::ptrdiff_t>(range.last + 1)
+    );
+    decay(m_levels.bands[i], Utils::power_to_level(loudest / reference, config.floor_db));
+  }
+
+  for (std::size_t side = 0; side < 2; ++side) {
+    const double mean_square = m_squares[side] / static_cast<double>(m_drained);
+    const double peak        = double{m_peaks[side]} * m_peaks[side];
+    decay(m_levels.rms[side], Utils::power_to_level(mean_square, config.floor_db));
+    decay(m_levels.peak[side], Utils::power_to_level(peak, config.floor_db));
+  }
+  m_squares = {};
+  m_peaks   = {};
+  m_drained = 0;
+}
+
+bool Visualizer::publish() {
+  VisualizerFrame &frame = m_frames[m_back];
+  frame.bands            = m_levels.bands;
+  frame.rms              = m_levels.rms;
+  frame.peak             = m_levels.peak;
+  frame.sequence         = ++m_levels.sequence;
+
+  const std::uint32_t back = static_cast<std::uint32_t>(m_back) | fresh_bit;
+  m_back                   = m_middle.exchange(back, std::memory_order_acq_rel) & ~fresh_bit;
+
+  bool changed    = false;
+  std::size_t i   = 0;
+  const auto show = [&](const float level) {
+    const int steps = static_cast<int>(level * shown_steps);
+    changed         = changed or steps != m_shown[i];
+    m_shown[i++]    = steps;
+  };
+  for (const float level : m_levels.bands)
+    show(level);
+  for (std::size_t side = 0; side < 2; ++side) {
+    show(m_levels.rms[side]);
+    show(m_levels.peak[side]);
+  }
+  return changed;
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static float Utils::power_to_level(const double power, const float floor_db) {
+  if (power <= 0.0)
+    return 0.0f;
+  const float db = static_cast<float>(10.0 * std::log10(power));
+  return std::clamp((db - floor_db) / -floor_db, 0.0f, 1.0f);
+}
+
+}  // namespace Tmupp
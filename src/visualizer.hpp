@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./fft.hpp"
+#include "./player.hpp"
+
+namespace Tmupp {
+
+struct VisualizerConfig {
+  /**
+   * Samples per transform, a power of two.
+   */
+  std::size_t fft_size   = 4096;
+  std::size_t band_count = 32;
+  /**
+   * The bands are spaced logarithmically between these, in Hz.
+   */
+  float min_frequency = 40.0f;
+  float max_frequency = 16000.0f;
+  /**
+   * Analyses per second, and at most as many redraws.
+   */
+  float fps = 60.0f;
+  /**
+   * Level shown as an empty bar, 0 dBFS being a full one.
+   */
+  float floor_db = -72.0f;
+  /**
+   * How fast bars and meters fall, they rise at once.
+   */
+  float fall_db_per_second = 36.0f;
+};
+
+/**
+ * Levels from 0 (`VisualizerConfig::floor_db` or less) to 1 (0 dBFS).
+ */
+struct VisualizerFrame {
+  std::vector<float> bands;
+  /**
+   * RMS and peak of the left and right channels over the last analysis.
+   */
+  std::array<float, 2> rms{};
+  std::array<float, 2> peak{};
+  /**
+   * Incremented by every analysis.
+   */
+  std::uint64_t sequence = 0;
+};
+
+/**
+  Spectrum analyser and VU meters of the player's output.
+
+  The audio callback only copies its output to the player's tap (see
+  `Player::set_output_tap()`). The analysis runs on its own thread `fps` times per second:
+  it drains the tap, transforms the last `fft_size` samples (mixed to mono, Hann
+  windowed) and reduces the bins to log-spaced bands.
+
+  Frames are handed to the renderer through a triple buffer, so neither side waits for the
+  other, and `on_frame` is only called when a bar or a meter moved by a visible amount,
+  so a still or silent output doesn't redraw the screen.
+*/
+class Visualizer {
+ public:
+  /**
+   * @param on_frame Called from the analysis thread when a new frame is ready.
+   */
+  Visualizer(Player &player_, const VisualizerConfig &config_, std::function<void()> on_frame);
+  Visualizer(const Visualizer &)            = delete;
+  Visualizer &operator=(const Visualizer &) = delete;
+  ~Visualizer();
+
+  /**
+   * Start or stop analysing, the tap is disabled while stopped.
+   */
+  void set_active(const bool active);
+  bool is_active() const { return m_active.load(std::memory_order_relaxed); }
+
+  /**
+   * Replace `frame` with the latest one if it's newer, returns whether it was. A single
+   * thread may call it.
+   */
+  bool get_frame(VisualizerFrame &frame);
+
+ public:
+  const VisualizerConfig config;
+
+ private:
+  /**
+   * Bins a band shows the loudest of.
+   */
+  struct BandRange {
+    std::size_t first;
+    std::size_t last;
+  };
+
+  void analysis_loop();
+  /**
+   * Move what the tap holds to the history and the meters.
+   */
+  void drain_tap();
+  /**
+   * Update the levels, `seconds` after the last analysis.
+   */
+  void analyse(const float seconds);
+  /**
+   * Hand the levels to the reader, returns whether they differ visibly from the ones
+   * reported last.
+   */
+  bool publish();
+
+ private:
+  Player &m_player;
+  const std::uint32_t m_channels;
+  const std::function<void()> m_on_frame;
+  Fft m_fft;
+  std::vector<float> m_window;
+  std::vector<BandRange> m_band_ranges;
+
+  // Analysis thread only
+  /**
+   * Last `fft_size` mono samples, circular from `m_history_position`.
+   */
+  std::vector<float> m_history;
+  std::size_t m_history_position = 0;
+  std::vector<float> m_tap_chunk;
+  std::vector<float> m_windowed;
+  std::vector<std::complex<float>> m_spectrum;
+  std::vector<float> m_power;
+  /**
+   * Sum of the squares and peak of the left and right channels since the last analysis.
+   */
+  std::array<double, 2> m_squares{};
+  std::array<float, 2> m_peaks{};
+  std::size_t m_drained = 0;
+  VisualizerFrame m_levels;
+  /**
+   * Level changes smaller than a step aren't worth a redraw.
+   */
+  static constexpr float shown_steps = 64.0f;
+  /**
+   * Levels last reported through `on_frame`, in `shown_steps`.
+   */
+  std::vector<int> m_shown;
+
+  /**
+   * Triple buffer: the analysis thread writes `m_frames[m_back]`, the reader reads
+   * `m_frames[m_front]` and they swap with `m_middle` (index, and `fresh_bit` when it
+   * holds a frame the reader hasn't seen).
+   */
+  static constexpr std::uint32_t fresh_bit = 4;
+  std::array<VisualizerFrame, 3> m_frames;
+  std::size_t m_back  = 0;
+  std::size_t m_front = 1;
+  std::atomic<std::uint32_t> m_middle{2};
+
+  std::atomic<bool> m_active{false};
+  bool m_quit = false;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::thread m_thread;
+};
+
+}  // namespace Tmupp
@@ -0,0 +1,477 @@
+#include "./waveform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "miniaudio.h"
+
+#include "midx.hpp"
+
+#include "./sidecar.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Tmupp {
+
+static constexpr SidecarFormat waveform_format{
+    {'T', 'M', 'U', 'P', 'P', 'W', 'A', 'V'}, 3, "waveform"
+};
+
+/**
+ * Frames per peak the first level starts at, doubled as long tracks need it.
+ */
+static constexpr std::uint32_t min_bucket_frames = 256;
+/**
+ * Frames decoded at once, between checks of the stop token.
+ */
+static constexpr std::size_t waveform_chunk_frames = 4096;
+
+static_assert(sizeof(WaveformPeak) == 3, "peaks are written as is");
+
+// Static helper functions
+namespace Utils {
+
+/**
+ * Follows the sidecar header.
+ */
+struct WaveformHeader {
+  std::uint64_t bucket_frames;
+  std::uint64_t length;
+  std::uint64_t level_count;
+  /**
+   * Of the first level, each next one has half as many rounded up.
+   */
+  std::uint64_t peak_count;
+  std::uint64_t leading_silence;
+  std::uint64_t trailing_silence;
+};
+
+/**
+ * Peak being built, before quantizing.
+ */
+struct Bucket {
+  float min            = 0.0f;
+  float max            = 0.0f;
+  double sum_squares   = 0.0;
+  std::uint32_t frames = 0;
+};
+
+static void accumulate(Bucket &bucket, const float *samples, const std::size_t count);
+
+static float sum_squares(const float *samples, const std::size_t count);
+
+/**
+ * Buckets merged by two, the last one alone if they're odd.
+ */
+static std::vector<Bucket> merge_pairs(const std::vector<Bucket> &buckets);
+
+static std::vector<WaveformPeak> quantize(const std::vector<Bucket> &buckets);
+
+}  // namespace Utils
+
+std::vector<WaveformPeak> Waveform::render(
+    const std::size_t columns, const double from, const double to
+) const {
+  std::vector<WaveformPeak> peaks{};
+  if (levels.empty() or levels.front().empty() or length == 0 or columns == 0)
+    return peaks;
+  const double start         = std::clamp(from, 0.0, 1.0) * static_cast<double>(length);
+  const double end           = std::clamp(to, from, 1.0) * static_cast<double>(length);
+  const double column_frames = (end - start) / static_cast<double>(columns);
+
+  // The coarsest level with at least a peak per column
+  std::size_t level = 0;
+  while (level + 1 < levels.size() and
+         static_cast<double>(std::uint64_t{bucket_frames} << (level + 1)) <= column_frames)
+    ++level;
+  const std::vector<WaveformPeak> &source = levels[level];
+  const double level_frames = static_cast<double>(std::uint64_t{bucket_frames} << level);
+
+  peaks.reserve(columns);
+  for (std::size_t column = 0; column < columns; ++column) {
+    const double column_start = start + static_cast<double>(column) * column_frames;
+    const std::size_t first =
+        std::min(static_cast<std::size_t>(column_start / level_frames), source.size() - 1);
+    const std::size_t last = std::clamp(
+        static_cast<std::size_t>(std::ceil((column_start + column_frames) / level_frames)),
+        first + 1, source.size()
+    );
+
+    WaveformPeak peak{source[first].min, source[first].max, 0};
+    double sum_squares = 0.0;
+    for (std::size_t i = first; i < last; ++i) {
+      peak.min = std::min(peak.min, source[i].min);
+      peak.max = std::max(peak.max, source[i].max);
+      sum_squares += static_cast<double>(source[i].rms) * source[i].rms;
+    }
+    peak.rms = static_cast<std::uint8_t>(
+        std::lround(std::sqrt(sum_squares / static_cast<double>(last - first)))
+    );
+    peaks.push_back(peak);
+  }
+  return peaks;
+}
+
+std::optional<Waveform> build_waveform(const std::string &path, std::stop_token stop) {
+  // Mixed to mono at the track's own rate, no need for more
+  const ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 1, 0);
+  ma_decoder decoder{};
+  if (ma_decoder_init_file(path.c_str(), &decoder_config, &decoder) != MA_SUCCESS)
+    return std::nullopt;
+
+  // Louder windows than that are music, what's before the first and after the last one
+  // is silence
+  const std::uint32_t window_frames = std::max<std::uint32_t>(
+      1, decoder.outputSampleRate * Waveform::silence_window_milliseconds / 1000
+  );
+  const double threshold    = std::pow(10.0, Waveform::silence_threshold_db / 10.0);
+  double window_squares     = 0.0;
+  std::uint32_t window_fill = 0;
+  std::optional<std::uint64_t> music_start{};
+  std::uint64_t music_end = 0;
+  const auto end_window   = [&](const std::uint64_t end) {
+    if (window_squares / window_fill >= threshold) {
+      if (not music_start.has_value())
+        music_start = end - window_fill;
+      music_end = end;
+    }
+    window_squares = 0.0;
+    window_fill    = 0;
+  };
+
+  // Merged by two whenever there are twice too many, the memory never grows with the
+  // length of the track
+  std::vector<Utils::Bucket> buckets{};
+  buckets.reserve(2 * Waveform::max_buckets);
+  std::uint32_t bucket_frames = min_bucket_frames;
+  Utils::Bucket bucket{};
+  std::vector<float> chunk(waveform_chunk_frames);
+  std::uint64_t length = 0;
+  while (true) {
+    if (stop.stop_requested()) {
+      ma_decoder_uninit(&decoder);
+      return std::nullopt;
+    }
+    ma_uint64 read = 0;
+    const ma_result result =
+        ma_decoder_read_pcm_frames(&decoder, chunk.data(), waveform_chunk_frames, &read);
+    for (std::size_t i = 0; i < read;) {
+      const std::size_t n = std::min<std::size_t>(read - i, bucket_frames - bucket.frames);
+      Utils::accumulate(bucket, chunk.data() + i, n);
+      i += n;
+      if (bucket.frames < bucket_frames)
+        continue;
+      buckets.push_back(bucket);
+      bucket = {};
+      if (buckets.size() == 2 * Waveform::max_buckets) {
+        buckets = Utils::merge_pairs(buckets);
+        bucket_frames *= 2;
+      }
+    }
+    for (std::size_t i = 0; i < read;) {
+      const std::size_t n = std::min<std::size_t>(read - i, window_frames - window_fill);
+      window_squares += Utils::sum_squares(chunk.data() + i, n);
+      window_fill += static_cast<std::uint32_t>(n);
+      i += n;
+      if (window_fill == window_frames)
+        end_window(length + i);
+    }
+    length += read;
+    if (result != MA_SUCCESS or read < waveform_chunk_frames)
+      break;
+  }
+  ma_decoder_uninit(&decoder);
+  if (length == 0)
+    return std::nullopt;
+  if (window_fill > 0)
+    end_window(length);
+
+  if (bucket.frames > 0)
+    buckets.push_back(bucket);
+  if (buckets.size() > Waveform::max_buckets) {
+    buckets = Utils::merge_pairs(buckets);
+    bucket_frames *= 2;
+  }
+
+  Waveform waveform{};
+  waveform.length        = length;
+  waveform.bucket_frames = bucket_frames;
+  if (music_start.has_value()) {
+    waveform.leading_silence  = *music_start;
+    waveform.trailing_silence = length - music_end;
+  }
+  waveform.levels.push_back(Utils::quantize(buckets));
+  while (buckets.size() > 1) {
+    buckets = Utils::merge_pairs(buckets);
+    waveform.levels.push_back(Utils::quantize(buckets));
+  }
+  return waveform;
+}
+
+bool write_waveform(
+    const std::string &waveform_path, const std::string &file_path, const Waveform &waveform
+) {
+  Utils::WaveformHeader header{};
+  header.bucket_frames    = waveform.bucket_frames;
+  header.length           = waveform.length;
+  header.level_count      = waveform.levels.size();
+  header.peak_count       = waveform.levels.empty() ? 0 : waveform.levels.front().size();
+  header.leading_silence  = waveform.leading_silence;
+  header.trailing_silence = waveform.trailing_silence;
+
+  return write_sidecar(waveform_path, file_path, waveform_format, [&](std::ofstream &file) {
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const std::vector<WaveformPeak> &level : waveform.levels)
+      file.write(
+          reinterpret_cast<const char *>(level.data()),
+          static_cast<std::streamsize>(level.size() * sizeof(WaveformPeak))
+      );
+  });
+}
+
+std::optional<Waveform> read_waveform(
+    const std::string &waveform_path, const std::string &file_path
+) {
+  std::optional<std::ifstream> file = open_sidecar(waveform_path, file_path, waveform_format);
+  Utils::WaveformHeader header{};
+  if (not file.has_value() or
+      not file->read(reinterpret_cast<char *>(&header), sizeof(header)) or
+      header.peak_count == 0 or header.peak_count > Waveform::max_buckets or
+      header.level_count > 64)
+    return std::nullopt;
+
+  Waveform waveform{};
+  waveform.length           = header.length;
+  waveform.bucket_frames    = static_cast<std::uint32_t>(header.bucket_frames);
+  waveform.leading_silence  = header.leading_silence;
+  waveform.trailing_silence = header.trailing_silence;
+  std::size_t count         = header.peak_count;
+  for (std::uint64_t i = 0; i < header.level_count; ++i) {
+    std::vector<WaveformPeak> &level = waveform.levels.emplace_back(count);
+    file->read(
+        reinterpret_cast<char *>(level.data()),
+        static_cast<std::streamsize>(count * sizeof(WaveformPeak))
+    );
+    count = (count + 1) / 2;
+  }
+  if (not *file) {
+    spdlog::error("Truncated waveform {}", waveform_path);
+    return std::nullopt;
+  }
+  return waveform;
+}
+
+WaveformStore::WaveformStore(DecoderPool &pool, const std::string &directory_)
+    : directory{
+          not directory_.empty() or Midx::data_dir.empty()
+              ? directory_
+              : std::format("{}/waveform", Midx::data_dir)
+      },
+      m_pool{pool} {
+  if (not directory.empty()) {
+    std::error_code ec{};
+    fs::create_directories(directory, ec);
+    if (ec)
+      spdlog::error("Failed to create {}: {}", directory, ec.message());
+  }
+}
+
+WaveformStore::~WaveformStore() {
+  std::vector<Job> jobs{};
+  {
+    std::lock_guard lock{m_mutex};
+    std::swap(jobs, m_jobs);
+  }
+  for (Job &job : jobs) {
+    job.handle.cancel();
+    job.handle.wait();
+  }
+}
+
+std::shared_ptr<const Waveform> WaveformStore::get(const std::string &path) {
+  std::lock_guard lock{m_mutex};
+  if (std::shared_ptr<const Waveform> waveform = find(path); waveform != nullptr)
+    return waveform;
+  // Cancelled for playback, whether it ran or was dropped, asked again
+  std::erase_if(m_jobs, [this](const Job &job) {
+    if (not job.handle.is_done())
+      return false;
+    if (job.handle.is_cancelled())
+      m_requested.erase(job.path);
+    return true;
+  });
+
+  if (m_requested.insert(path).second)
+    m_jobs.push_back(Job{
+        path, m_pool.submit(JobPriority::Background, [this, path](std::stop_token stop) {
+          load(path, stop);
+        })
+    });
+  return nullptr;
+}
+
+std::shared_ptr<const Waveform> WaveformStore::read(const std::string &path) {
+  {
+    std::lock_guard lock{m_mutex};
+    if (std::shared_ptr<const Waveform> waveform = find(path); waveform != nullptr)
+      return waveform;
+  }
+  const std::string waveform_path = get_waveform_path(path);
+  if (not waveform_path.empty()) {
+    if (std::optional<Waveform> waveform = read_waveform(waveform_path, path);
+        waveform.has_value()) {
+      std::lock_guard lock{m_mutex};
+      return insert(path, std::move(waveform.value()));
+    }
+  }
+  return get(path);
+}
+
+void WaveformStore::load(const std::string &path, std::stop_token stop) {
+  const std::string waveform_path = get_waveform_path(path);
+  std::optional<Waveform> waveform{};
+  if (not waveform_path.empty())
+    waveform = read_waveform(waveform_path, path);
+  if (not waveform.has_value()) {
+    const auto start = std::chrono::steady_clock::now();
+    waveform         = build_waveform(path, stop);
+    if (waveform.has_value()) {
+      spdlog::info(
+          "Built the waveform of {} in {} ms", path,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start
+          )
+              .count()
+      );
+      if (not waveform_path.empty())
+        write_waveform(waveform_path, path, waveform.value());
+    }
+  }
+
+  std::lock_guard lock{m_mutex};
+  if (waveform.has_value())
+    insert(path, std::move(waveform.value()));
+}
+
+std::shared_ptr<const Waveform> WaveformStore::find(const std::string &path) {
+  const auto it =
+      std::ranges::find(m_waveforms, path, &decltype(m_waveforms)::value_type::first);
+  if (it == m_waveforms.end())
+    return nullptr;
+  m_waveforms.splice(m_waveforms.begin(), m_waveforms, it);
+  return it->second;
+}
+
+std::shared_ptr<const Waveform> WaveformStore::insert(const std::string &path, Waveform waveform) {
+  // Read by the player meanwhile
+  if (std::shared_ptr<const Waveform> cached = find(path); cached != nullptr)
+    return cached;
+  m_requested.insert(path);
+  m_waveforms.emplace_front(path, std::make_shared<const Waveform>(std::move(waveform)));
+  if (m_waveforms.size() > max_cached_waveforms) {
+    m_requested.erase(m_waveforms.back().first);
+    m_waveforms.pop_back();
+  }
+  return m_waveforms.front().second;
+}
+
+std::string WaveformStore::get_waveform_path(const std::string &path) const {
+  return get_sidecar_path(directory, path, "wave");
+}
+
+/******************************************************************************/
+/************************** --| Static Functions |-- **************************/
+/******************************************************************************/
+
+static void Utils::accumulate(Bucket &bucket, const float *samples, const std::size_t count) {
+  if (count == 0)
+    return;
+  float low     = bucket.frames > 0 ? bucket.min : samples[0];
+  float high    = bucket.frames > 0 ? bucket.max : samples[0];
+  for (std::size_t i = 0; i < count; ++i) {
+    low  = std::min(low, samples[i]);
+    high = std::max(high, samples[i]);
+  }
+  bucket.min = low;
+  bucket.max = high;
+  bucket.sum_squares += sum_squares(samples, count);
+  bucket.frames += static_cast<std::uint32_t>(count);
+}
+
+static float Utils::sum_squares(const float *samples, const std::size_t count) {
+  std::size_t i = 0;
+  float sum     = 0.0f;
+#if defined(__SSE2__)
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (; i + 8 <= count; i += 8) {
+    const __m128 a = _mm_loadu_ps(samples + i);
+    const __m128 b = _mm_loadu_ps(samples + i + 4);
+    sum0           = _mm_add_ps(sum0, _mm_mul_ps(a, a));
+    sum1           = _mm_add_ps(sum1, _mm_mul_ps(b, b));
+  }
+  __m128 s = _mm_add_ps(sum0, sum1);
+  s        = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s        = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+  sum      = _mm_cvtss_f32(s);
+#elif defined(__ARM_NEON) and defined(__aarch64__)
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  for (; i + 8 <= count; i += 8) {
+    const float32x4_t a = vld1q_f32(samples + i);
+    const float32x4_t b = vld1q_f32(samples + i + 4);
+    sum0                = vfmaq_f32(sum0, a, a);
+    sum1                = vfmaq_f32(sum1, b, b);
+  }
+  sum = vaddvq_f32(vaddq_f32(sum0, sum1));
+#endif
+  for (; i < count; ++i)
+    sum += samples[i] * samples[i];
+  return sum;
+}
+
+static std::vector<Utils::Bucket> Utils::merge_pairs(const std::vector<Bucket> &buckets) {
+  std::vector<Bucket> merged{};
+  merged.reserve((buckets.size() + 1) / 2);
+  for (std::size_t i = 0; i < buckets.size(); i += 2) {
+    if (i + 1 == buckets.size()) {
+      merged.push_back(buckets[i]);
+      break;
+    }
+    const Bucket &a = buckets[i];
+    const Bucket &b = buckets[i + 1];
+    merged.push_back(Bucket{
+        std::min(a.min, b.min), std::max(a.max, b.max), a.sum_squares + b.sum_squares,
+        a.frames + b.frames
+    });
+  }
+  return merged;
+}
+
+static std::vector<WaveformPeak> Utils::quantize(const std::vector<Bucket> &buckets) {
+  std::vector<WaveformPeak> peaks{};
+  peaks.reserve(buckets.size());
+  for (const Bucket &bucket : buckets) {
+    const double rms = std::sqrt(bucket.sum_squares / std::max(bucket.frames, 1u));
+    peaks.push_back(WaveformPeak{
+        static_cast<std::int8_t>(std::lround(std::clamp(bucket.min, -1.0f, 1.0f) * 127.0f)),
+        static_cast<std::int8_t>(std::lround(std::clamp(bucket.max, -1.0f, 1.0f) * 127.0f)),
+        static_cast<std::uint8_t>(std::lround(std::clamp(rms, 0.0, 1.0) * 255.0))
+    });
+  }
+  return peaks;
+}
+
+}  // namespace Tmupp
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "./decoder_pool.hpp"
+
+namespace Tmupp {
+
+/**
+ * Levels of a stretch of a track, mixed to mono.
+ */
+struct WaveformPeak {
+  /**
+   * Lowest and highest sample, from -127 to 127 for -1 to 1.
+   */
+  std::int8_t min = 0;
+  std::int8_t max = 0;
+  /**
+   * From 0 to 255 for 0 to 1.
+   */
+  std::uint8_t rms = 0;
+};
+
+/**
+  Overview of a whole track for drawing it as a waveform, a few KB whatever its length,
+  along with the silence around its music.
+
+  A pyramid of peaks: the first level has a peak per `bucket_frames` frames, at most
+  `max_buckets` of them, and each next level merges the peaks of the previous one by
+  two, down to a single peak. Drawing at any width or zoom only reads the level closest
+  to one peak per column.
+*/
+struct Waveform {
+  /**
+   * Frames of the track at its own rate.
+   */
+  std::uint64_t length        = 0;
+  std::uint32_t bucket_frames = 0;
+  std::vector<std::vector<WaveformPeak>> levels;
+  /**
+   * Frames before the first and after the last window of `silence_window_milliseconds`
+   * louder than `silence_threshold_db`, both 0 for a track that's silent throughout.
+   */
+  std::uint64_t leading_silence  = 0;
+  std::uint64_t trailing_silence = 0;
+
+  /**
+   * Peaks of `columns` columns showing the track from `from` to `to`, fractions of its
+   * length. Empty for an empty track.
+   */
+  std::vector<WaveformPeak> render(
+      const std::size_t columns, const double from = 0.0, const double to = 1.0
+  ) const;
+
+  static constexpr std::size_t max_buckets = 2048;
+  /**
+   * RMS under which audio counts as silence, low enough to keep the tail of a fade out.
+   */
+  static constexpr float silence_threshold_db                = -60.0f;
+  static constexpr std::uint32_t silence_window_milliseconds = 10;
+};
+
+/**
+ * Decode the whole track at `path` into its waveform and find its silence, std::nullopt if
+ * it can't be decoded or `stop` was requested.
+ */
+std::optional<Waveform> build_waveform(const std::string &path, std::stop_token stop = {});
+
+/**
+ * Write `waveform` to `waveform_path`, along with what identifies `file_path`.
+ */
+bool write_waveform(
+    const std::string &waveform_path, const std::string &file_path, const Waveform &waveform
+);
+
+/**
+ * Read a waveform file, std::nullopt if it's invalid or `file_path` changed since.
+ */
+std::optional<Waveform> read_waveform(
+    const std::string &waveform_path, const std::string &file_path
+);
+
+/**
+  Waveforms of the recently shown tracks, loaded or built by background jobs of a
+  `DecoderPool`, so that they never take the CPU from playback.
+
+  Each track is decoded once: its waveform is written to a directory, under a hash of the
+  file's path. A build cancelled because playback needed the CPU is tried again the next
+  time the waveform is asked for.
+
+  The player reads the silence of the tracks it opens from there, see
+  `PlayerConfig::trim_silence_milliseconds`.
+*/
+class WaveformStore {
+ public:
+  /**
+   * @param directory Defaults to `Midx::data_dir/waveform`, without a data dir the
+   * waveforms are only kept in memory.
+   */
+  explicit WaveformStore(DecoderPool &pool, const std::string &directory = "");
+  WaveformStore(const WaveformStore &)            = delete;
+  WaveformStore &operator=(const WaveformStore &) = delete;
+  /**
+   * Cancel the jobs and wait for them.
+   */
+  ~WaveformStore();
+
+  /**
+   * The waveform of `path` if it's ready, otherwise nullptr and it's loaded or built in
+   * the background.
+   */
+  std::shared_ptr<const Waveform> get(const std::string &path);
+  /**
+   * As `get()`, but a waveform already written is read right away rather than in the
+   * background.
+   */
+  std::shared_ptr<const Waveform> read(const std::string &path);
+
+ public:
+  static constexpr std::size_t max_cached_waveforms = 64;
+
+  /**
+   * Empty when the waveforms aren't persisted.
+   */
+  const std::string directory;
+
+ private:
+  struct Job {
+    std::string path;
+    DecoderPool::Handle handle;
+  };
+
+  void load(const std::string &path, std::stop_token stop);
+  /**
+   * Move the waveform of `path` to the front of the cache, nullptr if it isn't there.
+   * `m_mutex` must be held.
+   */
+  std::shared_ptr<const Waveform> find(const std::string &path);
+  /**
+   * Cache the waveform of `path` unless it already is, `m_mutex` must be held.
+   */
+  std::shared_ptr<const Waveform> insert(const std::string &path, Waveform waveform);
+  std::string get_waveform_path(const std::string &path) const;
+
+ private:
+  DecoderPool &m_pool;
+  std::mutex m_mutex;
+  /**
+   * Including those done, until the next `get()`.
+   */
+  std::vector<Job> m_jobs;
+  /**
+   * Most recently used first.
+   */
+  std::list<std::pair<std::string, std::shared_ptr<const Waveform>>> m_waveforms;
+  /**
+   * Files being loaded or that couldn't be decoded, the latter never tried again.
+   */
+  std::unordered_set<std::string> m_requested;
+};
+
+}  // namespace Tmupp